@@ -0,0 +1,549 @@
+/*
+ * This file is part of ComparePlus plugin for Notepad++
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define NOMINMAX
+
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <map>
+
+#include "EngineCore.h"
+#include "BitDiff.h"
+
+
+namespace {
+
+// Same as the compare engine minimum
+const int cMinDiffCostLimit = 1000;
+
+// Same as the plugin default setting
+const int cDefaultDiffCostLimit = 4096;
+
+
+// Deterministic pseudo random numbers so the runs are comparable between builds
+class Random
+{
+public:
+	explicit Random(uint32_t seed) : _state(seed) {}
+
+	inline uint32_t next(uint32_t range)
+	{
+		_state = _state * 1664525u + 1013904223u;
+
+		return (_state >> 8) % range;
+	}
+
+private:
+	uint32_t _state;
+};
+
+
+enum class EditScript
+{
+	INSERTS,
+	MOVES,
+	NEAR_IDENTICAL,
+	DIFFERENT
+};
+
+
+const char* const cScriptNames[] = { "random inserts", "block moves", "near identical", "fully different" };
+
+
+// Element values - a small vocabulary makes the repeated values (empty lines, braces, common words and letters) the
+// boundary shifting and diffs combining work on
+struct ValueGen
+{
+	ValueGen(uint32_t seed, uint32_t vocabulary, uint32_t repeatedPercent) :
+		rnd(seed), vocabularySize(vocabulary), repeated(repeatedPercent) {}
+
+	inline uint64_t next()
+	{
+		if (rnd.next(100) < repeated)
+			return rnd.next(vocabularySize);
+
+		return (static_cast<uint64_t>(rnd.next(1u << 24)) << 24) + rnd.next(1u << 24) + vocabularySize;
+	}
+
+	Random		rnd;
+	uint32_t	vocabularySize;
+	uint32_t	repeated;
+};
+
+
+// Makes the two values sequences of the edit script
+void makeValues(EditScript script, int size, ValueGen& gen, std::vector<uint64_t>& v1, std::vector<uint64_t>& v2)
+{
+	v1.clear();
+	v2.clear();
+
+	for (int i = 0; i < size; ++i)
+		v1.push_back(gen.next());
+
+	Random& rnd = gen.rnd;
+
+	switch (script)
+	{
+		case EditScript::INSERTS:
+			for (int i = 0; i < size; ++i)
+			{
+				if (rnd.next(20) == 0)
+					v2.push_back(gen.next());
+
+				if (rnd.next(40) != 0)
+					v2.push_back(v1[i]);
+			}
+		break;
+
+		case EditScript::MOVES:
+		{
+			v2 = v1;
+
+			const int blockLen = std::max(size / 50, 1);
+
+			for (int i = 0; i < 10; ++i)
+			{
+				const int from	= rnd.next(size - blockLen + 1);
+				const int to	= rnd.next(size - blockLen + 1);
+
+				std::vector<uint64_t> block(v2.begin() + from, v2.begin() + from + blockLen);
+
+				v2.erase(v2.begin() + from, v2.begin() + from + blockLen);
+				v2.insert(v2.begin() + to, block.begin(), block.end());
+			}
+		}
+		break;
+
+		case EditScript::NEAR_IDENTICAL:
+			v2 = v1;
+
+			for (int i = 0; i < std::max(size / 1000, 1); ++i)
+				v2[rnd.next(size)] = gen.next();
+		break;
+
+		case EditScript::DIFFERENT:
+			for (int i = 0; i < size; ++i)
+				v2.push_back(gen.next());
+		break;
+	}
+}
+
+
+// The lines and words diffs run on their hashes as they are
+inline void makeElems(const std::vector<uint64_t>& values, std::vector<uint64_t>& elems)
+{
+	elems = values;
+}
+
+
+inline void makeElems(const std::vector<uint64_t>& values, std::vector<char>& elems)
+{
+	elems.clear();
+
+	// Text letters - the repeated values are the most common ones
+	for (size_t i = 0; i < values.size(); ++i)
+		elems.push_back(static_cast<char>('a' + values[i] % 26));
+}
+
+
+struct BenchTimes
+{
+	int64_t	total_ns	{0};
+	int64_t	search_ns	{0};
+	int64_t	combine_ns	{0};
+	int64_t	shift_ns	{0};
+	int		approximate	{0};
+};
+
+
+inline double toMilliseconds(int64_t ns)
+{
+	return ns / 1000000.0;
+}
+
+
+// Runs the compares the way the engine calls the instantiation and sums their phases times
+template <typename Elem, typename UserDataT>
+void runCase(const char* name, EditScript script, int size, int compares, int costLimit, bool doCombine,
+		bool doShift, diff_algorithm algorithm, uint32_t vocabulary, uint32_t repeatedPercent)
+{
+	ValueGen gen(static_cast<uint32_t>(size) * 31 + static_cast<uint32_t>(script), vocabulary, repeatedPercent);
+
+	std::vector<uint64_t> values1;
+	std::vector<uint64_t> values2;
+
+	std::vector<Elem> elems1;
+	std::vector<Elem> elems2;
+
+	std::vector<diff_info<UserDataT>> diffs;
+
+	BenchTimes times;
+
+	// Each compare runs on new inputs while the small ones are generated outside the timed part
+	for (int i = 0; i < compares; ++i)
+	{
+		makeValues(script, size, gen, values1, values2);
+		makeElems(values1, elems1);
+		makeElems(values2, elems2);
+
+		DiffCalc<Elem, UserDataT> diffCalc(elems1, elems2, costLimit);
+
+		const auto start = std::chrono::steady_clock::now();
+
+		diffCalc(diffs, doCombine, doShift, algorithm);
+
+		times.total_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - start).count();
+
+		const auto& timing = diffCalc.lastTiming();
+
+		times.search_ns		+= timing.search_ns;
+		times.combine_ns	+= timing.combine_ns;
+		times.shift_ns		+= timing.shift_ns;
+
+		if (diffCalc.isApproximate())
+			++times.approximate;
+	}
+
+	std::printf("%-6s %-16s %-8s %8d elems x %6d: total %9.2f ms, search %9.2f ms, combine %7.2f ms, "
+			"shift %7.2f ms, %8.2f us/compare%s\n",
+			name, cScriptNames[static_cast<int>(script)],
+			(algorithm == diff_algorithm::PATIENCE) ? "patience" : "myers", size, compares,
+			toMilliseconds(times.total_ns), toMilliseconds(times.search_ns), toMilliseconds(times.combine_ns),
+			toMilliseconds(times.shift_ns), times.total_ns / (compares * 1000.0),
+			times.approximate ? " (approximate)" : "");
+}
+
+
+
+// The chars diffs on the bit-parallel kernel - the same inputs as the DiffCalc<char> case
+void runBitCase(EditScript script, int size, int compares)
+{
+	ValueGen gen(static_cast<uint32_t>(size) * 31 + static_cast<uint32_t>(script), 26, 100);
+
+	std::vector<uint64_t> values1;
+	std::vector<uint64_t> values2;
+
+	std::vector<char> elems1;
+	std::vector<char> elems2;
+
+	std::vector<diff_info<void>> diffs;
+
+	BitDiff<char> bitDiff;
+
+	int64_t diff_ns = 0;
+	int64_t lcs_ns = 0;
+
+	int matchesLen = 0;
+
+	for (int i = 0; i < compares; ++i)
+	{
+		makeValues(script, size, gen, values1, values2);
+		makeElems(values1, elems1);
+		makeElems(values2, elems2);
+
+		auto start = std::chrono::steady_clock::now();
+
+		bitDiff(elems1, elems2, diffs);
+
+		diff_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - start).count();
+
+		start = std::chrono::steady_clock::now();
+
+		matchesLen += bitDiff.lcsLength(elems1, elems2);
+
+		lcs_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - start).count();
+	}
+
+	std::printf("%-6s %-16s %-8s %8d elems x %6d: diff %9.2f ms, LCS length %9.2f ms, %8.2f us/compare, "
+			"%d matches\n", "char", cScriptNames[static_cast<int>(script)], "bits", size, compares,
+			toMilliseconds(diff_ns), toMilliseconds(lcs_ns), diff_ns / (compares * 1000.0), matchesLen);
+}
+
+
+// Lines convergence candidate - only the lines matter to the mappings
+struct MappingConv
+{
+	int line1;
+	int line2;
+};
+
+
+// The greedy lines grouping the blocks compare used before getBestLineMappings() - kept to compare the mappings
+std::vector<std::pair<int, int>> getGroupedLineMappings(const std::vector<MappingConv>& convs,
+		const std::vector<section_t>& lines)
+{
+	std::vector<std::map<int, int>> groupedLines; // line2 -> line1
+
+	for (const auto& lineConvs: lines)
+	{
+		if (lineConvs.len == 0)
+			continue;
+
+		const MappingConv* ocBegin	= convs.data() + lineConvs.off;
+		const MappingConv* ocEnd	= ocBegin + lineConvs.len;
+
+		if (groupedLines.empty())
+		{
+			groupedLines.emplace_back();
+			groupedLines.back().emplace(ocBegin->line2, ocBegin->line1);
+
+			continue;
+		}
+
+		int addToIdx = -1;
+
+		for (const MappingConv* ocItr = ocBegin; ocItr != ocEnd; ++ocItr)
+		{
+			for (int i = 0; i < static_cast<int>(groupedLines.size()); ++i)
+			{
+				const auto& gl = groupedLines[i];
+
+				if ((ocItr->line2) > (gl.rbegin()->first))
+				{
+					if (addToIdx == -1)
+					{
+						addToIdx = i;
+					}
+					else if (groupedLines[addToIdx].size() < gl.size())
+					{
+						groupedLines.erase(groupedLines.begin() + addToIdx);
+						addToIdx = --i;
+					}
+					else
+					{
+						groupedLines.erase(groupedLines.begin() + i);
+						--i;
+					}
+				}
+			}
+
+			if (addToIdx != -1)
+			{
+				auto& gl = groupedLines[addToIdx];
+				gl.emplace_hint(gl.end(), ocItr->line2, ocItr->line1);
+
+				break;
+			}
+		}
+
+		if (addToIdx != -1)
+			continue;
+
+		const MappingConv* ocrItr = ocEnd - 1;
+
+		std::map<int, int> subGroup;
+
+		for (int i = 0; i < static_cast<int>(groupedLines.size()); ++i)
+		{
+			auto& gl = groupedLines[i];
+
+			auto glResItr = gl.emplace(ocrItr->line2, ocrItr->line1);
+
+			if (glResItr.second)
+			{
+				std::map<int, int> newSubGroup;
+				auto sgEndItr = glResItr.first;
+
+				newSubGroup.insert(gl.begin(), ++sgEndItr);
+				gl.erase(glResItr.first);
+
+				if (newSubGroup.size() > subGroup.size())
+					subGroup = std::move(newSubGroup);
+			}
+		}
+
+		if (!subGroup.empty())
+			groupedLines.emplace_back(std::move(subGroup));
+	}
+
+	std::vector<std::pair<int, int>> lineMappings;
+
+	if (groupedLines.empty())
+		return lineMappings;
+
+	int bestGroupIdx = 0;
+
+	for (int i = 1; i < static_cast<int>(groupedLines.size()); ++i)
+	{
+		if (groupedLines[bestGroupIdx].size() < groupedLines[i].size())
+			bestGroupIdx = i;
+	}
+
+	for (const auto& lm: groupedLines[bestGroupIdx])
+		lineMappings.emplace_back(lm.second, lm.first);
+
+	return lineMappings;
+}
+
+
+// Changed blocks lines convergences - most lines have a few candidates around the diagonal and some are moved.
+// The old and the new lines mappings are timed and compared
+void runMappingCase(int blockLines, int compares)
+{
+	Random rnd(static_cast<uint32_t>(blockLines) * 17);
+
+	std::vector<MappingConv> convs;
+	std::vector<section_t> lines;
+
+	int64_t grouped_ns = 0;
+	int64_t chain_ns = 0;
+
+	int same = 0;
+	int longer = 0;
+	int shorter = 0;
+	int equalLenDiffers = 0;
+
+	for (int i = 0; i < compares; ++i)
+	{
+		convs.clear();
+		lines.clear();
+
+		for (int line1 = 0; line1 < blockLines; ++line1)
+		{
+			const int off = static_cast<int>(convs.size());
+			const int candidates = static_cast<int>(rnd.next(4));
+
+			std::vector<int> lines2;
+
+			for (int c = 0; c < candidates; ++c)
+			{
+				const int line2 = (rnd.next(100) < 20) ? static_cast<int>(rnd.next(blockLines)) :
+						std::max(line1 + static_cast<int>(rnd.next(7)) - 3, 0);
+
+				lines2.emplace_back(std::min(line2, blockLines - 1));
+			}
+
+			std::sort(lines2.begin(), lines2.end());
+			lines2.erase(std::unique(lines2.begin(), lines2.end()), lines2.end());
+
+			for (int line2: lines2)
+				convs.push_back({ line1, line2 });
+
+			lines.emplace_back(off, static_cast<int>(convs.size()) - off);
+		}
+
+		auto start = std::chrono::steady_clock::now();
+
+		const auto grouped = getGroupedLineMappings(convs, lines);
+
+		grouped_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - start).count();
+
+		start = std::chrono::steady_clock::now();
+
+		const auto chain = getBestLineMappings(convs, lines);
+
+		chain_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - start).count();
+
+		if (chain == grouped)
+			++same;
+		else if (chain.size() > grouped.size())
+			++longer;
+		else if (chain.size() < grouped.size())
+			++shorter;
+		else
+			++equalLenDiffers;
+	}
+
+	std::printf("%-6s %-16s %-8s %8d lines x %6d: grouped %9.2f ms, chain %9.2f ms, same %d, longer %d, "
+			"shorter %d, other equally long %d\n", "map", "convergences", "", blockLines, compares,
+			toMilliseconds(grouped_ns), toMilliseconds(chain_ns), same, longer, shorter, equalLenDiffers);
+}
+
+}
+
+
+// The engine pairs the changed blocks only as DIFF_IN_1 followed by DIFF_IN_2 - adjacent blocks of the same type or
+// a DIFF_IN_2 followed by DIFF_IN_1 break the pairing. The input hits the cost limit and gave such blocks before
+bool checkDiffBlocksOrder()
+{
+	const char* const text1 = "badcf";
+	const char* const text2 = "fdccc";
+
+	const std::vector<uint64_t> elems1(text1, text1 + std::strlen(text1));
+	const std::vector<uint64_t> elems2(text2, text2 + std::strlen(text2));
+
+	DiffCalc<uint64_t> diffCalc(elems1, elems2, 5);
+
+	const std::vector<diff_info<void>> diffs = diffCalc(true, true).first;
+
+	for (size_t i = 1; i < diffs.size(); ++i)
+	{
+		if (diffs[i].type == diffs[i - 1].type ||
+				(diffs[i].type == diff_type::DIFF_IN_1 && diffs[i - 1].type == diff_type::DIFF_IN_2))
+		{
+			std::printf("Diff blocks order check failed at block %d\n", static_cast<int>(i));
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+// Usage: DiffBench [scale percent] - the default sizes are the usual engine ones: a million lines, tens of words and
+// a couple of hundreds of chars
+int main(int argc, char* argv[])
+{
+	const int scale = (argc == 2) ? std::max(std::atoi(argv[1]), 1) : 100;
+
+	const int linesCount	= std::max(1000000 * scale / 100, 100);
+	const int wordsCount	= 40;
+	const int charsCount	= 200;
+
+	const int wordCompares	= std::max(100000 * scale / 100, 10);
+	const int charCompares	= std::max(20000 * scale / 100, 10);
+
+	if (!checkDiffBlocksOrder())
+		return 1;
+
+	const int lineCostLimit = std::max(cDefaultDiffCostLimit, cMinDiffCostLimit);
+
+	for (EditScript script: { EditScript::INSERTS, EditScript::MOVES, EditScript::NEAR_IDENTICAL,
+			EditScript::DIFFERENT })
+	{
+		// Fully different documents hit the cost limit all the way - a tenth of the lines takes long enough
+		const int lines = (script == EditScript::DIFFERENT) ? std::max(linesCount / 10, 100) : linesCount;
+
+		for (diff_algorithm algorithm: { diff_algorithm::MYERS, diff_algorithm::PATIENCE })
+			runCase<uint64_t, blockDiffInfo>("line", script, lines, 1, lineCostLimit, true, true, algorithm, 64, 20);
+
+		runCase<uint64_t, void>("word", script, wordsCount, wordCompares, INT_MAX, true, true, diff_algorithm::MYERS,
+				16, 40);
+		runCase<char, void>("char", script, charsCount, charCompares, INT_MAX, false, false,
+				diff_algorithm::MYERS, 26, 100);
+
+		if (BitDiff<char>::fits(charsCount, charsCount))
+			runBitCase(script, charsCount, charCompares);
+	}
+
+	// The changed blocks are mostly short - a few long ones show the grouping cost
+	runMappingCase(20, std::max(20000 * scale / 100, 10));
+	runMappingCase(2000, std::max(20 * scale / 100, 2));
+
+	return 0;
+}
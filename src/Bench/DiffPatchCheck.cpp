@@ -0,0 +1,205 @@
+/*
+ * This file is part of ComparePlus plugin for Notepad++
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// DiffPatchCheck - applies the engine unified diffs with the patch tool (it must be in the path) and checks the
+// patched texts
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <fstream>
+#include <iterator>
+
+#include <windows.h>
+
+#include "Engine.h"
+
+
+namespace {
+
+const char* const cOldFile		= "DiffPatchCheck_old.txt";
+const char* const cDiffFile		= "DiffPatchCheck.diff";
+const char* const cPatchedFile	= "DiffPatchCheck_out.txt";
+
+
+struct PatchCase
+{
+	const char*	name;
+	const char*	oldText;
+	const char*	newText;
+
+	bool		ignoreSpaces;
+	bool		ignoreEmptyLines;
+
+	// The text patching oldText should give - the differences ignored by the compare are not in the diff
+	const char*	patchedText;
+};
+
+
+const PatchCase cPatchCases[] = {
+	{ "changed line",			"a\nb\nc\n",			"a\nB\nc\n",			false, false, nullptr },
+	{ "added and removed",		"a\nb\nc\nd\n",			"x\na\nc\nd\ny\n",		false, false, nullptr },
+	{ "CRLF",					"a\r\nb\r\nc\r\n",		"a\r\nB\r\nc\r\nd\r\n",	false, false, nullptr },
+	{ "LF to CRLF",				"a\nb\nc\n",			"a\r\nb\r\nX\r\n",		false, false, "a\nb\nX\r\n" },
+	{ "old no EOL",				"a\nb",					"a\nb\n",				false, false, nullptr },
+	{ "new no EOL",				"a\nb\n",				"a\nb",					false, false, nullptr },
+	{ "both no EOL",			"a\nb",					"a\nc",					false, false, nullptr },
+	{ "no EOL kept",			"a\nb\nc",				"x\nb\nc",				false, false, nullptr },
+	{ "old empty",				"",						"a\nb\n",				false, false, nullptr },
+	{ "new empty",				"a\nb\n",				"",						false, false, nullptr },
+	{ "empty line removed",		"a\n\nb\n",				"a\nb\nc\n",			false, true, nullptr },
+	{ "empty lines moved",		"a\n\n\nb\nc\n\nd\n",	"a\nb\n\nc\nD\n\n",		false, true, nullptr },
+	{ "empty lines only",		"a\n\nb\n",				"a\nb\n\n",				false, true, "a\n\nb\n" },
+	{ "empty lines changed",	"\na\n\nb\n\n",			"x\n\n\na\nb\n",		false, true, nullptr },
+	{ "empty last line",		"a\nb\n\n",				"a\nb\nc",				false, true, nullptr },
+	{ "ignored spaces",			"a b\nc\nd\n",			"a  b\nc\ne\n",			true, false, "a b\nc\ne\n" },
+	{ "spaces and empty lines",	"a b\n\nc\n",			"a  b\nc\n\nd\n",		true, true, "a b\nc\n\nd\n" },
+};
+
+
+bool readFile(const char* file, std::string& text)
+{
+	std::ifstream in(file, std::ios::binary);
+
+	if (!in)
+		return false;
+
+	text.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+
+	return true;
+}
+
+
+bool writeFile(const char* file, const std::string& text)
+{
+	std::ofstream out(file, std::ios::binary | std::ios::trunc);
+
+	out.write(text.data(), static_cast<std::streamsize>(text.size()));
+
+	return out.good();
+}
+
+
+void setCheckOptions(CompareOptions& options, const PatchCase& patchCase)
+{
+	options.newFileViewId			= SUB_VIEW;
+	options.findUniqueMode			= false;
+	options.alignAllMatches			= false;
+	options.neverMarkIgnored		= false;
+	options.charPrecision			= false;
+	options.diffsBasedLineChanges	= false;
+	options.ignoreSpaces			= patchCase.ignoreSpaces;
+	options.ignoreEmptyLines		= patchCase.ignoreEmptyLines;
+	options.ignoreCase				= false;
+	options.detectMoves				= true;
+	options.ignoreLineNumbers		= false;
+	options.verifyMatches			= false;
+	options.patienceDiff			= false;
+	options.changedThresholdPercent	= 30;
+	options.diffCostLimit			= 0;
+	options.addHighlightColor		= 0;
+	options.remHighlightColor		= 0;
+	options.selectionCompare		= false;
+}
+
+
+bool checkPatch(const PatchCase& patchCase, int contextLines)
+{
+	const std::string oldText = patchCase.oldText;
+	const std::string newText = patchCase.newText;
+	const std::string patchedText = patchCase.patchedText ? patchCase.patchedText : patchCase.newText;
+
+	CompareOptions options;
+
+	setCheckOptions(options, patchCase);
+
+	CompareSummary summary;
+	summary.clear();
+
+	CompareCache cmpCache;
+
+	const CompareResult result = compareTexts(options, oldText.data(), static_cast<intptr_t>(oldText.size()),
+			newText.data(), static_cast<intptr_t>(newText.size()), summary, cmpCache);
+
+	std::string diff;
+
+	if (result == CompareResult::COMPARE_MISMATCH && !getUnifiedDiff(cmpCache, oldText.data(), newText.data(),
+			"a/file", "b/file", contextLines, diff))
+	{
+		std::printf("%s (context %d): no diff\n", patchCase.name, contextLines);
+		return false;
+	}
+
+	std::string patched = oldText;
+
+	if (!diff.empty())
+	{
+		::DeleteFileA(cPatchedFile);
+
+		if (!writeFile(cOldFile, oldText) || !writeFile(cDiffFile, diff))
+		{
+			std::printf("Cannot write the check files\n");
+			return false;
+		}
+
+		char cmd[256];
+		_snprintf_s(cmd, _countof(cmd), _TRUNCATE, "patch -s --binary -o %s %s %s", cPatchedFile, cOldFile,
+				cDiffFile);
+
+		if (std::system(cmd) != 0 || !readFile(cPatchedFile, patched))
+		{
+			std::printf("%s (context %d): patch failed\n%s\n", patchCase.name, contextLines, diff.c_str());
+			return false;
+		}
+	}
+
+	if (patched != patchedText)
+	{
+		std::printf("%s (context %d): wrong patched text\n%s\n", patchCase.name, contextLines, diff.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+}
+
+
+int main()
+{
+	int failed = 0;
+	int checks = 0;
+
+	for (const PatchCase& patchCase: cPatchCases)
+	{
+		for (int contextLines: { 0, 1, 3 })
+		{
+			++checks;
+
+			if (!checkPatch(patchCase, contextLines))
+				++failed;
+		}
+	}
+
+	::DeleteFileA(cOldFile);
+	::DeleteFileA(cDiffFile);
+	::DeleteFileA(cPatchedFile);
+
+	std::printf("%d of %d patch checks passed\n", checks - failed, checks);
+
+	return failed ? 1 : 0;
+}
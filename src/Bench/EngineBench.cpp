@@ -0,0 +1,323 @@
+/*
+ * This file is part of ComparePlus plugin for Notepad++
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define NOMINMAX
+
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+
+#include <windows.h>
+#include <psapi.h>
+
+#include "Engine.h"
+
+
+namespace {
+
+const int cDefaultLinesCount	= 200000;
+const int cRunsCount			= 5;
+
+
+struct Corpus
+{
+	std::string	name;
+	std::string	oldText;
+	std::string	newText;
+};
+
+
+// Deterministic pseudo random numbers so the runs are comparable between builds
+class Random
+{
+public:
+	explicit Random(uint32_t seed) : _state(seed) {}
+
+	inline uint32_t next(uint32_t range)
+	{
+		_state = _state * 1664525u + 1013904223u;
+
+		return (_state >> 8) % range;
+	}
+
+private:
+	uint32_t _state;
+};
+
+
+// Application log - mostly unique lines, a few lines inserted, removed and changed
+Corpus makeLogCorpus(int linesCount)
+{
+	static const char* const levels[]	= { "INFO", "DEBUG", "WARN", "ERROR" };
+	static const char* const events[]	= {
+		"request served", "cache miss", "connection opened", "connection closed", "retrying request", "queue full"
+	};
+
+	Corpus corpus;
+	corpus.name = "log";
+
+	Random rnd(1);
+
+	char line[160];
+
+	for (int i = 0; i < linesCount; ++i)
+	{
+		_snprintf_s(line, _countof(line), _TRUNCATE,
+				"2026-01-%02d %02d:%02d:%02d.%03d %-5s [worker-%u] %s id=%u took %u ms\n", 1 + (i / 86400) % 28, (i / 3600) % 24, (i / 60) % 60, i % 60, rnd.next(1000), levels[rnd.next(4)],
+				rnd.next(16), events[rnd.next(6)], rnd.next(1000000), rnd.next(500));
+
+		corpus.oldText += line;
+
+		const uint32_t edit = rnd.next(100);
+
+		if (edit == 0)
+		{
+			continue;
+		}
+		else if (edit == 1)
+		{
+			corpus.newText += line;
+
+			_snprintf_s(line, _countof(line), _TRUNCATE, "2026-01-01 00:00:00.000 WARN  [worker-%u] inserted %u\n",
+					rnd.next(16), rnd.next(1000000));
+		}
+		else if (edit == 2)
+		{
+			line[rnd.next(40) + 24] = '#';
+		}
+
+		corpus.newText += line;
+	}
+
+	return corpus;
+}
+
+
+// Source code - repeated similar functions with some of them moved around and edited
+Corpus makeCodeCorpus(int linesCount)
+{
+	const int cFuncLines = 10;
+
+	std::vector<std::string> funcs;
+
+	Random rnd(2);
+
+	char buf[512];
+
+	for (int i = 0; i < linesCount / cFuncLines; ++i)
+	{
+		_snprintf_s(buf, _countof(buf), _TRUNCATE,
+				"int function%d(int a, int b)\n{\n\tint result = a * %u + b;\n\n\tfor (int i = 0; i < %u; ++i)\n"
+				"\t\tresult += process(i, a);\n\n\treturn result;\n}\n\n",
+				i, rnd.next(100), rnd.next(64));
+
+		funcs.emplace_back(buf);
+	}
+
+	Corpus corpus;
+	corpus.name = "code";
+
+	for (const auto& func: funcs)
+		corpus.oldText += func;
+
+	// Swap some blocks and change some identifiers
+	for (size_t i = 0; i + 1 < funcs.size(); ++i)
+	{
+		const uint32_t edit = rnd.next(50);
+
+		if (edit == 0)
+			std::swap(funcs[i], funcs[i + 1]);
+		else if (edit == 1)
+			funcs[i].replace(funcs[i].find("process"), 7, "handle");
+	}
+
+	for (const auto& func: funcs)
+		corpus.newText += func;
+
+	return corpus;
+}
+
+
+// CSV table - the same rows with some cells changed
+Corpus makeCsvCorpus(int linesCount)
+{
+	Corpus corpus;
+	corpus.name = "csv";
+
+	Random rnd(3);
+
+	char line[160];
+
+	for (int i = 0; i < linesCount; ++i)
+	{
+		const uint32_t qty		= rnd.next(1000);
+		const uint32_t price	= rnd.next(100000);
+
+		_snprintf_s(line, _countof(line), _TRUNCATE, "%d,item%u,%u,%u.%02u,store%u\n",
+				i, rnd.next(5000), qty, price / 100, price % 100, rnd.next(200));
+
+		corpus.oldText += line;
+
+		if (rnd.next(25) == 0)
+			_snprintf_s(line, _countof(line), _TRUNCATE, "%d,item%u,%u,%u.%02u,store%u\n",
+					i, rnd.next(5000), qty + 1, price / 100, price % 100, rnd.next(200));
+
+		corpus.newText += line;
+	}
+
+	return corpus;
+}
+
+
+bool readFile(const char* file, std::string& text)
+{
+	std::ifstream in(file, std::ios::binary);
+
+	if (!in)
+		return false;
+
+	text.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+
+	return true;
+}
+
+
+void setBenchOptions(CompareOptions& options)
+{
+	options.newFileViewId			= SUB_VIEW;
+	options.findUniqueMode			= false;
+	options.alignAllMatches			= false;
+	options.neverMarkIgnored		= false;
+	options.charPrecision			= false;
+	options.diffsBasedLineChanges	= false;
+	options.ignoreSpaces			= false;
+	options.ignoreEmptyLines		= false;
+	options.ignoreCase				= false;
+	options.detectMoves				= true;
+	options.ignoreLineNumbers		= false;
+	options.verifyMatches			= false;
+	options.patienceDiff			= false;
+	options.selectionCompare		= false;
+
+	// The plugin default settings
+	options.changedThresholdPercent	= 30;
+	options.diffCostLimit			= 4096;
+	options.addHighlightColor		= 0x683FF;
+	options.remHighlightColor		= 0x683FF;
+}
+
+
+size_t getPeakMemory_KB()
+{
+	PROCESS_MEMORY_COUNTERS memInfo;
+
+	if (!::GetProcessMemoryInfo(::GetCurrentProcess(), &memInfo, sizeof(memInfo)))
+		return 0;
+
+	return memInfo.PeakWorkingSetSize / 1024;
+}
+
+
+// Runs the compare a few times and prints the stats of the fastest run
+bool runBench(const Corpus& corpus, const CompareOptions& options)
+{
+	CompareSummary best;
+	best.stats.phaseTicks[0] = -1;
+
+	for (int i = 0; i < cRunsCount; ++i)
+	{
+		CompareSummary summary;
+		summary.clear();
+
+		CompareCache cmpCache;
+
+		const CompareResult result = compareTexts(options,
+				corpus.oldText.data(), static_cast<intptr_t>(corpus.oldText.size()),
+				corpus.newText.data(), static_cast<intptr_t>(corpus.newText.size()), summary, cmpCache);
+
+		if (result != CompareResult::COMPARE_MATCH && result != CompareResult::COMPARE_MISMATCH)
+		{
+			std::printf("%s: compare failed\n", corpus.name.c_str());
+			return false;
+		}
+
+		if (best.stats.phaseTicks[0] < 0 || summary.stats.getTotalTime_ms() < best.stats.getTotalTime_ms())
+			best = summary;
+	}
+
+	best.stats.peakMemory_KB = getPeakMemory_KB();
+
+	const double totalTime_s	= best.stats.getTotalTime_ms() / 1000.0;
+	const double textSize_MB	= (corpus.oldText.size() + corpus.newText.size()) / (1024.0 * 1024.0);
+
+	std::printf("%s: %u lines, %.2f MB, %d added, %d removed, %d changed, %d moved\n\t%s\n",
+			corpus.name.c_str(), static_cast<unsigned>(best.stats.linesCount), textSize_MB,
+			best.added, best.removed, best.changed, best.moved, best.stats.toString("\n\t").c_str());
+
+	if (totalTime_s > 0)
+		std::printf("\tThroughput: %.2f MB/s, %.0f lines/s\n\n", textSize_MB / totalTime_s,
+				best.stats.linesCount / totalTime_s);
+
+	return true;
+}
+
+}
+
+
+// Usage: EngineBench [lines count] | EngineBench <old file> <new file>
+int main(int argc, char* argv[])
+{
+	CompareOptions options;
+
+	setBenchOptions(options);
+
+	std::vector<Corpus> corpora;
+
+	if (argc == 3)
+	{
+		Corpus corpus;
+		corpus.name = argv[2];
+
+		if (!readFile(argv[1], corpus.oldText) || !readFile(argv[2], corpus.newText))
+		{
+			std::printf("Cannot read the files\n");
+			return 1;
+		}
+
+		corpora.emplace_back(std::move(corpus));
+	}
+	else
+	{
+		const int linesCount = (argc == 2) ? std::max(std::atoi(argv[1]), 10) : cDefaultLinesCount;
+
+		corpora.emplace_back(makeLogCorpus(linesCount));
+		corpora.emplace_back(makeCodeCorpus(linesCount));
+		corpora.emplace_back(makeCsvCorpus(linesCount));
+	}
+
+	bool ok = true;
+
+	for (const auto& corpus: corpora)
+		ok = runBench(corpus, options) && ok;
+
+	return ok ? 0 : 1;
+}
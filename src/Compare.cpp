@@ -17,25 +17,43 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#pragma comment (lib, "psapi")
+
+
 #include <cstdlib>
+#include <cstddef>
+#include <cstring>
 #include <vector>
 #include <memory>
 #include <cmath>
+#include <algorithm>
+#include <string>
+#include <map>
+#include <unordered_map>
 
 #include <windows.h>
 #include <tchar.h>
 #include <shlwapi.h>
 #include <commctrl.h>
 #include <commdlg.h>
+#include <shlobj.h>
+#include <psapi.h>
 
 #include "Tools.h"
 #include "Compare.h"
 #include "NppHelpers.h"
 #include "LibHelpers.h"
+#include "VcsPrefetch.h"
 #include "AboutDialog.h"
 #include "SettingsDialog.h"
 #include "NavDialog.h"
+#include "FolderDialog.h"
 #include "Engine.h"
+#include "TextScan.h"
+#include "ThreadPool.h"
+#include "IgnoreRules.h"
+#include "BatchCompare.h"
+#include "ComparePlusMsgs.h"
 #include "NppInternalDefines.h"
 #include "resource.h"
 
@@ -48,6 +66,8 @@ sptr_t			sciPtr[2];
 
 UserSettings	Settings;
 
+std::atomic<unsigned>	sciCallsCount(0);
+
 #ifdef DLOG
 
 std::string		dLog("ComparePlus debug log\n\n");
@@ -116,6 +136,25 @@ private:
 };
 
 
+/**
+ *  \struct
+ *  \brief  Alignment change made by a lines delete - the alignment pairs in the deleted lines and the shift of the
+ *          pairs after them. Undo reverts just that change instead of keeping a copy of the whole alignment
+ */
+struct AlignmentDelta
+{
+	inline bool isSet() const
+	{
+		return (view >= 0);
+	}
+
+	int				view {-1};
+	int				startIdx {0};
+	int				offset {0};
+	AlignmentInfo_t	erased;
+};
+
+
 /**
  *  \struct
  *  \brief
@@ -128,9 +167,9 @@ struct DeletedSection
 	 */
 	struct UndoData
 	{
-		AlignmentInfo_t		alignment;
+		AlignmentDelta		alignment;
 		std::pair<int, int>	selection {-1, -1};
-		std::vector<int>	otherViewMarks;
+		MarkerRuns			otherViewMarks;
 	};
 
 	DeletedSection(int action, int line, const std::shared_ptr<UndoData>& undo) :
@@ -142,7 +181,7 @@ struct DeletedSection
 	int					startLine;
 	bool				lineReplace;
 	int					restoreAction;
-	std::vector<int>	markers;
+	MarkerRuns			markers;
 	int					nextLineMarker;
 
 	const std::shared_ptr<UndoData> undoInfo;
@@ -320,7 +359,8 @@ public:
 	void setStatusInfo();
 	void setStatus();
 
-	void adjustAlignment(int view, int line, int offset);
+	void adjustAlignment(int view, int line, int offset, AlignmentDelta* delta = nullptr);
+	void revertAlignment(const AlignmentDelta& delta);
 
 	void setCompareDirty()
 	{
@@ -337,6 +377,15 @@ public:
 
 	CompareSummary	summary;
 
+	// Kept for the automatic re-compares, indexed by view id
+	LineHashCache	lineHashes[2];
+
+	// Last compare block diffs - re-compares of unchanged documents just mark them again
+	CompareCache	compareCache;
+
+	// Common base file of a three-way compare - empty for the two-way compares
+	std::basic_string<TCHAR>	baseFile;
+
 	bool			compareDirty	= false;
 	bool			manuallyChanged	= false;
 	unsigned		inEqualizeMode	= 0;
@@ -448,6 +497,38 @@ public:
 };
 
 
+/**
+ *  \class
+ *  \brief  Polls the background update compare and applies its results once it is done
+ */
+class DelayedUpdateApply : public DelayedWork
+{
+public:
+	DelayedUpdateApply() : DelayedWork() {}
+	virtual ~DelayedUpdateApply() = default;
+
+	virtual void operator()();
+
+	static const UINT cPollPeriod_ms = 20;
+};
+
+
+/**
+ *  \class
+ *  \brief  Runs the deferred changed blocks compares of the active compare and re-marks it as they finish
+ */
+class DelayedBlocksCompare : public DelayedWork
+{
+public:
+	DelayedBlocksCompare() : DelayedWork() {}
+	virtual ~DelayedBlocksCompare() = default;
+
+	virtual void operator()();
+
+	static const UINT cPollPeriod_ms = 20;
+};
+
+
 /**
  *  \class
  *  \brief
@@ -455,7 +536,7 @@ public:
 class SelectRangeTimeout : public DelayedWork
 {
 public:
-	SelectRangeTimeout(int view, int startPos, int endPos) : DelayedWork(), _view(view)
+	SelectRangeTimeout(int view, Sci_Position startPos, Sci_Position endPos) : DelayedWork(), _view(view)
 	{
 		_sel = getSelection(view);
 
@@ -469,7 +550,7 @@ public:
 private:
 	int	_view;
 
-	std::pair<int, int> _sel;
+	std::pair<Sci_Position, Sci_Position> _sel;
 };
 
 
@@ -516,11 +597,61 @@ LRESULT (*nppNotificationProc)(HWND, UINT, WPARAM, LPARAM) = nullptr;
 CompareList_t compareList;
 std::unique_ptr<NewCompare> newCompare = nullptr;
 
+
+/**
+ *  \struct
+ *  \brief  Last saved state of a buffer - the last save diffs check the buffer against it without reading the file.
+ *          Valid while the file size and last write time are the same
+ */
+struct SavedSnapshot
+{
+	DocSnapshot	doc;
+	uint64_t	fileSize;
+	uint64_t	fileTime;
+};
+
+
+// Kept for the compared buffers and the ones the last save diff is run on - indexed by buffer id
+std::unordered_map<LRESULT, SavedSnapshot> savedSnapshots;
+
+// Fetches the VCS bases of the opened files if Settings.PrefetchVcsBase is set - created on first use
+std::unique_ptr<VcsPrefetch> vcsPrefetch = nullptr;
+
+// The VCS base snapshot of the temp buffer opened for the VCS diff - its line hashes are taken from it
+std::pair<LRESULT, std::shared_ptr<const DocSnapshot>> tempBaseHashes;
+
 volatile unsigned	notificationsLock = 0;
 bool				isNppMinimized = false;
 
 std::unique_ptr<ViewLocation> storedLocation = nullptr;
-std::vector<int> copiedSectionMarks;
+MarkerRuns copiedSectionMarks;
+
+
+/**
+ *  \struct
+ *  \brief  Views lines mapping data that stays the same until the views text, alignment or wrapping change. The views
+ *          syncs on scroll and caret moves take it from here instead of querying Scintilla each time.
+ *          Invalidated on the text and annotation changes, on buffer activation and before each re-alignment
+ */
+struct ViewsSyncCache
+{
+	inline void invalidate()
+	{
+		valid = false;
+	}
+
+	bool	valid {false};
+
+	// Visible line of each view last document line start
+	int		lastDocLineVisible[2];
+
+	// Caret line last synced from each view and the matching line in the other view
+	int		caretLine[2];
+	int		otherCaretLine[2];
+};
+
+
+ViewsSyncCache syncCache;
 
 // Re-compare flags
 bool goToFirst = false;
@@ -534,7 +665,28 @@ DelayedClose	delayedClosure;
 DelayedUpdate	delayedUpdate;
 DelayedMaximize	delayedMaximize;
 
+DelayedUpdateApply	delayedUpdateApply;
+DelayedBlocksCompare	delayedBlocksCompare;
+
+// Background compare started by the automatic re-compare and the buffer it is started for
+std::unique_ptr<AsyncCompare>	asyncCompare = nullptr;
+LRESULT							asyncCompareBuffId = 0;
+
+// Deferred changed blocks compare and the buffer of the compare it refines
+std::unique_ptr<AsyncBlocksCompare>	asyncBlocksCompare = nullptr;
+LRESULT								asyncBlocksCompareBuffId = 0;
+
+// Folder compare results of the files being opened by CompareFiles() - marked by the new compare of the files
+CompareCache	folderEntryCache;
+
+// Base file selected for the compare being started by CompareToBase()
+std::basic_string<TCHAR>	compareBaseFile;
+
+// Stats of the last compares - written to the plugin config dir on request and on plugin exit
+CompareStatsLog	statsLog;
+
 NavDialog		NavDlg;
+FolderDialog	FolderDlg;
 
 toolbarIcons	tbSetFirst;
 toolbarIcons	tbCompare;
@@ -554,7 +706,7 @@ FuncItem funcItem[NB_MENU_COMMANDS] = { 0 };
 LRESULT statusProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam);
 void onBufferActivated(LRESULT buffId);
 void syncViews(int biasView);
-void temporaryRangeSelect(int view, int startPos = -1, int endPos = -1);
+void temporaryRangeSelect(int view, Sci_Position startPos = -1, Sci_Position endPos = -1);
 void setArrowMark(int view, int line = -1, bool down = true);
 int getAlignmentIdxAfter(const AlignmentViewData AlignmentPair::*pView, const AlignmentInfo_t &alignInfo, int line);
 int getAlignmentLine(const AlignmentInfo_t &alignInfo, int view, int line);
@@ -612,6 +764,8 @@ void NppSettings::updatePluginMenu()
 	::EnableMenuItem(hMenu, funcItem[CMD_PREV]._cmdID, flag);
 	::EnableMenuItem(hMenu, funcItem[CMD_NEXT]._cmdID, flag);
 	::EnableMenuItem(hMenu, funcItem[CMD_LAST]._cmdID, flag);
+	::EnableMenuItem(hMenu, funcItem[CMD_EXPORT_DIFF]._cmdID, flag);
+	::EnableMenuItem(hMenu, funcItem[CMD_COPY_DIFF]._cmdID, flag);
 
 	::DrawMenuBar(nppData._nppHandle);
 
@@ -1118,8 +1272,10 @@ void ComparedPair::setStatusInfo()
 					options.selections[SUB_VIEW].first + 1, options.selections[SUB_VIEW].second + 1);
 		}
 
-		infoCurrentPos = _sntprintf_s(info, _countof(info), _TRUNCATE, TEXT("%s%s"),
-				options.findUniqueMode ? TEXT("Find Unique") : TEXT("Compare"), buf);
+		infoCurrentPos = _sntprintf_s(info, _countof(info), _TRUNCATE, TEXT("%s%s%s"),
+				options.findUniqueMode ? TEXT("Find Unique") : baseFile.empty() ? TEXT("Compare") :
+				TEXT("Compare to Base"),
+				summary.approximate ? TEXT(" (Approximate)") : TEXT(""), buf);
 
 		// Toggle shown status bar info
 		if (Settings.statusType == StatusType::COMPARE_OPTIONS)
@@ -1171,6 +1327,13 @@ void ComparedPair::setStatusInfo()
 				_tcscpy_s(info + infoCurrentPos, _countof(info) - infoCurrentPos, buf);
 				infoCurrentPos += len;
 			}
+			if (summary.conflicts)
+			{
+				const int len =
+						_sntprintf_s(buf, _countof(buf), _TRUNCATE, TEXT(" %d Conflicts ,"), summary.conflicts);
+				_tcscpy_s(info + infoCurrentPos, _countof(info) - infoCurrentPos, buf);
+				infoCurrentPos += len;
+			}
 			if (summary.match)
 			{
 				const int len =
@@ -1178,6 +1341,14 @@ void ComparedPair::setStatusInfo()
 				_tcscpy_s(info + infoCurrentPos - 2, _countof(info) - infoCurrentPos + 2, buf);
 				infoCurrentPos += len;
 			}
+			if (summary.hashCollisions)
+			{
+				const int len =
+						_sntprintf_s(buf, _countof(buf), _TRUNCATE, TEXT(" %d Hash Collisions ,"),
+						summary.hashCollisions);
+				_tcscpy_s(info + infoCurrentPos, _countof(info) - infoCurrentPos, buf);
+				infoCurrentPos += len;
+			}
 		}
 
 		if (info[infoCurrentPos - 2] == TEXT(' '))
@@ -1211,13 +1382,21 @@ void ComparedPair::setStatus()
 }
 
 
-void ComparedPair::adjustAlignment(int view, int line, int offset)
+void ComparedPair::adjustAlignment(int view, int line, int offset, AlignmentDelta* delta)
 {
 	AlignmentViewData AlignmentPair::*alignView = (view == MAIN_VIEW) ? &AlignmentPair::main : &AlignmentPair::sub;
 	AlignmentInfo_t& alignInfo = summary.alignmentInfo;
 
 	const int startIdx = getAlignmentIdxAfter(alignView, alignInfo, line);
 
+	if (delta)
+	{
+		delta->view		= view;
+		delta->startIdx	= static_cast<int>(alignInfo.size());
+		delta->offset	= 0;
+		delta->erased.clear();
+	}
+
 	if ((startIdx < static_cast<int>(alignInfo.size())) && ((alignInfo[startIdx].*alignView).line >= line))
 	{
 		if (offset < 0)
@@ -1229,15 +1408,43 @@ void ComparedPair::adjustAlignment(int view, int line, int offset)
 				++endIdx;
 
 			if (endIdx > startIdx)
+			{
+				if (delta)
+					delta->erased.assign(alignInfo.begin() + startIdx, alignInfo.begin() + endIdx);
+
 				alignInfo.erase(alignInfo.begin() + startIdx, alignInfo.begin() + endIdx);
+			}
 		}
 
 		for (int i = startIdx; i < static_cast<int>(alignInfo.size()); ++i)
 			(alignInfo[i].*alignView).line += offset;
+
+		if (delta)
+		{
+			delta->startIdx	= startIdx;
+			delta->offset	= offset;
+		}
 	}
 }
 
 
+// The alignment must be in the state right after the adjustment that has recorded the delta
+void ComparedPair::revertAlignment(const AlignmentDelta& delta)
+{
+	AlignmentViewData AlignmentPair::*alignView =
+			(delta.view == MAIN_VIEW) ? &AlignmentPair::main : &AlignmentPair::sub;
+	AlignmentInfo_t& alignInfo = summary.alignmentInfo;
+
+	if (delta.startIdx > static_cast<int>(alignInfo.size()))
+		return;
+
+	for (int i = delta.startIdx; i < static_cast<int>(alignInfo.size()); ++i)
+		(alignInfo[i].*alignView).line -= delta.offset;
+
+	alignInfo.insert(alignInfo.begin() + delta.startIdx, delta.erased.begin(), delta.erased.end());
+}
+
+
 NewCompare::NewCompare(bool currFileIsNew, bool markFirstName)
 {
 	_firstTabText[0] = 0;
@@ -1355,7 +1562,7 @@ CompareList_t::iterator getCompareBySciDoc(int sciDoc)
 }
 
 
-void temporaryRangeSelect(int view, int startPos, int endPos)
+void temporaryRangeSelect(int view, Sci_Position startPos, Sci_Position endPos)
 {
 	static std::unique_ptr<SelectRangeTimeout> range;
 
@@ -1411,6 +1618,18 @@ void showBlankAdjacentArrowMark(int view, int line, bool down)
 }
 
 
+// The diffs index of the compared pair view - it is rebuilt from the view markers if a change has invalidated it
+const DiffLinesIndex& getDiffLines(ComparedPair& cmpPair, int view)
+{
+	DiffLinesIndex& diffLines = cmpPair.summary.diffRanges[view];
+
+	if (!diffLines.isValid())
+		diffLines.build(view);
+
+	return diffLines;
+}
+
+
 std::pair<int, int> jumpToNextChange(int mainStartLine, int subStartLine, bool down,
 		bool goToCornerDiff = false, bool doNotBlink = false)
 {
@@ -1421,6 +1640,9 @@ std::pair<int, int> jumpToNextChange(int mainStartLine, int subStartLine, bool d
 	int view			= getCurrentViewId();
 	const int otherView	= getOtherViewId(view);
 
+	const DiffLinesIndex& mainDiffLines	= getDiffLines(*cmpPair, MAIN_VIEW);
+	const DiffLinesIndex& subDiffLines	= getDiffLines(*cmpPair, SUB_VIEW);
+
 	if (!cmpPair->options.findUniqueMode && !goToCornerDiff)
 	{
 		const int edgeLine		= (down ? getLastLine(view) : getFirstLine(view));
@@ -1428,10 +1650,13 @@ std::pair<int, int> jumpToNextChange(int mainStartLine, int subStartLine, bool d
 
 		// Is the bias line manually positioned on a screen edge and adjacent to invisible blank diff?
 		// Make sure we don't miss it
-		if (!isLineMarked(view, currentLine, MARKER_MASK_LINE) &&
+		const DiffLinesIndex& diffLines			= (view == MAIN_VIEW) ? mainDiffLines : subDiffLines;
+		const DiffLinesIndex& otherDiffLines	= (view == MAIN_VIEW) ? subDiffLines : mainDiffLines;
+
+		if (!diffLines.isLineMarked(currentLine) &&
 			isAdjacentAnnotation(view, currentLine, down) &&
 			!isVisibleAdjacentAnnotation(view, currentLine, down) &&
-			isLineMarked(otherView, otherViewMatchingLine(view, currentLine) + 1, MARKER_MASK_LINE))
+			otherDiffLines.isLineMarked(otherViewMatchingLine(view, currentLine) + 1))
 		{
 			centerAt(view, currentLine);
 			return std::make_pair(view, currentLine);
@@ -1454,10 +1679,10 @@ std::pair<int, int> jumpToNextChange(int mainStartLine, int subStartLine, bool d
 		}
 	}
 
-	const int nextMarker = down ? SCI_MARKERNEXT : SCI_MARKERPREVIOUS;
-
-	int mainNextLine	= CallScintilla(MAIN_VIEW, nextMarker, mainStartLine, MARKER_MASK_LINE);
-	int subNextLine		= CallScintilla(SUB_VIEW, nextMarker, subStartLine, MARKER_MASK_LINE);
+	int mainNextLine	= down ?
+			mainDiffLines.getNextMarkedLine(mainStartLine) : mainDiffLines.getPrevMarkedLine(mainStartLine);
+	int subNextLine		= down ?
+			subDiffLines.getNextMarkedLine(subStartLine) : subDiffLines.getPrevMarkedLine(subStartLine);
 
 	if ((mainNextLine == mainStartLine) && !isCornerDiff)
 		mainNextLine = -1;
@@ -1550,10 +1775,11 @@ std::pair<int, int> jumpToNextChange(int mainStartLine, int subStartLine, bool d
 	LOGD("Jump to " + std::string(view == MAIN_VIEW ? "MAIN" : "SUB") +
 			" view, center doc line: " + std::to_string(line + 1) + "\n");
 
+	const bool isMarked = ((view == MAIN_VIEW) ? mainDiffLines : subDiffLines).isLineMarked(line);
+
 	// Line is not visible - scroll into view
 	if (!isLineVisible(view, line) ||
-		(!isLineMarked(view, line, MARKER_MASK_LINE) &&
-		isAdjacentAnnotation(view, line, down) && !isVisibleAdjacentAnnotation(view, line, down)))
+		(!isMarked && isAdjacentAnnotation(view, line, down) && !isVisibleAdjacentAnnotation(view, line, down)))
 	{
 		centerAt(view, line);
 		doNotBlink = true;
@@ -1561,10 +1787,9 @@ std::pair<int, int> jumpToNextChange(int mainStartLine, int subStartLine, bool d
 
 	if (Settings.FollowingCaret && line != getCurrentLine(view))
 	{
-		int pos;
+		Sci_Position pos;
 
-		if (down && (isLineAnnotated(view, line) && isLineWrapped(view, line) &&
-				!isLineMarked(view, line, MARKER_MASK_LINE)))
+		if (down && (isLineAnnotated(view, line) && isLineWrapped(view, line) && !isMarked))
 			pos = getLineEnd(view, line);
 		else
 			pos = getLineStart(view, line);
@@ -1603,6 +1828,10 @@ std::pair<int, int> jumpToLastChange(bool goToCornerDiff = false, bool doNotBlin
 
 std::pair<int, int> jumpToChange(bool down, bool wrapAround)
 {
+	CompareList_t::iterator	cmpPair = getCompare(getCurrentBuffId());
+	if (cmpPair == compareList.end())
+		return std::make_pair(-1, -1);
+
 	std::pair<int, int> viewLoc;
 
 	int mainStartLine	= 0;
@@ -1611,6 +1840,10 @@ std::pair<int, int> jumpToChange(bool down, bool wrapAround)
 	const int currentView	= getCurrentViewId();
 	const int otherView		= getOtherViewId(currentView);
 
+	const DiffLinesIndex& mainDiffLines	= getDiffLines(*cmpPair, MAIN_VIEW);
+	const DiffLinesIndex& subDiffLines	= getDiffLines(*cmpPair, SUB_VIEW);
+	const DiffLinesIndex& diffLines		= (currentView == MAIN_VIEW) ? mainDiffLines : subDiffLines;
+
 	int& currentLine	= (currentView == MAIN_VIEW) ? mainStartLine : subStartLine;
 	int& otherLine		= (currentView != MAIN_VIEW) ? mainStartLine : subStartLine;
 
@@ -1618,7 +1851,7 @@ std::pair<int, int> jumpToChange(bool down, bool wrapAround)
 	{
 		currentLine = (Settings.FollowingCaret ? getCurrentLine(currentView) : getLastLine(currentView));
 
-		if (Settings.FollowingCaret && isLineMarked(currentView, currentLine, MARKER_MASK_LINE) &&
+		if (Settings.FollowingCaret && diffLines.isLineMarked(currentLine) &&
 			(currentLine > getLastLine(currentView)))
 		{
 			// Current line is marked but invisible - get into view
@@ -1638,8 +1871,10 @@ std::pair<int, int> jumpToChange(bool down, bool wrapAround)
 			if (currentLineNotAnnotated && isLineAnnotated(otherView, otherLine))
 				++otherLine;
 
-			viewLoc = jumpToNextChange(getNextUnmarkedLine(MAIN_VIEW, mainStartLine, MARKER_MASK_LINE),
-					getNextUnmarkedLine(SUB_VIEW, subStartLine, MARKER_MASK_LINE), down);
+			viewLoc = jumpToNextChange(
+					mainDiffLines.getNextUnmarkedLine(mainStartLine, CallScintilla(MAIN_VIEW, SCI_GETLINECOUNT, 0, 0)),
+					subDiffLines.getNextUnmarkedLine(subStartLine, CallScintilla(SUB_VIEW, SCI_GETLINECOUNT, 0, 0)),
+					down);
 		}
 
 	}
@@ -1647,7 +1882,7 @@ std::pair<int, int> jumpToChange(bool down, bool wrapAround)
 	{
 		currentLine = (Settings.FollowingCaret ? getCurrentLine(currentView) : getFirstLine(currentView));
 
-		if (Settings.FollowingCaret && isLineMarked(currentView, currentLine, MARKER_MASK_LINE) &&
+		if (Settings.FollowingCaret && diffLines.isLineMarked(currentLine) &&
 			(currentLine < getFirstLine(currentView)))
 		{
 			// Current line is marked but invisible - get into view
@@ -1662,8 +1897,8 @@ std::pair<int, int> jumpToChange(bool down, bool wrapAround)
 			otherLine = (Settings.FollowingCaret ?
 					otherViewMatchingLine(currentView, currentLine) : getFirstLine(otherView));
 
-			viewLoc = jumpToNextChange(getPrevUnmarkedLine(MAIN_VIEW, mainStartLine, MARKER_MASK_LINE),
-					getPrevUnmarkedLine(SUB_VIEW, subStartLine, MARKER_MASK_LINE), down);
+			viewLoc = jumpToNextChange(mainDiffLines.getPrevUnmarkedLine(mainStartLine),
+					subDiffLines.getPrevUnmarkedLine(subStartLine), down);
 		}
 	}
 
@@ -1793,37 +2028,21 @@ bool isAlignmentNeeded(int view, const AlignmentInfo_t& alignmentInfo)
 }
 
 
-void alignDiffs(const CompareList_t::iterator& cmpPair)
+// Aligns the alignment pairs in the [startIdx, endIdx) range
+void alignDiffsRange(const AlignmentInfo_t& alignmentInfo, int startIdx, int endIdx)
 {
 	bool lineZeroAlignmentSkipped = false;
 
-	if (Settings.ShowOnlyDiffs)
-	{
-		hideUnmarked(MAIN_VIEW, MARKER_MASK_LINE);
-		hideUnmarked(SUB_VIEW, MARKER_MASK_LINE);
-	}
-	else if (cmpPair->options.selectionCompare && Settings.ShowOnlySelections)
-	{
-		hideOutsideRange(MAIN_VIEW, cmpPair->options.selections[MAIN_VIEW].first,
-				cmpPair->options.selections[MAIN_VIEW].second);
-		hideOutsideRange(SUB_VIEW, cmpPair->options.selections[SUB_VIEW].first,
-				cmpPair->options.selections[SUB_VIEW].second);
-	}
-	else
-	{
-		CallScintilla(MAIN_VIEW, SCI_FOLDALL, SC_FOLDACTION_EXPAND, 0);
-		CallScintilla(SUB_VIEW, SCI_FOLDALL, SC_FOLDACTION_EXPAND, 0);
-	}
-
-	const AlignmentInfo_t& alignmentInfo = cmpPair->summary.alignmentInfo;
-
 	const int maxSize = static_cast<int>(alignmentInfo.size());
 
 	int mainEndLine = CallScintilla(MAIN_VIEW, SCI_GETLINECOUNT, 0, 0) - 1;
 	int subEndLine = CallScintilla(SUB_VIEW, SCI_GETLINECOUNT, 0, 0) - 1;
 
+	if (endIdx > maxSize)
+		endIdx = maxSize;
+
 	// Align diffs
-	for (int i = 0; i < maxSize &&
+	for (int i = startIdx; i < endIdx &&
 			alignmentInfo[i].main.line <= mainEndLine && alignmentInfo[i].sub.line <= subEndLine; ++i)
 	{
 		int previousUnhiddenLine = getPreviousUnhiddenLine(MAIN_VIEW, alignmentInfo[i].main.line);
@@ -1890,6 +2109,32 @@ void alignDiffs(const CompareList_t::iterator& cmpPair)
 			}
 		}
 	}
+}
+
+
+void alignDiffs(const CompareList_t::iterator& cmpPair)
+{
+	const int64_t alignStart = getTimeStamp();
+
+	if (Settings.ShowOnlyDiffs)
+	{
+		hideUnmarked(MAIN_VIEW, getDiffLines(*cmpPair, MAIN_VIEW));
+		hideUnmarked(SUB_VIEW, getDiffLines(*cmpPair, SUB_VIEW));
+	}
+	else if (cmpPair->options.selectionCompare && Settings.ShowOnlySelections)
+	{
+		hideOutsideRange(MAIN_VIEW, cmpPair->options.selections[MAIN_VIEW].first,
+				cmpPair->options.selections[MAIN_VIEW].second);
+		hideOutsideRange(SUB_VIEW, cmpPair->options.selections[SUB_VIEW].first,
+				cmpPair->options.selections[SUB_VIEW].second);
+	}
+	else
+	{
+		CallScintilla(MAIN_VIEW, SCI_FOLDALL, SC_FOLDACTION_EXPAND, 0);
+		CallScintilla(SUB_VIEW, SCI_FOLDALL, SC_FOLDACTION_EXPAND, 0);
+	}
+
+	alignDiffsRange(cmpPair->summary.alignmentInfo, 0, static_cast<int>(cmpPair->summary.alignmentInfo.size()));
 
 	// Mark selections for clarity
 	if (cmpPair->options.selectionCompare)
@@ -1933,6 +2178,41 @@ void alignDiffs(const CompareList_t::iterator& cmpPair)
 					subAnnotation, subAnnotation, "--- Selection Compare Block End ---");
 		}
 	}
+
+	cmpPair->summary.stats.setTime(ComparePhase::ALIGNMENT, alignStart);
+}
+
+
+// Aligns only the diffs around the visible part of the view. Scintilla keeps the wrapped and hidden lines visible
+// positions in prefix sums so the cost depends on the number of the aligned pairs only
+void alignVisibleDiffs(const CompareList_t::iterator& cmpPair, int view)
+{
+	// Selection marks are placed relative to the alignment of the whole compared range
+	if (cmpPair->options.selectionCompare)
+	{
+		alignDiffs(cmpPair);
+		return;
+	}
+
+	const AlignmentViewData AlignmentPair::*pView = (view == MAIN_VIEW) ? &AlignmentPair::main : &AlignmentPair::sub;
+
+	const AlignmentInfo_t& alignmentInfo = cmpPair->summary.alignmentInfo;
+
+	// A screen above and below so the alignment is ready for small scrolls
+	const int margin	= CallScintilla(view, SCI_LINESONSCREEN, 0, 0);
+	const int lastLine	= getLastLine(view) + margin;
+
+	int startIdx = getAlignmentIdxAfter(pView, alignmentInfo, getFirstLine(view) - margin);
+
+	if (startIdx)
+		--startIdx;
+
+	int endIdx = startIdx;
+
+	for (const int maxSize = static_cast<int>(alignmentInfo.size());
+			endIdx < maxSize && (alignmentInfo[endIdx].*pView).line <= lastLine; ++endIdx);
+
+	alignDiffsRange(alignmentInfo, startIdx, endIdx + 1);
 }
 
 
@@ -2025,14 +2305,15 @@ bool setFirst(bool currFileIsNew, bool markName = false)
 }
 
 
-void setContent(const char* content)
+void setContent(const char* content, intptr_t len)
 {
 	const int view = getCurrentViewId();
 
 	ScopedViewUndoCollectionBlocker undoBlock(view);
 	ScopedViewWriteEnabler writeEn(view);
 
-	CallScintilla(view, SCI_SETTEXT, 0, (LPARAM)content);
+	CallScintilla(view, SCI_CLEARALL, 0, 0);
+	CallScintilla(view, SCI_APPENDTEXT, len, (LPARAM)content);
 	CallScintilla(view, SCI_SETSAVEPOINT, 0, 0);
 }
 
@@ -2221,10 +2502,81 @@ CompareList_t::iterator addComparePair()
 }
 
 
-CompareResult runCompare(CompareList_t::iterator cmpPair)
+// Completes the engine stats with the UI side counters and logs them - alignment is done later and is not logged
+void recordCompareStats(CompareStats& stats, unsigned sciCalls)
+{
+	stats.sciCalls = sciCalls;
+
+	PROCESS_MEMORY_COUNTERS memCounters;
+
+	if (::GetProcessMemoryInfo(::GetCurrentProcess(), &memCounters, sizeof(memCounters)))
+		stats.peakMemory_KB = memCounters.PeakWorkingSetSize / 1024;
+
+	statsLog.add(stats);
+}
+
+
+bool writeStatsLog(TCHAR* logFile, size_t logFileSize)
+{
+	::SendMessage(nppData._nppHandle, NPPM_GETPLUGINSCONFIGDIR, (WPARAM)logFileSize, (LPARAM)logFile);
+
+	if (!::PathAppend(logFile, TEXT("ComparePlusStats.log")))
+		return false;
+
+	return statsLog.write(logFile);
+}
+
+
+// The base file is read again on each re-compare - it is not opened in Notepad++
+CompareResult runCompareToBase(CompareList_t::iterator cmpPair)
+{
+	// Three-way compare results are not cached
+	cmpPair->compareCache.clear();
+
+	MappedFile base(cmpPair->baseFile.c_str());
+
+	if (!base.isOpen())
+	{
+		TCHAR msg[2 * MAX_PATH];
+
+		_sntprintf_s(msg, _countof(msg), _TRUNCATE, TEXT("Cannot read base file \"%s\"."),
+				cmpPair->baseFile.c_str());
+
+		::MessageBox(nppData._nppHandle, msg, PLUGIN_NAME, MB_OK | MB_ICONWARNING);
+
+		return CompareResult::COMPARE_ERROR;
+	}
+
+	const char*	baseText	= base.data();
+	intptr_t	baseTextLen	= base.size();
+
+	// The UTF-8 BOM is not loaded in Scintilla
+	if (baseTextLen >= 3 && !std::memcmp(baseText, "\xEF\xBB\xBF", 3))
+	{
+		baseText	+= 3;
+		baseTextLen	-= 3;
+	}
+
+	TCHAR progressInfo[MAX_PATH];
+	_sntprintf_s(progressInfo, _countof(progressInfo), _TRUNCATE, TEXT("Comparing \"%s\" vs. \"%s\" to \"%s\"..."),
+			::PathFindFileName(cmpPair->getNewFile().name), ::PathFindFileName(cmpPair->getOldFile().name),
+			::PathFindFileName(cmpPair->baseFile.c_str()));
+
+	return compareViewsToBase(cmpPair->options, progressInfo, baseText, baseTextLen, cmpPair->summary,
+			cmpPair->lineHashes);
+}
+
+
+CompareResult runCompare(CompareList_t::iterator cmpPair, AsyncCompare* asyncResult)
 {
 	setStyles(Settings);
 
+	if (!cmpPair->baseFile.empty())
+		return runCompareToBase(cmpPair);
+
+	if (asyncResult)
+		return asyncResult->apply(cmpPair->summary, cmpPair->lineHashes, &cmpPair->compareCache);
+
 	const TCHAR* newName = ::PathFindFileName(cmpPair->getNewFile().name);
 	const TCHAR* oldName = ::PathFindFileName(cmpPair->getOldFile().name);
 
@@ -2233,67 +2585,475 @@ CompareResult runCompare(CompareList_t::iterator cmpPair)
 			TEXT("Comparing selected lines in \"%s\" vs. selected lines in \"%s\"...") :
 			TEXT("Comparing \"%s\" vs. \"%s\"..."), newName, oldName);
 
-	return compareViews(cmpPair->options, progressInfo, cmpPair->summary);
+	return compareViews(cmpPair->options, progressInfo, cmpPair->summary, cmpPair->lineHashes,
+			&cmpPair->compareCache);
 }
 
 
-void compare(bool selectionCompare = false, bool findUniqueMode = false, bool autoUpdating = false)
+std::string toUTF8(const TCHAR* str)
 {
-	delayedUpdate.cancel();
+	std::string utf8;
 
-	ScopedIncrementer incr(notificationsLock);
+	const int len = ::WideCharToMultiByte(CP_UTF8, 0, str, -1, NULL, 0, NULL, NULL);
 
-	// Just to be sure any old state is cleared
-	storedLocation = nullptr;
-	goToFirst = false;
-	copiedSectionMarks.clear();
+	if (len > 1)
+	{
+		utf8.resize(len);
+		::WideCharToMultiByte(CP_UTF8, 0, str, -1, &utf8[0], len, NULL, NULL);
+		utf8.resize(len - 1);
+	}
 
-	temporaryRangeSelect(-1);
-	setArrowMark(-1);
+	return utf8;
+}
 
-	const bool				doubleView		= !isSingleView();
-	const LRESULT			currentBuffId	= getCurrentBuffId();
-	CompareList_t::iterator	cmpPair			= getCompare(currentBuffId);
-	const bool				recompare		= (cmpPair != compareList.end());
 
-	bool recompareSameSelections = false;
+// The ignore patterns are compiled again only when changed. The invalid ones are reported once
+std::shared_ptr<const IgnoreRules> getIgnoreRules()
+{
+	static std::basic_string<TCHAR>				patterns;
+	static std::shared_ptr<const IgnoreRules>	rules;
 
-	if (recompare)
-	{
-		newCompare = nullptr;
+	if (Settings.IgnorePatterns == patterns)
+		return rules;
 
-		cmpPair->autoUpdateDelay = 0;
+	patterns = Settings.IgnorePatterns;
+	rules = nullptr;
 
-		if (!autoUpdating && selectionCompare)
-		{
-			bool checkSelections = false;
+	if (patterns.empty())
+		return rules;
 
-			// New selections to compare - validate them
-			if (isSelection(MAIN_VIEW) && isSelection(SUB_VIEW))
-			{
-				checkSelections = true;
-			}
-			else if (isSelection(MAIN_VIEW) && (cmpPair->options.selections[SUB_VIEW].first != -1))
-			{
-				std::pair<int, int> newSelection = getSelectionLines(MAIN_VIEW);
-				checkSelections = (newSelection.first == -1);
+	std::shared_ptr<const IgnoreRules> newRules = std::make_shared<IgnoreRules>(toUTF8(patterns.c_str()));
 
-				if (!checkSelections)
-					cmpPair->options.selections[MAIN_VIEW] = newSelection;
+	if (!newRules->invalidPatterns().empty())
+	{
+		TCHAR invalid[512];
 
-				recompareSameSelections = true;
-			}
-			else if (isSelection(SUB_VIEW) && (cmpPair->options.selections[MAIN_VIEW].first != -1))
-			{
-				std::pair<int, int> newSelection = getSelectionLines(SUB_VIEW);
-				checkSelections = (newSelection.first == -1);
+		::MultiByteToWideChar(CP_UTF8, 0, newRules->invalidPatterns().c_str(), -1, invalid, _countof(invalid));
+		invalid[_countof(invalid) - 1] = 0;
 
-				if (!checkSelections)
-					cmpPair->options.selections[SUB_VIEW] = newSelection;
+		TCHAR msg[1024];
 
-				recompareSameSelections = true;
-			}
-			else
+		_sntprintf_s(msg, _countof(msg), _TRUNCATE, TEXT("Invalid ignore patterns (ignored):\n\n%s"), invalid);
+
+		::MessageBox(nppData._nppHandle, msg, PLUGIN_NAME, MB_OK | MB_ICONWARNING);
+	}
+
+	if (!newRules->empty())
+		rules = newRules;
+
+	return rules;
+}
+
+
+void setCompareOptions(CompareOptions& options, bool selectionCompare, bool findUniqueMode)
+{
+	options.newFileViewId			= Settings.NewFileViewId;
+
+	options.findUniqueMode			= findUniqueMode;
+	options.alignAllMatches			= Settings.AlignAllMatches;
+	options.neverMarkIgnored		= Settings.NeverMarkIgnored;
+	options.charPrecision			= Settings.CharPrecision;
+	options.diffsBasedLineChanges	= Settings.DiffsBasedLineChanges;
+	options.ignoreSpaces			= Settings.IgnoreSpaces;
+	options.ignoreEmptyLines		= Settings.IgnoreEmptyLines;
+	options.ignoreLineNumbers		= Settings.IgnoreLineNumbers;
+	options.ignoreRules				= getIgnoreRules();
+	options.ignoreCase				= Settings.IgnoreCase;
+	options.detectMoves				= Settings.DetectMoves;
+	options.verifyMatches			= Settings.VerifyMatches;
+	options.patienceDiff			= Settings.PatienceDiff;
+	options.changedThresholdPercent	= Settings.ChangedThresholdPercent;
+	options.diffCostLimit			= Settings.DiffCostLimit;
+	options.addHighlightColor		= Settings.colors.add_highlight;
+	options.remHighlightColor		= Settings.colors.rem_highlight;
+	options.selectionCompare		= selectionCompare;
+}
+
+
+// Documents of different languages are split in words as plain text
+WordTokenizer getWordTokenizer(const ComparedPair& cmpPair)
+{
+	const WordTokenizer tokenizer1 = getLangTokenizer(static_cast<int>(::SendMessage(nppData._nppHandle,
+			NPPM_GETBUFFERLANGTYPE, cmpPair.file[0].buffId, 0)));
+	const WordTokenizer tokenizer2 = getLangTokenizer(static_cast<int>(::SendMessage(nppData._nppHandle,
+			NPPM_GETBUFFERLANGTYPE, cmpPair.file[1].buffId, 0)));
+
+	return (tokenizer1 == tokenizer2) ? tokenizer1 : WordTokenizer::TEXT;
+}
+
+
+void showNoChangesMsg(const TCHAR* fileName, Temp_t tempType)
+{
+	TCHAR msg[2 * MAX_PATH];
+
+	if (tempType == LAST_SAVED_TEMP)
+		_sntprintf_s(msg, _countof(msg), _TRUNCATE,
+				TEXT("File \"%s\" has not been modified since last Save."), fileName);
+	else
+		_sntprintf_s(msg, _countof(msg), _TRUNCATE,
+				TEXT("File \"%s\" has no changes against %s."), fileName,
+				tempType == GIT_TEMP ? TEXT("Git") : TEXT("SVN"));
+
+	::MessageBox(nppData._nppHandle, msg, TEXT("Compare"), MB_OK);
+}
+
+
+// Returns the length of the current document BOM that is not loaded in Scintilla. Only the encodings that Notepad++
+// loads in Scintilla byte for byte are checked against the texts not opened in a tab, -1 is returned for the others
+// and for the compared documents - they are always compared in full
+int getCurrentDocBomLen()
+{
+	if (getCompare(getCurrentBuffId()) != compareList.end())
+		return -1;
+
+	switch (getEncoding(getCurrentBuffId()))
+	{
+		// ANSI, UTF-8 without BOM and 7-bit ASCII
+		case 0: case 4: case 5:
+		return 0;
+
+		// UTF-8 with BOM
+		case 1:
+		return 3;
+	}
+
+	return -1;
+}
+
+
+// Checks the current document against a text that is not opened in a tab. On a mismatch textSnapshot (if given) takes
+// the text hashes for the temp buffer opened to show the differences
+CompareResult compareCurrentDocToText(const char* text, intptr_t textLen, DocSnapshot* textSnapshot = nullptr)
+{
+	const int bomLen = getCurrentDocBomLen();
+
+	if (bomLen < 0 || textLen < bomLen || (bomLen && std::memcmp(text, "\xEF\xBB\xBF", bomLen)))
+		return CompareResult::COMPARE_ERROR;
+
+	CompareOptions options;
+
+	setCompareOptions(options, false, false);
+
+	return compareViewToText(options, getCurrentViewId(), text + bomLen, textLen - bomLen, textSnapshot);
+}
+
+
+// Checks the current document against the snapshot of a prefetched VCS base. COMPARE_ERROR is returned if the
+// snapshot can't tell - the base text should be checked then
+CompareResult compareCurrentDocToBase(const DocSnapshot& baseSnapshot, int baseBomLen)
+{
+	if (getCurrentDocBomLen() != baseBomLen)
+		return CompareResult::COMPARE_ERROR;
+
+	CompareOptions options;
+
+	setCompareOptions(options, false, false);
+
+	return compareViewToSnapshot(options, getCurrentViewId(), baseSnapshot);
+}
+
+
+CompareResult compareCurrentDocToFile(const TCHAR* file, DocSnapshot* fileSnapshot = nullptr)
+{
+	MappedFile mappedFile(file);
+
+	return mappedFile.isOpen() ? compareCurrentDocToText(mappedFile.data(), mappedFile.size(), fileSnapshot) :
+			CompareResult::COMPARE_ERROR;
+}
+
+
+/**
+ *  \struct
+ *  \brief  Header of the line hashes file stored for a document file. The hashes are used only while the file size,
+ *          last write time, the hashes options and the loaded text are the same
+ */
+struct LineHashesHeader
+{
+	uint32_t	magic;
+	uint32_t	formatVersion;
+	uint64_t	fileSize;
+	uint64_t	fileTime;
+	uint64_t	optionsKey;
+	int64_t		textLen;
+	int32_t		linesCount;
+};
+
+
+const uint32_t	cLineHashesMagic			= 0x484C5043; // "CPLH"
+const uint32_t	cLineHashesFormatVersion	= 2;
+
+// Smaller files are hashed fast enough
+const int		cMinLinesToStoreHashes		= 100000;
+const int		cMaxStoredHashesFiles		= 32;
+
+
+bool getFileIdentity(const TCHAR* file, uint64_t& fileSize, uint64_t& fileTime)
+{
+	WIN32_FILE_ATTRIBUTE_DATA attr;
+
+	if (::PathIsRelative(file) || !::GetFileAttributesEx(file, GetFileExInfoStandard, &attr) ||
+			(attr.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+		return false;
+
+	fileSize = (static_cast<uint64_t>(attr.nFileSizeHigh) << 32) | attr.nFileSizeLow;
+	fileTime = (static_cast<uint64_t>(attr.ftLastWriteTime.dwHighDateTime) << 32) |
+			attr.ftLastWriteTime.dwLowDateTime;
+
+	return true;
+}
+
+
+// Gets the line hashes file path in the plugin config dir - the name is the hash of the document file path
+bool getLineHashesFile(const TCHAR* file, TCHAR* hashesFile, size_t hashesFileSize, bool createDir = false)
+{
+	::SendMessage(nppData._nppHandle, NPPM_GETPLUGINSCONFIGDIR, (WPARAM)hashesFileSize, (LPARAM)hashesFile);
+
+	if (!::PathAppend(hashesFile, TEXT("ComparePlusCache")))
+		return false;
+
+	if (createDir && !::CreateDirectory(hashesFile, NULL) && (::GetLastError() != ERROR_ALREADY_EXISTS))
+		return false;
+
+	TCHAR path[MAX_PATH];
+
+	_tcscpy_s(path, _countof(path), file);
+	::CharLower(path);
+
+	TextHash pathHash;
+	pathHash.add(reinterpret_cast<const char*>(path), static_cast<int>(_tcslen(path) * sizeof(TCHAR)));
+
+	TCHAR name[32];
+	_sntprintf_s(name, _countof(name), _TRUNCATE, TEXT("%016llX.lhc"), pathHash.get());
+
+	return (::PathAppend(hashesFile, name) != FALSE);
+}
+
+
+// Keeps only the most recently stored line hashes files
+void pruneLineHashesFiles(const TCHAR* hashesFile)
+{
+	TCHAR pattern[MAX_PATH];
+
+	_tcscpy_s(pattern, _countof(pattern), hashesFile);
+	::PathRemoveFileSpec(pattern);
+	::PathAppend(pattern, TEXT("*.lhc"));
+
+	WIN32_FIND_DATA findData;
+	HANDLE hFind = ::FindFirstFile(pattern, &findData);
+
+	if (hFind == INVALID_HANDLE_VALUE)
+		return;
+
+	std::vector<std::pair<uint64_t, std::basic_string<TCHAR>>> files;
+
+	do
+	{
+		files.emplace_back((static_cast<uint64_t>(findData.ftLastWriteTime.dwHighDateTime) << 32) |
+				findData.ftLastWriteTime.dwLowDateTime, findData.cFileName);
+	}
+	while (::FindNextFile(hFind, &findData));
+
+	::FindClose(hFind);
+
+	if (static_cast<int>(files.size()) <= cMaxStoredHashesFiles)
+		return;
+
+	std::sort(files.begin(), files.end());
+
+	::PathRemoveFileSpec(pattern);
+
+	for (int i = 0; i < static_cast<int>(files.size()) - cMaxStoredHashesFiles; ++i)
+	{
+		TCHAR oldFile[MAX_PATH];
+
+		_tcscpy_s(oldFile, _countof(oldFile), pattern);
+
+		if (::PathAppend(oldFile, files[i].second.c_str()))
+			::DeleteFile(oldFile);
+	}
+}
+
+
+// The stored hashes are valid only for the unmodified document file so they are not loaded otherwise. The VCS diff
+// temp buffer takes them from its prefetched base snapshot
+void loadLineHashes(const ComparedFile& cmpFile, const CompareOptions& options, LineHashCache& cache)
+{
+	const uint64_t optionsKey = getLineHashesKey(options);
+
+	if ((cache.isValid() && cache.optionsKey == optionsKey) ||
+			CallScintilla(cmpFile.compareViewId, SCI_GETMODIFY, 0, 0))
+		return;
+
+	if (cmpFile.isTemp)
+	{
+		if (tempBaseHashes.second && tempBaseHashes.first == cmpFile.buffId)
+			setLineHashesFromSnapshot(options, cmpFile.compareViewId, *tempBaseHashes.second, cache);
+
+		return;
+	}
+
+	const int linesCount = CallScintilla(cmpFile.compareViewId, SCI_GETLINECOUNT, 0, 0);
+
+	if (linesCount < cMinLinesToStoreHashes)
+		return;
+
+	uint64_t fileSize;
+	uint64_t fileTime;
+	TCHAR hashesFile[MAX_PATH];
+
+	if (!getFileIdentity(cmpFile.name, fileSize, fileTime) ||
+			!getLineHashesFile(cmpFile.name, hashesFile, _countof(hashesFile)))
+		return;
+
+	MappedFile stored(hashesFile);
+
+	if (!stored.isOpen() || stored.size() < static_cast<intptr_t>(sizeof(LineHashesHeader)))
+		return;
+
+	LineHashesHeader header;
+	std::memcpy(&header, stored.data(), sizeof(header));
+
+	if ((header.magic != cLineHashesMagic) || (header.formatVersion != cLineHashesFormatVersion) ||
+		(header.fileSize != fileSize) || (header.fileTime != fileTime) || (header.optionsKey != optionsKey) ||
+		(header.textLen != CallScintilla(cmpFile.compareViewId, SCI_GETLENGTH, 0, 0)) ||
+		(header.linesCount != linesCount) ||
+		((stored.size() - sizeof(header)) / sizeof(uint64_t) != static_cast<size_t>(linesCount)))
+		return;
+
+	cache.hashes.resize(linesCount);
+	std::memcpy(cache.hashes.data(), stored.data() + sizeof(header), linesCount * sizeof(uint64_t));
+
+	cache.dirty.assign(linesCount, 0);
+	cache.optionsKey	= optionsKey;
+	cache.isStored		= true;
+}
+
+
+// Only complete cache of unmodified big document file is stored
+void storeLineHashes(const ComparedFile& cmpFile, LineHashCache& cache)
+{
+	if (cache.isStored || !cache.isValid() || cmpFile.isTemp ||
+			CallScintilla(cmpFile.compareViewId, SCI_GETMODIFY, 0, 0))
+		return;
+
+	const int linesCount = static_cast<int>(cache.hashes.size());
+
+	if ((linesCount < cMinLinesToStoreHashes) ||
+			(linesCount != CallScintilla(cmpFile.compareViewId, SCI_GETLINECOUNT, 0, 0)) ||
+			(std::find(cache.dirty.begin(), cache.dirty.end(), 1) != cache.dirty.end()))
+		return;
+
+	LineHashesHeader header;
+	TCHAR hashesFile[MAX_PATH];
+
+	if (!getFileIdentity(cmpFile.name, header.fileSize, header.fileTime) ||
+			!getLineHashesFile(cmpFile.name, hashesFile, _countof(hashesFile), true))
+		return;
+
+	header.magic			= cLineHashesMagic;
+	header.formatVersion	= cLineHashesFormatVersion;
+	header.optionsKey		= cache.optionsKey;
+	header.textLen			= CallScintilla(cmpFile.compareViewId, SCI_GETLENGTH, 0, 0);
+	header.linesCount		= linesCount;
+
+	HANDLE hFile = ::CreateFile(hashesFile, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if (hFile == INVALID_HANDLE_VALUE)
+		return;
+
+	const DWORD hashesSize = static_cast<DWORD>(linesCount * sizeof(uint64_t));
+
+	DWORD written = 0;
+
+	bool ok = ::WriteFile(hFile, &header, sizeof(header), &written, NULL) && (written == sizeof(header));
+
+	if (ok)
+		ok = ::WriteFile(hFile, cache.hashes.data(), hashesSize, &written, NULL) && (written == hashesSize);
+
+	::CloseHandle(hFile);
+
+	if (!ok)
+	{
+		::DeleteFile(hashesFile);
+		return;
+	}
+
+	cache.isStored = true;
+
+	pruneLineHashesFiles(hashesFile);
+}
+
+
+void compare(bool selectionCompare = false, bool findUniqueMode = false, bool autoUpdating = false)
+{
+	delayedUpdate.cancel();
+	delayedUpdateApply.cancel();
+	delayedBlocksCompare.cancel();
+
+	asyncBlocksCompare = nullptr;
+
+	// Finished background compare results are used by the automatic re-compare only
+	std::unique_ptr<AsyncCompare> asyncResult = std::move(asyncCompare);
+
+	if (asyncResult && (!autoUpdating || !asyncResult->isDone()))
+		asyncResult = nullptr;
+
+	ScopedIncrementer incr(notificationsLock);
+
+	// Just to be sure any old state is cleared
+	storedLocation = nullptr;
+	goToFirst = false;
+	copiedSectionMarks.clear();
+
+	temporaryRangeSelect(-1);
+	setArrowMark(-1);
+
+	const bool				doubleView		= !isSingleView();
+	const LRESULT			currentBuffId	= getCurrentBuffId();
+	CompareList_t::iterator	cmpPair			= getCompare(currentBuffId);
+	const bool				recompare		= (cmpPair != compareList.end());
+
+	if (asyncResult && (!recompare || getCompare(asyncCompareBuffId) != cmpPair))
+		asyncResult = nullptr;
+
+	bool recompareSameSelections = false;
+
+	if (recompare)
+	{
+		newCompare = nullptr;
+
+		cmpPair->autoUpdateDelay = 0;
+
+		if (!autoUpdating && selectionCompare)
+		{
+			bool checkSelections = false;
+
+			// New selections to compare - validate them
+			if (isSelection(MAIN_VIEW) && isSelection(SUB_VIEW))
+			{
+				checkSelections = true;
+			}
+			else if (isSelection(MAIN_VIEW) && (cmpPair->options.selections[SUB_VIEW].first != -1))
+			{
+				std::pair<int, int> newSelection = getSelectionLines(MAIN_VIEW);
+				checkSelections = (newSelection.first == -1);
+
+				if (!checkSelections)
+					cmpPair->options.selections[MAIN_VIEW] = newSelection;
+
+				recompareSameSelections = true;
+			}
+			else if (isSelection(SUB_VIEW) && (cmpPair->options.selections[MAIN_VIEW].first != -1))
+			{
+				std::pair<int, int> newSelection = getSelectionLines(SUB_VIEW);
+				checkSelections = (newSelection.first == -1);
+
+				if (!checkSelections)
+					cmpPair->options.selections[SUB_VIEW] = newSelection;
+
+				recompareSameSelections = true;
+			}
+			else
 			{
 				if ((cmpPair->options.selections[MAIN_VIEW].first == -1) ||
 						(cmpPair->options.selections[SUB_VIEW].first == -1))
@@ -2349,20 +3109,14 @@ void compare(bool selectionCompare = false, bool findUniqueMode = false, bool au
 	// Compare is triggered manually - get/re-get compare settings and position/reposition files
 	if (!autoUpdating)
 	{
-		cmpPair->options.newFileViewId				= Settings.NewFileViewId;
-
-		cmpPair->options.findUniqueMode				= findUniqueMode;
-		cmpPair->options.alignAllMatches			= Settings.AlignAllMatches;
-		cmpPair->options.neverMarkIgnored			= Settings.NeverMarkIgnored;
-		cmpPair->options.charPrecision				= Settings.CharPrecision;
-		cmpPair->options.diffsBasedLineChanges		= Settings.DiffsBasedLineChanges;
-		cmpPair->options.ignoreSpaces				= Settings.IgnoreSpaces;
-		cmpPair->options.ignoreEmptyLines			= Settings.IgnoreEmptyLines;
-		cmpPair->options.ignoreLineNumbers			= Settings.ignoreLineNumbers;
-		cmpPair->options.ignoreCase					= Settings.IgnoreCase;
-		cmpPair->options.detectMoves				= Settings.DetectMoves;
-		cmpPair->options.changedThresholdPercent	= Settings.ChangedThresholdPercent;
-		cmpPair->options.selectionCompare			= selectionCompare;
+		setCompareOptions(cmpPair->options, selectionCompare, findUniqueMode);
+
+		// Big changed blocks are shown as added and removed lines first and sub-compared in the background
+		cmpPair->options.deferBlocksCompare = true;
+
+		cmpPair->baseFile = compareBaseFile;
+
+		cmpPair->options.wordTokenizer = getWordTokenizer(*cmpPair);
 
 		cmpPair->positionFiles();
 
@@ -2375,15 +3129,44 @@ void compare(bool selectionCompare = false, bool findUniqueMode = false, bool au
 
 	selectionAutoRecompare = autoUpdating && cmpPair->options.selectionCompare;
 
-	const CompareResult cmpResult = runCompare(cmpPair);
+	// Folder compare results are reused if the opened files are not changed since then
+	if (!recompare && folderEntryCache.data && bindCompareCache(folderEntryCache, cmpPair->lineHashes))
+		cmpPair->compareCache = folderEntryCache;
+
+	folderEntryCache.clear();
+
+	// Line hashes of reopened big files might be stored on disk
+	if (!asyncResult)
+	{
+		loadLineHashes(cmpPair->getFileByViewId(MAIN_VIEW), cmpPair->options, cmpPair->lineHashes[MAIN_VIEW]);
+		loadLineHashes(cmpPair->getFileByViewId(SUB_VIEW), cmpPair->options, cmpPair->lineHashes[SUB_VIEW]);
+	}
+
+	const unsigned sciCalls = sciCallsCount;
+
+	const CompareResult cmpResult = runCompare(cmpPair, asyncResult.get());
 
 	cmpPair->compareDirty		= false;
 	cmpPair->manuallyChanged	= false;
 
+	if ((cmpResult == CompareResult::COMPARE_MISMATCH) || (cmpResult == CompareResult::COMPARE_MATCH))
+	{
+		recordCompareStats(cmpPair->summary.stats, sciCallsCount - sciCalls);
+
+		storeLineHashes(cmpPair->getFileByViewId(MAIN_VIEW), cmpPair->lineHashes[MAIN_VIEW]);
+		storeLineHashes(cmpPair->getFileByViewId(SUB_VIEW), cmpPair->lineHashes[SUB_VIEW]);
+	}
+
 	switch (cmpResult)
 	{
 		case CompareResult::COMPARE_MISMATCH:
 		{
+			if (cmpPair->summary.deferredBlocks)
+			{
+				asyncBlocksCompareBuffId = cmpPair->getNewFile().buffId;
+				delayedBlocksCompare.post(DelayedBlocksCompare::cPollPeriod_ms);
+			}
+
 			if (Settings.UseNavBar)
 				showNavBar();
 
@@ -2454,20 +3237,14 @@ void compare(bool selectionCompare = false, bool findUniqueMode = false, bool au
 							selectionCompare ? TEXT("Selections in files") : TEXT("Files"),
 							newName, ::PathFindFileName(oldFile.name),
 							cmpPair->options.findUniqueMode ? TEXT("do not contain unique lines") : TEXT("match"));
+
+					::MessageBox(nppData._nppHandle, msg, cmpPair->options.findUniqueMode ?
+							TEXT("Find Unique") : TEXT("Compare"), MB_OK);
 				}
 				else
 				{
-					if (oldFile.isTemp == LAST_SAVED_TEMP)
-						_sntprintf_s(msg, _countof(msg), _TRUNCATE,
-								TEXT("File \"%s\" has not been modified since last Save."), newName);
-					else
-						_sntprintf_s(msg, _countof(msg), _TRUNCATE,
-								TEXT("File \"%s\" has no changes against %s."), newName,
-								oldFile.isTemp == GIT_TEMP ? TEXT("Git") : TEXT("SVN"));
+					showNoChangesMsg(newName, oldFile.isTemp);
 				}
-
-				::MessageBox(nppData._nppHandle, msg, cmpPair->options.findUniqueMode ?
-						TEXT("Find Unique") : TEXT("Compare"), MB_OK);
 			}
 			else
 			{
@@ -2515,6 +3292,109 @@ void CompareWhole()
 }
 
 
+// Browses for a folder to compare - returns false if none is selected
+bool browseForFolder(const TCHAR* title, TCHAR* folder)
+{
+	BROWSEINFO bi = { 0 };
+
+	bi.hwndOwner		= nppData._nppHandle;
+	bi.pszDisplayName	= folder;
+	bi.lpszTitle		= title;
+	bi.ulFlags			= BIF_RETURNONLYFSDIRS | BIF_NEWDIALOGSTYLE;
+
+	LPITEMIDLIST pidl = ::SHBrowseForFolder(&bi);
+
+	if (pidl == NULL)
+		return false;
+
+	const bool selected = (::SHGetPathFromIDList(pidl, folder) != FALSE);
+
+	::CoTaskMemFree(pidl);
+
+	return selected;
+}
+
+
+void CompareFiles(const TCHAR* oldFile, const TCHAR* newFile, CompareCache* cmpCache)
+{
+	newCompare = nullptr;
+
+	// The files are compared as a new pair - the compares they are part of are cleared
+	for (const TCHAR* file: {newFile, oldFile})
+	{
+		if (!::SendMessage(nppData._nppHandle, NPPM_DOOPEN, 0, (LPARAM)file))
+			return;
+
+		if (getCompare(getCurrentBuffId()) != compareList.end())
+			clearComparePair(getCurrentBuffId());
+	}
+
+	if (!setFirst(false, true))
+		return;
+
+	if (!::SendMessage(nppData._nppHandle, NPPM_DOOPEN, 0, (LPARAM)newFile))
+	{
+		newCompare = nullptr;
+		return;
+	}
+
+	if (cmpCache)
+		folderEntryCache = *cmpCache;
+
+	compare(false, false);
+
+	folderEntryCache.clear();
+}
+
+
+void CompareToBase()
+{
+	TCHAR baseFile[MAX_PATH] = { 0 };
+
+	OPENFILENAME ofn = { 0 };
+
+	ofn.lStructSize	= sizeof(ofn);
+	ofn.hwndOwner	= nppData._nppHandle;
+	ofn.lpstrFile	= baseFile;
+	ofn.nMaxFile	= _countof(baseFile);
+	ofn.lpstrTitle	= TEXT("Select the common base file to compare to:");
+	ofn.Flags		= OFN_FILEMUSTEXIST | OFN_PATHMUSTEXIST | OFN_HIDEREADONLY;
+
+	if (!::GetOpenFileName(&ofn))
+		return;
+
+	compareBaseFile = baseFile;
+
+	compare(false, false);
+
+	compareBaseFile.clear();
+}
+
+
+void CompareFolders()
+{
+	TCHAR oldFolder[MAX_PATH];
+	TCHAR newFolder[MAX_PATH];
+
+	if (!browseForFolder(TEXT("Select the old folder to compare:"), oldFolder) ||
+			!browseForFolder(TEXT("Select the new folder to compare:"), newFolder))
+		return;
+
+	if (!_tcsicmp(oldFolder, newFolder))
+	{
+		::MessageBox(nppData._nppHandle, TEXT("Trying to compare folder to itself - operation ignored."),
+				PLUGIN_NAME, MB_OK);
+		return;
+	}
+
+	CompareOptions options;
+
+	setCompareOptions(options, false, false);
+
+	FolderDlg.Compare(options, oldFolder, newFolder);
+}
+
+
 void CompareSelections()
 {
 	compare(true, false);
@@ -2571,6 +3451,52 @@ void ClearAllCompares()
 }
 
 
+// Takes the current buffer snapshot as its last saved state - the buffer must be the same as the saved file
+void takeSavedSnapshot(const TCHAR* file)
+{
+	const LRESULT buffId = getCurrentBuffId();
+
+	SavedSnapshot& snapshot = savedSnapshots[buffId];
+
+	CompareOptions options;
+
+	setCompareOptions(options, false, false);
+
+	if (!getFileIdentity(file, snapshot.fileSize, snapshot.fileTime) ||
+			!takeViewSnapshot(options, getCurrentViewId(), snapshot.doc))
+		savedSnapshots.erase(buffId);
+}
+
+
+// Checks the current buffer against its last saved state snapshot. COMPARE_ERROR is returned if there is no valid
+// snapshot - the file should be checked then
+CompareResult compareToSavedSnapshot(const TCHAR* file)
+{
+	const LRESULT buffId = getCurrentBuffId();
+
+	auto snapshot = savedSnapshots.find(buffId);
+
+	if (snapshot == savedSnapshots.end() || getCompare(buffId) != compareList.end())
+		return CompareResult::COMPARE_ERROR;
+
+	uint64_t fileSize;
+	uint64_t fileTime;
+
+	if (!getFileIdentity(file, fileSize, fileTime) ||
+			fileSize != snapshot->second.fileSize || fileTime != snapshot->second.fileTime)
+	{
+		savedSnapshots.erase(snapshot);
+		return CompareResult::COMPARE_ERROR;
+	}
+
+	CompareOptions options;
+
+	setCompareOptions(options, false, false);
+
+	return compareViewToSnapshot(options, getCurrentViewId(), snapshot->second.doc);
+}
+
+
 void LastSaveDiff()
 {
 	TCHAR file[MAX_PATH];
@@ -2580,8 +3506,106 @@ void LastSaveDiff()
 	if (!checkFileExists(file))
 		return;
 
-	if (createTempFile(file, LAST_SAVED_TEMP))
-		compare(false, false);
+	CompareResult result = compareToSavedSnapshot(file);
+
+	std::shared_ptr<DocSnapshot> fileSnapshot;
+
+	if (result == CompareResult::COMPARE_ERROR)
+	{
+		fileSnapshot = std::make_shared<DocSnapshot>();
+
+		result = compareCurrentDocToFile(file, fileSnapshot.get());
+
+		// Next checks use the snapshot until the file is saved again
+		if (result == CompareResult::COMPARE_MATCH)
+			takeSavedSnapshot(file);
+		else if (result == CompareResult::COMPARE_ERROR)
+			fileSnapshot = nullptr;
+	}
+
+	// The temp file is created only if there are differences to show
+	if (result == CompareResult::COMPARE_MATCH)
+	{
+		showNoChangesMsg(::PathFindFileName(file), LAST_SAVED_TEMP);
+		return;
+	}
+
+	if (!createTempFile(file, LAST_SAVED_TEMP))
+		return;
+
+	if (fileSnapshot)
+		tempBaseHashes = std::make_pair(getCurrentBuffId(), std::shared_ptr<const DocSnapshot>(fileSnapshot));
+
+	compare(false, false);
+
+	tempBaseHashes.second = nullptr;
+}
+
+
+// Queues the VCS bases fetch of the opened or saved file so its SVN / Git diff doesn't read them
+void prefetchVcsBase(LRESULT buffId)
+{
+	if (!Settings.PrefetchVcsBase)
+		return;
+
+	TCHAR file[MAX_PATH];
+
+	if (::SendMessage(nppData._nppHandle, NPPM_GETFULLPATHFROMBUFFERID, buffId, (LPARAM)file) < 0 ||
+			::PathFileExists(file) == FALSE)
+		return;
+
+	if (!vcsPrefetch)
+		vcsPrefetch = std::make_unique<VcsPrefetch>();
+
+	CompareOptions options;
+
+	setCompareOptions(options, false, false);
+
+	vcsPrefetch->request(file, options);
+}
+
+
+// The prefetched base snapshot is checked first as it doesn't need the base text, the text is read and checked if the
+// snapshot can't tell. The temp buffer opened for the diff takes its line hashes from the snapshot or from the text
+// check
+void showVcsDiff(const TCHAR* file, const TCHAR* tempFile, Temp_t tempType, const char* text, intptr_t textLen,
+		const std::shared_ptr<const DocSnapshot>& baseSnapshot, int baseBomLen)
+{
+	CompareResult result = baseSnapshot ?
+			compareCurrentDocToBase(*baseSnapshot, baseBomLen) : CompareResult::COMPARE_ERROR;
+
+	std::shared_ptr<const DocSnapshot> tempSnapshot = baseSnapshot;
+
+	if (result == CompareResult::COMPARE_ERROR)
+	{
+		std::shared_ptr<DocSnapshot> textSnapshot = std::make_shared<DocSnapshot>();
+
+		result = text ? compareCurrentDocToText(text, textLen, textSnapshot.get()) :
+				compareCurrentDocToFile(tempFile, textSnapshot.get());
+
+		if (result == CompareResult::COMPARE_MISMATCH)
+			tempSnapshot = textSnapshot;
+	}
+
+	// The temp tab is opened only if there are differences to show
+	if (result == CompareResult::COMPARE_MATCH)
+	{
+		showNoChangesMsg(::PathFindFileName(file), tempType);
+		return;
+	}
+
+	if (!createTempFile(tempFile, tempType))
+		return;
+
+	if (text)
+		setContent(text, textLen);
+
+	if (tempSnapshot)
+		tempBaseHashes = std::make_pair(getCurrentBuffId(), tempSnapshot);
+
+	compare(false, false);
+
+	tempBaseHashes.second = nullptr;
 }
 
 
@@ -2598,8 +3622,15 @@ void SvnDiff()
 	if (!GetSvnFile(file, svnFile, _countof(svnFile)))
 		return;
 
-	if (createTempFile(svnFile, SVN_TEMP))
-		compare(false, false);
+	std::shared_ptr<const VcsBase> base = vcsPrefetch ? vcsPrefetch->find(file) : nullptr;
+
+	// The pristine copies are named by their content checksum - the prefetched one is current while it is the same
+	if (base && base->svnFile != svnFile)
+		base = nullptr;
+
+	showVcsDiff(file, svnFile, SVN_TEMP, nullptr, 0,
+			base ? std::shared_ptr<const DocSnapshot>(base, &base->svnSnapshot) : nullptr,
+			base ? base->svnBomLen : 0);
 }
 
 
@@ -2612,18 +3643,26 @@ void GitDiff()
 	if (!checkFileExists(file))
 		return;
 
-	std::vector<char> content = GetGitFileContent(file);
+	std::shared_ptr<const VcsBase> base = vcsPrefetch ? vcsPrefetch->find(file) : nullptr;
 
-	if (content.empty())
-		return;
+	if (base && !(base->gitContent && IsGitFileContentCurrent(file, *base->gitContent)))
+		base = nullptr;
 
-	if (!createTempFile(file, GIT_TEMP))
-		return;
+	GitFileContent content;
 
-	setContent(content.data());
-	content.clear();
+	if (!base)
+	{
+		content = GetGitFileContent(file);
 
-	compare(false, false);
+		if (!content.isValid())
+			return;
+	}
+
+	const GitFileContent& baseContent = base ? *base->gitContent : content;
+
+	showVcsDiff(file, file, GIT_TEMP, baseContent.data(), baseContent.size(),
+			base ? std::shared_ptr<const DocSnapshot>(base, &base->gitSnapshot) : nullptr,
+			base ? base->gitBomLen : 0);
 }
 
 
@@ -2853,14 +3892,119 @@ void OpenSettingsDlg(void)
 	{
 		Settings.save();
 
-		newCompare = nullptr;
+		newCompare = nullptr;
+
+		if (!Settings.PrefetchVcsBase)
+			vcsPrefetch = nullptr;
+
+		if (!compareList.empty())
+		{
+			setStyles(Settings);
+			NavDlg.SetColors(Settings.colors);
+		}
+	}
+}
+
+
+void ShowCompareStats()
+{
+	CompareList_t::iterator cmpPair = getCompare(getCurrentBuffId());
+
+	std::string stats = (cmpPair != compareList.end()) ?
+			cmpPair->summary.stats.toString("\n") : std::string("No compare in the active view.");
+
+	// The stats text is ASCII
+	std::basic_string<TCHAR> msg(stats.begin(), stats.end());
+
+	TCHAR logFile[MAX_PATH];
+
+	if (writeStatsLog(logFile, _countof(logFile)))
+	{
+		msg += TEXT("\n\nStats of the last compares are written to:\n");
+		msg += logFile;
+	}
+
+	::MessageBox(nppData._nppHandle, msg.c_str(), TEXT("Compare Statistics"), MB_OK);
+}
+
+
+// Returns the active compare if its diff can be exported, else shows why not
+CompareList_t::iterator getExportedCompare()
+{
+	CompareList_t::iterator cmpPair = getCompare(getCurrentBuffId());
+
+	if (cmpPair == compareList.end())
+		::MessageBox(nppData._nppHandle, TEXT("No compare in the active view."), PLUGIN_NAME, MB_OK);
+	else if (!isCompareCacheCurrent(cmpPair->compareCache, cmpPair->lineHashes))
+		::MessageBox(nppData._nppHandle, TEXT("The compare results are not current - re-compare the files to export ")
+				TEXT("their diff."), PLUGIN_NAME, MB_OK);
+	else
+		return cmpPair;
+
+	return compareList.end();
+}
+
+
+// The diff is taken from the compare results so the documents are not read line by line
+bool writeCompareDiff(ComparedPair& cmpPair, const DiffWriteFn& writeFn)
+{
+	// Context lines of the exported unified diffs
+	static const int cExportDiffContext = 3;
+
+	const std::string oldName = toUTF8(cmpPair.getOldFile().name);
+	const std::string newName = toUTF8(cmpPair.getNewFile().name);
+
+	return writeViewsUnifiedDiff(cmpPair.compareCache, cmpPair.lineHashes, oldName.c_str(), newName.c_str(),
+			cExportDiffContext, writeFn);
+}
+
+
+void ExportDiff()
+{
+	CompareList_t::iterator cmpPair = getExportedCompare();
+
+	if (cmpPair == compareList.end())
+		return;
+
+	TCHAR diffFile[MAX_PATH] = { 0 };
+
+	OPENFILENAME ofn = { 0 };
+
+	ofn.lStructSize	= sizeof(ofn);
+	ofn.hwndOwner	= nppData._nppHandle;
+	ofn.lpstrFilter	= TEXT("Diff files (*.diff, *.patch)\0*.diff;*.patch\0All files (*.*)\0*.*\0");
+	ofn.lpstrFile	= diffFile;
+	ofn.nMaxFile	= _countof(diffFile);
+	ofn.lpstrTitle	= TEXT("Export the unified diff to:");
+	ofn.lpstrDefExt	= TEXT("diff");
+	ofn.Flags		= OFN_OVERWRITEPROMPT | OFN_PATHMUSTEXIST | OFN_HIDEREADONLY;
+
+	if (!::GetSaveFileName(&ofn))
+		return;
+
+	OutputFile out(diffFile);
+
+	if (!out.isOpen() ||
+		!writeCompareDiff(*cmpPair, [&out](const char* data, intptr_t len) { return out.write(data, len); }) ||
+		!out.close())
+		::MessageBox(nppData._nppHandle, TEXT("Writing the diff file failed."), PLUGIN_NAME, MB_OK | MB_ICONWARNING);
+}
+
+
+void CopyDiff()
+{
+	CompareList_t::iterator cmpPair = getExportedCompare();
+
+	if (cmpPair == compareList.end())
+		return;
+
+	std::string diff;
 
-		if (!compareList.empty())
-		{
-			setStyles(Settings);
-			NavDlg.SetColors(Settings.colors);
-		}
-	}
+	writeCompareDiff(*cmpPair, [&diff](const char* data, intptr_t len) { diff.append(data, len); return true; });
+
+	// Scintilla converts the text from the documents encoding
+	if (!diff.empty())
+		CallScintilla(getCurrentViewId(), SCI_COPYTEXT, diff.size(), (LPARAM)diff.c_str());
 }
 
 
@@ -2985,6 +4129,12 @@ void createMenu()
 	funcItem[CMD_GIT_DIFF]._pShKey->_isShift		= false;
 	funcItem[CMD_GIT_DIFF]._pShKey->_key 			= 'G';
 
+	_tcscpy_s(funcItem[CMD_COMPARE_FOLDERS]._itemName, nbChar, TEXT("Compare Folders..."));
+	funcItem[CMD_COMPARE_FOLDERS]._pFunc 			= CompareFolders;
+
+	_tcscpy_s(funcItem[CMD_COMPARE_TO_BASE]._itemName, nbChar, TEXT("Compare to Base..."));
+	funcItem[CMD_COMPARE_TO_BASE]._pFunc 			= CompareToBase;
+
 	_tcscpy_s(funcItem[CMD_CHAR_HIGHLIGHTING]._itemName, nbChar, TEXT("Detect Diffs on Character Level"));
 	funcItem[CMD_CHAR_HIGHLIGHTING]._pFunc = CharPrecision;
 
@@ -3053,6 +4203,15 @@ void createMenu()
 	_tcscpy_s(funcItem[CMD_SETTINGS]._itemName, nbChar, TEXT("Settings..."));
 	funcItem[CMD_SETTINGS]._pFunc = OpenSettingsDlg;
 
+	_tcscpy_s(funcItem[CMD_COMPARE_STATS]._itemName, nbChar, TEXT("Compare Statistics..."));
+	funcItem[CMD_COMPARE_STATS]._pFunc = ShowCompareStats;
+
+	_tcscpy_s(funcItem[CMD_EXPORT_DIFF]._itemName, nbChar, TEXT("Export Diff..."));
+	funcItem[CMD_EXPORT_DIFF]._pFunc = ExportDiff;
+
+	_tcscpy_s(funcItem[CMD_COPY_DIFF]._itemName, nbChar, TEXT("Copy Diff to Clipboard"));
+	funcItem[CMD_COPY_DIFF]._pFunc = CopyDiff;
+
 #ifdef DLOG
 	_tcscpy_s(funcItem[CMD_ABOUT]._itemName, nbChar, TEXT("Show debug log"));
 #else
@@ -3064,6 +4223,33 @@ void createMenu()
 
 void deinitPlugin()
 {
+	asyncCompare = nullptr;
+	asyncBlocksCompare = nullptr;
+
+	// Stop the VCS bases fetch and the folder compare before the thread pool and the VCS cache are released. The
+	// folders compare panel is always closed, else it would ask for folders to compare on startup
+	vcsPrefetch = nullptr;
+
+	if (FolderDlg.isVisible())
+		FolderDlg.Hide();
+
+	FolderDlg.destroy();
+
+#ifdef MULTITHREAD
+	ThreadPool::release();
+#endif
+
+	// Written once on shutdown - it is empty when called again on the DLL detach
+	if (!statsLog.empty())
+	{
+		TCHAR logFile[MAX_PATH];
+
+		writeStatsLog(logFile, _countof(logFile));
+		statsLog.clear();
+	}
+
+	ClearVcsCache();
+
 	// Always close it, else N++'s plugin manager would call 'ToggleNavigationBar'
 	// on startup, when N++ has been shut down before with opened navigation bar
 	if (NavDlg.isVisible())
@@ -3117,22 +4303,32 @@ void syncViews(int biasView)
 {
 	const int otherView = getOtherViewId(biasView);
 
+	if (!syncCache.valid)
+	{
+		for (int view: {MAIN_VIEW, SUB_VIEW})
+		{
+			syncCache.lastDocLineVisible[view] = CallScintilla(view, SCI_VISIBLEFROMDOCLINE,
+					CallScintilla(view, SCI_GETLINECOUNT, 0, 0) - 1, 0);
+			syncCache.caretLine[view] = -1;
+		}
+
+		syncCache.valid = true;
+	}
+
 	const int firstVisible = getFirstVisibleLine(biasView);
 	const int otherFirstVisible = getFirstVisibleLine(otherView);
 
-	const int firstLine = CallScintilla(biasView, SCI_DOCLINEFROMVISIBLE, firstVisible, 0);
-
 	int otherLine = -1;
 
-	if (firstLine < CallScintilla(biasView, SCI_GETLINECOUNT, 0, 0) - 1)
+	// The first visible line is not on the last document line
+	if (firstVisible < syncCache.lastDocLineVisible[biasView])
 	{
 		if (firstVisible != otherFirstVisible)
 		{
 			LOGD("Syncing to " + std::string(biasView == MAIN_VIEW ? "MAIN" : "SUB") + " view, visible doc line: " +
-					std::to_string(firstLine + 1) + "\n");
+					std::to_string(CallScintilla(biasView, SCI_DOCLINEFROMVISIBLE, firstVisible, 0) + 1) + "\n");
 
-			const int otherLastVisible = CallScintilla(otherView, SCI_VISIBLEFROMDOCLINE,
-					CallScintilla(otherView, SCI_GETLINECOUNT, 0, 0) - 1, 0);
+			const int otherLastVisible = syncCache.lastDocLineVisible[otherView];
 
 			otherLine = (firstVisible > otherLastVisible) ? otherLastVisible : firstVisible;
 		}
@@ -3155,11 +4351,17 @@ void syncViews(int biasView)
 	{
 		const int line = getCurrentLine(biasView);
 
-		otherLine = otherViewMatchingLine(biasView, line);
+		if (line != syncCache.caretLine[biasView])
+		{
+			syncCache.caretLine[biasView]		= line;
+			syncCache.otherCaretLine[biasView]	= otherViewMatchingLine(biasView, line);
+		}
+
+		otherLine = syncCache.otherCaretLine[biasView];
 
 		if ((otherLine != getCurrentLine(otherView)) && !isSelection(otherView))
 		{
-			int pos;
+			Sci_Position pos;
 
 			if (isLineAnnotated(otherView, otherLine) && isLineWrapped(otherView, otherLine))
 				pos = getLineEnd(otherView, otherLine);
@@ -3182,8 +4384,12 @@ void comparedFileActivated()
 {
 	if (!NppSettings::get().compareMode)
 	{
+		// The NavBar of an unchanged pair is restored as it was last shown
 		if (Settings.UseNavBar && !NavDlg.isVisible())
-			showNavBar();
+		{
+			NavDlg.SetColors(Settings.colors);
+			NavDlg.Restore();
+		}
 
 		ScopedIncrementer incr(notificationsLock);
 
@@ -3333,16 +4539,20 @@ void DelayedAlign::operator()()
 	if (alignmentInfo.empty())
 		return;
 
-	bool realign = goToFirst || selectionAutoRecompare;
+	// Wrapping might have changed as well
+	syncCache.invalidate();
+
+	// Only the visible diffs are re-aligned on scroll
+	const bool alignAll = goToFirst || selectionAutoRecompare;
+
+	bool realign = alignAll;
 
 	ScopedIncrementer incr(notificationsLock);
 
-	if (!realign)
-	{
-		const int view = storedLocation ? storedLocation->getView() : getCurrentViewId();
+	const int view = storedLocation ? storedLocation->getView() : getCurrentViewId();
 
+	if (!realign)
 		realign = isAlignmentNeeded(view, alignmentInfo);
-	}
 
 	if (realign)
 	{
@@ -3353,7 +4563,10 @@ void DelayedAlign::operator()()
 
 		selectionAutoRecompare = false;
 
-		alignDiffs(cmpPair);
+		if (alignAll)
+			alignDiffs(cmpPair);
+		else
+			alignVisibleDiffs(cmpPair, view);
 	}
 
 	if (goToFirst)
@@ -3423,10 +4636,101 @@ void onSciUpdateUI(HWND view)
 
 void DelayedUpdate::operator()()
 {
+	delayedUpdateApply.cancel();
+
+	// Stop the previous background compare before taking the new text snapshot
+	asyncCompare = nullptr;
+
+	const LRESULT			currentBuffId	= getCurrentBuffId();
+	CompareList_t::iterator	cmpPair			= getCompare(currentBuffId);
+
+	if (cmpPair == compareList.end())
+		return;
+
+	cmpPair->autoUpdateDelay = 0;
+
+	// Compares to a base are re-run synchronously - the base file is read by the compare itself
+	if (!cmpPair->baseFile.empty())
+	{
+		compare(false, false, true);
+		return;
+	}
+
+	asyncCompare		= std::make_unique<AsyncCompare>(cmpPair->options, cmpPair->lineHashes,
+			&cmpPair->compareCache);
+	asyncCompareBuffId	= currentBuffId;
+
+	delayedUpdateApply();
+}
+
+
+void DelayedUpdateApply::operator()()
+{
+	if (!asyncCompare)
+		return;
+
+	if (!asyncCompare->isDone())
+	{
+		post(cPollPeriod_ms);
+		return;
+	}
+
+	CompareList_t::iterator cmpPair = getCompare(asyncCompareBuffId);
+
+	// Compared pair closed meanwhile
+	if (cmpPair == compareList.end())
+	{
+		asyncCompare = nullptr;
+		return;
+	}
+
+	// Results are outdated - schedule new update
+	if (asyncCompare->isStale(cmpPair->lineHashes) || (getCompare(getCurrentBuffId()) != cmpPair))
+	{
+		asyncCompare = nullptr;
+
+		if (!cmpPair->autoUpdateDelay)
+			cmpPair->autoUpdateDelay = 500;
+
+		return;
+	}
+
 	compare(false, false, true);
 }
 
 
+void DelayedBlocksCompare::operator()()
+{
+	CompareList_t::iterator cmpPair = getCompare(asyncBlocksCompareBuffId);
+
+	// Compared pair closed or not shown meanwhile - its blocks are compared once it is re-compared
+	if (cmpPair == compareList.end() || getCompare(getCurrentBuffId()) != cmpPair)
+	{
+		asyncBlocksCompare = nullptr;
+		return;
+	}
+
+	if (!asyncBlocksCompare)
+	{
+		asyncBlocksCompare = std::make_unique<AsyncBlocksCompare>(cmpPair->compareCache, cmpPair->lineHashes);
+	}
+	else if (asyncBlocksCompare->isDone())
+	{
+		const bool applied = asyncBlocksCompare->apply(cmpPair->compareCache, cmpPair->lineHashes);
+
+		asyncBlocksCompare = nullptr;
+
+		// The cache is refined - re-marking it posts the next run if some blocks are left
+		if (applied)
+			compare(false, false, true);
+
+		return;
+	}
+
+	post(cPollPeriod_ms);
+}
+
+
 void onMarginClick(HWND view, int pos, int keyMods)
 {
 	if (keyMods & SCMOD_ALT)
@@ -3460,10 +4764,14 @@ void onMarginClick(HWND view, int pos, int keyMods)
 
 	const int otherViewId = getOtherViewId(viewId);
 
+	// Copying sections moves and clears markers also where the lines count doesn't change
+	cmpPair->summary.diffRanges[MAIN_VIEW].invalidate();
+	cmpPair->summary.diffRanges[SUB_VIEW].invalidate();
+
 	if ((keyMods & SCMOD_SHIFT) && (mark == (1 << MARKER_CHANGED_LINE)))
 	{
-		const int startPos	= getLineStart(viewId, line);
-		const int endPos	= getLineStart(viewId, line + 1);
+		const Sci_Position startPos	= getLineStart(viewId, line);
+		const Sci_Position endPos	= getLineStart(viewId, line + 1);
 		const int otherLine = otherViewMatchingLine(viewId, line, 0, true);
 
 		if ((otherLine < 0) ||
@@ -3528,7 +4836,7 @@ void onMarginClick(HWND view, int pos, int keyMods)
 		return;
 	}
 
-	std::pair<int, int> markedRange = getMarkedSection(viewId, line, line, mark);
+	std::pair<Sci_Position, Sci_Position> markedRange = getMarkedSection(viewId, line, line, mark);
 
 	if ((markedRange.first < 0) && !(keyMods & SCMOD_SHIFT))
 		markedRange = getMarkedSection(viewId, line + 1, line + 1, mark);
@@ -3548,12 +4856,12 @@ void onMarginClick(HWND view, int pos, int keyMods)
 		return;
 	}
 
-	std::pair<int, int> otherMarkedRange;
+	std::pair<int, int> otherMarkedLines;
 
 	if (markedRange.first < 0)
 	{
-		otherMarkedRange.first	= otherViewMatchingLine(viewId, line, getWrapCount(viewId, line));
-		otherMarkedRange.second	= otherViewMatchingLine(viewId, line + 1, -1);
+		otherMarkedLines.first	= otherViewMatchingLine(viewId, line, getWrapCount(viewId, line));
+		otherMarkedLines.second	= otherViewMatchingLine(viewId, line + 1, -1);
 	}
 	else
 	{
@@ -3576,46 +4884,40 @@ void onMarginClick(HWND view, int pos, int keyMods)
 		if (!Settings.ShowOnlyDiffs)
 			endOffset += getLineAnnotation(viewId, endLine);
 
-		otherMarkedRange.first = otherViewMatchingLine(viewId, startLine, startOffset, true);
+		otherMarkedLines.first = otherViewMatchingLine(viewId, startLine, startOffset, true);
 
-		if (otherMarkedRange.first < 0)
-			otherMarkedRange.first = otherViewMatchingLine(viewId, startLine, startOffset) + 1;
+		if (otherMarkedLines.first < 0)
+			otherMarkedLines.first = otherViewMatchingLine(viewId, startLine, startOffset) + 1;
 
-		otherMarkedRange.second	= otherViewMatchingLine(viewId, endLine, endOffset);
+		otherMarkedLines.second	= otherViewMatchingLine(viewId, endLine, endOffset);
 	}
 
 	if (!Settings.ShowOnlyDiffs)
 	{
-		for (; (otherMarkedRange.first <= otherMarkedRange.second) &&
-				!isLineMarked(otherViewId, otherMarkedRange.first, mark); ++otherMarkedRange.first);
+		for (; (otherMarkedLines.first <= otherMarkedLines.second) &&
+				!isLineMarked(otherViewId, otherMarkedLines.first, mark); ++otherMarkedLines.first);
 	}
 	else
 	{
-		int otherLine = otherMarkedRange.second;
+		int otherLine = otherMarkedLines.second;
 
-		for (; (otherLine > otherMarkedRange.first) && isLineMarked(otherViewId, otherLine, mark); --otherLine);
+		for (; (otherLine > otherMarkedLines.first) && isLineMarked(otherViewId, otherLine, mark); --otherLine);
 
-		if (otherLine > otherMarkedRange.first)
-			otherMarkedRange.first = otherLine + 1;
+		if (otherLine > otherMarkedLines.first)
+			otherMarkedLines.first = otherLine + 1;
 	}
 
-	if (otherMarkedRange.first > otherMarkedRange.second)
-	{
-		otherMarkedRange.first = -1;
-	}
-	else
+	std::pair<Sci_Position, Sci_Position> otherMarkedRange(-1, -1);
+
+	if (otherMarkedLines.first <= otherMarkedLines.second)
 	{
-		for (; (otherMarkedRange.second >= otherMarkedRange.first) &&
-				!isLineMarked(otherViewId, otherMarkedRange.second, mark); --otherMarkedRange.second);
+		for (; (otherMarkedLines.second >= otherMarkedLines.first) &&
+				!isLineMarked(otherViewId, otherMarkedLines.second, mark); --otherMarkedLines.second);
 
-		if (otherMarkedRange.second < otherMarkedRange.first)
-		{
-			otherMarkedRange.first = -1;
-		}
-		else
+		if (otherMarkedLines.second >= otherMarkedLines.first)
 		{
-			otherMarkedRange.first	= getLineStart(otherViewId, otherMarkedRange.first);
-			otherMarkedRange.second	= getLineStart(otherViewId, otherMarkedRange.second + 1);
+			otherMarkedRange.first	= getLineStart(otherViewId, otherMarkedLines.first);
+			otherMarkedRange.second	= getLineStart(otherViewId, otherMarkedLines.second + 1);
 		}
 	}
 
@@ -3683,28 +4985,30 @@ void onMarginClick(HWND view, int pos, int keyMods)
 
 		bool copyOtherTillEnd = false;
 
-		int startPos = markedRange.first;
+		Sci_Position startPos = markedRange.first;
 
 		if (startPos < 0)
 		{
 			if (line < lastLine)
 			{
+				int startLine;
+
 				if (!Settings.ShowOnlyDiffs)
 				{
-					startPos = line + 1;
+					startLine = line + 1;
 				}
 				else
 				{
 					if (otherStartLine < 0)
 						return;
 
-					startPos = getAlignmentLine(cmpPair->summary.alignmentInfo, otherViewId, otherStartLine);
+					startLine = getAlignmentLine(cmpPair->summary.alignmentInfo, otherViewId, otherStartLine);
 
-					if (startPos < 0)
+					if (startLine < 0)
 						return;
 				}
 
-				startPos = getLineStart(viewId, startPos);
+				startPos = getLineStart(viewId, startLine);
 			}
 			else
 			{
@@ -3746,16 +5050,48 @@ void onMarginClick(HWND view, int pos, int keyMods)
 }
 
 
+// Keeps the compared documents line hashes cache in sync with the text changes. Called even when the other
+// notifications processing is locked because the text might still be changed
+void onSciTextChanged(SCNotification* notifyCode)
+{
+	const int view = getViewId((HWND)notifyCode->nmhdr.hwndFrom);
+
+	CompareList_t::iterator cmpPair = getCompareBySciDoc(getDocId(view));
+	if (cmpPair == compareList.end())
+		return;
+
+	cmpPair->lineHashes[view].onTextChanged(CallScintilla(view, SCI_LINEFROMPOSITION, notifyCode->position, 0),
+			notifyCode->linesAdded);
+
+	// Running background compare results are stale now
+	if (asyncCompare && getCompare(asyncCompareBuffId) == cmpPair)
+		asyncCompare->cancel();
+
+	if (asyncBlocksCompare && getCompare(asyncBlocksCompareBuffId) == cmpPair)
+		asyncBlocksCompare->cancel();
+}
+
+
 void onSciModified(SCNotification* notifyCode)
 {
 	static bool notReverting = true;
 
+	// Undo data of the lines delete in progress - the alignment change is recorded in it
+	static std::shared_ptr<DeletedSection::UndoData> deleteUndo;
+
 	const int view = getViewId((HWND)notifyCode->nmhdr.hwndFrom);
 
 	CompareList_t::iterator cmpPair = getCompareBySciDoc(getDocId(view));
 	if (cmpPair == compareList.end())
 		return;
 
+	// Lines changes move the diff markers and undo/redo might restore the other view markers too
+	if ((notifyCode->modificationType & (SC_MOD_INSERTTEXT | SC_MOD_DELETETEXT)) && notifyCode->linesAdded)
+	{
+		cmpPair->summary.diffRanges[MAIN_VIEW].invalidate();
+		cmpPair->summary.diffRanges[SUB_VIEW].invalidate();
+	}
+
 	std::shared_ptr<DeletedSection::UndoData> undo = nullptr;
 
 	if (notifyCode->modificationType & SC_MOD_BEFOREDELETE)
@@ -3786,14 +5122,14 @@ void onSciModified(SCNotification* notifyCode)
 			if (!undo)
 				undo = std::make_shared<DeletedSection::UndoData>();
 
-			undo->alignment = cmpPair->summary.alignmentInfo;
-
 			if (cmpPair->inEqualizeMode && !copiedSectionMarks.empty())
 				undo->otherViewMarks = std::move(copiedSectionMarks);
 		}
 
 		notReverting = cmpPair->getFileByViewId(view).pushDeletedSection(action, startLine, endLine - startLine, undo);
 
+		deleteUndo = Settings.RecompareOnChange ? nullptr : undo;
+
 #ifdef DLOG
 		if (notReverting)
 		{
@@ -3804,10 +5140,6 @@ void onSciModified(SCNotification* notifyCode)
 					LOGD("Selection stored.\n");
 				}
 
-				if (!undo->alignment.empty())
-				{
-					LOGD("Alignment stored.\n");
-				}
 
 				if (!undo->otherViewMarks.empty())
 				{
@@ -3852,9 +5184,12 @@ void onSciModified(SCNotification* notifyCode)
 
 			if (!Settings.RecompareOnChange)
 			{
-				cmpPair->summary.alignmentInfo = std::move(undo->alignment);
+				if (undo->alignment.isSet())
+				{
+					cmpPair->revertAlignment(undo->alignment);
 
-				LOGD("Alignment restored.\n");
+					LOGD("Alignment restored.\n");
+				}
 
 				if (!undo->otherViewMarks.empty())
 				{
@@ -3999,7 +5334,11 @@ void onSciModified(SCNotification* notifyCode)
 			{
 				if (!cmpPair->options.selectionCompare || selectionsAdjusted)
 				{
-					cmpPair->adjustAlignment(view, startLine, notifyCode->linesAdded);
+					AlignmentDelta* delta = (deleteUndo && (notifyCode->modificationType & SC_MOD_DELETETEXT)) ?
+							&deleteUndo->alignment : nullptr;
+
+					cmpPair->adjustAlignment(view, startLine, notifyCode->linesAdded, delta);
+					deleteUndo = nullptr;
 
 					LOGD("Alignment adjusted.\n");
 				}
@@ -4014,7 +5353,17 @@ void onSciModified(SCNotification* notifyCode)
 			}
 
 			if (Settings.UseNavBar && !cmpPair->inEqualizeMode)
-				NavDlg.Show();
+			{
+				if (NavDlg.isVisible())
+				{
+					NavDlg.LinesChanged(view, startLine, notifyCode->linesAdded);
+					NavDlg.Update();
+				}
+				else
+				{
+					NavDlg.Show();
+				}
+			}
 		}
 
 		if (updateStatus)
@@ -4050,14 +5399,12 @@ void DelayedActivate::operator()()
 	if (buffId != currentlyActiveBuffID)
 	{
 		const int viewId				= viewIdFromBuffId(buffId);
-		const std::pair<int, int> sel	= getSelection(viewId); // Used to refresh selection
+		const auto sel					= getSelection(viewId); // Used to refresh selection
 
 		ScopedIncrementer incr(notificationsLock);
 
 		setSelection(viewId, sel.first, sel.first);
 
-		onSciUpdateUI(getView(viewId));
-
 		const ComparedFile& otherFile = cmpPair->getOtherFileByBuffId(buffId);
 
 		// When compared file is activated make sure its corresponding pair file is also active in the other view
@@ -4075,6 +5422,9 @@ void DelayedActivate::operator()()
 				::SetFocus(hCaptureWnd);
 		}
 
+		// Synced once both pair files are shown so the NavBar is not built for a half switched pair
+		onSciUpdateUI(getView(viewId));
+
 		currentlyActiveBuffID = buffId;
 
 		comparedFileActivated();
@@ -4215,6 +5565,28 @@ void onFileBeforeClose(LRESULT buffId)
 }
 
 
+// Refreshes the saved snapshots of the buffers the last save diff has been run on. The saved buffer is normally the
+// current one - the snapshots of other buffers are dropped. The compared buffers are not checked against their
+// snapshots (see compareToSavedSnapshot()) so their snapshots are dropped too
+void updateSavedSnapshot(LRESULT buffId)
+{
+	if (savedSnapshots.find(buffId) == savedSnapshots.end())
+		return;
+
+	if (buffId != getCurrentBuffId() || getCompare(buffId) != compareList.end())
+	{
+		savedSnapshots.erase(buffId);
+		return;
+	}
+
+	TCHAR file[MAX_PATH];
+
+	::SendMessage(nppData._nppHandle, NPPM_GETFULLCURRENTPATH, _countof(file), (LPARAM)file);
+
+	takeSavedSnapshot(file);
+}
+
+
 void onFileSaved(LRESULT buffId)
 {
 	CompareList_t::iterator cmpPair = getCompare(buffId);
@@ -4315,6 +5687,166 @@ LRESULT statusProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
 	return nppNotificationProc(hwnd, msg, wParam, lParam);
 }
 
+
+// Size of the first version requests - they end before diffFile
+const int cBatchRequestV1Size = static_cast<int>(offsetof(ComparePlusRequest, diffFile));
+
+
+// The requests are laid out by the caller's struct size - the older versions ones are smaller
+inline ComparePlusRequest& getBatchRequest(ComparePlusBatch* batch, int i)
+{
+	return *reinterpret_cast<ComparePlusRequest*>(reinterpret_cast<char*>(batch->requests) +
+			static_cast<intptr_t>(i) * batch->requests[0].structSize);
+}
+
+
+// Headless batch compares requested by other plugins - see ComparePlusMsgs.h
+BOOL onBatchCompareMsg(long internalMsg, ComparePlusBatch* batch)
+{
+	if (!batch || batch->count < 0 || (batch->count && !batch->requests))
+		return FALSE;
+
+	const int structSize = batch->count ? batch->requests[0].structSize : 0;
+
+	if (batch->count && structSize != static_cast<int>(sizeof(ComparePlusRequest)) &&
+			structSize != cBatchRequestV1Size)
+		return FALSE;
+
+	if (internalMsg == CPM_FREE_RESULTS)
+	{
+		for (int i = 0; i < batch->count; ++i)
+		{
+			ComparePlusRequest& req = getBatchRequest(batch, i);
+
+			delete[] req.diff;
+
+			req.diff	= nullptr;
+			req.diffLen	= 0;
+		}
+
+		return TRUE;
+	}
+
+	if (internalMsg != CPM_COMPARE)
+		return FALSE;
+
+	std::vector<BatchCompareItem> items(batch->count);
+
+	for (int i = 0; i < batch->count; ++i)
+	{
+		ComparePlusRequest& req = getBatchRequest(batch, i);
+		BatchCompareItem& item = items[i];
+
+		if (req.structSize != structSize)
+			return FALSE;
+
+		req.result	= CPR_ERROR;
+		req.added	= 0;
+		req.removed	= 0;
+		req.changed	= 0;
+		req.moved	= 0;
+		req.diff	= nullptr;
+		req.diffLen	= 0;
+
+		if ((!req.text1 && !req.file1) || (!req.text2 && !req.file2))
+			return FALSE;
+
+		item.text1			= req.text1;
+		item.textLen1		= req.text1 ? req.textLen1 : 0;
+		item.text2			= req.text2;
+		item.textLen2		= req.text2 ? req.textLen2 : 0;
+		item.diffContext	= req.diffContext;
+
+		if (structSize > cBatchRequestV1Size && req.diffFile)
+			item.diffFile = req.diffFile;
+
+		if (req.file1)
+		{
+			item.file1 = req.file1;
+			item.name1 = toUTF8(req.file1);
+		}
+
+		if (req.file2)
+		{
+			item.file2 = req.file2;
+			item.name2 = toUTF8(req.file2);
+		}
+	}
+
+	// The requests of each options flags are compared as a batch of their own
+	std::map<int, std::vector<int>> flagsRequests;
+
+	for (int i = 0; i < batch->count; ++i)
+		flagsRequests[getBatchRequest(batch, i).options].emplace_back(i);
+
+	for (const auto& requests: flagsRequests)
+	{
+		const int flags = requests.first;
+
+		CompareOptions options;
+
+		setCompareOptions(options, false, false);
+
+		if (!(flags & CPO_USE_SETTINGS))
+		{
+			options.ignoreSpaces		= ((flags & CPO_IGNORE_SPACES) != 0);
+			options.ignoreCase			= ((flags & CPO_IGNORE_CASE) != 0);
+			options.ignoreEmptyLines	= ((flags & CPO_IGNORE_EMPTY_LINES) != 0);
+			options.detectMoves			= ((flags & CPO_DETECT_MOVES) != 0);
+			options.ignoreLineNumbers	= ((flags & CPO_IGNORE_LINE_NUMBERS) != 0);
+			options.ignoreRules			= nullptr;
+		}
+
+		if (requests.second.size() == items.size())
+		{
+			compareBatch(options, items);
+			break;
+		}
+
+		std::vector<BatchCompareItem> flagsItems;
+		flagsItems.reserve(requests.second.size());
+
+		for (int i: requests.second)
+			flagsItems.emplace_back(std::move(items[i]));
+
+		compareBatch(options, flagsItems);
+
+		for (size_t i = 0; i < flagsItems.size(); ++i)
+			items[requests.second[i]] = std::move(flagsItems[i]);
+	}
+
+	for (int i = 0; i < batch->count; ++i)
+	{
+		ComparePlusRequest& req = getBatchRequest(batch, i);
+		const BatchCompareItem& item = items[i];
+
+		if (item.result == CompareResult::COMPARE_MATCH)
+		{
+			req.result = CPR_MATCH;
+		}
+		else if (item.result == CompareResult::COMPARE_MISMATCH)
+		{
+			req.result	= CPR_MISMATCH;
+			req.added	= item.summary.added;
+			req.removed	= item.summary.removed;
+			req.changed	= item.summary.changed;
+			req.moved	= item.summary.moved;
+
+			if (!item.diff.empty())
+			{
+				char* diff = new char[item.diff.size() + 1];
+
+				std::memcpy(diff, item.diff.c_str(), item.diff.size() + 1);
+
+				req.diff	= diff;
+				req.diffLen	= static_cast<intptr_t>(item.diff.size());
+			}
+		}
+	}
+
+	return TRUE;
+}
+
 } // anonymous namespace
 
 
@@ -4386,7 +5918,18 @@ extern "C" __declspec(dllexport) void setInfo(NppData notpadPlusData)
 
 	Settings.load();
 
+#ifdef DLOG
+	setEngineLog([](const std::string& msg, bool resetTime)
+		{
+			if (resetTime)
+				dLogTime_ms = ::GetTickCount();
+			else
+				LOGD(msg);
+		});
+#endif
+
 	NavDlg.init(hInstance);
+	FolderDlg.init(hInstance);
 }
 
 
@@ -4436,6 +5979,8 @@ extern "C" __declspec(dllexport) void beNotified(SCNotification* notifyCode)
 		break;
 
 		case NPPN_BUFFERACTIVATED:
+			syncCache.invalidate();
+
 			if (!compareList.empty() && !notificationsLock && !delayedClosure)
 				onBufferActivated(notifyCode->nmhdr.idFrom);
 		break;
@@ -4460,9 +6005,24 @@ extern "C" __declspec(dllexport) void beNotified(SCNotification* notifyCode)
 
 				LOGDB(notifyCode->nmhdr.idFrom, "NPPN_FILEOPENED\n");
 			}
+			else if (!notificationsLock)
+			{
+				prefetchVcsBase(notifyCode->nmhdr.idFrom);
+			}
 		break;
 
 		case NPPN_FILEBEFORECLOSE:
+			savedSnapshots.erase(static_cast<LRESULT>(notifyCode->nmhdr.idFrom));
+
+			if (vcsPrefetch)
+			{
+				TCHAR file[MAX_PATH];
+
+				if (::SendMessage(nppData._nppHandle, NPPM_GETFULLPATHFROMBUFFERID, notifyCode->nmhdr.idFrom,
+						(LPARAM)file) >= 0)
+					vcsPrefetch->forget(file);
+			}
+
 			if (newCompare && (newCompare->pair.file[0].buffId == static_cast<LRESULT>(notifyCode->nmhdr.idFrom)))
 				newCompare = nullptr;
 #ifdef DLOG
@@ -4474,14 +6034,28 @@ extern "C" __declspec(dllexport) void beNotified(SCNotification* notifyCode)
 		break;
 
 		case NPPN_FILESAVED:
+			if (!notificationsLock)
+			{
+				updateSavedSnapshot(notifyCode->nmhdr.idFrom);
+				prefetchVcsBase(notifyCode->nmhdr.idFrom);
+			}
+
 			if (!compareList.empty() && !notificationsLock)
 				onFileSaved(notifyCode->nmhdr.idFrom);
 		break;
 
 		// This is used to monitor deletion of lines to properly clear their compare markings
 		case SCN_MODIFIED:
-			if (NppSettings::get().compareMode && !notificationsLock)
-				onSciModified(notifyCode);
+			if (NppSettings::get().compareMode)
+			{
+				syncCache.invalidate();
+
+				if (notifyCode->modificationType & (SC_MOD_INSERTTEXT | SC_MOD_DELETETEXT))
+					onSciTextChanged(notifyCode);
+
+				if (!notificationsLock)
+					onSciModified(notifyCode);
+			}
 		break;
 
 		case SCN_ZOOM:
@@ -4533,8 +6107,18 @@ extern "C" __declspec(dllexport) void beNotified(SCNotification* notifyCode)
 }
 
 
-extern "C" __declspec(dllexport) LRESULT messageProc(UINT msg, WPARAM wParam, LPARAM)
+extern "C" __declspec(dllexport) LRESULT messageProc(UINT msg, WPARAM wParam, LPARAM lParam)
 {
+	if (msg == NPPM_MSGTOPLUGIN)
+	{
+		const CommunicationInfo* info = reinterpret_cast<const CommunicationInfo*>(lParam);
+
+		if (!info)
+			return FALSE;
+
+		return onBatchCompareMsg(info->internalMsg, static_cast<ComparePlusBatch*>(info->info));
+	}
+
 	if (msg == WM_SIZE)
 	{
 		if (wParam == SIZE_MINIMIZED)
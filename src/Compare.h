@@ -19,6 +19,7 @@
 #pragma once
 
 #include <cassert>
+#include <atomic>
 
 #include <windows.h>
 #include <tchar.h>
@@ -127,6 +128,8 @@ enum MENU_COMMANDS
 	CMD_LAST_SAVE_DIFF,
 	CMD_SVN_DIFF,
 	CMD_GIT_DIFF,
+	CMD_COMPARE_FOLDERS,
+	CMD_COMPARE_TO_BASE,
 	CMD_SEPARATOR_2,
 	CMD_CHAR_HIGHLIGHTING,
 	CMD_DIFFS_BASED_LINE_CHANGES,
@@ -149,6 +152,9 @@ enum MENU_COMMANDS
 	CMD_LAST,
 	CMD_SEPARATOR_7,
 	CMD_SETTINGS,
+	CMD_COMPARE_STATS,
+	CMD_EXPORT_DIFF,
+	CMD_COPY_DIFF,
 	CMD_SEPARATOR_8,
 	CMD_ABOUT,
 	NB_MENU_COMMANDS
@@ -163,13 +169,25 @@ extern sptr_t		sciPtr[2];
 
 extern UserSettings	Settings;
 
+// Scintilla calls count used by the compare stats - atomic so it is never torn when read from another thread
+extern std::atomic<unsigned>	sciCallsCount;
+
 
 inline LRESULT CallScintilla(int viewNum, unsigned int uMsg, uptr_t wParam, sptr_t lParam)
 {
 	assert(viewNum >= 0 && viewNum < 2);
 
+	++sciCallsCount;
+
 	return sciFunc(sciPtr[viewNum], uMsg, wParam, lParam);
 }
 
 
 void ToggleNavigationBar();
+
+
+struct CompareCache;
+
+// Opens and compares two files. The optional cmpCache holds their folder compare results - they are only marked if the
+// opened files still hold the compared text
+void CompareFiles(const TCHAR* oldFile, const TCHAR* newFile, CompareCache* cmpCache = nullptr);
@@ -0,0 +1,106 @@
+/*
+ * This file is part of ComparePlus plugin for Notepad++
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <wchar.h>
+
+
+/*
+ *  Usage:
+ *      ComparePlusRequest reqs[2] = {};
+ *      ...
+ *      ComparePlusBatch batch = { reqs, 2 };
+ *      CommunicationInfo ci = { CPM_COMPARE, L"MyPlugin.dll", &batch };
+ *
+ *      ::SendMessage(nppHandle, NPPM_MSGTOPLUGIN, (WPARAM)L"ComparePlus.dll", (LPARAM)&ci);
+ *      ... read the results ...
+ *      ci.internalMsg = CPM_FREE_RESULTS;
+ *      ::SendMessage(nppHandle, NPPM_MSGTOPLUGIN, (WPARAM)L"ComparePlus.dll", (LPARAM)&ci);
+ *
+ *  The batch requests are compared in parallel and the message returns once all are done. No document or view is
+ *  touched. The texts are UTF-8 - Notepad++ buffers can be passed by their Scintilla character pointers
+ */
+
+// info is ComparePlusBatch*
+#define CPM_COMPARE			1
+// Frees the results of a CPM_COMPARE batch, info is the same ComparePlusBatch*
+#define CPM_FREE_RESULTS	2
+
+
+// Request options flags
+#define CPO_USE_SETTINGS		0x01	// The plugin settings are used and the rest of the flags are ignored
+#define CPO_IGNORE_SPACES		0x02
+#define CPO_IGNORE_CASE			0x04
+#define CPO_IGNORE_EMPTY_LINES	0x08
+#define CPO_DETECT_MOVES		0x10
+#define CPO_IGNORE_LINE_NUMBERS	0x20
+
+
+// Request results
+#define CPR_ERROR		0	// Not compared - not readable, binary or UTF-16/32 file or a compare failure
+#define CPR_MATCH		1
+#define CPR_MISMATCH	2
+
+
+struct ComparePlusRequest
+{
+	// Must be sizeof(ComparePlusRequest) - the same in all batch requests. The requests of older versions of this
+	// header are smaller and are still accepted, the fields added after them are not accessed then
+	int				structSize;
+
+	// The old and new texts (UTF-8) - when a text is NULL the file is read instead
+	const char*		text1;
+	intptr_t		textLen1;
+	const char*		text2;
+	intptr_t		textLen2;
+
+	const wchar_t*	file1;
+	const wchar_t*	file2;
+
+	// CPO_* flags
+	int				options;
+
+	// Context lines of the unified diff, negative for no diff
+	int				diffContext;
+
+	// Results - set by CPM_COMPARE
+	int				result;
+
+	int				added;
+	int				removed;
+	int				changed;
+	int				moved;
+
+	// The unified diff of a CPR_MISMATCH request if asked - owned by ComparePlus until CPM_FREE_RESULTS
+	const char*		diff;
+	intptr_t		diffLen;
+
+	// Fields added after the first version are appended here
+
+	// When set the unified diff is written to that file instead of diff - it is left empty if the texts match. The
+	// diff is streamed to the file so that is the way to take the diffs of big texts
+	const wchar_t*	diffFile;
+};
+
+
+struct ComparePlusBatch
+{
+	struct ComparePlusRequest*	requests;
+	int							count;
+};
@@ -0,0 +1,125 @@
+/*
+ * This file is part of ComparePlus plugin for Notepad++
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <memory>
+
+#include "BatchCompare.h"
+#include "ThreadPool.h"
+#include "Tools.h"
+
+
+namespace {
+
+void compareItem(const CompareOptions& options, BatchCompareItem& item)
+{
+	try
+	{
+		std::unique_ptr<MappedFile> file1;
+		std::unique_ptr<MappedFile> file2;
+
+		const char* text1	= item.text1;
+		intptr_t textLen1	= item.textLen1;
+		const char* text2	= item.text2;
+		intptr_t textLen2	= item.textLen2;
+
+		if (!text1)
+		{
+			file1.reset(new MappedFile(item.file1.c_str()));
+
+			if (!file1->isOpen() || !(text1 = getLoadedText(*file1)))
+				return;
+
+			textLen1 = file1->size() - (text1 - file1->data());
+		}
+
+		if (!text2)
+		{
+			file2.reset(new MappedFile(item.file2.c_str()));
+
+			if (!file2->isOpen() || !(text2 = getLoadedText(*file2)))
+				return;
+
+			textLen2 = file2->size() - (text2 - file2->data());
+		}
+
+		CompareCache cmpCache;
+
+		item.summary.clear();
+		item.result = compareTexts(options, text1, textLen1, text2, textLen2, item.summary, cmpCache);
+
+		if (item.diffContext < 0 ||
+				(item.result != CompareResult::COMPARE_MISMATCH && item.result != CompareResult::COMPARE_MATCH))
+			return;
+
+		if (item.diffFile.empty())
+		{
+			if (item.result == CompareResult::COMPARE_MISMATCH && !getUnifiedDiff(cmpCache, text1, text2,
+					item.name1.c_str(), item.name2.c_str(), item.diffContext, item.diff))
+				item.result = CompareResult::COMPARE_ERROR;
+
+			return;
+		}
+
+		OutputFile diffFile(item.diffFile.c_str());
+
+		if (!diffFile.isOpen() ||
+			!writeUnifiedDiff(cmpCache, text1, text2, item.name1.c_str(), item.name2.c_str(), item.diffContext,
+					[&diffFile](const char* data, intptr_t len) { return diffFile.write(data, len); }) ||
+			!diffFile.close())
+			item.result = CompareResult::COMPARE_ERROR;
+	}
+	catch (...)
+	{
+		item.diff.clear();
+		item.result = CompareResult::COMPARE_ERROR;
+	}
+}
+
+}
+
+
+void compareBatch(const CompareOptions& options, std::vector<BatchCompareItem>& items)
+{
+	CompareOptions batchOptions = options;
+
+	// Texts are compared as a whole without any UI
+	batchOptions.selectionCompare	= false;
+	batchOptions.findUniqueMode		= false;
+	batchOptions.deferBlocksCompare	= false;
+	batchOptions.cancelToken		= nullptr;
+	batchOptions.progress			= nullptr;
+
+	for (auto& item: items)
+	{
+		item.result = CompareResult::COMPARE_ERROR;
+		item.diff.clear();
+	}
+
+	TaskGroup tasks;
+
+	for (auto& item: items)
+	{
+#ifdef DLOG
+		// Debug log is not thread safe - texts are compared one by one
+		compareItem(batchOptions, item);
+#else
+		tasks.run([&batchOptions, &item]() { compareItem(batchOptions, item); });
+#endif
+	}
+
+	tasks.wait();
+}
@@ -0,0 +1,64 @@
+/*
+ * This file is part of ComparePlus plugin for Notepad++
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <windows.h>
+#include <tchar.h>
+
+#include "Engine.h"
+
+
+/**
+ *  \struct
+ *  \brief  A compare of a batch. The texts are given by their buffers or, when text1 / text2 is null, read from
+ *          file1 / file2 mapped in memory. The buffers must be kept until the batch is done
+ */
+struct BatchCompareItem
+{
+	const char*					text1 {nullptr};
+	intptr_t					textLen1 {0};
+	const char*					text2 {nullptr};
+	intptr_t					textLen2 {0};
+
+	std::basic_string<TCHAR>	file1;
+	std::basic_string<TCHAR>	file2;
+
+	// Context lines of the unified diff written in diff - no diff is made if negative
+	int							diffContext {-1};
+
+	// The unified diff is streamed to that file instead of diff if set. The file is left empty if the texts match and
+	// it is not left on failure
+	std::basic_string<TCHAR>	diffFile;
+
+	// The texts names in the diff header (UTF-8)
+	std::string					name1 {"a"};
+	std::string					name2 {"b"};
+
+	CompareResult				result {CompareResult::COMPARE_ERROR};
+	CompareSummary				summary;
+
+	std::string					diff;
+};
+
+
+// Runs the batch compares in parallel on the thread pool and returns once all are done. Each item gets its own
+// result - the failed ones are COMPARE_ERROR. No Scintilla view is used
+void compareBatch(const CompareOptions& options, std::vector<BatchCompareItem>& items);
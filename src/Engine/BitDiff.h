@@ -0,0 +1,349 @@
+/*
+ * This file is part of ComparePlus plugin for Notepad++
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+
+#include "diff.h"
+
+
+/**
+ *  \class  BitDiff
+ *  \brief  Diffs sequences of byte sized elements (diffHash(const Elem&) must return values below 256) when the shorter
+ *          one is up to cMaxLen elements long and the longer one up to cMaxLongLen. Each element of the longer
+ *          sequence is processed by a few word operations over the bit vector of the shorter one and the edit script
+ *          is recovered from the kept bit vectors. The diffs are minimal as the ones of DiffCalc without cost limit but
+ *          equal cost alternatives might be aligned differently. The object keeps the bit vectors memory for reuse
+ */
+template <typename Elem>
+class BitDiff
+{
+public:
+	static const int cMaxLen = 256;
+
+	// The diff keeps a bit vector per longer sequence element - up to 2 MB
+	static const int cMaxLongLen = 64 * 1024;
+
+	static inline bool fits(int size1, int size2)
+	{
+		return (fitsLcs(size1, size2) && std::max(size1, size2) <= cMaxLongLen);
+	}
+
+	// The LCS length keeps no bit vectors so only the shorter sequence is bounded
+	static inline bool fitsLcs(int size1, int size2)
+	{
+		const int minSize = std::min(size1, size2);
+
+		return (minSize > 0 && minSize <= cMaxLen);
+	}
+
+	// Same results as DiffCalc - returns the swap flag telling that DIFF_IN_1 diffs are regarding v2.
+	// The sequences must fit
+	bool operator()(const std::vector<Elem>& v1, const std::vector<Elem>& v2, std::vector<diff_info<void>>& diffs);
+
+	// The elements count of the longest common subsequence - the same as the matches length of the diffs.
+	// The sequences must fit the LCS
+	int lcsLength(const std::vector<Elem>& v1, const std::vector<Elem>& v2);
+
+private:
+	static const int cWordBits = 64;
+
+	static inline unsigned _symbol(const Elem& e)
+	{
+		return static_cast<unsigned>(diffHash(e)) & 0xFF;
+	}
+
+	static inline int _popcount(uint64_t x)
+	{
+		x = x - ((x >> 1) & 0x5555555555555555ULL);
+		x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+		x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+
+		return static_cast<int>((x * 0x0101010101010101ULL) >> 56);
+	}
+
+	template <int W>
+	static inline void _build_peq(const Elem* a, int a_size, uint64_t (&peq)[256][W]);
+
+	template <int W>
+	static inline void _step(uint64_t* v, const uint64_t* eq);
+
+	template <int W>
+	int _lcs_length(const Elem* a, int a_size, const Elem* b, int b_size);
+
+	template <int W>
+	void _diff(const Elem* a, int a_size, const Elem* b, int b_size, int off, std::vector<diff_info<void>>& diffs);
+
+	static inline void _edit_back(std::vector<diff_info<void>>& diffs, size_t first, diff_type type, int off, int len);
+
+	// Common prefix and suffix lengths - they are matched without the kernel
+	static inline void _trim(const Elem* a, int a_size, const Elem* b, int b_size, int& prefix, int& suffix);
+
+	// Bit vectors after each element of b, W words each
+	std::vector<uint64_t>	_rows;
+};
+
+
+template <typename Elem>
+template <int W>
+inline void BitDiff<Elem>::_build_peq(const Elem* a, int a_size, uint64_t (&peq)[256][W])
+{
+	std::memset(peq, 0, sizeof(peq));
+
+	for (int i = 0; i < a_size; ++i)
+		peq[_symbol(a[i])][i / cWordBits] |= (1ULL << (i % cWordBits));
+}
+
+
+// V' = (V + (V & Eq)) | (V & ~Eq) - the zero bits of V mark the a positions where the LCS length grows
+template <typename Elem>
+template <int W>
+inline void BitDiff<Elem>::_step(uint64_t* v, const uint64_t* eq)
+{
+	uint64_t carry = 0;
+
+	for (int w = 0; w < W; ++w)
+	{
+		const uint64_t u = v[w] & eq[w];
+		const uint64_t t = v[w] + u;
+		const uint64_t s = t + carry;
+
+		carry = ((t < v[w]) || (s < t)) ? 1 : 0;
+
+		v[w] = s | (v[w] - u);
+	}
+}
+
+
+template <typename Elem>
+template <int W>
+int BitDiff<Elem>::_lcs_length(const Elem* a, int a_size, const Elem* b, int b_size)
+{
+	uint64_t peq[256][W];
+
+	_build_peq<W>(a, a_size, peq);
+
+	uint64_t v[W];
+
+	std::fill(v, v + W, ~0ULL);
+
+	for (int j = 0; j < b_size; ++j)
+		_step<W>(v, peq[_symbol(b[j])]);
+
+	int lcs = 0;
+
+	for (int w = 0; w < W; ++w)
+	{
+		int bits = a_size - w * cWordBits;
+
+		if (bits > cWordBits)
+			bits = cWordBits;
+
+		const uint64_t mask = (bits == cWordBits) ? ~0ULL : ((1ULL << bits) - 1);
+
+		lcs += bits - _popcount(v[w] & mask);
+	}
+
+	return lcs;
+}
+
+
+template <typename Elem>
+inline void BitDiff<Elem>::_trim(const Elem* a, int a_size, const Elem* b, int b_size, int& prefix, int& suffix)
+{
+	const int minSize = std::min(a_size, b_size);
+
+	prefix = diff_match_fwd(a, b, minSize);
+	suffix = diff_match_bwd(a + a_size, b + b_size, minSize - prefix);
+}
+
+
+// Adds the diff in front of the ones found so far after index first - the edit script is recovered from the end
+template <typename Elem>
+inline void BitDiff<Elem>::_edit_back(std::vector<diff_info<void>>& diffs, size_t first, diff_type type, int off,
+		int len)
+{
+	if (len == 0)
+		return;
+
+	if (diffs.size() > first && diffs.back().type == type)
+	{
+		diffs.back().off = off;
+		diffs.back().len += len;
+	}
+	else
+	{
+		diffs.push_back(diff_info<void>{type, off, len});
+	}
+}
+
+
+template <typename Elem>
+template <int W>
+void BitDiff<Elem>::_diff(const Elem* a, int a_size, const Elem* b, int b_size, int off,
+		std::vector<diff_info<void>>& diffs)
+{
+	uint64_t peq[256][W];
+
+	_build_peq<W>(a, a_size, peq);
+
+	_rows.resize(static_cast<size_t>(b_size + 1) * W);
+
+	uint64_t* v = _rows.data();
+
+	std::fill(v, v + W, ~0ULL);
+
+	for (int j = 0; j < b_size; ++j, v += W)
+	{
+		std::copy(v, v + W, v + W);
+		_step<W>(v + W, peq[_symbol(b[j])]);
+	}
+
+	// Walk back from the end - take the matches, and the a elements not growing the LCS at that b position before
+	// the b elements. The diffs are added in reverse order, DIFF_IN_2 before DIFF_IN_1 so they end as in DiffCalc
+	const size_t first = diffs.size();
+
+	int i = a_size;
+	int j = b_size;
+
+	int gapEnd1 = i;
+	int gapEnd2 = j;
+
+	while (i > 0 && j > 0)
+	{
+		if (a[i - 1] == b[j - 1])
+		{
+			_edit_back(diffs, first, diff_type::DIFF_IN_2, off + j, gapEnd2 - j);
+			_edit_back(diffs, first, diff_type::DIFF_IN_1, off + i, gapEnd1 - i);
+
+			--i;
+			--j;
+
+			_edit_back(diffs, first, diff_type::DIFF_MATCH, off + i, 1);
+
+			gapEnd1 = i;
+			gapEnd2 = j;
+		}
+		else if (_rows[static_cast<size_t>(j) * W + (i - 1) / cWordBits] & (1ULL << ((i - 1) % cWordBits)))
+		{
+			--i;
+		}
+		else
+		{
+			--j;
+		}
+	}
+
+	_edit_back(diffs, first, diff_type::DIFF_IN_2, off, gapEnd2);
+	_edit_back(diffs, first, diff_type::DIFF_IN_1, off, gapEnd1);
+
+	std::reverse(diffs.begin() + first, diffs.end());
+}
+
+
+template <typename Elem>
+bool BitDiff<Elem>::operator()(const std::vector<Elem>& v1, const std::vector<Elem>& v2,
+		std::vector<diff_info<void>>& diffs)
+{
+	diffs.clear();
+
+	// The shorter sequence is the bit vector one
+	const bool swapped = (v1.size() > v2.size());
+
+	const std::vector<Elem>& a = swapped ? v2 : v1;
+	const std::vector<Elem>& b = swapped ? v1 : v2;
+
+	const int a_size = static_cast<int>(a.size());
+	const int b_size = static_cast<int>(b.size());
+
+	int prefix;
+	int suffix;
+
+	_trim(a.data(), a_size, b.data(), b_size, prefix, suffix);
+
+	if (prefix)
+		diffs.push_back(diff_info<void>{diff_type::DIFF_MATCH, 0, prefix});
+
+	// The changed middle parts start and end with a diff so they don't join the matches around them
+	const Elem* pa = a.data() + prefix;
+	const Elem* pb = b.data() + prefix;
+
+	const int a_len = a_size - prefix - suffix;
+	const int b_len = b_size - prefix - suffix;
+
+	if (a_len == 0)
+	{
+		if (b_len)
+			diffs.push_back(diff_info<void>{diff_type::DIFF_IN_2, prefix, b_len});
+	}
+	else
+	{
+		switch ((a_len + cWordBits - 1) / cWordBits)
+		{
+			case 1:		_diff<1>(pa, a_len, pb, b_len, prefix, diffs);	break;
+			case 2:		_diff<2>(pa, a_len, pb, b_len, prefix, diffs);	break;
+			case 3:		_diff<3>(pa, a_len, pb, b_len, prefix, diffs);	break;
+			default:	_diff<4>(pa, a_len, pb, b_len, prefix, diffs);
+		}
+	}
+
+	if (suffix)
+		diffs.push_back(diff_info<void>{diff_type::DIFF_MATCH, a_size - suffix, suffix});
+
+	return swapped;
+}
+
+
+template <typename Elem>
+int BitDiff<Elem>::lcsLength(const std::vector<Elem>& v1, const std::vector<Elem>& v2)
+{
+	const std::vector<Elem>& a = (v1.size() > v2.size()) ? v2 : v1;
+	const std::vector<Elem>& b = (v1.size() > v2.size()) ? v1 : v2;
+
+	const int a_size = static_cast<int>(a.size());
+	const int b_size = static_cast<int>(b.size());
+
+	int prefix;
+	int suffix;
+
+	_trim(a.data(), a_size, b.data(), b_size, prefix, suffix);
+
+	const Elem* pa = a.data() + prefix;
+	const Elem* pb = b.data() + prefix;
+
+	const int a_len = a_size - prefix - suffix;
+	const int b_len = b_size - prefix - suffix;
+
+	int lcs = prefix + suffix;
+
+	if (a_len == 0)
+		return lcs;
+
+	switch ((a_len + cWordBits - 1) / cWordBits)
+	{
+		case 1:		lcs += _lcs_length<1>(pa, a_len, pb, b_len);	break;
+		case 2:		lcs += _lcs_length<2>(pa, a_len, pb, b_len);	break;
+		case 3:		lcs += _lcs_length<3>(pa, a_len, pb, b_len);	break;
+		default:	lcs += _lcs_length<4>(pa, a_len, pb, b_len);
+	}
+
+	return lcs;
+}
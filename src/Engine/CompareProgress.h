@@ -0,0 +1,38 @@
+/*
+ * This file is part of ComparePlus plugin for Notepad++
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+
+/**
+ *  \class
+ *  \brief  Followed by the compare phases that take long. Advance() and NextPhase() return false when the compare
+ *          is cancelled. Advance() and IsCancelled() are lock-free so all the compare threads call them at any rate
+ */
+class CompareProgress
+{
+public:
+	virtual ~CompareProgress() {}
+
+	virtual bool IsCancelled() const = 0;
+
+	virtual unsigned NextPhase() = 0;
+	virtual bool SetMaxCount(unsigned max, unsigned phase = 0) = 0;
+	virtual bool Advance(unsigned cnt = 1, unsigned phase = 0) = 0;
+
+	virtual void Show() const = 0;
+};
@@ -0,0 +1,164 @@
+/*
+ * This file is part of ComparePlus plugin for Notepad++
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <algorithm>
+#include <iterator>
+
+#include "CompareStats.h"
+
+
+namespace {
+
+const char* const cPhaseNames[] = {
+	"Hash", "Lines diff", "Moves", "Blocks diff", "Marking", "Apply", "Alignment"
+};
+
+static_assert(sizeof(cPhaseNames) / sizeof(cPhaseNames[0]) == static_cast<int>(ComparePhase::COUNT),
+		"Phase names mismatch");
+
+
+double toMilliseconds(int64_t ticks)
+{
+	static const double frequency =
+		[]()
+		{
+			LARGE_INTEGER freq;
+			::QueryPerformanceFrequency(&freq);
+
+			return static_cast<double>(freq.QuadPart);
+		}();
+
+	return (ticks * 1000.0) / frequency;
+}
+
+}
+
+
+void CompareStats::clear()
+{
+	std::fill(std::begin(phaseTicks), std::end(phaseTicks), 0);
+
+	linesCount		= 0;
+	linesHashed		= 0;
+	blockDiffs		= 0;
+	changedBlocks	= 0;
+	subDiffs		= 0;
+	sciCalls		= 0;
+	peakMemory_KB	= 0;
+	reused			= false;
+}
+
+
+double CompareStats::getTime_ms(ComparePhase phase) const
+{
+	return toMilliseconds(phaseTicks[static_cast<int>(phase)]);
+}
+
+
+double CompareStats::getTotalTime_ms() const
+{
+	int64_t ticks = 0;
+
+	for (int64_t phase: phaseTicks)
+		ticks += phase;
+
+	return toMilliseconds(ticks);
+}
+
+
+std::string CompareStats::toString(const char* separator) const
+{
+	std::string text;
+
+	char buf[128];
+
+	for (int i = 0; i < static_cast<int>(ComparePhase::COUNT); ++i)
+	{
+		_snprintf_s(buf, _countof(buf), _TRUNCATE, "%s: %.2f ms%s", cPhaseNames[i],
+				toMilliseconds(phaseTicks[i]), separator);
+		text += buf;
+	}
+
+	_snprintf_s(buf, _countof(buf), _TRUNCATE,
+			"Total: %.2f ms%sLines: %d%sLines hashed: %d%sBlocks: %d%sChanged blocks: %d%sSub-diffs: %d%s",
+			getTotalTime_ms(), separator, linesCount, separator, linesHashed, separator, blockDiffs, separator,
+			changedBlocks, separator, subDiffs, separator);
+	text += buf;
+
+	_snprintf_s(buf, _countof(buf), _TRUNCATE, "Scintilla calls: %u%sPeak memory: %u KB%sCached: %s",
+			sciCalls, separator, static_cast<unsigned>(peakMemory_KB), separator, reused ? "yes" : "no");
+	text += buf;
+
+	return text;
+}
+
+
+void CompareStatsLog::add(const CompareStats& stats)
+{
+	Record record;
+
+	::GetLocalTime(&record.time);
+	record.stats = stats;
+
+	if (_records.size() < _capacity)
+	{
+		_records.emplace_back(record);
+	}
+	else
+	{
+		_records[_next] = record;
+	}
+
+	_next = (_next + 1) % _capacity;
+}
+
+
+bool CompareStatsLog::write(const TCHAR* file) const
+{
+	HANDLE hFile = ::CreateFile(file, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	bool ok = true;
+
+	// The oldest record is the next one to be overwritten once the log is full
+	const size_t first = (_records.size() < _capacity) ? 0 : _next;
+
+	for (size_t i = 0; ok && i < _records.size(); ++i)
+	{
+		const Record& record = _records[(first + i) % _records.size()];
+
+		char time[32];
+
+		_snprintf_s(time, _countof(time), _TRUNCATE, "%04u-%02u-%02u %02u:%02u:%02u.%03u ",
+				record.time.wYear, record.time.wMonth, record.time.wDay,
+				record.time.wHour, record.time.wMinute, record.time.wSecond, record.time.wMilliseconds);
+
+		const std::string line = time + record.stats.toString(", ") + "\r\n";
+
+		DWORD written;
+
+		ok = ::WriteFile(hFile, line.data(), static_cast<DWORD>(line.size()), &written, NULL) &&
+				(written == line.size());
+	}
+
+	::CloseHandle(hFile);
+
+	return ok;
+}
@@ -0,0 +1,140 @@
+/*
+ * This file is part of ComparePlus plugin for Notepad++
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <windows.h>
+#include <tchar.h>
+
+
+enum class ComparePhase
+{
+	HASH,			// Both documents are hashed at once
+	LINES_DIFF,
+	MOVES,
+	BLOCKS_DIFF,	// Changed blocks lines convergence and word / char diffs
+	MARKING,
+	APPLY,			// Scintilla markers and indicators
+	ALIGNMENT,
+	COUNT
+};
+
+
+inline int64_t getTimeStamp()
+{
+	LARGE_INTEGER counter;
+	::QueryPerformanceCounter(&counter);
+
+	return counter.QuadPart;
+}
+
+
+/**
+ *  \struct
+ *  \brief  Timings and counters of a compare. The phases are timed on the thread that runs them so the parallel
+ *          phases are measured by their wall time. Cancelled phases are not timed
+ */
+struct CompareStats
+{
+	CompareStats()
+	{
+		clear();
+	}
+
+	void clear();
+
+	inline void addTime(ComparePhase phase, int64_t startTime)
+	{
+		phaseTicks[static_cast<int>(phase)] += getTimeStamp() - startTime;
+	}
+
+	// Replaces the phase time - for the phases run again without a new compare (e.g. alignment)
+	inline void setTime(ComparePhase phase, int64_t startTime)
+	{
+		phaseTicks[static_cast<int>(phase)] = getTimeStamp() - startTime;
+	}
+
+	double getTime_ms(ComparePhase phase) const;
+	double getTotalTime_ms() const;
+
+	// A "name: value" entry per phase and counter in text, entries are separated by separator
+	std::string toString(const char* separator) const;
+
+	int64_t		phaseTicks[static_cast<int>(ComparePhase::COUNT)];
+
+	// Compared lines of both documents and the ones not reused from the line hashes caches
+	int			linesCount;
+	int			linesHashed;
+
+	int			blockDiffs;
+	int			changedBlocks;
+
+	// Word and char diffs run by the changed blocks compares
+	int			subDiffs;
+
+	unsigned	sciCalls;
+
+	// Process peak working set at the compare end
+	size_t		peakMemory_KB;
+
+	// Set when the block diffs are reused from the compare cache and only marked
+	bool		reused;
+};
+
+
+/**
+ *  \class
+ *  \brief  Ring buffer of the last compares stats - it never grows past its capacity, the oldest records are
+ *          overwritten
+ */
+class CompareStatsLog
+{
+public:
+	explicit CompareStatsLog(size_t capacity = 64) : _capacity(capacity), _next(0) {}
+
+	void add(const CompareStats& stats);
+
+	inline bool empty() const
+	{
+		return _records.empty();
+	}
+
+	inline void clear()
+	{
+		_records.clear();
+		_next = 0;
+	}
+
+	// Writes the records oldest first, a text line per compare. Returns false on failure
+	bool write(const TCHAR* file) const;
+
+private:
+	struct Record
+	{
+		SYSTEMTIME		time;
+		CompareStats	stats;
+	};
+
+	const size_t		_capacity;
+	size_t				_next;
+
+	std::vector<Record>	_records;
+};
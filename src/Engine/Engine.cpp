@@ -20,232 +20,140 @@
 #define NOMINMAX
 
 #include <climits>
+#include <cstdlib>
+#include <cstring>
 #include <cstdint>
 #include <exception>
+#include <stdexcept>
 #include <utility>
 #include <vector>
-#include <unordered_set>
-#include <set>
+#include <array>
 #include <unordered_map>
-#include <map>
 #include <algorithm>
 #include <functional>
 
 #include <windows.h>
 
 #include "Engine.h"
+#include "EngineCore.h"
+#include "CompareProgress.h"
 #include "diff.h"
-#include "ProgressDlg.h"
+#include "BitDiff.h"
+#include "TextScan.h"
+#include "ThreadPool.h"
+#include "IgnoreRules.h"
 
 #ifdef MULTITHREAD
 
 #if defined(__MINGW32__) && !defined(_GLIBCXX_HAS_GTHREADS)
 #include "../mingw-std-threads/mingw.thread.h"
-#include "../mingw-std-threads/mingw.mutex.h"
 #else
 #include <thread>
-#include <mutex>
 #endif // __MINGW32__ ...
 
 #endif // MULTITHREAD
 
 
-namespace {
+#ifdef DLOG
 
-#ifdef MULTITHREAD
+// The engine logs through its own hook instead of the plugin debug log macros
+#undef LOGD_GET_TIME
+#undef LOGD
 
-struct Autolock
-{
-	Autolock(std::mutex& m) : _mtx(m)
-	{
-		m.lock();
+#define LOGD_GET_TIME \
+	for (;;) { \
+		if (engineLog) engineLog(std::string(), true); \
+		break; \
 	}
 
-	~Autolock()
-	{
-		_mtx.unlock();
+#define LOGD(STR) \
+	for (;;) { \
+		if (engineLog) engineLog((STR), false); \
+		break; \
 	}
 
-	Autolock& operator=(const Autolock&) = delete;
-
-private:
-	std::mutex& _mtx;
-};
 
-#endif // MULTITHREAD
+namespace {
 
+EngineLogFn engineLog;
 
-enum class charType
-{
-	SPACECHAR,
-	ALPHANUMCHAR,
-	OTHERCHAR
-};
+}
 
 
-struct Line
+void setEngineLog(EngineLogFn logFn)
 {
-	int line;
-
-	uint64_t hash;
-
-	inline bool operator==(const Line& rhs) const
-	{
-		return (hash == rhs.hash);
-	}
-
-	inline bool operator!=(const Line& rhs) const
-	{
-		return (hash != rhs.hash);
-	}
+	engineLog = std::move(logFn);
+}
 
-	inline bool operator==(uint64_t rhs) const
-	{
-		return (hash == rhs);
-	}
+#endif // DLOG
 
-	inline bool operator!=(uint64_t rhs) const
-	{
-		return (hash != rhs);
-	}
-};
 
+namespace {
 
-struct Word
+// Background compares are followed through their cancel token only - they are not given a progress
+inline CompareProgress* getProgress(const CompareOptions& options)
 {
-	int pos;
-	int len;
-
-	uint64_t hash;
-
-	inline bool operator==(const Word& rhs) const
-	{
-		return (hash == rhs.hash);
-	}
-
-	inline bool operator!=(const Word& rhs) const
-	{
-		return (hash != rhs.hash);
-	}
-
-	inline bool operator==(uint64_t rhs) const
-	{
-		return (hash == rhs);
-	}
-
-	inline bool operator!=(uint64_t rhs) const
-	{
-		return (hash != rhs);
-	}
-};
+	return options.progress;
+}
 
 
-struct Char
+bool advanceProgress(const CompareOptions& options, unsigned count = 1)
 {
-	Char(char c, int p) : ch(c), pos(p) {}
-
-	char ch;
-	int pos;
-
-	inline bool operator==(const Char& rhs) const
-	{
-		return (ch == rhs.ch);
-	}
-
-	inline bool operator!=(const Char& rhs) const
-	{
-		return (ch != rhs.ch);
-	}
-
-	inline bool operator==(char rhs) const
-	{
-		return (ch == rhs);
-	}
-
-	inline bool operator!=(char rhs) const
-	{
-		return (ch != rhs);
-	}
-};
-
+	if (options.isCancelled())
+		return false;
 
-struct DocCmpInfo
-{
-	int			view;
-	section_t	section;
+	CompareProgress* progress = getProgress(options);
 
-	int			blockDiffMask;
+	if (!progress)
+		return true;
 
-	std::vector<Line>		lines;
-	std::unordered_set<int>	nonUniqueLines;
-};
+	return progress->Advance(count);
+}
 
 
-struct diffLine
+enum class charType
 {
-	diffLine(int lineNum) : line(lineNum) {}
-
-	int line;
-	std::vector<section_t> changes;
+	SPACECHAR,
+	ALPHANUMCHAR,
+	OTHERCHAR
 };
 
 
-struct blockDiffInfo
+/**
+ *  \struct
+ *  \brief  Words of all lines of a block diff kept in a single buffer. The words of block line i are
+ *          [offsets[i], offsets[i + 1]) in words. Their hashes are in the parallel hashes array the word diffs run on
+ */
+struct BlockWords
 {
-	const diff_info<blockDiffInfo>*	matchBlock {nullptr};
+	std::vector<Word>		words;
+	std::vector<uint64_t>	hashes;
+	std::vector<int>		offsets;
 
-	std::vector<diffLine>	changedLines;
-	std::vector<section_t>	moves;
-
-	inline int movedCount() const
+	inline const Word* lineWords(int line) const
 	{
-		int count = 0;
-
-		for (const auto& move: moves)
-			count += move.len;
-
-		return count;
+		return words.data() + offsets[line];
 	}
 
-	inline int movedSection(int line) const
+	inline const uint64_t* lineHashes(int line) const
 	{
-		for (const auto& move: moves)
-		{
-			if (line >= move.off && line < move.off + move.len)
-				return move.len;
-		}
-
-		return 0;
+		return hashes.data() + offsets[line];
 	}
 
-	inline bool getNextUnmoved(int& line) const
+	inline int wordsCount(int line) const
 	{
-		for (const auto& move: moves)
-		{
-			if (line >= move.off && line < move.off + move.len)
-			{
-				line = move.off + move.len;
-				return true;
-			}
-		}
-
-		return false;
+		return offsets[line + 1] - offsets[line];
 	}
 };
 
 
-using diffInfo = diff_info<blockDiffInfo>;
-
+// Positions of the unmatched lines of one document by line hash. Positions are pairs of block diff index and
+// offset in that block diff sorted in document order
+using LinesIndex = std::unordered_map<uint64_t, std::vector<std::pair<int, int>>>;
 
-struct CompareInfo
-{
-	// Input data
-	DocCmpInfo				doc1;
-	DocCmpInfo				doc2;
 
-	// Output data - filled by the compare engine
-	std::vector<diffInfo>	blockDiffs;
-};
+// Counts of the distinct chars of a line sorted by char
+using CharCounts = std::vector<std::pair<char, int>>;
 
 
 struct MatchInfo
@@ -313,24 +221,22 @@ struct LinesConv
 		line1 = l1;
 		line2 = l2;
 	}
-
-	bool operator<(const LinesConv& rhs) const
-	{
-		return ((conv > rhs.conv) || ((conv == rhs.conv) && (line2 < rhs.line2)));
-	}
 };
 
 
-const uint64_t cHashSeed = 0x84222325;
-
-inline uint64_t Hash(uint64_t hval, char letter)
+/**
+ *  \struct
+ *  \brief  Best lines convergences of a changed block kept in one flat buffer. lines[line1] is the range in convs of
+ *          line1 best convergences - they all have the same conv and are sorted by line2
+ */
+struct BlockConvergence
 {
-	hval ^= static_cast<uint64_t>(letter);
-
-	hval += (hval << 1) + (hval << 4) + (hval << 5) + (hval << 7) + (hval << 8) + (hval << 40);
+	std::vector<LinesConv>	convs;
+	std::vector<section_t>	lines;
 
-	return hval;
-}
+	// Word and char diffs run to find the convergences
+	int						subDiffs {0};
+};
 
 
 inline int toAlignmentLine(const DocCmpInfo& doc, int bdLine)
@@ -351,1813 +257,4925 @@ void swap(DocCmpInfo& lhs, DocCmpInfo& rhs)
 	std::swap(lhs.view, rhs.view);
 	std::swap(lhs.section, rhs.section);
 	std::swap(lhs.blockDiffMask, rhs.blockDiffMask);
+	std::swap(lhs.text, rhs.text);
+	std::swap(lhs.textLen, rhs.textLen);
+	std::swap(lhs.linesCount, rhs.linesCount);
+	std::swap(lhs.textCopy, rhs.textCopy);
+	std::swap(lhs.firstLine, rhs.firstLine);
+	std::swap(lhs.lineSpans, rhs.lineSpans);
+	std::swap(lhs.ignoredSpans, rhs.ignoredSpans);
+	std::swap(lhs.lineHashes, rhs.lineHashes);
 	std::swap(lhs.lines, rhs.lines);
 	std::swap(lhs.nonUniqueLines, rhs.nonUniqueLines);
+	std::swap(lhs.marks, rhs.marks);
 }
 
 
-void getLines(DocCmpInfo& doc, const CompareOptions& options)
+// Returns the text section from the doc snapshot, lower-cased if needed. buf is used as storage only for converted
+// non-ASCII text, ASCII text is returned unmodified and is folded by the caller
+inline const char* getSnapshotText(const DocCmpInfo& doc, intptr_t startPos, int len, bool ignoreCase,
+		std::vector<char>& buf, bool& foldASCII)
 {
-	const int monitorCancelEveryXLine = 500;
+	const char* text = doc.text + startPos;
 
-	progress_ptr& progress = ProgressDlg::Get();
+	foldASCII = ignoreCase;
 
-	doc.lines.clear();
+	if (ignoreCase && !isASCII(text, len))
+	{
+		buf.assign(text, text + len);
+		buf.push_back(0);
 
-	int linesCount = CallScintilla(doc.view, SCI_GETLENGTH, 0, 0);
+		toLowerCase(buf);
 
-	if (linesCount)
-		linesCount = CallScintilla(doc.view, SCI_GETLINECOUNT, 0, 0);
-	else
-		return;
+		foldASCII = false;
 
-	if ((doc.section.len <= 0) || (doc.section.off + doc.section.len > linesCount))
-		doc.section.len = linesCount - doc.section.off;
+		return buf.data();
+	}
 
-	if (progress)
-		progress->SetMaxCount((doc.section.len / monitorCancelEveryXLine) + 1);
+	return text;
+}
+
+
+inline char foldChar(char letter, bool foldASCII)
+{
+	return foldASCII ? toLowerASCII(letter) : letter;
+}
+
+
+// Returns the ignored spans overlapping the doc text from start to end
+inline std::pair<const span_t*, const span_t*> findIgnoredSpans(const DocCmpInfo& doc, intptr_t start, intptr_t end)
+{
+	const span_t* first = doc.ignoredSpans.data();
+	const span_t* last = first + doc.ignoredSpans.size();
+
+	first = std::lower_bound(first, last, start,
+			[](const span_t& span, intptr_t pos) { return span.off + span.len <= pos; });
+	last = std::lower_bound(first, last, end,
+			[](const span_t& span, intptr_t pos) { return span.off < pos; });
+
+	return std::make_pair(first, last);
+}
 
-	doc.lines.reserve(doc.section.len);
 
-	for (int lineNum = 0; lineNum < doc.section.len; ++lineNum)
+// The same as getSnapshotText but the ignored spans from first to last are left out of the text. The text is copied
+// in buf if there are such spans and len is set to the length of the text returned
+inline const char* getUnignoredText(const DocCmpInfo& doc, intptr_t startPos, intptr_t endPos, const span_t* first,
+		const span_t* last, bool ignoreCase, std::vector<char>& buf, int& len, bool& foldASCII)
+{
+	if (first == last)
 	{
-		if (progress && (lineNum % monitorCancelEveryXLine == 0) && !progress->Advance())
-		{
-			doc.lines.clear();
-			return;
-		}
+		len = static_cast<int>(endPos - startPos);
 
-		const int lineStart	= getLineStart(doc.view, lineNum + doc.section.off);
-		const int lineEnd	= getLineEnd(doc.view, lineNum + doc.section.off);
+		return getSnapshotText(doc, startPos, len, ignoreCase, buf, foldASCII);
+	}
 
-		Line newLine;
-		newLine.hash = cHashSeed;
-		newLine.line = lineNum + doc.section.off;
-
-		int lineStartmoved = lineStart;
-		bool endfound = false;
-		while (options.ignoreLineNumbers && !endfound && lineStartmoved < lineEnd - 1) {
-			const std::vector<char> text = getText(doc.view, lineStartmoved, lineStartmoved + 1);
-			if (isdigit(text[0])) {
-				lineStartmoved++;
-			}
-			else
-			{
-				endfound = true;
-			}
-		}
+	buf.clear();
 
-		if (lineEnd - lineStartmoved)
-		{
-			std::vector<char> line = getText(doc.view, lineStartmoved, lineEnd);
+	intptr_t pos = startPos;
 
-			if (options.ignoreCase)
-				toLowerCase(line);
+	for (; first != last; ++first)
+	{
+		if (first->off > pos)
+			buf.insert(buf.end(), doc.text + pos, doc.text + first->off);
 
-			for (int i = 0; i < lineEnd - lineStartmoved; ++i)
-			{
-				if (options.ignoreSpaces && (line[i] == ' ' || line[i] == '\t'))
-					continue;
+		pos = std::max(pos, first->off + first->len);
+	}
 
-				newLine.hash = Hash(newLine.hash, line[i]);
-			}
-		}
+	if (endPos > pos)
+		buf.insert(buf.end(), doc.text + pos, doc.text + endPos);
 
-		if (!options.ignoreEmptyLines || newLine.hash != cHashSeed)
-			doc.lines.emplace_back(newLine);
+	len = static_cast<int>(buf.size());
+
+	foldASCII = ignoreCase;
+
+	if (ignoreCase && !isASCII(buf.data(), len))
+	{
+		toLowerCase(buf);
+
+		foldASCII = false;
 	}
+
+	buf.push_back(0);
+
+	return buf.data();
 }
 
 
-charType getCharType(char letter)
+// The line diffs run on the hashes in a contiguous array - the snakes are extended several hashes at a time
+std::vector<uint64_t> getLineHashes(const std::vector<Line>& lines)
 {
-	if (letter == ' ' || letter == '\t')
-		return charType::SPACECHAR;
+	std::vector<uint64_t> hashes(lines.size());
 
-	if (::IsCharAlphaNumericA(letter) || letter == '_')
-		return charType::ALPHANUMCHAR;
+	for (size_t i = 0; i < lines.size(); ++i)
+		hashes[i] = lines[i].hash;
 
-	return charType::OTHERCHAR;
+	return hashes;
 }
 
 
-std::vector<Char> getSectionChars(int view, int secStart, int secEnd, const CompareOptions& options)
+// Returns the position the line text to compare starts from - leading line numbers are skipped if needed
+inline intptr_t getLineTextStart(const DocCmpInfo& doc, intptr_t lineStart, intptr_t lineEnd,
+		const CompareOptions& options)
 {
-	std::vector<Char> chars;
+	intptr_t textStart = lineStart;
 
-	if (secEnd - secStart)
+	if (options.ignoreLineNumbers)
 	{
-		std::vector<char> line = getText(view, secStart, secEnd);
-		const int lineLen = static_cast<int>(line.size()) - 1;
-
-		chars.reserve(lineLen);
-
-		if (options.ignoreCase)
-			toLowerCase(line);
-
-		for (int i = 0; i < lineLen; ++i)
-		{
-			if (!options.ignoreSpaces || getCharType(line[i]) != charType::SPACECHAR)
-				chars.emplace_back(line[i], i);
-		}
+		while (textStart < lineEnd - 1 && isdigit(static_cast<unsigned char>(doc.text[textStart])))
+			++textStart;
 	}
 
-	return chars;
+	return textStart;
 }
 
 
-std::vector<Word> getLineWords(int view, int lineNum, const CompareOptions& options)
-{
-	std::vector<Word> words;
+const int cMonitorCancelEveryXLine	= 500;
+const int cMinLinesPerChunk			= 20000;
+const int cMinBytesPerChunk			= 1024 * 1024;
 
-	const int docLineStart	= getLineStart(view, lineNum);
-	const int docLineEnd	= getLineEnd(view, lineNum);
+// The lines are indexed by int and so are the chars of a line - the diffs of both documents lines add their counts
+const intptr_t cMaxLinesCount		= INT_MAX / 4;
+const intptr_t cMaxLineLen			= INT_MAX / 4;
 
-	if (docLineEnd - docLineStart)
-	{
-		std::vector<char> line = getText(view, docLineStart, docLineEnd);
-		const int lineLen = static_cast<int>(line.size()) - 1;
+// Lower limits make the approximate line diff recurse too deep
+const int cMinDiffCostLimit			= 1000;
 
-		if (options.ignoreCase)
-			toLowerCase(line);
+// Lines convergence tasks granularity
+const int cMinPairsPerTask			= 50;
 
-		charType currentWordType = getCharType(line[0]);
+// Documents with more lines than that (both together) are line diffed window by window between sync points
+const int cMinWindowedDiffLines		= 4 * 1024 * 1024;
+const int cDiffWindowLines			= 256 * 1024;
 
-		Word word;
-		word.hash = Hash(cHashSeed, line[0]);
-		word.pos = 0;
-		word.len = 1;
+// Smaller documents are line diffed as a whole even in multi-threaded builds - the parallel windows are cut at sync
+// points so their diffs might differ from the whole documents diff a bit
+const int cMinParallelDiffLines		= 200000;
+const int cMinParallelWindowLines	= 10000;
 
-		for (int i = 1; i < lineLen; ++i)
-		{
-			charType newWordType = getCharType(line[i]);
+// Only the lines with hashes that are multiples of that are sync points candidates
+const uint64_t cSyncLinesSampling	= 8;
 
-			if (newWordType == currentWordType)
-			{
-				++word.len;
-				word.hash = Hash(word.hash, line[i]);
-			}
-			else
-			{
-				if (!options.ignoreSpaces || currentWordType != charType::SPACECHAR)
-					words.emplace_back(word);
+// Best line2 candidates kept per line1 in the lines convergence - bounds its memory on big blocks of similar lines
+const int cMaxLineConvs				= 8;
 
-				currentWordType = newWordType;
+// Edited moves are found by the fingerprints of that many consecutive lines. Each run of cFuzzyMoveWinnowing windows
+// keeps only its smallest fingerprint so matching line runs of cFuzzyMoveWindowLines + cFuzzyMoveWinnowing - 1 lines
+// always share one
+const int cFuzzyMoveWindowLines		= 3;
+const int cFuzzyMoveWinnowing		= 4;
 
-				word.hash = Hash(cHashSeed, line[i]);
-				word.pos = i;
-				word.len = 1;
-			}
-		}
+// Fingerprints found in more places than that are too common to point at a move
+const int cMaxFuzzyMoveCandidates	= 8;
 
-		if (!options.ignoreSpaces || currentWordType != charType::SPACECHAR)
-			words.emplace_back(word);
-	}
+// Lines between the fingerprints hits of the same edited move
+const int cMaxFuzzyMoveGap			= 8;
 
-	return words;
-}
+// Matching words needed to take two sections as an edited move
+const int cMinFuzzyMoveMatchPercent	= 75;
 
+// Changed blocks lines pairs (summed over all blocks) a deferred blocks compare is worth for - see AsyncBlocksCompare
+const int cMinDeferredBlocksWork	= 1000000;
 
-std::vector<std::vector<Char>> getChars(const DocCmpInfo& doc, const diffInfo& blockDiff,
-		const CompareOptions& options)
-{
-	std::vector<std::vector<Char>> chars(blockDiff.len);
+// Lines with that many words (e.g. minified JSON or XML) are diffed by chunks of words first and then word by word
+// only where the chunks differ. Their diffs always have a cost limit
+const int cMinLongLineWords			= 8 * 1024;
 
-	for (int lineNum = 0; lineNum < blockDiff.len; ++lineNum)
-	{
-		// Don't get moved lines
-		if (blockDiff.info.getNextUnmoved(lineNum))
-		{
-			--lineNum;
-			continue;
-		}
+// Average words of a long line chunk - the chunks end at the words with hashes selecting them so the chunks not
+// touched by the changes stay the same whatever is inserted or removed before them
+const int cLineChunkWords			= 64;
+const int cMinLineChunkWords		= 16;
+const int cMaxLineChunkWords		= 4 * cLineChunkWords;
 
-		const int docLineNum	= doc.lines[lineNum + blockDiff.off].line;
-		const int docLineStart	= getLineStart(doc.view, docLineNum);
-		const int docLineEnd	= getLineEnd(doc.view, docLineNum);
+// Changed sections with more chars are char diffed with a cost limit
+const int cMinLongSectionLen		= 64 * 1024;
 
-		if (docLineEnd - docLineStart)
-			chars[lineNum] = getSectionChars(doc.view, docLineStart, docLineEnd, options);
-	}
 
-	return chars;
-}
+// Splits and hashes chunk lines using only the document snapshot so it is safe to be run in a worker thread.
+// Lines that are not dirty in the doc line hashes cache are not re-hashed.
+// Returns false if the operation is cancelled
+bool hashLines(LinesChunk& chunk, const CompareOptions& options, const std::function<bool()>& advanceFn)
+{
+	const DocCmpInfo& doc = chunk.doc;
 
+	LineHashCache* cache = doc.lineHashes;
 
-// Scan for the best single matching block in the other file
-void findBestMatch(const CompareInfo& cmpInfo, const diffInfo& lookupDiff, int lookupOff, MatchInfo& mi)
-{
-	mi.matchLen		= 0;
-	mi.matchDiff	= nullptr;
+	chunk.lines.reserve(chunk.linesCount);
+	chunk.lineSpans.reserve(chunk.linesCount);
 
-	const std::vector<Line>* pLookupLines;
-	const std::vector<Line>* pMatchLines;
-	diff_type matchType;
+	const IgnoreRules* ignoreRules = options.ignoreRules ? options.ignoreRules.get() : nullptr;
 
-	if (lookupDiff.type == diff_type::DIFF_IN_1)
-	{
-		pLookupLines	= &cmpInfo.doc1.lines;
-		pMatchLines		= &cmpInfo.doc2.lines;
-		matchType		= diff_type::DIFF_IN_2;
-	}
-	else
-	{
-		pLookupLines	= &cmpInfo.doc2.lines;
-		pMatchLines		= &cmpInfo.doc1.lines;
-		matchType		= diff_type::DIFF_IN_1;
-	}
+	std::vector<char> lineBuf;
 
-	int minMatchLen = 1;
+	intptr_t pos = chunk.startPos;
 
-	for (const diffInfo& matchDiff: cmpInfo.blockDiffs)
+	for (int lineNum = 0; lineNum < chunk.linesCount; ++lineNum)
 	{
-		if (matchDiff.type != matchType || matchDiff.len < minMatchLen)
-			continue;
+		if ((lineNum % cMonitorCancelEveryXLine == 0) && !advanceFn())
+			return false;
 
-		for (int matchOff = 0; matchOff < matchDiff.len; ++matchOff)
-		{
-			if ((*pLookupLines)[lookupDiff.off + lookupOff] != (*pMatchLines)[matchDiff.off + matchOff])
-				continue;
+		const intptr_t lineStart = pos;
 
-			if (matchDiff.info.getNextUnmoved(matchOff))
-			{
-				if (matchOff >= matchDiff.len)
-					break;
+		pos = findLineEnd(doc.text, pos, doc.textLen);
 
-				if ((*pLookupLines)[lookupDiff.off + lookupOff] != (*pMatchLines)[matchDiff.off + matchOff])
-					continue;
-			}
+		const intptr_t lineEnd = pos;
+
+		if (pos < doc.textLen)
+			pos += (doc.text[pos] == '\r' && pos + 1 < doc.textLen && doc.text[pos + 1] == '\n') ? 2 : 1;
 
-			int lookupStart	= lookupOff - 1;
-			int matchStart	= matchOff - 1;
+		// The word and char diffs index the line text by int
+		if (lineEnd - lineStart > cMaxLineLen)
+			throw std::length_error("Line too long to compare");
 
-			// Check for the beginning of the matched block (containing lookupOff element)
-			for (; lookupStart >= 0 && matchStart >= 0 &&
-					(*pLookupLines)[lookupDiff.off + lookupStart] == (*pMatchLines)[matchDiff.off + matchStart] &&
-					!lookupDiff.info.movedSection(lookupStart) && !matchDiff.info.movedSection(matchStart);
-					--lookupStart, --matchStart);
+		chunk.lineSpans.emplace_back(lineStart, static_cast<int>(lineEnd - lineStart));
+
+		Line newLine;
+		newLine.line = lineNum + chunk.firstLine;
 
-			++lookupStart;
-			++matchStart;
+		const intptr_t textStart = getLineTextStart(doc, lineStart, lineEnd, options);
 
-			int lookupEnd	= lookupOff + 1;
-			int matchEnd	= matchOff + 1;
+		// The ignored spans are needed by the matches checks and the marking even for the cached line hashes
+		const size_t firstSpan = chunk.ignoredSpans.size();
 
-			// Check for the end of the matched block (containing lookupOff element)
-			for (; lookupEnd < lookupDiff.len && matchEnd < matchDiff.len &&
-					(*pLookupLines)[lookupDiff.off + lookupEnd] == (*pMatchLines)[matchDiff.off + matchEnd] &&
-					!lookupDiff.info.movedSection(lookupEnd) && !matchDiff.info.movedSection(matchEnd);
-					++lookupEnd, ++matchEnd);
+		if (ignoreRules)
+			ignoreRules->scan(doc.text + textStart, static_cast<int>(lineEnd - textStart), textStart,
+					chunk.ignoredSpans);
 
-			const int matchLen = lookupEnd - lookupStart;
+		if (cache && !cache->dirty[newLine.line])
+		{
+			newLine.hash = cache->hashes[newLine.line];
+		}
+		else
+		{
+			TextHash lineHash;
 
-			if (mi.matchLen < matchLen)
+			if (lineEnd - textStart)
 			{
-				mi.lookupOff	= lookupStart;
-				mi.matchDiff	= const_cast<diffInfo*>(&matchDiff);
-				mi.matchOff		= matchStart;
-				mi.matchLen		= matchLen;
+				const span_t* spans = chunk.ignoredSpans.data();
 
-				minMatchLen		= matchLen;
-				matchOff		= matchEnd - 1;
+				int len;
+				bool foldASCII;
+				const char* line = getUnignoredText(doc, textStart, lineEnd, spans + firstSpan,
+						spans + chunk.ignoredSpans.size(), options.ignoreCase, lineBuf, len, foldASCII);
+
+				hashText(lineHash, line, len, options.ignoreSpaces, foldASCII);
 			}
-			else if (mi.matchLen == matchLen)
+
+			newLine.hash = lineHash.get();
+
+			++chunk.linesHashed;
+
+			// Each chunk writes only its own lines so no locking is needed
+			if (cache)
 			{
-				mi.matchDiff	= nullptr;
-				matchOff		= matchEnd - 1;
+				cache->hashes[newLine.line]	= newLine.hash;
+				cache->dirty[newLine.line]	= 0;
 			}
 		}
+
+		if (!options.ignoreEmptyLines || newLine.hash != cHashSeed)
+			chunk.lines.emplace_back(newLine);
 	}
+
+	return true;
 }
 
 
-// Recursively resolve the best match
-bool resolveMatch(const CompareInfo& cmpInfo, diffInfo& lookupDiff, int lookupOff, MatchInfo& lookupMi)
+// Re-checks the content of the matched elements and moves the ones that only have equal hashes to the differences.
+// isEqual is called with the element indexes in the first and the second compared sequences.
+// Returns the number of hash collisions found - diffs are left untouched if there are none
+template <typename UserDataT, typename EqualFn>
+int splitHashCollisions(std::vector<diff_info<UserDataT>>& diffs, EqualFn isEqual)
 {
-	bool ret = false;
+	int collisions = 0;
 
-	if (lookupMi.matchDiff)
-	{
-		lookupOff = lookupMi.matchOff + (lookupOff - lookupMi.lookupOff);
+	std::vector<diff_info<UserDataT>> verified;
 
-		MatchInfo reverseMi;
-		findBestMatch(cmpInfo, *(lookupMi.matchDiff), lookupOff, reverseMi);
+	diff_info<UserDataT> match;
+	diff_info<UserDataT> in1;
+	diff_info<UserDataT> in2;
 
-		if ((reverseMi.matchDiff == &lookupDiff) && (reverseMi.matchOff == lookupMi.lookupOff))
+	match.type	= diff_type::DIFF_MATCH;
+	match.len	= 0;
+	in1.type	= diff_type::DIFF_IN_1;
+	in1.len		= 0;
+	in2.type	= diff_type::DIFF_IN_2;
+	in2.len		= 0;
+
+	auto flush =
+		[&](diff_info<UserDataT>& diff)
 		{
-			LOGD("Move match found, len: " + std::to_string(lookupMi.matchLen) + "\n");
+			if (diff.len)
+			{
+				verified.emplace_back(diff);
+				diff.len = 0;
+			}
+		};
 
-			lookupDiff.info.moves.emplace_back(lookupMi.lookupOff, lookupMi.matchLen);
-			lookupMi.matchDiff->info.moves.emplace_back(lookupMi.matchOff, lookupMi.matchLen);
-			ret = true;
+	auto extend =
+		[](diff_info<UserDataT>& diff, int off, int len)
+		{
+			if (diff.len == 0)
+				diff.off = off;
+
+			diff.len += len;
+		};
+
+	int off2 = 0;
+
+	for (const auto& diff: diffs)
+	{
+		if (diff.type == diff_type::DIFF_IN_1)
+		{
+			flush(match);
+			extend(in1, diff.off, diff.len);
 		}
-		else if (reverseMi.matchDiff)
+		else if (diff.type == diff_type::DIFF_IN_2)
 		{
-			ret = resolveMatch(cmpInfo, *(lookupMi.matchDiff), lookupOff, reverseMi);
-			lookupMi.matchLen = 0;
+			flush(match);
+			extend(in2, diff.off, diff.len);
+
+			off2 = diff.off + diff.len;
+		}
+		else
+		{
+			for (int i = 0; i < diff.len; ++i)
+			{
+				if (isEqual(diff.off + i, off2 + i))
+				{
+					flush(in1);
+					flush(in2);
+					extend(match, diff.off + i, 1);
+				}
+				else
+				{
+					++collisions;
+
+					flush(match);
+					extend(in1, diff.off + i, 1);
+					extend(in2, off2 + i, 1);
+				}
+			}
+
+			off2 += diff.len;
 		}
 	}
 
-	return ret;
+	if (collisions)
+	{
+		flush(match);
+		flush(in1);
+		flush(in2);
+
+		diffs = std::move(verified);
+	}
+
+	return collisions;
 }
 
 
-void findMoves(CompareInfo& cmpInfo)
+// Verifies the matched lines content, returns the number of hash collisions found
+int verifyLineMatches(CompareInfo& cmpInfo, const CompareOptions& options)
 {
-	LOGD("FIND MOVES\n");
-
-	bool repeat = true;
+	const DocCmpInfo& doc1 = cmpInfo.doc1;
+	const DocCmpInfo& doc2 = cmpInfo.doc2;
 
-	while (repeat)
-	{
-		repeat = false;
+	std::vector<char> buf1;
+	std::vector<char> buf2;
 
-		for (diffInfo& lookupDiff: cmpInfo.blockDiffs)
+	return splitHashCollisions(cmpInfo.blockDiffs,
+		[&](int off1, int off2) -> bool
 		{
-			if (lookupDiff.type != diff_type::DIFF_IN_1)
-				continue;
-
-			LOGD("Check D1 with off: " + std::to_string(cmpInfo.doc1.lines[lookupDiff.off].line + 1) + "\n");
-
-			// Go through all lookupDiff's elements and check if each is matched
-			for (int lookupEi = 0; lookupEi < lookupDiff.len; ++lookupEi)
-			{
-				// Skip already detected moves
-				if (lookupDiff.info.getNextUnmoved(lookupEi))
-				{
-					if (lookupEi >= lookupDiff.len)
-						break;
-				}
-
-				MatchInfo mi;
-				findBestMatch(cmpInfo, lookupDiff, lookupEi, mi);
+			return areLinesEqual(doc1, doc1.lines[off1].line, doc2, doc2.lines[off2].line, options, buf1, buf2);
+		});
+}
 
-				if (resolveMatch(cmpInfo, lookupDiff, lookupEi, mi))
-				{
-					repeat = true;
 
-					if (mi.matchLen)
-						lookupEi = mi.lookupOff + mi.matchLen - 1;
-					else
-						--lookupEi;
-				}
-			}
-		}
-	}
+// The non-ASCII bytes are alphanumeric so the multi-byte UTF-8 chars are never split between words
+constexpr charType classifyChar(int letter)
+{
+	return (letter == ' ' || letter == '\t') ? charType::SPACECHAR :
+			((letter >= '0' && letter <= '9') || (letter >= 'A' && letter <= 'Z') || (letter >= 'a' && letter <= 'z') ||
+			letter == '_' || letter >= 0x80) ? charType::ALPHANUMCHAR : charType::OTHERCHAR;
 }
 
 
-void findUniqueLines(CompareInfo& cmpInfo)
-{
-	std::unordered_map<uint64_t, std::vector<int>> doc1LinesMap;
+#define CHAR_TYPES_4(c)		classifyChar(c), classifyChar(c + 1), classifyChar(c + 2), classifyChar(c + 3)
+#define CHAR_TYPES_16(c)	CHAR_TYPES_4(c), CHAR_TYPES_4(c + 4), CHAR_TYPES_4(c + 8), CHAR_TYPES_4(c + 12)
+#define CHAR_TYPES_64(c)	CHAR_TYPES_16(c), CHAR_TYPES_16(c + 16), CHAR_TYPES_16(c + 32), CHAR_TYPES_16(c + 48)
 
-	for (const auto& line: cmpInfo.doc1.lines)
-	{
-		auto insertPair = doc1LinesMap.emplace(line.hash, std::vector<int>{line.line});
-		if (!insertPair.second)
-			insertPair.first->second.emplace_back(line.line);
-	}
+constexpr charType cCharTypes[256] = {
+	CHAR_TYPES_64(0), CHAR_TYPES_64(64), CHAR_TYPES_64(128), CHAR_TYPES_64(192)
+};
 
-	for (const auto& line: cmpInfo.doc2.lines)
-	{
-		auto doc1it = doc1LinesMap.find(line.hash);
+#undef CHAR_TYPES_64
+#undef CHAR_TYPES_16
+#undef CHAR_TYPES_4
 
-		if (doc1it != doc1LinesMap.end())
-		{
-			cmpInfo.doc2.nonUniqueLines.emplace(line.line);
 
-			auto insertPair = cmpInfo.doc1.nonUniqueLines.emplace(doc1it->second[0]);
-			if (insertPair.second)
-			{
-				for (unsigned int j = 1; j < doc1it->second.size(); ++j)
-					cmpInfo.doc1.nonUniqueLines.emplace(doc1it->second[j]);
-			}
-		}
-	}
+inline charType getCharType(char letter)
+{
+	return cCharTypes[static_cast<unsigned char>(letter)];
 }
 
 
-inline int matchBeginEnd(diffInfo& blockDiff1, diffInfo& blockDiff2,
-		const std::vector<Char>& sec1, const std::vector<Char>& sec2,
-		int off1, int off2, int end1, int end2, std::function<bool(char)>&& charFilter_fn)
+SectionChars getSectionChars(const DocCmpInfo& doc, intptr_t secStart, intptr_t secEnd, const CompareOptions& options)
 {
-	const int minSecSize = std::min(sec1.size(), sec2.size());
-
-	int startMatch = 0;
-	while ((minSecSize > startMatch) && (sec1[startMatch] == sec2[startMatch]) && charFilter_fn(sec1[startMatch].ch))
-		++startMatch;
+	SectionChars sc;
 
-	int endMatch = 0;
-	while ((minSecSize - startMatch > endMatch) &&
-			(sec1[sec1.size() - endMatch - 1] == sec2[sec2.size() - endMatch - 1]) &&
-			charFilter_fn(sec1[sec1.size() - endMatch - 1].ch))
-		++endMatch;
+	const int secLen = static_cast<int>(secEnd - secStart);
 
-	if (startMatch || endMatch)
+	if (secLen > 0)
 	{
-		section_t change;
+		std::vector<char> buf;
 
-		if ((int)sec1.size() > startMatch + endMatch)
-		{
-			change.off = off1;
-			if (startMatch)
-				change.off += sec1[startMatch].pos;
+		bool foldASCII;
+		const char* sec = getSnapshotText(doc, secStart, secLen, options.ignoreCase, buf, foldASCII);
 
-			change.len = (endMatch ?
-					sec1[sec1.size() - endMatch - 1].pos + 1 + off1 : end1) - change.off;
+		sc.chars.reserve(secLen);
 
-			if (change.len > 0)
-				blockDiff1.info.changedLines.back().changes.emplace_back(change);
+		if (!options.ignoreSpaces)
+		{
+			for (int i = 0; i < secLen; ++i)
+				sc.chars.push_back(foldChar(sec[i], foldASCII));
 		}
-
-		if ((int)sec2.size() > startMatch + endMatch)
+		else
 		{
-			change.off = off2;
-			if (startMatch)
-				change.off += sec2[startMatch].pos;
+			sc.positions.reserve(secLen);
 
-			change.len = (endMatch ?
-					sec2[sec2.size() - endMatch - 1].pos + 1 + off2 : end2) - change.off;
+			for (int i = 0; i < secLen; ++i)
+			{
+				const char ch = foldChar(sec[i], foldASCII);
 
-			if (change.len > 0)
-				blockDiff2.info.changedLines.back().changes.emplace_back(change);
+				if (getCharType(ch) != charType::SPACECHAR)
+				{
+					sc.chars.push_back(ch);
+					sc.positions.push_back(i);
+				}
+			}
+
+			// No spaces skipped - the positions are the chars indexes
+			if (sc.size() == secLen)
+				std::vector<int>().swap(sc.positions);
 		}
 	}
 
-	return (startMatch + endMatch);
+	return sc;
 }
 
 
-void compareLines(const DocCmpInfo& doc1, const DocCmpInfo& doc2, diffInfo& blockDiff1, diffInfo& blockDiff2,
-		const std::map<int, int>& lineMappings, const CompareOptions& options)
+/**
+ *  \struct
+ *  \brief  Plain text words tokenizer - runs of spaces, alphanumeric and other chars
+ */
+struct TextTokenizer
 {
-	for (const auto& lm: lineMappings)
+	// Returns the end of the token starting at pos
+	static inline int tokenEnd(const char* line, int pos, int len)
 	{
-		int line1 = lm.second;
-		int line2 = lm.first;
+		const charType type = getCharType(line[pos]);
 
-		LOGD("Compare Lines " + std::to_string(doc1.lines[blockDiff1.off + line1].line + 1) + " and " +
-				std::to_string(doc2.lines[blockDiff2.off + line2].line + 1) + "\n");
+		while (++pos < len && getCharType(line[pos]) == type);
 
-		const std::vector<Word> lineWords1 = getLineWords(doc1.view, doc1.lines[blockDiff1.off + line1].line, options);
-		const std::vector<Word> lineWords2 = getLineWords(doc2.view, doc2.lines[blockDiff2.off + line2].line, options);
+		return pos;
+	}
+};
 
-		const auto* pLine1 = &lineWords1;
-		const auto* pLine2 = &lineWords2;
 
-		const DocCmpInfo* pDoc1 = &doc1;
-		const DocCmpInfo* pDoc2 = &doc2;
+/**
+ *  \struct
+ *  \brief  Source code tokenizer - identifiers, numbers, string literals and operators. Spaces runs are single
+ *          tokens. SingleQuotes enables the single quoted literals and MultiCharOps the C-like two chars operators
+ */
+template <bool SingleQuotes, bool MultiCharOps>
+struct CodeTokenizer
+{
+	static inline int tokenEnd(const char* line, int pos, int len)
+	{
+		const char ch = line[pos];
+		const charType type = getCharType(ch);
 
-		diffInfo* pBlockDiff1 = &blockDiff1;
-		diffInfo* pBlockDiff2 = &blockDiff2;
+		if (type == charType::SPACECHAR)
+			return TextTokenizer::tokenEnd(line, pos, len);
 
-		// First use word granularity (find matching words) for better precision
-		auto wordDiffRes = DiffCalc<Word>(lineWords1, lineWords2)(!options.charPrecision, true);
-		const std::vector<diff_info<void>> lineDiffs = std::move(wordDiffRes.first);
+		if (type == charType::ALPHANUMCHAR)
+			return isDigit(ch) ? numberEnd(line, pos, len) : TextTokenizer::tokenEnd(line, pos, len);
 
-		if (wordDiffRes.second)
-		{
-			std::swap(pDoc1, pDoc2);
-			std::swap(pBlockDiff1, pBlockDiff2);
-			std::swap(pLine1, pLine2);
-			std::swap(line1, line2);
-		}
+		if (ch == '"')
+			return literalEnd(line, pos, len);
 
-		const int lineDiffsSize = static_cast<int>(lineDiffs.size());
+		// A quote that follows a word is an apostrophe (e.g. in a comment) - it is a single char token
+		if (SingleQuotes && ch == '\'' && (pos == 0 || getCharType(line[pos - 1]) != charType::ALPHANUMCHAR))
+			return literalEnd(line, pos, len);
 
-		PRINT_DIFFS("WORD DIFFS", lineDiffs);
+		if (ch == '.' && pos + 1 < len && isDigit(line[pos + 1]))
+			return numberEnd(line, pos, len);
 
-		pBlockDiff1->info.changedLines.emplace_back(line1);
-		pBlockDiff2->info.changedLines.emplace_back(line2);
+		if (MultiCharOps && pos + 1 < len && isTwoCharsOp(ch, line[pos + 1]))
+			return pos + 2;
 
-		const int lineOff1 = getLineStart(pDoc1->view, pDoc1->lines[line1 + pBlockDiff1->off].line);
-		const int lineOff2 = getLineStart(pDoc2->view, pDoc2->lines[line2 + pBlockDiff2->off].line);
+		return pos + 1;
+	}
 
-		int lineLen1 = 0;
-		int lineLen2 = 0;
+private:
+	static inline bool isDigit(char ch)
+	{
+		return (ch >= '0' && ch <= '9');
+	}
 
-		for (const auto& word: *pLine1)
-			lineLen1 += word.len;
+	// Numbers take the suffixes, the fraction and the signed exponent - hex numbers exponent is 'p'
+	static inline int numberEnd(const char* line, int pos, int len)
+	{
+		const bool isHex = (line[pos] == '0' && pos + 1 < len && (line[pos + 1] | 0x20) == 'x');
 
-		for (const auto& word: *pLine2)
-			lineLen2 += word.len;
+		for (++pos; pos < len; ++pos)
+		{
+			const char ch = line[pos];
 
-		int totalLineMatchLen = 0;
+			if (getCharType(ch) == charType::ALPHANUMCHAR || ch == '.')
+				continue;
 
-		for (int i = 0; i < lineDiffsSize; ++i)
-		{
-			const auto& ld = lineDiffs[i];
+			const char exp = line[pos - 1] | 0x20;
 
-			if (ld.type == diff_type::DIFF_MATCH)
-			{
-				for (int j = 0; j < ld.len; ++j)
-					totalLineMatchLen += (*pLine1)[ld.off + j].len;
-			}
-			else if (ld.type == diff_type::DIFF_IN_2)
-			{
-				section_t change;
+			if ((ch == '+' || ch == '-') && (isHex ? (exp == 'p') : (exp == 'e' || exp == 'p')))
+				continue;
 
-				change.off = (*pLine2)[ld.off].pos;
-				change.len = (*pLine2)[ld.off + ld.len - 1].pos + (*pLine2)[ld.off + ld.len - 1].len - change.off;
+			break;
+		}
 
-				pBlockDiff2->info.changedLines.back().changes.emplace_back(change);
-			}
-			else
-			{
-				// Resolve words mismatched DIFF_IN_1 / DIFF_IN_2 pairs to find possible sub-word similarities
-				if ((i + 1 < lineDiffsSize) && (lineDiffs[i + 1].type == diff_type::DIFF_IN_2))
-				{
-					const auto& ld2 = lineDiffs[i + 1];
+		return pos;
+	}
 
-					int off1 = (*pLine1)[ld.off].pos;
-					int end1 = (*pLine1)[ld.off + ld.len - 1].pos + (*pLine1)[ld.off + ld.len - 1].len;
+	// Literals end at the closing quote that is not escaped or at the line end. The single quoted ones must be closed
+	// on the line, else the quote is an apostrophe
+	static inline int literalEnd(const char* line, int pos, int len)
+	{
+		const char quote = line[pos];
 
-					int off2 = (*pLine2)[ld2.off].pos;
-					int end2 = (*pLine2)[ld2.off + ld2.len - 1].pos + (*pLine2)[ld2.off + ld2.len - 1].len;
+		for (int i = pos + 1; i < len; ++i)
+		{
+			if (line[i] == '\\')
+				++i;
+			else if (line[i] == quote)
+				return i + 1;
+		}
 
-					const std::vector<Char> sec1 =
-							getSectionChars(pDoc1->view, off1 + lineOff1, end1 + lineOff1, options);
-					const std::vector<Char> sec2 =
-							getSectionChars(pDoc2->view, off2 + lineOff2, end2 + lineOff2, options);
+		return (quote == '\'') ? pos + 1 : len;
+	}
 
-					if (options.charPrecision)
-					{
-						LOGD("Compare Sections " +
-								std::to_string(off1 + 1) + " to " +
-								std::to_string(end1 + 1) + " and " +
-								std::to_string(off2 + 1) + " to " +
-								std::to_string(end2 + 1) + "\n");
+	static inline bool isTwoCharsOp(char ch1, char ch2)
+	{
+		switch (ch1)
+		{
+			case '-':	return (ch2 == '>' || ch2 == '-' || ch2 == '=');
+			case '+':	return (ch2 == '+' || ch2 == '=');
+			case '&':	return (ch2 == '&' || ch2 == '=');
+			case '|':	return (ch2 == '|' || ch2 == '=');
+			case '<':	return (ch2 == '<' || ch2 == '=');
+			case '>':	return (ch2 == '>' || ch2 == '=');
+			case ':':	return (ch2 == ':');
+			case '/':	return (ch2 == '/' || ch2 == '*' || ch2 == '=');
+			case '*':	return (ch2 == '/' || ch2 == '=');
+			case '=':
+			case '!':
+			case '%':
+			case '^':	return (ch2 == '=');
+		}
 
-						const auto* pSec1 = &sec1;
-						const auto* pSec2 = &sec2;
+		return false;
+	}
+};
 
-						diffInfo* pBD1 = pBlockDiff1;
-						diffInfo* pBD2 = pBlockDiff2;
 
-						// Compare changed words
-						auto diffRes = DiffCalc<Char>(sec1, sec2)();
-						const std::vector<diff_info<void>> sectionDiffs = std::move(diffRes.first);
+// Splits the line in tokens in a single pass and appends them to the block words. The tokenizer is selected at
+// compile time so its char checks are inlined in the loop
+template <typename Tokenizer>
+void tokenizeLine(const DocCmpInfo& doc, int lineNum, const CompareOptions& options, std::vector<char>& buf,
+		BlockWords& blockWords)
+{
+	const span_t& span = doc.lineSpan(lineNum);
 
-						if (diffRes.second)
-						{
-							std::swap(pSec1, pSec2);
-							std::swap(pBD1, pBD2);
-							std::swap(off1, off2);
-							std::swap(end1, end2);
-						}
+	if (span.len == 0)
+		return;
 
-						PRINT_DIFFS("CHAR DIFFS", sectionDiffs);
+	bool foldASCII;
+	const char* line = getSnapshotText(doc, span.off, span.len, options.ignoreCase, buf, foldASCII);
 
-						int matchLen = 0;
-						int matchSections = 0;
+	for (int pos = 0; pos < span.len;)
+	{
+		const int end = Tokenizer::tokenEnd(line, pos, span.len);
 
-						for (const auto& sd: sectionDiffs)
-						{
-							if (sd.type == diff_type::DIFF_MATCH)
-							{
-								matchLen += sd.len;
-								++matchSections;
-							}
-						}
+		// Case folding doesn't change the chars type
+		if (!options.ignoreSpaces || getCharType(line[pos]) != charType::SPACECHAR)
+		{
+			// The literals can have spaces - they are hashed the same way as the lines
+			TextHash wordHash;
 
-						if (matchSections)
-						{
-							LOGD("Matching sections found: " + std::to_string(matchSections) +
-									", matched len: " + std::to_string(matchLen) + "\n");
+			hashText(wordHash, line + pos, end - pos, options.ignoreSpaces, foldASCII);
 
-							// Are similarities a considerable portion of the diff?
-							if ((int)((matchLen * 100) / std::max(sec1.size(), sec2.size())) >=
-								options.changedThresholdPercent)
-							{
-								for (const auto& sd: sectionDiffs)
-								{
-									if (sd.type == diff_type::DIFF_IN_1)
-									{
-										section_t change;
+			blockWords.words.push_back({ pos, end - pos });
+			blockWords.hashes.push_back(wordHash.get());
+		}
 
-										change.off = (*pSec1)[sd.off].pos + off1;
-										change.len = (*pSec1)[sd.off + sd.len - 1].pos + off1 + 1 - change.off;
+		pos = end;
+	}
+}
 
-										pBD1->info.changedLines.back().changes.emplace_back(change);
-									}
-									else if (sd.type == diff_type::DIFF_IN_2)
-									{
-										section_t change;
 
-										change.off = (*pSec2)[sd.off].pos + off2;
-										change.len = (*pSec2)[sd.off + sd.len - 1].pos + off2 + 1 - change.off;
+template <typename Tokenizer>
+void tokenizeBlock(const DocCmpInfo& doc, const diffInfo& blockDiff, const CompareOptions& options,
+		BlockWords& blockWords)
+{
+	std::vector<char> buf;
 
-										pBD2->info.changedLines.back().changes.emplace_back(change);
-									}
-								}
+	for (int i = 0; i < blockDiff.len; ++i)
+	{
+		tokenizeLine<Tokenizer>(doc, doc.lines[blockDiff.off + i].line, options, buf, blockWords);
 
-								totalLineMatchLen += matchLen;
+		blockWords.offsets.emplace_back(static_cast<int>(blockWords.words.size()));
+	}
+}
 
-								LOGD("Whole section checked for matches\n");
 
-								++i;
-								continue;
-							}
-							// If not, mark only beginning and ending diff section matches
-							else
-							{
-								const int matches =
-										matchBeginEnd(*pBD1, *pBD2, *pSec1, *pSec2, off1, off2, end1, end2,
-												[](char) { return true; });
+// Tokenizes the block diff lines once per compare - the words are shared by the lines convergence and compare phases
+void getBlockWords(const DocCmpInfo& doc, const diffInfo& blockDiff, const CompareOptions& options,
+		BlockWords& blockWords)
+{
+	blockWords.words.clear();
+	blockWords.hashes.clear();
+	blockWords.offsets.clear();
 
-								if (matches)
-								{
-									totalLineMatchLen += matches;
+	blockWords.offsets.reserve(blockDiff.len + 1);
+	blockWords.offsets.emplace_back(0);
 
-									++i;
-									continue;
-								}
-							}
+	switch (options.wordTokenizer)
+	{
+		case WordTokenizer::CODE:
+			tokenizeBlock<CodeTokenizer<true, true>>(doc, blockDiff, options, blockWords);
+		break;
 
-							// No matching sections between the lines found - move to next lines
-							if (lineDiffsSize == 2)
-								break;
-						}
-					}
-					// Always match non-alphabetical characters in the beginning and at the end
-					else
-					{
-						const int matches =
-								matchBeginEnd(*pBlockDiff1, *pBlockDiff2, sec1, sec2, off1, off2, end1, end2,
-										[](char ch) { return (getCharType(ch) != charType::ALPHANUMCHAR); });
+		case WordTokenizer::JSON:
+			tokenizeBlock<CodeTokenizer<false, false>>(doc, blockDiff, options, blockWords);
+		break;
 
-						if (matches)
-						{
-							totalLineMatchLen += matches;
+		default:
+			tokenizeBlock<TextTokenizer>(doc, blockDiff, options, blockWords);
+	}
+}
 
-							++i;
-							continue;
-						}
 
-						// No matching sections between the lines found - move to next lines
-						if (lineDiffsSize == 2)
-							break;
-					}
-				}
+// Moved block lines have no chars
+SectionChars getLineChars(const DocCmpInfo& doc, const diffInfo& blockDiff, int lineNum, const CompareOptions& options)
+{
+	int nextLine = lineNum;
 
-				section_t change;
+	if (blockDiff.info.getNextUnmoved(nextLine))
+		return SectionChars();
 
-				change.off = (*pLine1)[ld.off].pos;
-				change.len = (*pLine1)[ld.off + ld.len - 1].pos + (*pLine1)[ld.off + ld.len - 1].len - change.off;
+	const span_t& span = doc.lineSpan(doc.lines[lineNum + blockDiff.off].line);
 
-				pBlockDiff1->info.changedLines.back().changes.emplace_back(change);
-			}
-		}
+	if (!span.len)
+		return SectionChars();
 
-		// Not enough portion of the lines matches - consider them totally different
-		if (((totalLineMatchLen * 100) / std::max(lineLen1, lineLen2)) < options.changedThresholdPercent)
-		{
-			pBlockDiff1->info.changedLines.pop_back();
-			pBlockDiff2->info.changedLines.pop_back();
-		}
-	}
+	return getSectionChars(doc, span.off, span.off + span.len, options);
 }
 
 
-std::vector<std::set<LinesConv>> getOrderedConvergence(const DocCmpInfo& doc1, const DocCmpInfo& doc2,
-		const diffInfo& blockDiff1, const diffInfo& blockDiff2, const CompareOptions& options)
+std::vector<SectionChars> getChars(const DocCmpInfo& doc, const diffInfo& blockDiff, const CompareOptions& options)
 {
-	const std::vector<std::vector<Char>> chunk1 = getChars(doc1, blockDiff1, options);
-	const std::vector<std::vector<Char>> chunk2 = getChars(doc2, blockDiff2, options);
+	std::vector<SectionChars> chars(blockDiff.len);
 
-	const int linesCount1 = static_cast<int>(chunk1.size());
-	const int linesCount2 = static_cast<int>(chunk2.size());
+	for (int lineNum = 0; lineNum < blockDiff.len; ++lineNum)
+	{
+		// Don't get moved lines
+		if (blockDiff.info.getNextUnmoved(lineNum))
+		{
+			--lineNum;
+			continue;
+		}
 
-	std::vector<std::vector<Word>> words2(linesCount2);
+		const span_t& span = doc.lineSpan(doc.lines[lineNum + blockDiff.off].line);
 
-	if (!options.charPrecision)
-	{
-		for (int line2 = 0; line2 < linesCount2; ++line2)
-			if (!chunk2[line2].empty())
-				words2[line2] = getLineWords(doc2.view, doc2.lines[blockDiff2.off + line2].line, options);
+		if (span.len)
+			chars[lineNum] = getSectionChars(doc, span.off, span.off + span.len, options);
 	}
 
-	std::vector<std::set<LinesConv>> lines1Convergence(linesCount1);
-	std::vector<std::set<LinesConv>> lines2Convergence(linesCount2);
+	return chars;
+}
 
-#ifdef MULTITHREAD
-	std::mutex mtx;
-#endif
 
-	auto workFn =
-		[&](int startLine, int endLine)
-		{
-			progress_ptr& progress = ProgressDlg::Get();
+inline int getLongDiffCostLimit(const CompareOptions& options)
+{
+	return std::max(options.diffCostLimit, cMinDiffCostLimit);
+}
 
-			int linesProgress = 0;
 
-			for (int line1 = startLine; line1 < endLine; ++line1)
-			{
-				if (chunk1[line1].empty())
-				{
-					linesProgress += linesCount2;
-					continue;
-				}
+// Short sections are diffed by the bit-parallel kernel - the longer ones and the empty ones by DiffCalc, with the cost
+// limit if long. Returns the DiffCalc swap flag
+inline bool diffChars(const SectionChars& sec1, const SectionChars& sec2, BitDiff<char>& bitDiff,
+		std::vector<diff_info<void>>& diffs, const CompareOptions& options)
+{
+	if (BitDiff<char>::fits(sec1.size(), sec2.size()))
+		return bitDiff(sec1.chars, sec2.chars, diffs);
 
-				std::vector<Word> words1;
+	const int costLimit = (std::max(sec1.size(), sec2.size()) >= cMinLongSectionLen) ?
+			getLongDiffCostLimit(options) : INT_MAX;
 
-				for (int line2 = 0; line2 < linesCount2; ++line2)
-				{
-					if (chunk2[line2].empty())
-					{
-						++linesProgress;
-						continue;
-					}
+	return DiffCalc<char>(sec1.chars, sec2.chars, costLimit)(diffs);
+}
 
-					const int minSize = std::min(chunk1[line1].size(), chunk2[line2].size());
-					const int maxSize = std::max(chunk1[line1].size(), chunk2[line2].size());
 
-					if (((minSize * 100) / maxSize) < options.changedThresholdPercent)
-					{
-						++linesProgress;
-						continue;
-					}
+// The matching chars count of the sections diff - only the LCS length is needed for the short ones
+inline int getCharMatchesLen(const SectionChars& sec1, const SectionChars& sec2, BitDiff<char>& bitDiff,
+		std::vector<diff_info<void>>& diffs)
+{
+	if (BitDiff<char>::fitsLcs(sec1.size(), sec2.size()))
+		return bitDiff.lcsLength(sec1.chars, sec2.chars);
 
-					int matchesCount	= 0;
-					int diffsCount		= 0;
+	DiffCalc<char>(sec1.chars, sec2.chars)(diffs);
 
-					if (!options.charPrecision)
-					{
-						if (words1.empty())
-							words1 = getLineWords(doc1.view, doc1.lines[blockDiff1.off + line1].line, options);
+	int matchesLen = 0;
 
-						auto wordDiffs = DiffCalc<Word>(words1, words2[line2])(true);
+	for (const auto& d: diffs)
+	{
+		if (d.type == diff_type::DIFF_MATCH)
+			matchesLen += d.len;
+	}
 
-						const int wordDiffsSize = static_cast<int>(wordDiffs.first.size());
+	return matchesLen;
+}
 
-						for (int i = 0; i < wordDiffsSize; ++i)
-						{
-							if (wordDiffs.first[i].type == diff_type::DIFF_MATCH)
-							{
-								++matchesCount;
-							}
-							else
-							{
-								if (options.diffsBasedLineChanges)
-									++diffsCount;
 
-								// Count replacement as a single diff
-								if ((i + 1 < wordDiffsSize) && (wordDiffs.first[i + 1].type == diff_type::DIFF_IN_2))
-									++i;
-							}
-						}
+// Counts the line chars in the 256 entries counts array
+inline void countChars(const SectionChars& sc, int* counts)
+{
+	std::fill(counts, counts + 256, 0);
 
-						if (matchesCount == 0)
-						{
-							++linesProgress;
-							continue;
-						}
-					}
+	for (char c: sc.chars)
+		++counts[static_cast<unsigned char>(c)];
+}
 
-					matchesCount = 0;
-					{
-						auto charDiffs = DiffCalc<Char>(chunk1[line1], chunk2[line2])();
 
-						for (const auto& ld: charDiffs.first)
-						{
-							if (ld.type == diff_type::DIFF_MATCH)
-								matchesCount += ld.len;
-						}
-					}
+CharCounts getCharCounts(const SectionChars& sc)
+{
+	int counts[256];
 
-					if (((matchesCount * 100) / minSize) >= options.changedThresholdPercent)
-					{
-						const float lineConvergence = ((static_cast<float>(matchesCount) * 100) / minSize) +
-								((static_cast<float>(matchesCount) * 100) / maxSize);
+	countChars(sc, counts);
 
-						Conv conv(lineConvergence, diffsCount);
+	CharCounts charCounts;
 
-#ifdef MULTITHREAD
-						Autolock lock(mtx);
-#endif
+	for (int i = 0; i < 256; ++i)
+	{
+		if (counts[i])
+			charCounts.emplace_back(static_cast<char>(i), counts[i]);
+	}
 
-						if (progress && !progress->Advance(linesProgress + 1))
-							return;
+	return charCounts;
+}
 
-						linesProgress = 0;
 
-						bool addL1C = false;
+// Turns the diffs of the swapped sequences DiffCalc returned into the diffs of the sequences in their given order
+void unswapDiffs(std::vector<diff_info<void>>& diffs)
+{
+	int off1 = 0;
 
-						if (lines2Convergence[line2].empty() || (conv == lines2Convergence[line2].begin()->conv))
-						{
-							lines2Convergence[line2].emplace(conv, line1, line2);
-							addL1C = true;
-						}
-						else if (conv > lines2Convergence[line2].begin()->conv)
-						{
-							for (const auto& l2c : lines2Convergence[line2])
-							{
-								auto& l1c = lines1Convergence[l2c.line1];
+	for (size_t i = 0; i < diffs.size(); ++i)
+	{
+		diff_info<void>& d = diffs[i];
 
-								if (!l1c.empty())
-								{
-									for (auto l1cI = l1c.begin(); l1cI != l1c.end(); ++l1cI)
-									{
-										if (l1cI->line2 == line2)
-										{
-											l1c.erase(l1cI);
-											break;
-										}
-									}
-								}
-							}
+		if (d.type == diff_type::DIFF_MATCH)
+		{
+			d.off = off1;
+			off1 += d.len;
+		}
+		else if (d.type == diff_type::DIFF_IN_1)
+		{
+			d.type = diff_type::DIFF_IN_2;
+		}
+		else
+		{
+			d.type = diff_type::DIFF_IN_1;
+			off1 += d.len;
+		}
 
-							lines2Convergence[line2].clear();
-							lines2Convergence[line2].emplace(conv, line1, line2);
-							addL1C = true;
-						}
+		// Replacements are DIFF_IN_1 followed by DIFF_IN_2
+		if (i && d.type == diff_type::DIFF_IN_1 && diffs[i - 1].type == diff_type::DIFF_IN_2)
+			std::swap(diffs[i - 1], d);
+	}
+}
 
-						if (addL1C)
-						{
-							if (lines1Convergence[line1].empty() || (conv == lines1Convergence[line1].begin()->conv))
-							{
-								lines1Convergence[line1].emplace(conv, line1, line2);
-							}
-							else if (conv > lines1Convergence[line1].begin()->conv)
-							{
-								lines1Convergence[line1].clear();
-								lines1Convergence[line1].emplace(conv, line1, line2);
-							}
-						}
-					}
-					else
-					{
-#ifdef MULTITHREAD
-						Autolock lock(mtx);
-#endif
 
-						if (progress && !progress->Advance(linesProgress + 1))
-							return;
+inline void appendDiff(std::vector<diff_info<void>>& diffs, diff_type type, int off, int len)
+{
+	if (len <= 0)
+		return;
 
-						linesProgress = 0;
-					}
-				}
-			}
-		};
+	if (!diffs.empty() && diffs.back().type == type)
+		diffs.back().len += len;
+	else
+		diffs.push_back(diff_info<void>{type, off, len});
+}
 
-#ifdef MULTITHREAD
 
-	auto threadFn =
-		[&](int startLine, int endLine)
-		{
-			try
-			{
-				workFn(startLine, endLine);
-			}
-			catch (std::exception& e)
-			{
-				char msg[128];
-				_snprintf_s(msg, _countof(msg), _TRUNCATE, "Exception occurred: %s", e.what());
-				::MessageBoxA(nppData._nppHandle, msg, "ComparePlus", MB_OK | MB_ICONWARNING);
-			}
-			catch (...)
-			{
-				::MessageBoxA(nppData._nppHandle, "Unknown exception occurred.", "ComparePlus",
-						MB_OK | MB_ICONWARNING);
-			}
-		};
+/**
+ *  \struct
+ *  \brief  Long line words split in chunks - chunk i is words [offsets[i], offsets[i + 1]) and hashes[i] is the hash
+ *          of their hashes
+ */
+struct LineChunks
+{
+	std::vector<uint64_t>	hashes;
+	std::vector<int>		offsets;
+};
+
+
+void getLineChunks(const uint64_t* wordHashes, int wordsCount, LineChunks& chunks)
+{
+	chunks.hashes.clear();
+	chunks.offsets.clear();
 
-	int threadsCount = std::thread::hardware_concurrency() - 2;
+	chunks.hashes.reserve(wordsCount / cLineChunkWords + 1);
+	chunks.offsets.reserve(wordsCount / cLineChunkWords + 2);
 
-	if (threadsCount < 1)
-		threadsCount = 1;
+	chunks.offsets.emplace_back(0);
 
-	if (threadsCount == 1)
+	for (int start = 0; start < wordsCount;)
 	{
-		LOGD("getOrderedConvergence(): only 1 worker thread available\n");
+		int end = std::min(start + cMinLineChunkWords, wordsCount);
+		const int maxEnd = std::min(start + cMaxLineChunkWords, wordsCount);
+
+		while (end < maxEnd && ((wordHashes[end - 1] >> 32) % cLineChunkWords) != 0)
+			++end;
+
+		TextHash chunkHash;
+
+		chunkHash.add(reinterpret_cast<const char*>(wordHashes + start),
+				static_cast<int>((end - start) * sizeof(uint64_t)));
+
+		chunks.hashes.emplace_back(chunkHash.get());
+		chunks.offsets.emplace_back(end);
 
-		workFn(0, linesCount1);
+		start = end;
 	}
-	else
-	{
-		const int totalJobs = linesCount1 * linesCount2;
+}
 
-		int jobsPerThread = 50;
 
-		const int threadsNeeded = (totalJobs + jobsPerThread - 1) / jobsPerThread;
+// Same as the DiffCalc words diff for the usual lines. The long lines are diffed by chunks first - the words are
+// diffed only between the matched chunks so the time and memory stay about linear in the line length. The long
+// lines diffs are never swapped, returns the swap flag as DiffCalc
+bool diffWords(const uint64_t* wordHashes1, int wordsCount1, const uint64_t* wordHashes2, int wordsCount2,
+		std::vector<diff_info<void>>& diffs, bool doDiffsCombine, bool doBoundaryShift, const CompareOptions& options)
+{
+	if (wordsCount1 < cMinLongLineWords && wordsCount2 < cMinLongLineWords)
+		return DiffCalc<uint64_t>(wordHashes1, wordsCount1, wordHashes2, wordsCount2)(diffs, doDiffsCombine,
+				doBoundaryShift);
 
-		if (threadsCount > threadsNeeded)
-			threadsCount = threadsNeeded;
+	const int costLimit = getLongDiffCostLimit(options);
 
-		jobsPerThread = (totalJobs + threadsCount - 1) / threadsCount;
+	LineChunks chunks1;
+	LineChunks chunks2;
 
-		LOGD("getOrderedConvergence(): " + std::to_string(threadsCount) + " threads will be used, " +
-				std::to_string(jobsPerThread) + " jobs per thread\n");
+	getLineChunks(wordHashes1, wordsCount1, chunks1);
+	getLineChunks(wordHashes2, wordsCount2, chunks2);
 
-		// Convert to line1 iterations per thread
-		jobsPerThread = (jobsPerThread + linesCount2 - 1) / linesCount2;
+	std::vector<diff_info<void>> chunkDiffs;
 
-		std::vector<std::thread> threads;
+	if (DiffCalc<uint64_t>(chunks1.hashes, chunks2.hashes, costLimit)(chunkDiffs))
+		unswapDiffs(chunkDiffs);
 
-		int startLine = 0;
+	diffs.clear();
 
-		for (int th = 0; th < threadsCount; ++th)
-		{
-			const int endLine = ((th == (threadsCount - 1)) ? linesCount1 : (startLine + jobsPerThread));
+	std::vector<diff_info<void>> sectionDiffs;
 
-			LOGD("Thread " + std::to_string(th + 1) + " line1 range: " + std::to_string(startLine) + " to " +
-					std::to_string(endLine - 1) + "\n");
+	// The words between the matched chunks - [start1, end1) and [start2, end2)
+	int start1 = 0;
+	int start2 = 0;
+	int end1 = 0;
+	int end2 = 0;
 
-			try
+	auto diffSection =
+		[&]()
+		{
+			if (end1 > start1 && end2 > start2)
 			{
-				threads.emplace_back(std::bind(threadFn, startLine, endLine));
+				if (DiffCalc<uint64_t>(wordHashes1 + start1, end1 - start1, wordHashes2 + start2, end2 - start2,
+						costLimit)(sectionDiffs, doDiffsCombine, doBoundaryShift))
+					unswapDiffs(sectionDiffs);
+
+				for (const auto& sd: sectionDiffs)
+					appendDiff(diffs, sd.type, sd.off + ((sd.type == diff_type::DIFF_IN_2) ? start2 : start1), sd.len);
 			}
-			catch (...)
+			else
 			{
-				workFn(startLine, linesCount1);
-				break;
+				appendDiff(diffs, diff_type::DIFF_IN_1, start1, end1 - start1);
+				appendDiff(diffs, diff_type::DIFF_IN_2, start2, end2 - start2);
 			}
 
-			startLine += jobsPerThread;
-		}
-
-		for (auto& th : threads)
-			th.join();
-	}
+			start1 = end1;
+			start2 = end2;
+		};
 
-#else
+	int chunk1 = 0;
+	int chunk2 = 0;
 
-	workFn(0, linesCount1);
+	for (const auto& cd: chunkDiffs)
+	{
+		if (cd.type == diff_type::DIFF_IN_1)
+		{
+			chunk1 += cd.len;
+			end1 = chunks1.offsets[chunk1];
 
-#endif // MULTITHREAD
+			continue;
+		}
 
-	return lines1Convergence;
-}
+		if (cd.type == diff_type::DIFF_IN_2)
+		{
+			chunk2 += cd.len;
+			end2 = chunks2.offsets[chunk2];
 
+			continue;
+		}
 
-bool compareBlocks(const DocCmpInfo& doc1, const DocCmpInfo& doc2, diffInfo& blockDiff1, diffInfo& blockDiff2,
-		const CompareOptions& options)
-{
-	std::vector<std::set<LinesConv>> orderedLinesConvergence =
-			getOrderedConvergence(doc1, doc2, blockDiff1, blockDiff2, options);
+		for (int i = 0; i < cd.len; ++i, ++chunk1, ++chunk2)
+		{
+			const int off1 = chunks1.offsets[chunk1];
+			const int off2 = chunks2.offsets[chunk2];
+			const int len1 = chunks1.offsets[chunk1 + 1] - off1;
+			const int len2 = chunks2.offsets[chunk2 + 1] - off2;
 
-	{
-		progress_ptr& progress = ProgressDlg::Get();
+			// The chunks hashes can collide
+			if (len1 == len2 && std::equal(wordHashes1 + off1, wordHashes1 + off1 + len1, wordHashes2 + off2))
+			{
+				diffSection();
+				appendDiff(diffs, diff_type::DIFF_MATCH, off1, len1);
 
-		if (progress && progress->IsCancelled())
-			return false;
-	}
+				start1 += len1;
+				start2 += len2;
+			}
 
-#ifdef DLOG
-	for (const auto& oc: orderedLinesConvergence)
-	{
-		if (!oc.empty())
-			LOGD("Best Matching Lines: " + std::to_string(doc1.lines[oc.begin()->line1 + blockDiff1.off].line + 1) +
-					" and " + std::to_string(doc2.lines[oc.begin()->line2 + blockDiff2.off].line + 1) + "\n");
+			end1 = off1 + len1;
+			end2 = off2 + len2;
+		}
 	}
-#endif
 
-	std::map<int, int> bestLineMappings; // line2 -> line1
-	{
-		std::vector<std::map<int, int>> groupedLines;
+	end1 = wordsCount1;
+	end2 = wordsCount2;
 
-		for (const auto& oc: orderedLinesConvergence)
-		{
-			if (oc.empty())
-				continue;
+	diffSection();
 
-			if (groupedLines.empty())
-			{
-				auto ocItr = oc.begin();
+	return false;
+}
 
-				groupedLines.emplace_back();
-				groupedLines.back().emplace(ocItr->line2, ocItr->line1);
 
-				continue;
-			}
+// The chars count of the matching words - the long lines are compared that way instead of char by char
+int getWordMatchesLen(const Word* words1, const std::vector<diff_info<void>>& wordDiffs)
+{
+	int matchesLen = 0;
 
-			int addToIdx = -1;
+	for (const auto& wd: wordDiffs)
+	{
+		if (wd.type == diff_type::DIFF_MATCH)
+		{
+			for (int i = 0; i < wd.len; ++i)
+				matchesLen += words1[wd.off + i].len;
+		}
+	}
 
-			for (auto ocItr = oc.begin(); ocItr != oc.end(); ++ocItr)
-			{
-				for (int i = 0; i < static_cast<int>(groupedLines.size()); ++i)
-				{
-					const auto& gl = groupedLines[i];
+	return matchesLen;
+}
 
-					if ((ocItr->line2) > (gl.rbegin()->first))
-					{
-						if (addToIdx == -1)
-						{
-							addToIdx = i;
-						}
-						else if (groupedLines[addToIdx].size() < gl.size())
-						{
-							groupedLines.erase(groupedLines.begin() + addToIdx);
-							addToIdx = --i;
-						}
-						else
-						{
-							groupedLines.erase(groupedLines.begin() + i);
-							--i;
-						}
-					}
-				}
 
-				if (addToIdx != -1)
-				{
-					auto& gl = groupedLines[addToIdx];
-					gl.emplace_hint(gl.end(), ocItr->line2, ocItr->line1);
+// Verifies the matched words content, returns the number of hash collisions found
+int verifyWordMatches(std::vector<diff_info<void>>& wordDiffs,
+		const DocCmpInfo& doc1, int line1, const Word* words1,
+		const DocCmpInfo& doc2, int line2, const Word* words2, const CompareOptions& options)
+{
+	const span_t& span1 = doc1.lineSpan(line1);
+	const span_t& span2 = doc2.lineSpan(line2);
 
-					break;
-				}
-			}
+	std::vector<char> buf1;
+	std::vector<char> buf2;
 
-			if (addToIdx != -1)
-				continue;
+	bool foldASCII1;
+	bool foldASCII2;
 
-			auto ocrItr = oc.rbegin();
+	const char* text1 = getSnapshotText(doc1, span1.off, span1.len, options.ignoreCase, buf1, foldASCII1);
+	const char* text2 = getSnapshotText(doc2, span2.off, span2.len, options.ignoreCase, buf2, foldASCII2);
 
-			std::map<int, int> subGroup;
+	return splitHashCollisions(wordDiffs,
+		[&](int off1, int off2) -> bool
+		{
+			const Word& word1 = words1[off1];
+			const Word& word2 = words2[off2];
+
+			// Code literals can have spaces
+			return ((options.ignoreSpaces || word1.len == word2.len) &&
+					isTextEqual(text1 + word1.pos, word1.len, foldASCII1, text2 + word2.pos, word2.len, foldASCII2,
+							options.ignoreSpaces));
+		});
+}
 
-			for (int i = 0; i < static_cast<int>(groupedLines.size()); ++i)
-			{
-				auto& gl = groupedLines[i];
 
-				auto glResItr = gl.emplace(ocrItr->line2, ocrItr->line1);
+// Finds the best single matching block in the other file looking up only the lines with the same hash
+void findBestMatch(const CompareInfo& cmpInfo, const LinesIndex& matchIndex, const diffInfo& lookupDiff,
+		int lookupOff, MatchInfo& mi)
+{
+	mi.matchLen		= 0;
+	mi.matchDiff	= nullptr;
 
-				if (glResItr.second)
-				{
-					std::map<int, int> newSubGroup;
-					auto sgEndItr = glResItr.first;
+	const std::vector<Line>* pLookupLines;
+	const std::vector<Line>* pMatchLines;
 
-					newSubGroup.insert(gl.begin(), ++sgEndItr);
-					gl.erase(glResItr.first);
+	if (lookupDiff.type == diff_type::DIFF_IN_1)
+	{
+		pLookupLines	= &cmpInfo.doc1.lines;
+		pMatchLines		= &cmpInfo.doc2.lines;
+	}
+	else
+	{
+		pLookupLines	= &cmpInfo.doc2.lines;
+		pMatchLines		= &cmpInfo.doc1.lines;
+	}
 
-					if (newSubGroup.size() > subGroup.size())
-						subGroup = std::move(newSubGroup);
-				}
-			}
+	auto candidates = matchIndex.find((*pLookupLines)[lookupDiff.off + lookupOff].hash);
 
-			if (!subGroup.empty())
-			{
-				groupedLines.emplace_back(std::move(subGroup));
+	if (candidates == matchIndex.end())
+		return;
 
-				LOGD("New lines group (" + std::to_string(groupedLines.size()) + " total). Last lines: " +
-						std::to_string(doc1.lines[ocrItr->line1 + blockDiff1.off].line + 1) + " - " +
-						std::to_string(doc2.lines[ocrItr->line2 + blockDiff2.off].line + 1) + "\n");
-			}
-		}
+	int minMatchLen = 1;
 
-		if (groupedLines.empty())
-			return true;
+	int currentDiffIdx	= -1;
+	bool skipDiff		= false;
+	int nextMatchOff	= 0;
 
-		int bestGroupIdx = 0;
-		std::size_t bestSize = groupedLines[0].size();
+	for (const auto& candidate: candidates->second)
+	{
+		const diffInfo& matchDiff = cmpInfo.blockDiffs[candidate.first];
 
-		for (int i = 1; i < static_cast<int>(groupedLines.size()); ++i)
+		// Block diffs shorter than the best match so far cannot contain a better one
+		if (candidate.first != currentDiffIdx)
 		{
-			if (bestSize < groupedLines[i].size())
-			{
-				bestSize = groupedLines[i].size();
-				bestGroupIdx = i;
-			}
+			currentDiffIdx	= candidate.first;
+			skipDiff		= (matchDiff.len < minMatchLen);
+			nextMatchOff	= 0;
 		}
 
-		bestLineMappings = std::move(groupedLines[bestGroupIdx]);
-	}
-
-	compareLines(doc1, doc2, blockDiff1, blockDiff2, bestLineMappings, options);
-
-	return true;
-}
+		if (skipDiff)
+			continue;
 
+		const int matchOff = candidate.second;
 
-void markSection(const DocCmpInfo& doc, const diffInfo& bd, const CompareOptions& options)
-{
-	const int endOff = doc.section.off + doc.section.len;
+		// Skip lines inside the last found match block or in already detected moves
+		if (matchOff < nextMatchOff || matchDiff.info.movedSection(matchOff))
+			continue;
 
-	for (int i = doc.section.off, line = bd.off + doc.section.off; i < endOff; ++i, ++line)
-	{
-		int movedLen = bd.info.movedSection(i);
+		int lookupStart	= lookupOff - 1;
+		int matchStart	= matchOff - 1;
 
-		if (movedLen > doc.section.len)
-			movedLen = doc.section.len;
+		// Check for the beginning of the matched block (containing lookupOff element)
+		for (; lookupStart >= 0 && matchStart >= 0 &&
+				(*pLookupLines)[lookupDiff.off + lookupStart] == (*pMatchLines)[matchDiff.off + matchStart] &&
+				!lookupDiff.info.movedSection(lookupStart) && !matchDiff.info.movedSection(matchStart);
+				--lookupStart, --matchStart);
 
-		if (movedLen == 0)
-		{
-			int prevLine = doc.lines[line].line + 1;
+		++lookupStart;
+		++matchStart;
 
-			for (; (i < endOff) && (bd.info.movedSection(i) == 0); ++i, ++line)
-			{
-				const int docLine = doc.lines[line].line;
-				const int mark = (doc.nonUniqueLines.find(docLine) == doc.nonUniqueLines.end()) ? doc.blockDiffMask :
-						(doc.blockDiffMask == MARKER_MASK_ADDED) ? MARKER_MASK_ADDED_LOCAL : MARKER_MASK_REMOVED_LOCAL;
+		int lookupEnd	= lookupOff + 1;
+		int matchEnd	= matchOff + 1;
 
-				CallScintilla(doc.view, SCI_MARKERADDSET, docLine, mark);
+		// Check for the end of the matched block (containing lookupOff element)
+		for (; lookupEnd < lookupDiff.len && matchEnd < matchDiff.len &&
+				(*pLookupLines)[lookupDiff.off + lookupEnd] == (*pMatchLines)[matchDiff.off + matchEnd] &&
+				!lookupDiff.info.movedSection(lookupEnd) && !matchDiff.info.movedSection(matchEnd);
+				++lookupEnd, ++matchEnd);
 
-				if (options.ignoreEmptyLines && !options.neverMarkIgnored)
-				{
-					for (; prevLine < docLine; ++prevLine)
-						CallScintilla(doc.view, SCI_MARKERADDSET, prevLine, doc.blockDiffMask & MARKER_MASK_LINE);
+		const int matchLen = lookupEnd - lookupStart;
 
-					prevLine = docLine + 1;
-				}
-			}
+		if (mi.matchLen < matchLen)
+		{
+			mi.lookupOff	= lookupStart;
+			mi.matchDiff	= const_cast<diffInfo*>(&matchDiff);
+			mi.matchOff		= matchStart;
+			mi.matchLen		= matchLen;
 
-			--i;
-			--line;
+			minMatchLen		= matchLen;
+			nextMatchOff	= matchEnd;
 		}
-		else if (movedLen == 1)
+		else if (mi.matchLen == matchLen)
 		{
-			CallScintilla(doc.view, SCI_MARKERADDSET, doc.lines[line].line, MARKER_MASK_MOVED_LINE);
+			mi.matchDiff	= nullptr;
+			nextMatchOff	= matchEnd;
 		}
-		else
-		{
-			CallScintilla(doc.view, SCI_MARKERADDSET, doc.lines[line].line, MARKER_MASK_MOVED_BEGIN);
+	}
+}
 
-			i += --movedLen;
 
+// Recursively resolve the best match
+bool resolveMatch(const CompareInfo& cmpInfo, const LinesIndex (&indexes)[2], diffInfo& lookupDiff, int lookupOff,
+		MatchInfo& lookupMi)
+{
+	bool ret = false;
+
+	if (lookupMi.matchDiff)
+	{
+		lookupOff = lookupMi.matchOff + (lookupOff - lookupMi.lookupOff);
+
+		MatchInfo reverseMi;
+		findBestMatch(cmpInfo, indexes[lookupDiff.type == diff_type::DIFF_IN_1 ? 0 : 1], *(lookupMi.matchDiff),
+				lookupOff, reverseMi);
+
+		if ((reverseMi.matchDiff == &lookupDiff) && (reverseMi.matchOff == lookupMi.lookupOff))
+		{
+			LOGD("Move match found, len: " + std::to_string(lookupMi.matchLen) + "\n");
+
+			lookupDiff.info.addMove(lookupMi.lookupOff, lookupMi.matchLen);
+			lookupMi.matchDiff->info.addMove(lookupMi.matchOff, lookupMi.matchLen);
+			ret = true;
+		}
+		else if (reverseMi.matchDiff)
+		{
+			ret = resolveMatch(cmpInfo, indexes, *(lookupMi.matchDiff), lookupOff, reverseMi);
+			lookupMi.matchLen = 0;
+		}
+	}
+
+	return ret;
+}
+
+
+void findMoves(CompareInfo& cmpInfo)
+{
+	LOGD("FIND MOVES\n");
+
+	// The unmatched lines of both documents are indexed once - block diffs do not change while moves are searched
+	LinesIndex indexes[2];
+
+	const int blockDiffsSize = static_cast<int>(cmpInfo.blockDiffs.size());
+
+	for (int i = 0; i < blockDiffsSize; ++i)
+	{
+		const diffInfo& bd = cmpInfo.blockDiffs[i];
+
+		if (bd.type == diff_type::DIFF_MATCH)
+			continue;
+
+		const bool inDoc1 = (bd.type == diff_type::DIFF_IN_1);
+
+		const std::vector<Line>& lines = inDoc1 ? cmpInfo.doc1.lines : cmpInfo.doc2.lines;
+		LinesIndex& index = indexes[inDoc1 ? 0 : 1];
+
+		for (int off = 0; off < bd.len; ++off)
+			index[lines[bd.off + off].hash].emplace_back(i, off);
+	}
+
+	bool repeat = true;
+
+	while (repeat)
+	{
+		repeat = false;
+
+		for (diffInfo& lookupDiff: cmpInfo.blockDiffs)
+		{
+			if (lookupDiff.type != diff_type::DIFF_IN_1)
+				continue;
+
+			LOGD("Check D1 with off: " + std::to_string(cmpInfo.doc1.lines[lookupDiff.off].line + 1) + "\n");
+
+			// Go through all lookupDiff's elements and check if each is matched
+			for (int lookupEi = 0; lookupEi < lookupDiff.len; ++lookupEi)
+			{
+				// Skip already detected moves
+				if (lookupDiff.info.getNextUnmoved(lookupEi))
+				{
+					if (lookupEi >= lookupDiff.len)
+						break;
+				}
+
+				MatchInfo mi;
+				findBestMatch(cmpInfo, indexes[1], lookupDiff, lookupEi, mi);
+
+				if (resolveMatch(cmpInfo, indexes, lookupDiff, lookupEi, mi))
+				{
+					repeat = true;
+
+					if (mi.matchLen)
+						lookupEi = mi.lookupOff + mi.matchLen - 1;
+					else
+						--lookupEi;
+				}
+			}
+		}
+	}
+}
+
+
+// Sections of a DIFF_IN_1 and a DIFF_IN_2 block diff sharing fingerprints
+struct FuzzyMove
+{
+	int			block1;
+	int			block2;
+	section_t	sec1;
+	section_t	sec2;
+	int			hitsCount;
+};
+
+
+// Winnowed fingerprints of the block diff windows of unmoved lines - pairs of fingerprint and window offset.
+// The windows hashes are rolled line by line
+std::vector<std::pair<uint64_t, int>> getFingerprints(const std::vector<Line>& lines, const diffInfo& bd)
+{
+	static const uint64_t cPrime = 0x100000001B3ULL;
+
+	uint64_t firstLineWeight = 1;
+
+	for (int i = 1; i < cFuzzyMoveWindowLines; ++i)
+		firstLineWeight *= cPrime;
+
+	std::vector<std::pair<uint64_t, int>> fingerprints;
+	std::vector<std::pair<uint64_t, int>> windows;
+
+	for (int off = 0; off < bd.len;)
+	{
+		if (bd.info.getNextUnmoved(off))
+			continue;
+
+		const auto move = bd.info.nextMove(off);
+		const int runEnd = (move != bd.info.moves.end()) ? move->off : bd.len;
+
+		windows.clear();
+
+		uint64_t hash = 0;
+
+		for (int i = off; i < runEnd; ++i)
+		{
+			if (i - off >= cFuzzyMoveWindowLines)
+				hash -= lines[bd.off + i - cFuzzyMoveWindowLines].hash * firstLineWeight;
+
+			hash = hash * cPrime + lines[bd.off + i].hash;
+
+			if (i - off + 1 >= cFuzzyMoveWindowLines)
+				windows.emplace_back(hash, i + 1 - cFuzzyMoveWindowLines);
+		}
+
+		off = runEnd;
+
+		const int windowsCount = static_cast<int>(windows.size());
+
+		if (windowsCount == 0)
+			continue;
+
+		const int winnowing = std::min(cFuzzyMoveWinnowing, windowsCount);
+
+		int lastPicked = -1;
+
+		for (int i = 0; i + winnowing <= windowsCount; ++i)
+		{
+			int minIdx = i;
+
+			for (int j = i + 1; j < i + winnowing; ++j)
+			{
+				if (windows[j].first <= windows[minIdx].first)
+					minIdx = j;
+			}
+
+			if (minIdx != lastPicked)
+			{
+				fingerprints.emplace_back(windows[minIdx]);
+				lastPicked = minIdx;
+			}
+		}
+	}
+
+	return fingerprints;
+}
+
+
+// Extends the sections over the matching lines around them - single edited lines followed by matching ones are taken
+// as well since the fingerprints of the windows with edited lines are lost
+void extendFuzzyMove(const CompareInfo& cmpInfo, const diffInfo& bd1, section_t& sec1, const diffInfo& bd2,
+		section_t& sec2)
+{
+	auto isMatch =
+		[&](int off1, int off2, int len)
+		{
+			if (off1 < 0 || off2 < 0 || off1 + len > bd1.len || off2 + len > bd2.len)
+				return false;
+
+			for (int i = 0; i < len; ++i)
+			{
+				if (cmpInfo.doc1.lines[bd1.off + off1 + i] != cmpInfo.doc2.lines[bd2.off + off2 + i])
+					return false;
+			}
+
+			return true;
+		};
+
+	for (;;)
+	{
+		const int end1 = sec1.off + sec1.len;
+		const int end2 = sec2.off + sec2.len;
+
+		int len = 0;
+
+		if (isMatch(end1, end2, 1))
+			len = 1;
+		else if (isMatch(end1 + 1, end2 + 1, cFuzzyMoveWindowLines))
+			len = 1 + cFuzzyMoveWindowLines;
+		else
+			break;
+
+		sec1.len += len;
+		sec2.len += len;
+	}
+
+	for (;;)
+	{
+		int len = 0;
+
+		if (isMatch(sec1.off - 1, sec2.off - 1, 1))
+			len = 1;
+		else if (isMatch(sec1.off - 1 - cFuzzyMoveWindowLines, sec2.off - 1 - cFuzzyMoveWindowLines,
+				cFuzzyMoveWindowLines))
+			len = 1 + cFuzzyMoveWindowLines;
+		else
+			break;
+
+		sec1.off -= len;
+		sec1.len += len;
+		sec2.off -= len;
+		sec2.len += len;
+	}
+}
+
+
+inline bool isMoveOverlapped(const diffInfo& bd, const section_t& sec)
+{
+	const auto move = bd.info.nextMove(sec.off);
+
+	return (move != bd.info.moves.end() && move->off < sec.off + sec.len);
+}
+
+
+// Compares the sections words - they are similar if most of them match
+bool areSectionsSimilar(const DocCmpInfo& doc1, const diffInfo& bd1, const section_t& sec1,
+		const DocCmpInfo& doc2, const diffInfo& bd2, const section_t& sec2, const CompareOptions& options)
+{
+	diffInfo region1;
+	diffInfo region2;
+
+	region1.type	= bd1.type;
+	region1.off		= bd1.off + sec1.off;
+	region1.len		= sec1.len;
+
+	region2.type	= bd2.type;
+	region2.off		= bd2.off + sec2.off;
+	region2.len		= sec2.len;
+
+	BlockWords words1;
+	BlockWords words2;
+
+	getBlockWords(doc1, region1, options, words1);
+	getBlockWords(doc2, region2, options, words2);
+
+	const int wordsCount = static_cast<int>(words1.hashes.size() + words2.hashes.size());
+
+	if (wordsCount == 0)
+		return false;
+
+	// Costlier diffs can't have enough matches
+	const int costLimit = std::max(wordsCount * (100 - cMinFuzzyMoveMatchPercent) / 100, cMinDiffCostLimit);
+
+	std::vector<diff_info<void>> diffs;
+
+	DiffCalc<uint64_t>(words1.hashes, words2.hashes, costLimit)(diffs);
+
+	int matchLen = 0;
+
+	for (const auto& d: diffs)
+	{
+		if (d.type == diff_type::DIFF_MATCH)
+			matchLen += d.len;
+	}
+
+	return (matchLen * 200 >= wordsCount * cMinFuzzyMoveMatchPercent);
+}
+
+
+// A line is not unique if its hash is found in the other document. The doc1 hashes are put in an open addressing
+// table with linear probing, a state per slot tells if the hash is also found in doc2 - nothing is allocated per line
+void findUniqueLines(CompareInfo& cmpInfo)
+{
+	DocCmpInfo& doc1 = cmpInfo.doc1;
+	DocCmpInfo& doc2 = cmpInfo.doc2;
+
+	const size_t linesCount1 = doc1.lines.size();
+
+	// The table is kept at most two-thirds full
+	int tableBits = 4;
+
+	while ((static_cast<size_t>(1) << tableBits) < linesCount1 + linesCount1 / 2)
+		++tableBits;
+
+	const size_t tableMask = (static_cast<size_t>(1) << tableBits) - 1;
+
+	enum : char { EMPTY = 0, IN_DOC1, IN_BOTH };
+
+	std::vector<uint64_t>	hashes(tableMask + 1);
+	std::vector<char>		states(tableMask + 1, EMPTY);
+
+	auto findSlot =
+		[&](uint64_t hash) -> size_t
+		{
+			size_t slot = static_cast<size_t>((hash * 0x9E3779B97F4A7C15ULL) >> (64 - tableBits));
+
+			while (states[slot] != EMPTY && hashes[slot] != hash)
+				slot = (slot + 1) & tableMask;
+
+			return slot;
+		};
+
+	for (const auto& line: doc1.lines)
+	{
+		const size_t slot = findSlot(line.hash);
+
+		if (states[slot] == EMPTY)
+		{
+			hashes[slot] = line.hash;
+			states[slot] = IN_DOC1;
+		}
+	}
+
+	doc1.nonUniqueLines.reset(static_cast<int>(doc1.lineSpans.size()));
+	doc2.nonUniqueLines.reset(static_cast<int>(doc2.lineSpans.size()));
+
+	for (const auto& line: doc2.lines)
+	{
+		const size_t slot = findSlot(line.hash);
+
+		if (states[slot] != EMPTY)
+		{
+			states[slot] = IN_BOTH;
+			doc2.nonUniqueLines.set(line.line - doc2.firstLine);
+		}
+	}
+
+	for (const auto& line: doc1.lines)
+	{
+		if (states[findSlot(line.hash)] == IN_BOTH)
+			doc1.nonUniqueLines.set(line.line - doc1.firstLine);
+	}
+}
+
+
+// The matching chars runs are found on the whole vectors first and only then cut at the first char the filter rejects
+// so the filter is not called at all when it accepts every char
+template <typename CharFilter>
+inline int matchBeginEnd(diffInfo& blockDiff1, diffInfo& blockDiff2,
+		const SectionChars& sec1, const SectionChars& sec2,
+		int off1, int off2, int end1, int end2, CharFilter charFilter_fn)
+{
+	const int size1 = sec1.size();
+	const int size2 = sec2.size();
+
+	const int minSecSize = std::min(size1, size2);
+
+	const char* chars1 = sec1.chars.data();
+
+	int startMatch = diff_match_fwd(chars1, sec2.chars.data(), minSecSize);
+
+	for (int i = 0; i < startMatch; ++i)
+	{
+		if (!charFilter_fn(chars1[i]))
+		{
+			startMatch = i;
+			break;
+		}
+	}
+
+	int endMatch = diff_match_bwd(chars1 + size1, sec2.chars.data() + size2, minSecSize - startMatch);
+
+	for (int i = 0; i < endMatch; ++i)
+	{
+		if (!charFilter_fn(chars1[size1 - i - 1]))
+		{
+			endMatch = i;
+			break;
+		}
+	}
+
+	if (startMatch || endMatch)
+	{
+		section_t change;
+
+		if (size1 > startMatch + endMatch)
+		{
+			change.off = off1;
+			if (startMatch)
+				change.off += sec1.pos(startMatch);
+
+			change.len = (endMatch ? sec1.pos(size1 - endMatch - 1) + 1 + off1 : end1) - change.off;
+
+			if (change.len > 0)
+				blockDiff1.info.changedLines.back().changes.emplace_back(change);
+		}
+
+		if (size2 > startMatch + endMatch)
+		{
+			change.off = off2;
+			if (startMatch)
+				change.off += sec2.pos(startMatch);
+
+			change.len = (endMatch ? sec2.pos(size2 - endMatch - 1) + 1 + off2 : end2) - change.off;
+
+			if (change.len > 0)
+				blockDiff2.info.changedLines.back().changes.emplace_back(change);
+		}
+	}
+
+	return (startMatch + endMatch);
+}
+
+
+void compareLines(const DocCmpInfo& doc1, const DocCmpInfo& doc2, diffInfo& blockDiff1, diffInfo& blockDiff2,
+		const BlockWords& words1, const BlockWords& words2, const std::vector<std::pair<int, int>>& lineMappings,
+		const CompareOptions& options, int& hashCollisions, int& subDiffs)
+{
+	// Diff results memory is reused for all lines
+	std::vector<diff_info<void>> lineDiffs;
+	std::vector<diff_info<void>> sectionDiffs;
+
+	BitDiff<char> bitDiff;
+
+	for (const auto& lm: lineMappings)
+	{
+		int line1 = lm.first;
+		int line2 = lm.second;
+
+		LOGD("Compare Lines " + std::to_string(doc1.lines[blockDiff1.off + line1].line + 1) + " and " +
+				std::to_string(doc2.lines[blockDiff2.off + line2].line + 1) + "\n");
+
+		const Word* pLine1 = words1.lineWords(line1);
+		const Word* pLine2 = words2.lineWords(line2);
+
+		int wordsCount1 = words1.wordsCount(line1);
+		int wordsCount2 = words2.wordsCount(line2);
+
+		const DocCmpInfo* pDoc1 = &doc1;
+		const DocCmpInfo* pDoc2 = &doc2;
+
+		diffInfo* pBlockDiff1 = &blockDiff1;
+		diffInfo* pBlockDiff2 = &blockDiff2;
+
+		++subDiffs;
+
+		// First use word granularity (find matching words) for better precision
+		if (diffWords(words1.lineHashes(line1), wordsCount1, words2.lineHashes(line2), wordsCount2, lineDiffs,
+				!options.charPrecision, true, options))
+		{
+			std::swap(pDoc1, pDoc2);
+			std::swap(pBlockDiff1, pBlockDiff2);
+			std::swap(pLine1, pLine2);
+			std::swap(wordsCount1, wordsCount2);
+			std::swap(line1, line2);
+		}
+
+		if (options.verifyMatches)
+			hashCollisions += verifyWordMatches(lineDiffs, *pDoc1, pDoc1->lines[line1 + pBlockDiff1->off].line, pLine1,
+					*pDoc2, pDoc2->lines[line2 + pBlockDiff2->off].line, pLine2, options);
+
+		const int lineDiffsSize = static_cast<int>(lineDiffs.size());
+
+		PRINT_DIFFS("WORD DIFFS", lineDiffs);
+
+		pBlockDiff1->info.changedLines.emplace_back(line1);
+		pBlockDiff2->info.changedLines.emplace_back(line2);
+
+		const intptr_t lineOff1 = pDoc1->lineSpan(pDoc1->lines[line1 + pBlockDiff1->off].line).off;
+		const intptr_t lineOff2 = pDoc2->lineSpan(pDoc2->lines[line2 + pBlockDiff2->off].line).off;
+
+		int lineLen1 = 0;
+		int lineLen2 = 0;
+
+		for (int i = 0; i < wordsCount1; ++i)
+			lineLen1 += pLine1[i].len;
+
+		for (int i = 0; i < wordsCount2; ++i)
+			lineLen2 += pLine2[i].len;
+
+		int totalLineMatchLen = 0;
+
+		for (int i = 0; i < lineDiffsSize; ++i)
+		{
+			const auto& ld = lineDiffs[i];
+
+			if (ld.type == diff_type::DIFF_MATCH)
+			{
+				for (int j = 0; j < ld.len; ++j)
+					totalLineMatchLen += pLine1[ld.off + j].len;
+			}
+			else if (ld.type == diff_type::DIFF_IN_2)
+			{
+				section_t change;
+
+				change.off = pLine2[ld.off].pos;
+				change.len = pLine2[ld.off + ld.len - 1].pos + pLine2[ld.off + ld.len - 1].len - change.off;
+
+				pBlockDiff2->info.changedLines.back().changes.emplace_back(change);
+			}
+			else
+			{
+				// Resolve words mismatched DIFF_IN_1 / DIFF_IN_2 pairs to find possible sub-word similarities
+				if ((i + 1 < lineDiffsSize) && (lineDiffs[i + 1].type == diff_type::DIFF_IN_2))
+				{
+					const auto& ld2 = lineDiffs[i + 1];
+
+					int off1 = pLine1[ld.off].pos;
+					int end1 = pLine1[ld.off + ld.len - 1].pos + pLine1[ld.off + ld.len - 1].len;
+
+					int off2 = pLine2[ld2.off].pos;
+					int end2 = pLine2[ld2.off + ld2.len - 1].pos + pLine2[ld2.off + ld2.len - 1].len;
+
+					const SectionChars sec1 = getSectionChars(*pDoc1, off1 + lineOff1, end1 + lineOff1, options);
+					const SectionChars sec2 = getSectionChars(*pDoc2, off2 + lineOff2, end2 + lineOff2, options);
+
+					if (options.charPrecision)
+					{
+						LOGD("Compare Sections " +
+								std::to_string(off1 + 1) + " to " +
+								std::to_string(end1 + 1) + " and " +
+								std::to_string(off2 + 1) + " to " +
+								std::to_string(end2 + 1) + "\n");
+
+						const auto* pSec1 = &sec1;
+						const auto* pSec2 = &sec2;
+
+						diffInfo* pBD1 = pBlockDiff1;
+						diffInfo* pBD2 = pBlockDiff2;
+
+						++subDiffs;
+
+						// Compare changed words
+						if (diffChars(sec1, sec2, bitDiff, sectionDiffs, options))
+						{
+							std::swap(pSec1, pSec2);
+							std::swap(pBD1, pBD2);
+							std::swap(off1, off2);
+							std::swap(end1, end2);
+						}
+
+						PRINT_DIFFS("CHAR DIFFS", sectionDiffs);
+
+						int matchLen = 0;
+						int matchSections = 0;
+
+						for (const auto& sd: sectionDiffs)
+						{
+							if (sd.type == diff_type::DIFF_MATCH)
+							{
+								matchLen += sd.len;
+								++matchSections;
+							}
+						}
+
+						if (matchSections)
+						{
+							LOGD("Matching sections found: " + std::to_string(matchSections) +
+									", matched len: " + std::to_string(matchLen) + "\n");
+
+							// Are similarities a considerable portion of the diff?
+							if ((int)((matchLen * 100) / std::max(sec1.size(), sec2.size())) >=
+								options.changedThresholdPercent)
+							{
+								for (const auto& sd: sectionDiffs)
+								{
+									if (sd.type == diff_type::DIFF_IN_1)
+									{
+										section_t change;
+
+										change.off = pSec1->pos(sd.off) + off1;
+										change.len = pSec1->pos(sd.off + sd.len - 1) + off1 + 1 - change.off;
+
+										pBD1->info.changedLines.back().changes.emplace_back(change);
+									}
+									else if (sd.type == diff_type::DIFF_IN_2)
+									{
+										section_t change;
+
+										change.off = pSec2->pos(sd.off) + off2;
+										change.len = pSec2->pos(sd.off + sd.len - 1) + off2 + 1 - change.off;
+
+										pBD2->info.changedLines.back().changes.emplace_back(change);
+									}
+								}
+
+								totalLineMatchLen += matchLen;
+
+								LOGD("Whole section checked for matches\n");
+
+								++i;
+								continue;
+							}
+							// If not, mark only beginning and ending diff section matches
+							else
+							{
+								const int matches =
+										matchBeginEnd(*pBD1, *pBD2, *pSec1, *pSec2, off1, off2, end1, end2,
+												[](char) { return true; });
+
+								if (matches)
+								{
+									totalLineMatchLen += matches;
+
+									++i;
+									continue;
+								}
+							}
+
+							// No matching sections between the lines found - move to next lines
+							if (lineDiffsSize == 2)
+								break;
+						}
+					}
+					// Always match non-alphabetical characters in the beginning and at the end
+					else
+					{
+						const int matches =
+								matchBeginEnd(*pBlockDiff1, *pBlockDiff2, sec1, sec2, off1, off2, end1, end2,
+										[](char ch) { return (getCharType(ch) != charType::ALPHANUMCHAR); });
+
+						if (matches)
+						{
+							totalLineMatchLen += matches;
+
+							++i;
+							continue;
+						}
+
+						// No matching sections between the lines found - move to next lines
+						if (lineDiffsSize == 2)
+							break;
+					}
+				}
+
+				section_t change;
+
+				change.off = pLine1[ld.off].pos;
+				change.len = pLine1[ld.off + ld.len - 1].pos + pLine1[ld.off + ld.len - 1].len - change.off;
+
+				pBlockDiff1->info.changedLines.back().changes.emplace_back(change);
+			}
+		}
+
+		// Not enough portion of the lines matches - consider them totally different
+		if (((totalLineMatchLen * 100) / std::max(lineLen1, lineLen2)) < options.changedThresholdPercent)
+		{
+			pBlockDiff1->info.changedLines.pop_back();
+			pBlockDiff2->info.changedLines.pop_back();
+		}
+	}
+}
+
+
+BlockConvergence getOrderedConvergence(const DocCmpInfo& doc1, const DocCmpInfo& doc2,
+		const diffInfo& blockDiff1, const diffInfo& blockDiff2, const BlockWords& words1, const BlockWords& words2,
+		const CompareOptions& options)
+{
+	// Only the lines2 chars are kept for the whole block - each line1 chars are got while its row is processed
+	const std::vector<SectionChars> chunk2 = getChars(doc2, blockDiff2, options);
+
+	const int linesCount1 = blockDiff1.len;
+	const int linesCount2 = static_cast<int>(chunk2.size());
+
+	std::vector<CharCounts> charCounts2(linesCount2);
+
+	for (int line2 = 0; line2 < linesCount2; ++line2)
+		if (!chunk2[line2].empty())
+			charCounts2[line2] = getCharCounts(chunk2[line2]);
+
+	CompareProgress* progress = getProgress(options);
+
+	// Lines are split in tasks of at least cMinPairsPerTask line pairs that the pool workers balance between them
+	const int linesPerTask =
+			(linesCount2 > 0) ? (cMinPairsPerTask + linesCount2 - 1) / linesCount2 : std::max(linesCount1, 1);
+	const int tasksCount = (linesCount1 + linesPerTask - 1) / linesPerTask;
+
+	// Each task collects its lines convergences in its own buffer so no locking is needed. Buffers are filled in line1
+	// then line2 order with the cMaxLineConvs best convergences of each line1
+	std::vector<std::vector<LinesConv>> tasksConvs(tasksCount);
+	std::vector<int> tasksSubDiffs(tasksCount, 0);
+
+	auto workFn =
+		[&](int task)
+		{
+			const int startLine	= task * linesPerTask;
+			const int endLine	= std::min(startLine + linesPerTask, linesCount1);
+
+			std::vector<LinesConv>& convs = tasksConvs[task];
+			int& subDiffs = tasksSubDiffs[task];
+			convs.reserve(endLine - startLine);
+
+			std::vector<LinesConv> lineConvs;
+
+			std::vector<diff_info<void>> wordDiffs;
+			std::vector<diff_info<void>> charDiffs;
+
+			BitDiff<char> bitDiff;
+
+			int linesProgress = 0;
+
+			for (int line1 = startLine; line1 < endLine; ++line1)
+			{
+				const SectionChars sec1 = getLineChars(doc1, blockDiff1, line1, options);
+
+				if (sec1.empty())
+				{
+					linesProgress += linesCount2;
+					continue;
+				}
+
+				int charCounts1[256];
+
+				countChars(sec1, charCounts1);
+
+				lineConvs.clear();
+
+				// Once line1 has a perfect match only the other identical lines2 can tie with it
+				bool perfectMatch = false;
+
+				for (int line2 = 0; line2 < linesCount2; ++line2)
+				{
+					if (chunk2[line2].empty() || (perfectMatch && chunk2[line2].chars != sec1.chars))
+					{
+						++linesProgress;
+						continue;
+					}
+
+					const int minSize = std::min(sec1.size(), chunk2[line2].size());
+					const int maxSize = std::max(sec1.size(), chunk2[line2].size());
+
+					if (((minSize * 100) / maxSize) < options.changedThresholdPercent)
+					{
+						++linesProgress;
+						continue;
+					}
+
+					// Lines can't match more chars than they have in common - skip the diffs if that is not enough
+					{
+						int commonChars = 0;
+
+						for (const auto& cc: charCounts2[line2])
+							commonChars += std::min(charCounts1[static_cast<unsigned char>(cc.first)], cc.second);
+
+						if (((commonChars * 100) / minSize) < options.changedThresholdPercent)
+						{
+							++linesProgress;
+							continue;
+						}
+					}
+
+					int matchesCount	= 0;
+					int diffsCount		= 0;
+
+					// The matching chars of the long lines are counted by their matching words
+					const bool longLines = (words1.wordsCount(line1) >= cMinLongLineWords ||
+							words2.wordsCount(line2) >= cMinLongLineWords);
+
+					if (!options.charPrecision || longLines)
+					{
+						++subDiffs;
+
+						diffWords(words1.lineHashes(line1), words1.wordsCount(line1),
+								words2.lineHashes(line2), words2.wordsCount(line2), wordDiffs, true, false, options);
+
+						const int wordDiffsSize = static_cast<int>(wordDiffs.size());
+
+						for (int i = 0; i < wordDiffsSize; ++i)
+						{
+							if (wordDiffs[i].type == diff_type::DIFF_MATCH)
+							{
+								++matchesCount;
+							}
+							else
+							{
+								if (options.diffsBasedLineChanges && !options.charPrecision)
+									++diffsCount;
+
+								// Count replacement as a single diff
+								if ((i + 1 < wordDiffsSize) && (wordDiffs[i + 1].type == diff_type::DIFF_IN_2))
+									++i;
+							}
+						}
+
+						if (matchesCount == 0)
+						{
+							++linesProgress;
+							continue;
+						}
+					}
+
+					if (longLines)
+					{
+						// The collisions are counted by the mapped lines compare that verifies them again
+						if (options.verifyMatches)
+							verifyWordMatches(wordDiffs, doc1, doc1.lines[blockDiff1.off + line1].line,
+									words1.lineWords(line1), doc2, doc2.lines[blockDiff2.off + line2].line,
+									words2.lineWords(line2), options);
+
+						matchesCount = getWordMatchesLen(words1.lineWords(line1), wordDiffs);
+					}
+					else
+					{
+						++subDiffs;
+
+						matchesCount = getCharMatchesLen(sec1, chunk2[line2], bitDiff, charDiffs);
+					}
+
+					if (((matchesCount * 100) / minSize) >= options.changedThresholdPercent)
+					{
+						const float lineConvergence = ((static_cast<float>(matchesCount) * 100) / minSize) +
+								((static_cast<float>(matchesCount) * 100) / maxSize);
+
+						lineConvs.emplace_back(Conv(lineConvergence, diffsCount), line1, line2);
+
+						if (matchesCount == maxSize && diffsCount == 0)
+							perfectMatch = true;
+					}
+
+					if ((progress && progress->IsCancelled()) || options.isCancelled())
+						return;
+
+					++linesProgress;
+				}
+
+				// The best convergences are kept, of the equal ones those of the first lines2
+				if (static_cast<int>(lineConvs.size()) > cMaxLineConvs)
+				{
+					std::stable_sort(lineConvs.begin(), lineConvs.end(),
+							[](const LinesConv& lhs, const LinesConv& rhs) { return (lhs.conv > rhs.conv); });
+
+					lineConvs.resize(cMaxLineConvs);
+
+					std::sort(lineConvs.begin(), lineConvs.end(),
+							[](const LinesConv& lhs, const LinesConv& rhs) { return (lhs.line2 < rhs.line2); });
+				}
+
+				convs.insert(convs.end(), lineConvs.begin(), lineConvs.end());
+
+				if (!advanceProgress(options, linesProgress))
+					return;
+
+				linesProgress = 0;
+			}
+
+			advanceProgress(options, linesProgress);
+		};
+
+	{
+		TaskGroup tasks;
+
+		for (int task = 0; task < tasksCount; ++task)
+			tasks.run(std::bind(workFn, task));
+
+		tasks.wait();
+	}
+
+	BlockConvergence blockConv;
+
+	for (int subDiffs: tasksSubDiffs)
+		blockConv.subDiffs += subDiffs;
+
+	if ((progress && progress->IsCancelled()) || options.isCancelled())
+		return blockConv;
+
+	blockConv.lines.resize(linesCount1);
+
+	// Lower than any real convergence
+	const Conv noConv(-1, INT_MAX);
+
+	// Line pairs are kept if they are the best for their line2 or tie with the previous lines best for it
+	std::vector<Conv> bestConv2(linesCount2, noConv);
+
+	for (const auto& convs: tasksConvs)
+	{
+		for (const auto& lc: convs)
+		{
+			if (lc.conv > bestConv2[lc.line2])
+				bestConv2[lc.line2] = lc.conv;
+		}
+	}
+
+	// Best line2 convergences of the lines before the current line1
+	std::vector<Conv> prevBestConv2(linesCount2, noConv);
+
+	for (const auto& convs: tasksConvs)
+	{
+		for (auto lineStart = convs.begin(); lineStart != convs.end();)
+		{
+			const int line1 = lineStart->line1;
+
+			const auto lineEnd = std::find_if(lineStart, convs.end(),
+					[line1](const LinesConv& lc) { return (lc.line1 != line1); });
+
+			// Line1 best convergence among the line2 candidates that the previous lines don't converge better to
+			Conv bestConv1 = noConv;
+
+			for (auto lcItr = lineStart; lcItr != lineEnd; ++lcItr)
+			{
+				if (!(prevBestConv2[lcItr->line2] > lcItr->conv) && (lcItr->conv > bestConv1))
+					bestConv1 = lcItr->conv;
+			}
+
+			section_t& lineConvs = blockConv.lines[line1];
+			lineConvs.off = static_cast<int>(blockConv.convs.size());
+
+			for (auto lcItr = lineStart; lcItr != lineEnd; ++lcItr)
+			{
+				if ((lcItr->conv == bestConv1) &&
+					((lcItr->conv == bestConv2[lcItr->line2]) || (lcItr->conv == prevBestConv2[lcItr->line2])))
+					blockConv.convs.emplace_back(*lcItr);
+
+				if (lcItr->conv > prevBestConv2[lcItr->line2])
+					prevBestConv2[lcItr->line2] = lcItr->conv;
+			}
+
+			lineConvs.len = static_cast<int>(blockConv.convs.size()) - lineConvs.off;
+
+			lineStart = lineEnd;
+		}
+	}
+
+	return blockConv;
+}
+
+
+bool compareBlocks(const DocCmpInfo& doc1, const DocCmpInfo& doc2, diffInfo& blockDiff1, diffInfo& blockDiff2,
+		const CompareOptions& options, int& hashCollisions, int& subDiffs)
+{
+	// Each block line is tokenized once - the words are used by both the convergence and the lines compare
+	BlockWords words1;
+	BlockWords words2;
+
+	getBlockWords(doc1, blockDiff1, options, words1);
+	getBlockWords(doc2, blockDiff2, options, words2);
+
+	const BlockConvergence blockConv =
+			getOrderedConvergence(doc1, doc2, blockDiff1, blockDiff2, words1, words2, options);
+
+	subDiffs = blockConv.subDiffs;
+
+	{
+		CompareProgress* progress = getProgress(options);
+
+		if ((progress && progress->IsCancelled()) || options.isCancelled())
+			return false;
+	}
+
+#ifdef DLOG
+	for (const auto& lineConvs: blockConv.lines)
+	{
+		if (lineConvs.len)
+		{
+			const LinesConv& lc = blockConv.convs[lineConvs.off];
+
+			LOGD("Best Matching Lines: " + std::to_string(doc1.lines[lc.line1 + blockDiff1.off].line + 1) +
+					" and " + std::to_string(doc2.lines[lc.line2 + blockDiff2.off].line + 1) + "\n");
+		}
+	}
+#endif
+
+	const std::vector<std::pair<int, int>> bestLineMappings = getBestLineMappings(blockConv.convs, blockConv.lines);
+
+	if (bestLineMappings.empty())
+		return true;
+
+	LOGD("Best lines mapping length: " + std::to_string(bestLineMappings.size()) + "\n");
+
+	compareLines(doc1, doc2, blockDiff1, blockDiff2, words1, words2, bestLineMappings, options, hashCollisions,
+			subDiffs);
+
+	return true;
+}
+
+
+// Compares the fuzzy move sections line by line. Their unedited lines and the edited ones paired by the blocks compare
+// become the blocks moves - the paired lines changes are kept to be marked. The unpaired lines are left unmoved
+void addFuzzyMove(const CompareInfo& cmpInfo, diffInfo& bd1, const section_t& sec1, diffInfo& bd2,
+		const section_t& sec2, const CompareOptions& options)
+{
+	std::vector<uint64_t> hashes1(sec1.len);
+	std::vector<uint64_t> hashes2(sec2.len);
+
+	for (int i = 0; i < sec1.len; ++i)
+		hashes1[i] = cmpInfo.doc1.lines[bd1.off + sec1.off + i].hash;
+
+	for (int i = 0; i < sec2.len; ++i)
+		hashes2[i] = cmpInfo.doc2.lines[bd2.off + sec2.off + i].hash;
+
+	std::vector<diff_info<void>> lineDiffs;
+
+	DiffCalc<uint64_t>(hashes1, hashes2)(lineDiffs);
+
+	std::vector<char> moved1(sec1.len, 0);
+	std::vector<char> moved2(sec2.len, 0);
+
+	const int lineDiffsSize = static_cast<int>(lineDiffs.size());
+
+	int off1 = 0;
+	int off2 = 0;
+
+	for (int d = 0; d < lineDiffsSize; ++d)
+	{
+		const diff_info<void>& ld = lineDiffs[d];
+
+		if (ld.type == diff_type::DIFF_MATCH)
+		{
+			std::fill_n(moved1.begin() + off1, ld.len, 1);
+			std::fill_n(moved2.begin() + off2, ld.len, 1);
+
+			off1 += ld.len;
+			off2 += ld.len;
+		}
+		else if (ld.type == diff_type::DIFF_IN_2)
+		{
+			off2 += ld.len;
+		}
+		else
+		{
+			const int len2 = (d + 1 < lineDiffsSize && lineDiffs[d + 1].type == diff_type::DIFF_IN_2) ?
+					lineDiffs[++d].len : 0;
+
+			if (len2)
+			{
+				diffInfo region1;
+				diffInfo region2;
+
+				region1.type	= bd1.type;
+				region1.off		= bd1.off + sec1.off + off1;
+				region1.len		= ld.len;
+
+				region2.type	= bd2.type;
+				region2.off		= bd2.off + sec2.off + off2;
+				region2.len		= len2;
+
+				int hashCollisions = 0;
+				int subDiffs = 0;
+
+				compareBlocks(cmpInfo.doc1, cmpInfo.doc2, region1, region2, options, hashCollisions, subDiffs);
+
+				const int changedLinesCount = static_cast<int>(region1.info.changedLines.size());
+
+				for (int j = 0; j < changedLinesCount; ++j)
+				{
+					diffLine& changed1 = region1.info.changedLines[j];
+					diffLine& changed2 = region2.info.changedLines[j];
+
+					moved1[off1 + changed1.line] = 1;
+					moved2[off2 + changed2.line] = 1;
+
+					changed1.line += region1.off - bd1.off;
+					changed2.line += region2.off - bd2.off;
+
+					bd1.info.addMovedChange(std::move(changed1));
+					bd2.info.addMovedChange(std::move(changed2));
+				}
+			}
+
+			off1 += ld.len;
+			off2 += len2;
+		}
+	}
+
+	auto addMoves = [](diffInfo& bd, const section_t& sec, const std::vector<char>& moved)
+	{
+		for (int i = 0; i < sec.len;)
+		{
+			if (!moved[i])
+			{
+				++i;
+				continue;
+			}
+
+			int end = i + 1;
+
+			while (end < sec.len && moved[end])
+				++end;
+
+			bd.info.addMove(sec.off + i, end - i);
+
+			i = end;
+		}
+	};
+
+	addMoves(bd1, sec1, moved1);
+	addMoves(bd2, sec2, moved2);
+}
+
+
+// Finds the moved sections that are edited as well. The doc2 unmoved lines fingerprints are indexed and looked up by
+// the doc1 ones - the hits of a doc1 block in the same doc2 block close to each other make a candidate move that is
+// confirmed by its words diff. Candidates with more hits are checked first
+void findFuzzyMoves(CompareInfo& cmpInfo, const CompareOptions& options)
+{
+	LOGD("FIND FUZZY MOVES\n");
+
+	const int blockDiffsSize = static_cast<int>(cmpInfo.blockDiffs.size());
+
+	// Positions of the doc2 fingerprints - pairs of block diff index and window offset
+	LinesIndex index;
+
+	for (int i = 0; i < blockDiffsSize; ++i)
+	{
+		const diffInfo& bd = cmpInfo.blockDiffs[i];
+
+		if (bd.type != diff_type::DIFF_IN_2)
+			continue;
+
+		for (const auto& fingerprint: getFingerprints(cmpInfo.doc2.lines, bd))
+			index[fingerprint.first].emplace_back(i, fingerprint.second);
+	}
+
+	if (index.empty())
+		return;
+
+	std::vector<FuzzyMove> moves;
+
+	// Pairs of doc2 block diff index and window offset per doc1 window offset
+	std::vector<std::pair<int, std::pair<int, int>>> hits;
+
+	for (int i = 0; i < blockDiffsSize; ++i)
+	{
+		const diffInfo& bd = cmpInfo.blockDiffs[i];
+
+		if (bd.type != diff_type::DIFF_IN_1)
+			continue;
+
+		hits.clear();
+
+		for (const auto& fingerprint: getFingerprints(cmpInfo.doc1.lines, bd))
+		{
+			auto candidates = index.find(fingerprint.first);
+
+			if (candidates == index.end() || candidates->second.size() > cMaxFuzzyMoveCandidates)
+				continue;
+
+			for (const auto& candidate: candidates->second)
+			{
+				// The changed block pair lines are compared by the blocks compare
+				if (candidate.first != i + 1)
+					hits.emplace_back(candidate.first, std::make_pair(fingerprint.second, candidate.second));
+			}
+		}
+
+		std::sort(hits.begin(), hits.end());
+
+		const int hitsCount = static_cast<int>(hits.size());
+
+		for (int h = 0; h < hitsCount;)
+		{
+			const int block2 = hits[h].first;
+
+			int start1	= hits[h].second.first;
+			int end1	= start1 + cFuzzyMoveWindowLines;
+			int start2	= hits[h].second.second;
+			int end2	= start2 + cFuzzyMoveWindowLines;
+
+			int e = h + 1;
+
+			for (; e < hitsCount && hits[e].first == block2; ++e)
+			{
+				const int off1 = hits[e].second.first;
+				const int off2 = hits[e].second.second;
+
+				const int step1 = off1 - hits[e - 1].second.first;
+				const int step2 = off2 - hits[e - 1].second.second;
+
+				if (off1 > end1 + cMaxFuzzyMoveGap || std::abs(step2 - step1) > cMaxFuzzyMoveGap)
+					break;
+
+				end1	= std::max(end1, off1 + cFuzzyMoveWindowLines);
+				start2	= std::min(start2, off2);
+				end2	= std::max(end2, off2 + cFuzzyMoveWindowLines);
+			}
+
+			moves.push_back({i, block2, section_t(start1, end1 - start1), section_t(start2, end2 - start2), e - h});
+
+			h = e;
+		}
+	}
+
+	std::stable_sort(moves.begin(), moves.end(),
+			[](const FuzzyMove& lhs, const FuzzyMove& rhs) { return lhs.hitsCount > rhs.hitsCount; });
+
+	for (FuzzyMove& move: moves)
+	{
+		diffInfo& bd1 = cmpInfo.blockDiffs[move.block1];
+		diffInfo& bd2 = cmpInfo.blockDiffs[move.block2];
+
+		extendFuzzyMove(cmpInfo, bd1, move.sec1, bd2, move.sec2);
+
+		if (isMoveOverlapped(bd1, move.sec1) || isMoveOverlapped(bd2, move.sec2))
+			continue;
+
+		if (!areSectionsSimilar(cmpInfo.doc1, bd1, move.sec1, cmpInfo.doc2, bd2, move.sec2, options))
+			continue;
+
+		LOGD("Fuzzy move found, lens: " + std::to_string(move.sec1.len) + " and " + std::to_string(move.sec2.len) +
+				"\n");
+
+		addFuzzyMove(cmpInfo, bd1, move.sec1, bd2, move.sec2, options);
+	}
+}
+
+
+// Checks if the text from the line start up to and including offset is a number
+bool isNumberFromStartOfLine(const DocCmpInfo& doc, intptr_t lineStart, int offset)
+{
+	const intptr_t end = std::min(lineStart + offset + 1, doc.textLen);
+
+	for (intptr_t i = lineStart; i < end; ++i)
+	{
+		if (!isdigit(static_cast<unsigned char>(doc.text[i])))
+			return false;
+	}
+
+	return true;
+}
+
+
+// Highlights the doc text from pos up to pos + len except the ignored spans in it
+void addUnignoredHighlight(DocCmpInfo& doc, intptr_t pos, int len, int color)
+{
+	const intptr_t end = pos + len;
+
+	const auto spans = findIgnoredSpans(doc, pos, end);
+
+	for (const span_t* span = spans.first; span != spans.second; ++span)
+	{
+		if (span->off > pos)
+			doc.marks.addHighlight(pos, span->off - pos, color);
+
+		pos = std::max(pos, span->off + span->len);
+	}
+
+	if (end > pos)
+		doc.marks.addHighlight(pos, end - pos, color);
+}
+
+
+// Marks the changed line and highlights its changes
+void markChangedLine(DocCmpInfo& doc, int docLine, const std::vector<section_t>& changes,
+		const CompareOptions& options)
+{
+	const intptr_t linePos = doc.lineSpan(docLine).off;
+	const int color = (doc.blockDiffMask == MARKER_MASK_ADDED) ? options.addHighlightColor : options.remHighlightColor;
+
+	for (const auto& change: changes)
+		if (!options.ignoreLineNumbers || !isNumberFromStartOfLine(doc, linePos, change.off))
+			addUnignoredHighlight(doc, linePos + change.off, change.len, color);
+
+	doc.marks.addMarker(docLine, !doc.isNonUnique(docLine) ? MARKER_MASK_CHANGED : MARKER_MASK_CHANGED_LOCAL);
+}
+
+
+// Marks len moved lines starting from the doc.lines index line
+void markMovedLines(DocCmpInfo& doc, int line, int len, const CompareOptions& options)
+{
+	if (len == 1)
+	{
+		doc.marks.addMarker(doc.lines[line].line, MARKER_MASK_MOVED_LINE);
+		return;
+	}
+
+	doc.marks.addMarker(doc.lines[line].line, MARKER_MASK_MOVED_BEGIN);
+
+	int prevLine = doc.lines[line].line + 1;
+	const int endLine = line + len - 1;
+
+	for (++line; line < endLine; ++line)
+	{
+		const int docLine = doc.lines[line].line;
+		doc.marks.addMarker(docLine, MARKER_MASK_MOVED_MID);
+
+		if (options.ignoreEmptyLines && !options.neverMarkIgnored)
+		{
+			for (; prevLine < docLine; ++prevLine)
+				doc.marks.addMarker(prevLine, MARKER_MASK_MOVED_MID & MARKER_MASK_LINE);
+
+			prevLine = docLine + 1;
+		}
+	}
+
+	const int docLine = doc.lines[line].line;
+	doc.marks.addMarker(docLine, MARKER_MASK_MOVED_END);
+
+	if (options.ignoreEmptyLines && !options.neverMarkIgnored)
+	{
+		for (; prevLine < docLine; ++prevLine)
+			doc.marks.addMarker(prevLine, MARKER_MASK_MOVED_MID & MARKER_MASK_LINE);
+	}
+}
+
+
+void markSection(DocCmpInfo& doc, const diffInfo& bd, const CompareOptions& options)
+{
+	const int endOff = doc.section.off + doc.section.len;
+
+	// Moves are sorted so they are walked along with the section lines
+	auto move = bd.info.nextMove(doc.section.off);
+	const auto movesEnd = bd.info.moves.end();
+
+	auto changed = std::lower_bound(bd.info.movedChanges.begin(), bd.info.movedChanges.end(), doc.section.off,
+			[](const diffLine& dl, int l) { return dl.line < l; });
+	const auto changedEnd = bd.info.movedChanges.end();
+
+	for (int i = doc.section.off, line = bd.off + doc.section.off; i < endOff; ++i, ++line)
+	{
+		while (move != movesEnd && move->off + move->len <= i)
+			++move;
+
+		int movedLen = (move != movesEnd && i >= move->off) ? move->len : 0;
+
+		if (movedLen > doc.section.len)
+			movedLen = doc.section.len;
+
+		if (movedLen == 0)
+		{
 			int prevLine = doc.lines[line].line + 1;
-			int endLine = line + movedLen;
 
-			for (++line; line < endLine; ++line)
-			{
-				const int docLine = doc.lines[line].line;
-				CallScintilla(doc.view, SCI_MARKERADDSET, docLine, MARKER_MASK_MOVED_MID);
+			const int unmovedEnd = (move != movesEnd && move->off < endOff) ? move->off : endOff;
+
+			for (; i < unmovedEnd; ++i, ++line)
+			{
+				const int docLine = doc.lines[line].line;
+				const int mark = !doc.isNonUnique(docLine) ? doc.blockDiffMask :
+						(doc.blockDiffMask == MARKER_MASK_ADDED) ? MARKER_MASK_ADDED_LOCAL : MARKER_MASK_REMOVED_LOCAL;
+
+				doc.marks.addMarker(docLine, mark);
+
+				if (options.ignoreEmptyLines && !options.neverMarkIgnored)
+				{
+					for (; prevLine < docLine; ++prevLine)
+						doc.marks.addMarker(prevLine, doc.blockDiffMask & MARKER_MASK_LINE);
+
+					prevLine = docLine + 1;
+				}
+			}
+
+			--i;
+			--line;
+		}
+		else
+		{
+			// The fuzzy moves edited lines split the move to unedited runs
+			const int movedEnd = std::min(i + movedLen, endOff);
+
+			while (i < movedEnd)
+			{
+				if (changed != changedEnd && changed->line == i)
+				{
+					markChangedLine(doc, doc.lines[line].line, changed->changes, options);
+
+					++changed;
+					++i;
+					++line;
+					continue;
+				}
+
+				const int runLen =
+						((changed != changedEnd && changed->line < movedEnd) ? changed->line : movedEnd) - i;
+
+				markMovedLines(doc, line, runLen, options);
+
+				i += runLen;
+				line += runLen;
+			}
+
+			--i;
+			--line;
+		}
+	}
+}
+
+
+void markLineDiffs(CompareInfo& cmpInfo, const diffInfo& bd, int lineIdx, const CompareOptions& options)
+{
+	markChangedLine(cmpInfo.doc1, cmpInfo.doc1.lines[bd.off + bd.info.changedLines[lineIdx].line].line,
+			bd.info.changedLines[lineIdx].changes, options);
+
+	const diffInfo& matchBlock = *bd.info.matchBlock;
+
+	markChangedLine(cmpInfo.doc2, cmpInfo.doc2.lines[matchBlock.off + matchBlock.info.changedLines[lineIdx].line].line,
+			matchBlock.info.changedLines[lineIdx].changes, options);
+}
+
+
+// Sorts the lines by hash with LSD radix sort - a byte of the hash per pass. Lines chunks are counted and scattered
+// in parallel in each pass. buf is the scatter buffer
+void sortLinesByHash(std::vector<Line>& lines, std::vector<Line>& buf)
+{
+	const int linesCount = static_cast<int>(lines.size());
+
+	if (linesCount < 2)
+		return;
+
+	int chunksCount = linesCount / cMinLinesPerChunk;
+
+	if (chunksCount > getMaxChunks())
+		chunksCount = getMaxChunks();
+	else if (chunksCount < 1)
+		chunksCount = 1;
+
+	const int chunkLen = (linesCount + chunksCount - 1) / chunksCount;
+
+	buf.resize(linesCount);
+
+	// Chunks byte values counts that become the chunks scatter offsets
+	std::vector<std::array<int, 256>> offsets(chunksCount);
+
+	for (int shift = 0; shift < 64; shift += 8)
+	{
+		{
+			TaskGroup tasks;
+
+			for (int chunk = 0; chunk < chunksCount; ++chunk)
+			{
+				tasks.run(
+					[&, chunk]()
+					{
+						std::array<int, 256>& counts = offsets[chunk];
+						counts.fill(0);
+
+						const int end = std::min((chunk + 1) * chunkLen, linesCount);
+
+						for (int i = chunk * chunkLen; i < end; ++i)
+							++counts[(lines[i].hash >> shift) & 0xFF];
+					});
+			}
+
+			tasks.wait();
+		}
+
+		int offset = 0;
+		bool skipPass = false;
+
+		for (int byteVal = 0; byteVal < 256 && !skipPass; ++byteVal)
+		{
+			const int prevOffset = offset;
+
+			for (auto& counts: offsets)
+			{
+				const int count = counts[byteVal];
+
+				counts[byteVal] = offset;
+				offset += count;
+			}
+
+			// All lines have the same byte value - they are already sorted by it
+			skipPass = (prevOffset == 0 && offset == linesCount);
+		}
+
+		if (skipPass)
+			continue;
+
+		{
+			TaskGroup tasks;
+
+			for (int chunk = 0; chunk < chunksCount; ++chunk)
+			{
+				tasks.run(
+					[&, chunk]()
+					{
+						std::array<int, 256>& scatterOffsets = offsets[chunk];
+
+						const int end = std::min((chunk + 1) * chunkLen, linesCount);
+
+						for (int i = chunk * chunkLen; i < end; ++i)
+							buf[scatterOffsets[(lines[i].hash >> shift) & 0xFF]++] = lines[i];
+					});
+			}
+
+			tasks.wait();
+		}
+
+		lines.swap(buf);
+	}
+}
+
+
+enum class MergeChange
+{
+	NONE,		// Base lines kept in both documents
+	IN_1,		// Changed only in doc1
+	IN_2,		// Changed only in doc2
+	SAME,		// Changed the same way in both documents
+	CONFLICT	// Changed differently in both documents
+};
+
+
+/**
+ *  \struct
+ *  \brief  Section of the three-way compare - base lines kept in both documents or the lines between them. The
+ *          sections are indexes in the documents hashed lines
+ */
+struct MergeRegion
+{
+	MergeChange	change;
+
+	section_t	base;
+	section_t	sec1;
+	section_t	sec2;
+};
+
+
+// Maps each base line to the matching doc line (indexes in the documents hashed lines) or -1 if the line is not kept
+// in doc. Uses only the documents snapshots so both documents are diffed against the base in parallel.
+// Returns the count of the hash collisions found
+int getBaseMatches(const DocCmpInfo& base, const DocCmpInfo& doc, const CompareOptions& options,
+		std::vector<int>& matches, bool& approximate)
+{
+	matches.assign(base.lines.size(), -1);
+
+	const int diffCostLimit = (options.diffCostLimit > 0) ?
+			std::max(options.diffCostLimit, cMinDiffCostLimit) : INT_MAX;
+
+	const std::vector<uint64_t> baseHashes	= getLineHashes(base.lines);
+	const std::vector<uint64_t> docHashes	= getLineHashes(doc.lines);
+
+	DiffCalc<uint64_t> diffCalc(baseHashes, docHashes, diffCostLimit);
+
+	const auto diffRes = diffCalc(true, true, options.patienceDiff ? diff_algorithm::PATIENCE : diff_algorithm::MYERS);
+
+	approximate = diffCalc.isApproximate();
+
+	int hashCollisions = 0;
+
+	std::vector<char> buf1;
+	std::vector<char> buf2;
+
+	// Positions in the diffed sequences - the first one is doc if they have been swapped
+	int pos1 = 0;
+	int pos2 = 0;
+
+	for (const auto& bd: diffRes.first)
+	{
+		if (bd.type == diff_type::DIFF_MATCH)
+		{
+			for (int i = 0; i < bd.len; ++i)
+			{
+				const int baseLine	= diffRes.second ? pos2 + i : pos1 + i;
+				const int docLine	= diffRes.second ? pos1 + i : pos2 + i;
+
+				if (options.verifyMatches && !areLinesEqual(base, base.lines[baseLine].line,
+						doc, doc.lines[docLine].line, options, buf1, buf2))
+					++hashCollisions;
+				else
+					matches[baseLine] = docLine;
+			}
+
+			pos1 += bd.len;
+			pos2 += bd.len;
+		}
+		else if (bd.type == diff_type::DIFF_IN_1)
+		{
+			pos1 += bd.len;
+		}
+		else
+		{
+			pos2 += bd.len;
+		}
+	}
+
+	return hashCollisions;
+}
+
+
+// Checks if the doc section differs from the base section it replaces
+inline bool isChangedFromBase(const section_t& base, const section_t& sec, const std::vector<int>& matches)
+{
+	if (base.len != sec.len)
+		return true;
+
+	for (int i = 0; i < base.len; ++i)
+	{
+		if (matches[base.off + i] != sec.off + i)
+			return true;
+	}
+
+	return false;
+}
+
+
+MergeChange getMergeChange(const DocCmpInfo& doc1, const DocCmpInfo& doc2, const MergeRegion& region,
+		const std::vector<int>& matches1, const std::vector<int>& matches2, const CompareOptions& options)
+{
+	const bool changed1 = isChangedFromBase(region.base, region.sec1, matches1);
+	const bool changed2 = isChangedFromBase(region.base, region.sec2, matches2);
+
+	if (!changed2)
+		return MergeChange::IN_1;
+
+	if (!changed1)
+		return MergeChange::IN_2;
+
+	if (region.sec1.len != region.sec2.len)
+		return MergeChange::CONFLICT;
+
+	std::vector<char> buf1;
+	std::vector<char> buf2;
+
+	for (int i = 0; i < region.sec1.len; ++i)
+	{
+		const Line& line1 = doc1.lines[region.sec1.off + i];
+		const Line& line2 = doc2.lines[region.sec2.off + i];
+
+		if (line1.hash != line2.hash ||
+			(options.verifyMatches && !areLinesEqual(doc1, line1.line, doc2, line2.line, options, buf1, buf2)))
+			return MergeChange::CONFLICT;
+	}
+
+	return MergeChange::SAME;
+}
+
+
+// Splits the documents in regions around the base lines kept in both of them and tells how each document changed
+// the base lines between them - that's the conflicts and changes map of the merge
+std::vector<MergeRegion> getMergeRegions(const DocCmpInfo& doc1, const DocCmpInfo& doc2,
+		const std::vector<int>& matches1, const std::vector<int>& matches2, const CompareOptions& options)
+{
+	std::vector<MergeRegion> regions;
+
+	const int baseLinesCount = static_cast<int>(matches1.size());
+
+	int baseLine	= 0;
+	int line1		= 0;
+	int line2		= 0;
+
+	for (;;)
+	{
+		int stableLine = baseLine;
+
+		while (stableLine < baseLinesCount && (matches1[stableLine] < 0 || matches2[stableLine] < 0))
+			++stableLine;
+
+		const int end1 = (stableLine < baseLinesCount) ? matches1[stableLine] : static_cast<int>(doc1.lines.size());
+		const int end2 = (stableLine < baseLinesCount) ? matches2[stableLine] : static_cast<int>(doc2.lines.size());
+
+		if (stableLine > baseLine || end1 > line1 || end2 > line2)
+		{
+			MergeRegion region;
+
+			region.base	= section_t(baseLine, stableLine - baseLine);
+			region.sec1	= section_t(line1, end1 - line1);
+			region.sec2	= section_t(line2, end2 - line2);
+
+			region.change = getMergeChange(doc1, doc2, region, matches1, matches2, options);
+
+			regions.emplace_back(region);
+		}
+
+		if (stableLine == baseLinesCount)
+			break;
+
+		// Consecutive stable lines are kept in a single region
+		if (!regions.empty() && regions.back().change == MergeChange::NONE)
+		{
+			++regions.back().base.len;
+			++regions.back().sec1.len;
+			++regions.back().sec2.len;
+		}
+		else
+		{
+			MergeRegion region;
+
+			region.change	= MergeChange::NONE;
+			region.base		= section_t(stableLine, 1);
+			region.sec1		= section_t(end1, 1);
+			region.sec2		= section_t(end2, 1);
+
+			regions.emplace_back(region);
+		}
+
+		baseLine	= stableLine + 1;
+		line1		= end1 + 1;
+		line2		= end2 + 1;
+	}
+
+	return regions;
+}
+
+
+void markMergeSection(DocCmpInfo& doc, const section_t& sec, int mask, const CompareOptions& options)
+{
+	const int endOff = sec.off + sec.len;
+
+	for (int i = sec.off; i < endOff; ++i)
+	{
+		const int docLine = doc.lines[i].line;
+
+		if (options.ignoreEmptyLines && !options.neverMarkIgnored && i > sec.off)
+		{
+			for (int line = doc.lines[i - 1].line + 1; line < docLine; ++line)
+				doc.marks.addMarker(line, mask & MARKER_MASK_LINE);
+		}
+
+		doc.marks.addMarker(docLine, mask);
+	}
+}
+
+
+// Collects the documents markers and the alignment of the merge regions - the lines changed the same way in both
+// documents are aligned as matching ones
+void markMergeRegions(CompareInfo& cmpInfo, const std::vector<MergeRegion>& regions, const CompareOptions& options,
+		CompareSummary& summary)
+{
+	DocCmpInfo& doc1 = cmpInfo.doc1;
+	DocCmpInfo& doc2 = cmpInfo.doc2;
+
+	AlignmentPair alignPair;
+
+	for (const MergeRegion& region: regions)
+	{
+		if (region.change == MergeChange::NONE || region.change == MergeChange::SAME)
+		{
+			for (int i = 0; i < region.sec1.len; ++i)
+			{
+				const int line1 = doc1.lines[region.sec1.off + i].line;
+				const int line2 = doc2.lines[region.sec2.off + i].line;
+
+				// Align the region start and the lines after ignored lines sections
+				const bool align = (i == 0 || options.alignAllMatches ||
+						line1 != alignPair.main.line + 1 || line2 != alignPair.sub.line + 1);
+
+				alignPair.main.line	= line1;
+				alignPair.sub.line	= line2;
+
+				if (align)
+					summary.alignmentInfo.emplace_back(alignPair);
+			}
+
+			summary.match += region.sec1.len;
+
+			continue;
+		}
+
+		int mask1 = MARKER_MASK_CHANGED;
+		int mask2 = MARKER_MASK_CHANGED;
+
+		if (region.change == MergeChange::IN_1)
+		{
+			mask1 = MARKER_MASK_ADDED;
+			mask2 = MARKER_MASK_REMOVED;
+
+			summary.added	+= region.sec1.len;
+			summary.removed	+= region.sec2.len;
+		}
+		else if (region.change == MergeChange::IN_2)
+		{
+			mask1 = MARKER_MASK_REMOVED;
+			mask2 = MARKER_MASK_ADDED;
+
+			summary.added	+= region.sec2.len;
+			summary.removed	+= region.sec1.len;
+		}
+		else
+		{
+			summary.conflicts += std::max(region.sec1.len, region.sec2.len);
+		}
+
+		alignPair.main.diffMask	= region.sec1.len ? mask1 : 0;
+		alignPair.main.line		= toAlignmentLine(doc1, region.sec1.off);
+
+		alignPair.sub.diffMask	= region.sec2.len ? mask2 : 0;
+		alignPair.sub.line		= toAlignmentLine(doc2, region.sec2.off);
+
+		summary.alignmentInfo.emplace_back(alignPair);
+
+		alignPair.main.diffMask	= 0;
+		alignPair.sub.diffMask	= 0;
+
+		markMergeSection(doc1, region.sec1, mask1, options);
+		markMergeSection(doc2, region.sec2, mask2, options);
+
+		summary.diffLines += std::max(region.sec1.len, region.sec2.len);
+	}
+}
+
+}
+
+
+// Work of the parallel phases is split in up to that many chunks
+int getMaxChunks()
+{
+#ifdef MULTITHREAD
+	const int threadsCount = std::thread::hardware_concurrency();
+
+	return (threadsCount < 1) ? 1 : threadsCount;
+#else
+	return 1;
+#endif
+}
+
+
+// Takes the document text snapshot and splits its section in up to maxChunks line chunks. The text is copied if
+// the snapshot should stay valid while the document is changed.
+// Must be called from the thread the document source can be accessed from
+void getSnapshot(DocCmpInfo& doc, const DocSource& source, int maxChunks, std::vector<LinesChunk>& chunks,
+		bool copyText)
+{
+	doc.lines.clear();
+	doc.lineSpans.clear();
+	doc.ignoredSpans.clear();
+	doc.textCopy.clear();
+	doc.text = nullptr;
+
+	const intptr_t linesCount = source.linesCount();
+
+	if (linesCount > cMaxLinesCount)
+		throw std::length_error("Too many lines to compare");
+
+	doc.textLen		= source.textLength();
+	doc.linesCount	= static_cast<int>(linesCount);
+
+	if (doc.textLen == 0)
+		return;
+
+	if ((doc.section.len <= 0) || (doc.section.off + doc.section.len > doc.linesCount))
+		doc.section.len = doc.linesCount - doc.section.off;
+
+	// Cache that doesn't match the document is useless - start it over
+	if (doc.lineHashes && static_cast<int>(doc.lineHashes->hashes.size()) != doc.linesCount)
+	{
+		doc.lineHashes->hashes.assign(doc.linesCount, 0);
+		doc.lineHashes->dirty.assign(doc.linesCount, 1);
+		doc.lineHashes->isStored = false;
+	}
+
+	// Get the whole document buffer at once - it is contiguous and NUL terminated
+	doc.text		= source.text();
+	doc.firstLine	= doc.section.off;
+
+	if (copyText)
+	{
+		doc.textCopy.assign(doc.text, doc.text + doc.textLen + 1);
+		doc.text = doc.textCopy.data();
+	}
+
+	int chunksCount = doc.section.len / cMinLinesPerChunk;
+
+	if (chunksCount > maxChunks)
+		chunksCount = maxChunks;
+	else if (chunksCount < 1)
+		chunksCount = 1;
+
+	const int linesPerChunk = doc.section.len / chunksCount;
+
+	for (int i = 0; i < chunksCount; ++i)
+	{
+		const int firstLine = doc.section.off + i * linesPerChunk;
+		const int chunkLines = (i == chunksCount - 1) ? (doc.section.len - i * linesPerChunk) : linesPerChunk;
+
+		chunks.emplace_back(doc, firstLine, chunkLines, source.lineStart(firstLine));
+	}
+}
+
+
+// Takes a snapshot of text that is not in a view and splits it in up to maxChunks line chunks. The text is not copied
+void getTextSnapshot(DocCmpInfo& doc, const char* text, intptr_t textLen, int maxChunks,
+		std::vector<LinesChunk>& chunks)
+{
+	doc.lines.clear();
+	doc.lineSpans.clear();
+	doc.ignoredSpans.clear();
+	doc.textCopy.clear();
+
+	doc.text		= text;
+	doc.textLen		= textLen;
+	doc.linesCount	= 1;
+	doc.firstLine	= 0;
+
+	if (textLen == 0)
+		return;
+
+	const intptr_t chunksLimit = textLen / cMinBytesPerChunk;
+
+	int chunksCount = (chunksLimit > maxChunks) ? maxChunks : static_cast<int>(chunksLimit);
+
+	if (chunksCount < 1)
+		chunksCount = 1;
+
+	// Chunks start after the first line end in each equal text part
+	std::vector<intptr_t> chunkStarts(1, 0);
+
+	for (int i = 1; i < chunksCount; ++i)
+	{
+		intptr_t pos = findLineEnd(text, std::max(chunkStarts.back(), i * (textLen / chunksCount)), textLen);
+
+		if (pos < textLen)
+			pos += (text[pos] == '\r' && pos + 1 < textLen && text[pos + 1] == '\n') ? 2 : 1;
+
+		if (pos >= textLen)
+			break;
+
+		chunkStarts.emplace_back(pos);
+	}
+
+	chunksCount = static_cast<int>(chunkStarts.size());
+	chunkStarts.emplace_back(textLen);
+
+	std::vector<intptr_t> chunkLines(chunksCount);
+
+	{
+		TaskGroup tasks;
+
+		for (int i = 0; i < chunksCount; ++i)
+			tasks.run([&, i]() { chunkLines[i] = countLineEnds(text, chunkStarts[i], chunkStarts[i + 1]); });
+
+		tasks.wait();
+	}
+
+	// The line after the last line end
+	++chunkLines.back();
+
+	intptr_t linesCount = 0;
+
+	for (intptr_t lines: chunkLines)
+		linesCount += lines;
+
+	if (linesCount > cMaxLinesCount)
+		throw std::length_error("Too many lines to compare");
+
+	int firstLine = 0;
+
+	for (int i = 0; i < chunksCount; ++i)
+	{
+		chunks.emplace_back(doc, firstLine, static_cast<int>(chunkLines[i]), chunkStarts[i]);
+		firstLine += static_cast<int>(chunkLines[i]);
+	}
+
+	doc.linesCount		= firstLine;
+	doc.section.off		= 0;
+	doc.section.len		= firstLine;
+}
+
+
+// Hashes the snapshots chunks in parallel and collects their lines in the documents. Returns the count of the lines
+// hashed (not reused from the line hashes caches).
+// Uses only the snapshots so it is safe to be run in a worker thread
+int hashChunks(std::vector<LinesChunk>& chunks, const CompareOptions& options)
+{
+	CompareProgress* progress = getProgress(options);
+
+	if (chunks.empty())
+		return 0;
+
+	if (progress)
+	{
+		unsigned progressMax = 0;
+
+		for (const auto& chunk: chunks)
+			progressMax += (chunk.linesCount / cMonitorCancelEveryXLine) + 1;
+
+		progress->SetMaxCount(progressMax);
+	}
+
+	auto advanceFn =
+		[&]() -> bool
+		{
+			return advanceProgress(options);
+		};
+
+	const int chunksCount = static_cast<int>(chunks.size());
+
+	std::vector<char> chunkDone(chunksCount, 0);
+
+	LOGD("hashChunks(): " + std::to_string(chunksCount) + " chunks will be hashed in parallel\n");
+
+	// Worker exceptions are rethrown here by wait()
+	{
+		TaskGroup tasks;
+
+		for (int i = 0; i < chunksCount; ++i)
+			tasks.run([&, i]() { chunkDone[i] = hashLines(chunks[i], options, advanceFn); });
+
+		tasks.wait();
+	}
+
+	bool cancelled = false;
+
+	for (char done: chunkDone)
+	{
+		if (!done)
+			cancelled = true;
+	}
+
+	if (cancelled)
+	{
+		for (auto& chunk: chunks)
+		{
+			chunk.doc.lineSpans.clear();
+			chunk.doc.ignoredSpans.clear();
+		}
+
+		return 0;
+	}
+
+	int linesHashed = 0;
+
+	for (auto& chunk: chunks)
+	{
+		DocCmpInfo& doc = chunk.doc;
+
+		linesHashed += chunk.linesHashed;
+
+		if (doc.lineSpans.empty())
+		{
+			doc.lines.reserve(doc.section.len);
+			doc.lineSpans.reserve(doc.section.len);
+		}
+
+		doc.lines.insert(doc.lines.end(), chunk.lines.begin(), chunk.lines.end());
+		doc.lineSpans.insert(doc.lineSpans.end(), chunk.lineSpans.begin(), chunk.lineSpans.end());
+		doc.ignoredSpans.insert(doc.ignoredSpans.end(), chunk.ignoredSpans.begin(), chunk.ignoredSpans.end());
+	}
+
+	return linesHashed;
+}
+
+
+bool markAllDiffs(CompareInfo& cmpInfo, const CompareOptions& options, CompareSummary& summary)
+{
+	CompareProgress* progress = getProgress(options);
+
+	summary.clear();
+
+	const int blockDiffSize = static_cast<int>(cmpInfo.blockDiffs.size());
+
+	if (progress)
+		progress->SetMaxCount(blockDiffSize);
+
+	std::pair<int, int> alignLines {0, 0};
+
+	AlignmentPair alignPair;
+
+	AlignmentViewData* pMainAlignData	= &alignPair.main;
+	AlignmentViewData* pSubAlignData	= &alignPair.sub;
+
+	// Make sure pMainAlignData is linked to doc1
+	if (cmpInfo.doc1.view == SUB_VIEW)
+		std::swap(pMainAlignData, pSubAlignData);
+
+	for (int i = 0; i < blockDiffSize; ++i)
+	{
+		const diffInfo& bd = cmpInfo.blockDiffs[i];
+
+		if (bd.type == diff_type::DIFF_MATCH)
+		{
+			pMainAlignData->diffMask	= 0;
+			pMainAlignData->line		= toAlignmentLine(cmpInfo.doc1, alignLines.first);
+
+			pSubAlignData->diffMask		= 0;
+			pSubAlignData->line			= toAlignmentLine(cmpInfo.doc2, alignLines.second);
+
+			summary.alignmentInfo.emplace_back(alignPair);
+
+			if (options.alignAllMatches)
+			{
+				// Align all pairs of matching lines
+				for (int j = bd.len - 1; j; --j)
+				{
+					++alignLines.first;
+					++alignLines.second;
+
+					pMainAlignData->line	= cmpInfo.doc1.lines[alignLines.first].line;
+					pSubAlignData->line		= cmpInfo.doc2.lines[alignLines.second].line;
+
+					summary.alignmentInfo.emplace_back(alignPair);
+				}
+
+				++alignLines.first;
+				++alignLines.second;
+			}
+			else
+			{
+				if (options.ignoreEmptyLines)
+				{
+					// Align pairs of matching lines after ignored lines sections
+					for (int j = bd.len - 1; j; --j)
+					{
+						++alignLines.first;
+						++alignLines.second;
+
+						if ((++pMainAlignData->line != cmpInfo.doc1.lines[alignLines.first].line) ||
+							(++pSubAlignData->line != cmpInfo.doc2.lines[alignLines.second].line))
+						{
+							pMainAlignData->line	= cmpInfo.doc1.lines[alignLines.first].line;
+							pSubAlignData->line		= cmpInfo.doc2.lines[alignLines.second].line;
+
+							summary.alignmentInfo.emplace_back(alignPair);
+						}
+					}
+
+					++alignLines.first;
+					++alignLines.second;
+				}
+				else
+				{
+					alignLines.first	+= bd.len;
+					alignLines.second	+= bd.len;
+				}
+			}
+
+			summary.match += bd.len;
+		}
+		else if (bd.type == diff_type::DIFF_IN_2)
+		{
+			cmpInfo.doc2.section.off = 0;
+			cmpInfo.doc2.section.len = bd.len;
+			markSection(cmpInfo.doc2, bd, options);
+
+			pMainAlignData->diffMask	= 0;
+			pMainAlignData->line		= toAlignmentLine(cmpInfo.doc1, alignLines.first);
+
+			pSubAlignData->diffMask		= cmpInfo.doc2.blockDiffMask;
+			pSubAlignData->line			= toAlignmentLine(cmpInfo.doc2, alignLines.second);
+
+			summary.alignmentInfo.emplace_back(alignPair);
+
+			const int movedLines = bd.info.movedCount();
+
+			summary.diffLines	+= bd.len;
+			summary.moved		+= movedLines - static_cast<int>(bd.info.movedChanges.size());
+
+			if (cmpInfo.doc2.blockDiffMask == MARKER_MASK_ADDED)
+				summary.added += bd.len - movedLines;
+			else
+				summary.removed += bd.len - movedLines;
+
+			alignLines.second += bd.len;
+		}
+		else if (bd.type == diff_type::DIFF_IN_1)
+		{
+			if (bd.info.matchBlock)
+			{
+				const int changedLinesCount = static_cast<int>(bd.info.changedLines.size());
+
+				cmpInfo.doc1.section.off = 0;
+				cmpInfo.doc2.section.off = 0;
+
+				for (int j = 0; j < changedLinesCount; ++j)
+				{
+					cmpInfo.doc1.section.len = bd.info.changedLines[j].line - cmpInfo.doc1.section.off;
+					cmpInfo.doc2.section.len = bd.info.matchBlock->info.changedLines[j].line - cmpInfo.doc2.section.off;
+
+					if (cmpInfo.doc1.section.len || cmpInfo.doc2.section.len)
+					{
+						pMainAlignData->diffMask	= cmpInfo.doc1.section.len ? cmpInfo.doc1.blockDiffMask : 0;
+						pMainAlignData->line		= toAlignmentLine(cmpInfo.doc1, alignLines.first);
+
+						pSubAlignData->diffMask		= cmpInfo.doc2.section.len ? cmpInfo.doc2.blockDiffMask : 0;
+						pSubAlignData->line			= toAlignmentLine(cmpInfo.doc2, alignLines.second);
+
+						summary.alignmentInfo.emplace_back(alignPair);
+
+						if (options.ignoreEmptyLines && options.neverMarkIgnored &&
+							cmpInfo.doc1.section.len && cmpInfo.doc2.section.len)
+						{
+							std::vector<int> alignLines1;
+							int maxLines = cmpInfo.doc1.section.len + alignLines.first;
+
+							for (int l = alignLines.first + 1; l < maxLines; ++l)
+							{
+								if (cmpInfo.doc1.lines[l].line - cmpInfo.doc1.lines[l - 1].line > 1)
+									alignLines1.emplace_back(l);
+							}
+
+							if (!alignLines1.empty())
+							{
+								std::vector<int> alignLines2;
+								maxLines = cmpInfo.doc2.section.len + alignLines.second;
+
+								for (int l = alignLines.second + 1; l < maxLines; ++l)
+								{
+									if (cmpInfo.doc2.lines[l].line - cmpInfo.doc2.lines[l - 1].line > 1)
+										alignLines2.emplace_back(l);
+								}
+
+								maxLines = std::min(alignLines1.size(), alignLines2.size());
+
+								for (int l = 0; l < maxLines; ++l)
+								{
+									pMainAlignData->line	= toAlignmentLine(cmpInfo.doc1, alignLines1[l]);
+									pSubAlignData->line		= toAlignmentLine(cmpInfo.doc2, alignLines2[l]);
+
+									summary.alignmentInfo.emplace_back(alignPair);
+								}
+							}
+						}
+
+						if (cmpInfo.doc1.section.len)
+						{
+							markSection(cmpInfo.doc1, bd, options);
+							alignLines.first += cmpInfo.doc1.section.len;
+						}
+
+						if (cmpInfo.doc2.section.len)
+						{
+							markSection(cmpInfo.doc2, *bd.info.matchBlock, options);
+							alignLines.second += cmpInfo.doc2.section.len;
+						}
+
+						summary.diffLines += std::max(cmpInfo.doc1.section.len, cmpInfo.doc2.section.len);
+					}
+
+					pMainAlignData->diffMask	= MARKER_MASK_CHANGED;
+					pMainAlignData->line		= toAlignmentLine(cmpInfo.doc1, alignLines.first);
+
+					pSubAlignData->diffMask		= MARKER_MASK_CHANGED;
+					pSubAlignData->line			= toAlignmentLine(cmpInfo.doc2, alignLines.second);
+
+					summary.alignmentInfo.emplace_back(alignPair);
+
+					markLineDiffs(cmpInfo, bd, j, options);
+
+					cmpInfo.doc1.section.off = bd.info.changedLines[j].line + 1;
+					cmpInfo.doc2.section.off = bd.info.matchBlock->info.changedLines[j].line + 1;
+
+					++alignLines.first;
+					++alignLines.second;
+				}
+
+				cmpInfo.doc1.section.len = bd.len - cmpInfo.doc1.section.off;
+				cmpInfo.doc2.section.len = bd.info.matchBlock->len - cmpInfo.doc2.section.off;
+
+				if (cmpInfo.doc1.section.len || cmpInfo.doc2.section.len)
+				{
+					pMainAlignData->diffMask	= cmpInfo.doc1.section.len ? cmpInfo.doc1.blockDiffMask : 0;
+					pMainAlignData->line		= toAlignmentLine(cmpInfo.doc1, alignLines.first);
+
+					pSubAlignData->diffMask		= cmpInfo.doc2.section.len ? cmpInfo.doc2.blockDiffMask : 0;
+					pSubAlignData->line			= toAlignmentLine(cmpInfo.doc2, alignLines.second);
+
+					summary.alignmentInfo.emplace_back(alignPair);
+
+					if (options.ignoreEmptyLines && options.neverMarkIgnored &&
+						cmpInfo.doc1.section.len && cmpInfo.doc2.section.len)
+					{
+						std::vector<int> alignLines1;
+						int maxLines = cmpInfo.doc1.section.len + alignLines.first;
+
+						for (int l = alignLines.first + 1; l < maxLines; ++l)
+						{
+							if (cmpInfo.doc1.lines[l].line - cmpInfo.doc1.lines[l - 1].line > 1)
+								alignLines1.emplace_back(l);
+						}
+
+						if (!alignLines1.empty())
+						{
+							std::vector<int> alignLines2;
+							maxLines = cmpInfo.doc2.section.len + alignLines.second;
+
+							for (int l = alignLines.second + 1; l < maxLines; ++l)
+							{
+								if (cmpInfo.doc2.lines[l].line - cmpInfo.doc2.lines[l - 1].line > 1)
+									alignLines2.emplace_back(l);
+							}
+
+							maxLines = std::min(alignLines1.size(), alignLines2.size());
+
+							for (int l = 0; l < maxLines; ++l)
+							{
+								pMainAlignData->line	= toAlignmentLine(cmpInfo.doc1, alignLines1[l]);
+								pSubAlignData->line		= toAlignmentLine(cmpInfo.doc2, alignLines2[l]);
+
+								summary.alignmentInfo.emplace_back(alignPair);
+							}
+						}
+					}
+
+					if (cmpInfo.doc1.section.len)
+					{
+						markSection(cmpInfo.doc1, bd, options);
+						alignLines.first += cmpInfo.doc1.section.len;
+					}
+
+					if (cmpInfo.doc2.section.len)
+					{
+						markSection(cmpInfo.doc2, *bd.info.matchBlock, options);
+						alignLines.second += cmpInfo.doc2.section.len;
+					}
+
+					summary.diffLines += std::max(cmpInfo.doc1.section.len, cmpInfo.doc2.section.len);
+				}
+
+				const int movedLines1 = bd.info.movedCount();
+				const int movedLines2 = bd.info.matchBlock->info.movedCount();
+
+				const int newLines1 = bd.len - changedLinesCount - movedLines1;
+				const int newLines2 = bd.info.matchBlock->len - changedLinesCount - movedLines2;
+
+				const int movedChanges1 = static_cast<int>(bd.info.movedChanges.size());
+				const int movedChanges2 = static_cast<int>(bd.info.matchBlock->info.movedChanges.size());
+
+				// The fuzzy moves changed lines are counted once - by their doc1 block
+				summary.diffLines	+= changedLinesCount;
+				summary.changed		+= changedLinesCount + movedChanges1;
+				summary.moved		+= movedLines1 - movedChanges1 + movedLines2 - movedChanges2;
+
+				if (cmpInfo.doc1.blockDiffMask == MARKER_MASK_ADDED)
+				{
+					summary.added	+= newLines1;
+					summary.removed	+= newLines2;
+				}
+				else
+				{
+					summary.added	+= newLines2;
+					summary.removed	+= newLines1;
+				}
+
+				++i;
+			}
+			else
+			{
+				cmpInfo.doc1.section.off = 0;
+				cmpInfo.doc1.section.len = bd.len;
+				markSection(cmpInfo.doc1, bd, options);
+
+				pMainAlignData->diffMask	= cmpInfo.doc1.blockDiffMask;
+				pMainAlignData->line		= toAlignmentLine(cmpInfo.doc1, alignLines.first);
+
+				pSubAlignData->diffMask		= 0;
+				pSubAlignData->line			= toAlignmentLine(cmpInfo.doc2, alignLines.second);
+
+				summary.alignmentInfo.emplace_back(alignPair);
+
+				const int movedLines = bd.info.movedCount();
+				const int movedChanges = static_cast<int>(bd.info.movedChanges.size());
+
+				// The fuzzy moves changed lines are counted once - by their doc1 block
+				summary.diffLines	+= bd.len;
+				summary.changed		+= movedChanges;
+				summary.moved		+= movedLines - movedChanges;
+
+				if (cmpInfo.doc1.blockDiffMask == MARKER_MASK_ADDED)
+					summary.added += bd.len - movedLines;
+				else
+					summary.removed += bd.len - movedLines;
+
+				alignLines.first += bd.len;
+			}
+		}
+
+		if ((progress && !progress->Advance()) || options.isCancelled())
+			return false;
+	}
+
+	summary.moved /= 2;
+
+	if (options.selectionCompare)
+	{
+		pMainAlignData->diffMask	= 0;
+		pMainAlignData->line		= options.selections[cmpInfo.doc1.view].second + 1;
+
+		pSubAlignData->diffMask		= 0;
+		pSubAlignData->line			= options.selections[cmpInfo.doc2.view].second + 1;
+
+		if ((pMainAlignData->line < cmpInfo.doc1.linesCount) && (pSubAlignData->line < cmpInfo.doc2.linesCount))
+			summary.alignmentInfo.emplace_back(alignPair);
+	}
+
+	if ((progress && !progress->NextPhase()) || options.isCancelled())
+		return false;
+
+	return true;
+}
+
+
+// Sets the compared documents views, sections and markers
+void setupDocs(DocCmpInfo& doc1, DocCmpInfo& doc2, const CompareOptions& options, LineHashCache* lineHashes)
+{
+	doc1.view	= MAIN_VIEW;
+	doc2.view	= SUB_VIEW;
+
+	if (lineHashes)
+	{
+		doc1.lineHashes = &lineHashes[MAIN_VIEW];
+		doc2.lineHashes = &lineHashes[SUB_VIEW];
+
+		// Hashes calculated with other options are useless - the rest of the options don't affect them
+		const uint64_t optionsKey = getLineHashesKey(options);
+
+		for (int view = MAIN_VIEW; view <= SUB_VIEW; ++view)
+		{
+			if (lineHashes[view].optionsKey != optionsKey)
+			{
+				lineHashes[view].invalidate();
+				lineHashes[view].optionsKey = optionsKey;
+			}
+		}
+	}
+
+	if (options.selectionCompare)
+	{
+		doc1.section.off	= options.selections[MAIN_VIEW].first;
+		doc1.section.len	= options.selections[MAIN_VIEW].second - options.selections[MAIN_VIEW].first + 1;
+
+		doc2.section.off	= options.selections[SUB_VIEW].first;
+		doc2.section.len	= options.selections[SUB_VIEW].second - options.selections[SUB_VIEW].first + 1;
+	}
+
+	doc1.blockDiffMask = (options.newFileViewId == MAIN_VIEW) ? MARKER_MASK_ADDED : MARKER_MASK_REMOVED;
+	doc2.blockDiffMask = (options.newFileViewId == MAIN_VIEW) ? MARKER_MASK_REMOVED : MARKER_MASK_ADDED;
+}
+
+
+// Finds the sync points of the windowed line diff - lines unique in both documents, the longest chain of them in
+// order in both. Lines hashes are sampled so the occurrences table holds a fraction of the lines. All the lines with
+// a sampled hash are counted so their uniqueness is exact
+std::vector<std::pair<int, int>> getSyncPoints(const std::vector<uint64_t>& hashes1,
+		const std::vector<uint64_t>& hashes2)
+{
+	struct occurrence {
+		int count1, count2;
+		int line2;
+	};
+
+	std::unordered_map<uint64_t, occurrence> occurrences;
+	occurrences.reserve(hashes1.size() / cSyncLinesSampling);
+
+	for (uint64_t hash: hashes1)
+	{
+		if (hash % cSyncLinesSampling == 0)
+			++occurrences.emplace(hash, occurrence{ 0, 0, 0 }).first->second.count1;
+	}
+
+	const int linesCount2 = static_cast<int>(hashes2.size());
+
+	for (int line2 = 0; line2 < linesCount2; ++line2)
+	{
+		if (hashes2[line2] % cSyncLinesSampling)
+			continue;
+
+		auto it = occurrences.find(hashes2[line2]);
+
+		if (it != occurrences.end() && it->second.count2++ == 0)
+			it->second.line2 = line2;
+	}
+
+	// Unique lines in doc1 order
+	std::vector<std::pair<int, int>> unique;
+
+	const int linesCount1 = static_cast<int>(hashes1.size());
+
+	for (int line1 = 0; line1 < linesCount1; ++line1)
+	{
+		if (hashes1[line1] % cSyncLinesSampling)
+			continue;
+
+		const occurrence& occ = occurrences[hashes1[line1]];
+
+		if (occ.count1 == 1 && occ.count2 == 1)
+			unique.emplace_back(line1, occ.line2);
+	}
+
+	std::unordered_map<uint64_t, occurrence>().swap(occurrences);
+
+	std::vector<std::pair<int, int>> syncPoints;
+
+	if (unique.empty())
+		return syncPoints;
+
+	// Patience sorting - tails[n] is the index in unique of the smallest line2 ending an increasing run of n + 1
+	std::vector<int> tails;
+	std::vector<int> prev(unique.size(), -1);
+
+	for (int i = 0; i < static_cast<int>(unique.size()); ++i)
+	{
+		auto tailItr = std::lower_bound(tails.begin(), tails.end(), unique[i].second,
+				[&unique](int tail, int line2) { return (unique[tail].second < line2); });
+
+		if (tailItr != tails.begin())
+			prev[i] = *(tailItr - 1);
+
+		if (tailItr == tails.end())
+			tails.emplace_back(i);
+		else
+			*tailItr = i;
+	}
+
+	syncPoints.resize(tails.size());
+
+	for (int i = tails.back(), j = static_cast<int>(tails.size()) - 1; i >= 0; i = prev[i], --j)
+		syncPoints[j] = unique[i];
+
+	return syncPoints;
+}
+
+
+inline void appendBlockDiff(std::vector<diff_info<blockDiffInfo>>& blockDiffs, diff_type type, int off, int len)
+{
+	if (!blockDiffs.empty() && blockDiffs.back().type == type)
+	{
+		blockDiffs.back().len += len;
+	}
+	else
+	{
+		blockDiffs.emplace_back();
+		blockDiffs.back().type	= type;
+		blockDiffs.back().off	= off;
+		blockDiffs.back().len	= len;
+	}
+}
+
+
+/**
+ *  \struct
+ *  \brief  Lines range between two sync points diffed on its own - the diffs are regarding doc1 - doc2 with offsets
+ *          relative to the window
+ */
+struct DiffWindow
+{
+	int	off1;
+	int	len1;
+	int	off2;
+	int	len2;
+
+	std::vector<diff_info<void>>	diffs;
+
+	bool	approximate {false};
+};
+
+
+void diffWindow(const std::vector<uint64_t>& hashes1, const std::vector<uint64_t>& hashes2, int diffCostLimit,
+		diff_algorithm algorithm, DiffWindow& window)
+{
+	DiffCalc<uint64_t> diffCalc(hashes1.data() + window.off1, window.len1, hashes2.data() + window.off2, window.len2,
+			diffCostLimit);
+
+	const bool swapped = diffCalc(window.diffs, true, true, algorithm);
+
+	window.approximate = diffCalc.isApproximate();
+
+	// Swapped window diffs are turned back to doc1 - doc2 ones with the removed lines before the added ones
+	if (swapped)
+	{
+		for (auto& d: window.diffs)
+		{
+			if (d.type == diff_type::DIFF_IN_1)
+				d.type = diff_type::DIFF_IN_2;
+			else if (d.type == diff_type::DIFF_IN_2)
+				d.type = diff_type::DIFF_IN_1;
+		}
+
+		for (size_t i = 1; i < window.diffs.size(); ++i)
+		{
+			if (window.diffs[i - 1].type == diff_type::DIFF_IN_2 && window.diffs[i].type == diff_type::DIFF_IN_1)
+				std::swap(window.diffs[i - 1], window.diffs[i]);
+		}
+	}
+}
+
+
+// Appends the window diffs to the documents diffs. The windows start with their sync line so they join on matches -
+// the sync lines are unique in both documents so no diff boundary can be shifted or combined across them
+void stitchWindow(const DiffWindow& window, std::vector<diff_info<blockDiffInfo>>& blockDiffs)
+{
+	int pos1 = window.off1;
+	int pos2 = window.off2;
+
+	for (const auto& d: window.diffs)
+	{
+		if (d.type == diff_type::DIFF_IN_2)
+		{
+			appendBlockDiff(blockDiffs, d.type, pos2, d.len);
+			pos2 += d.len;
+		}
+		else
+		{
+			appendBlockDiff(blockDiffs, d.type, pos1, d.len);
+			pos1 += d.len;
+
+			if (d.type == diff_type::DIFF_MATCH)
+				pos2 += d.len;
+		}
+	}
+}
+
+
+// Line diffs of big documents - they are cut in windows of at least windowLines lines at the sync points. Huge
+// documents windows are diffed one by one so the diff memory is bounded by the window size. In parallel mode the
+// windows are diffed in the thread pool and stitched in order after that. Returns true if any window diff is
+// approximate
+bool diffLinesWindowed(const std::vector<uint64_t>& hashes1, const std::vector<uint64_t>& hashes2,
+		int diffCostLimit, diff_algorithm algorithm, int windowLines, bool parallel,
+		std::vector<diff_info<blockDiffInfo>>& blockDiffs, const CompareOptions& options)
+{
+	std::vector<DiffWindow> windows;
+
+	{
+		std::pair<int, int> lastCut(0, 0);
+
+		auto addWindow =
+			[&](const std::pair<int, int>& cut)
+			{
+				windows.emplace_back();
+
+				DiffWindow& window = windows.back();
+
+				window.off1	= lastCut.first;
+				window.len1	= cut.first - lastCut.first;
+				window.off2	= lastCut.second;
+				window.len2	= cut.second - lastCut.second;
+
+				lastCut = cut;
+			};
+
+		const std::vector<std::pair<int, int>> syncPoints = getSyncPoints(hashes1, hashes2);
+
+		for (const auto& sp: syncPoints)
+		{
+			if (std::max(sp.first - lastCut.first, sp.second - lastCut.second) >= windowLines)
+				addWindow(sp);
+		}
+
+		addWindow(std::make_pair(static_cast<int>(hashes1.size()), static_cast<int>(hashes2.size())));
+	}
+
+	blockDiffs.clear();
+
+	bool approximate = false;
+
+	if (parallel)
+	{
+		TaskGroup tasks;
+
+		for (auto& window: windows)
+		{
+			DiffWindow* pWindow = &window;
+
+			tasks.run(
+				[&hashes1, &hashes2, diffCostLimit, algorithm, pWindow, &options]()
+				{
+					if (!options.isCancelled())
+						diffWindow(hashes1, hashes2, diffCostLimit, algorithm, *pWindow);
+				});
+		}
+
+		tasks.wait();
+
+		if (options.isCancelled())
+			return false;
+
+		for (const auto& window: windows)
+		{
+			stitchWindow(window, blockDiffs);
+			approximate = approximate || window.approximate;
+		}
+	}
+	else
+	{
+		for (auto& window: windows)
+		{
+			if (options.isCancelled())
+				return false;
+
+			diffWindow(hashes1, hashes2, diffCostLimit, algorithm, window);
+			stitchWindow(window, blockDiffs);
+
+			approximate = approximate || window.approximate;
+
+			std::vector<diff_info<void>>().swap(window.diffs);
+		}
+	}
+
+	return approximate;
+}
+
+
+// Sub-compares the changed blocks pairs given by the indexes of their DIFF_IN_2 blocks and links the pairs blocks.
+// Each block has its own result so blocks are compared in parallel
+bool compareChangedBlocks(CompareInfo& cmpInfo, const std::vector<int>& changedBlockIdx, const CompareOptions& options,
+		int& hashCollisions, int& subDiffs)
+{
+	const int changedBlocksCount = static_cast<int>(changedBlockIdx.size());
+
+	std::vector<int> blockHashCollisions(changedBlocksCount, 0);
+	std::vector<int> blockSubDiffs(changedBlocksCount, 0);
+	std::vector<char> blockDone(changedBlocksCount, 0);
+
+	auto blockFn =
+		[&](int block)
+		{
+			const int i = changedBlockIdx[block];
+
+			blockDone[block] = compareBlocks(cmpInfo.doc1, cmpInfo.doc2, cmpInfo.blockDiffs[i - 1],
+					cmpInfo.blockDiffs[i], options, blockHashCollisions[block], blockSubDiffs[block]);
+		};
+
+	// Do block compares
+	{
+		TaskGroup tasks;
+
+		for (int block = 0; block < changedBlocksCount; ++block)
+		{
+			const int i = changedBlockIdx[block];
+
+			cmpInfo.blockDiffs[i - 1].info.matchBlock = &cmpInfo.blockDiffs[i];
+			cmpInfo.blockDiffs[i].info.matchBlock = &cmpInfo.blockDiffs[i - 1];
+
+#ifdef DLOG
+			// Debug log is not thread safe - blocks are compared one by one and only their lines in parallel
+			blockFn(block);
+#else
+			tasks.run(std::bind(blockFn, block));
+#endif
+		}
+
+		tasks.wait();
+	}
+
+	for (int block = 0; block < changedBlocksCount; ++block)
+	{
+		if (!blockDone[block])
+			return false;
+
+		hashCollisions	+= blockHashCollisions[block];
+		subDiffs		+= blockSubDiffs[block];
+	}
+
+	return true;
+}
+
+
+std::vector<int> getDeferredBlocks(const CompareInfo& cmpInfo)
+{
+	std::vector<int> deferredBlockIdx;
+
+	const int blockDiffsSize = static_cast<int>(cmpInfo.blockDiffs.size());
+
+	for (int i = 1; i < blockDiffsSize; ++i)
+	{
+		if ((cmpInfo.blockDiffs[i].type == diff_type::DIFF_IN_2) &&
+				(cmpInfo.blockDiffs[i - 1].type == diff_type::DIFF_IN_1))
+		{
+			if (!cmpInfo.blockDiffs[i].info.matchBlock)
+				deferredBlockIdx.emplace_back(i);
+
+			++i;
+		}
+	}
+
+	return deferredBlockIdx;
+}
+
+
+// Splices the line diffs of the edited documents in the previous compare ones. The unchanged lines at both documents
+// ends are found by their hashes and the previous diffs are cut inside their last and first matches there. Only the
+// lines between the cuts are diffed - the matches at the cuts are the window anchors so the diffs join on them.
+// Returns false if the previous diffs don't fit or the window is too big - the documents should be diffed as a whole
+bool spliceLineDiffs(const PrevLineDiffs& prev, CompareInfo& cmpInfo, int diffCostLimit, diff_algorithm algorithm,
+		const CompareOptions& options, int& hashCollisions, bool& approximate)
+{
+	if (cmpInfo.doc1.view != prev.views[0] && cmpInfo.doc2.view != prev.views[0])
+		return false;
+
+	const bool swapped = (cmpInfo.doc1.view != prev.views[0]);
+
+	const DocCmpInfo& doc1 = swapped ? cmpInfo.doc2 : cmpInfo.doc1;
+	const DocCmpInfo& doc2 = swapped ? cmpInfo.doc1 : cmpInfo.doc2;
+
+	const std::vector<uint64_t> hashes1 = getLineHashes(doc1.lines);
+	const std::vector<uint64_t> hashes2 = getLineHashes(doc2.lines);
+
+	const int oldSize1 = static_cast<int>(prev.hashes1.size());
+	const int oldSize2 = static_cast<int>(prev.hashes2.size());
+	const int newSize1 = static_cast<int>(hashes1.size());
+	const int newSize2 = static_cast<int>(hashes2.size());
+
+	auto getCommonEnds =
+		[](const std::vector<uint64_t>& oldHashes, const std::vector<uint64_t>& newHashes, int& prefix, int& suffix)
+		{
+			const int commonSize = static_cast<int>(std::min(oldHashes.size(), newHashes.size()));
+
+			for (prefix = 0; prefix < commonSize && oldHashes[prefix] == newHashes[prefix]; ++prefix);
+
+			// Any cut of an unchanged document is fine
+			if (prefix == static_cast<int>(oldHashes.size()) && prefix == static_cast<int>(newHashes.size()))
+			{
+				suffix = prefix;
+				return;
+			}
+
+			auto oldItr = oldHashes.rbegin();
+			auto newItr = newHashes.rbegin();
+
+			for (suffix = 0; suffix < commonSize - prefix && *oldItr == *newItr; ++suffix, ++oldItr, ++newItr);
+		};
+
+	int prefix1, suffix1, prefix2, suffix2;
+
+	getCommonEnds(prev.hashes1, hashes1, prefix1, suffix1);
+	getCommonEnds(prev.hashes2, hashes2, prefix2, suffix2);
+
+	const int diffsSize = static_cast<int>(prev.diffs.size());
+
+	// Head cut - the blocks before headBlock are kept and headMatch lines of the headBlock match
+	int headBlock = 0;
+	int headMatch = 0;
+
+	DiffWindow window;
+
+	window.off1 = 0;
+	window.off2 = 0;
+
+	for (int i = 0, pos1 = 0, pos2 = 0; i < diffsSize; ++i)
+	{
+		const diff_info<void>& d = prev.diffs[i];
+
+		if (d.type == diff_type::DIFF_MATCH)
+		{
+			const int kept = std::min(d.len, std::min(prefix1 - pos1, prefix2 - pos2));
+
+			if (kept > 0)
+			{
+				headBlock	= i;
+				headMatch	= kept;
+				window.off1	= pos1 + kept;
+				window.off2	= pos2 + kept;
+			}
+
+			if (kept < d.len)
+				break;
+
+			pos1 += d.len;
+			pos2 += d.len;
+		}
+		else if (d.type == diff_type::DIFF_IN_1)
+		{
+			if ((pos1 += d.len) > prefix1)
+				break;
+		}
+		else if ((pos2 += d.len) > prefix2)
+		{
+			break;
+		}
+	}
+
+	// Tail cut - the blocks after tailBlock are kept and tailMatch last lines of the tailBlock match
+	int tailBlock = diffsSize;
+	int tailMatch = 0;
+
+	int tailOff1 = oldSize1;
+	int tailOff2 = oldSize2;
+
+	for (int i = diffsSize - 1, end1 = oldSize1, end2 = oldSize2; i >= 0; --i)
+	{
+		const diff_info<void>& d = prev.diffs[i];
+
+		if (d.type == diff_type::DIFF_MATCH)
+		{
+			const int kept = std::min(d.len, std::min(end1 - (oldSize1 - suffix1), end2 - (oldSize2 - suffix2)));
+
+			if (kept > 0)
+			{
+				tailBlock	= i;
+				tailMatch	= kept;
+				tailOff1	= end1 - kept;
+				tailOff2	= end2 - kept;
+			}
+
+			if (kept < d.len)
+				break;
+
+			end1 -= d.len;
+			end2 -= d.len;
+		}
+		else if (d.type == diff_type::DIFF_IN_1)
+		{
+			if ((end1 -= d.len) < oldSize1 - suffix1)
+				break;
+		}
+		else if ((end2 -= d.len) < oldSize2 - suffix2)
+		{
+			break;
+		}
+	}
+
+	const int delta1 = newSize1 - oldSize1;
+	const int delta2 = newSize2 - oldSize2;
+
+	window.len1 = tailOff1 + delta1 - window.off1;
+	window.len2 = tailOff2 + delta2 - window.off2;
+
+	if (window.len1 < 0 || window.len2 < 0 || window.len1 + window.len2 > cMinParallelDiffLines)
+		return false;
+
+	diffWindow(hashes1, hashes2, diffCostLimit, algorithm, window);
+
+	if (options.isCancelled())
+		return false;
+
+	if (options.verifyMatches)
+	{
+		std::vector<char> buf1;
+		std::vector<char> buf2;
+
+		hashCollisions = splitHashCollisions(window.diffs,
+			[&](int off1, int off2) -> bool
+			{
+				return areLinesEqual(doc1, doc1.lines[window.off1 + off1].line,
+						doc2, doc2.lines[window.off2 + off2].line, options, buf1, buf2);
+			});
+	}
+
+	std::vector<diffInfo> blockDiffs;
+
+	blockDiffs.reserve(prev.diffs.size() + window.diffs.size());
+
+	for (int i = 0; i < headBlock; ++i)
+		appendBlockDiff(blockDiffs, prev.diffs[i].type, prev.diffs[i].off, prev.diffs[i].len);
+
+	if (headMatch)
+		appendBlockDiff(blockDiffs, diff_type::DIFF_MATCH, prev.diffs[headBlock].off, headMatch);
+
+	stitchWindow(window, blockDiffs);
+
+	if (tailMatch)
+		appendBlockDiff(blockDiffs, diff_type::DIFF_MATCH, tailOff1 + delta1, tailMatch);
+
+	for (int i = tailBlock + 1; i < diffsSize; ++i)
+	{
+		const diff_info<void>& d = prev.diffs[i];
+
+		appendBlockDiff(blockDiffs, d.type, d.off + (d.type == diff_type::DIFF_IN_2 ? delta2 : delta1), d.len);
+	}
+
+	LOGD("LINE DIFFS SPLICED - window lines " + std::to_string(window.len1) + " and " +
+			std::to_string(window.len2) + "\n");
+
+	if (swapped)
+		swap(cmpInfo.doc1, cmpInfo.doc2);
+
+	cmpInfo.blockDiffs = std::move(blockDiffs);
+
+	approximate = prev.approximate || window.approximate;
+
+	return true;
+}
+
+
+// Compares the hashed documents and collects their markers. Uses only the documents snapshots so it is safe to be
+// run in a worker thread
+CompareResult compareDocs(CompareInfo& cmpInfo, const CompareOptions& options, CompareSummary& summary,
+		const PrevLineDiffs* prevDiffs)
+{
+	CompareProgress* progress = getProgress(options);
+
+	// Both documents hashing phases are done at once
+	if ((progress && (!progress->NextPhase() || !progress->NextPhase())) || options.isCancelled())
+		return CompareResult::COMPARE_CANCELLED;
+
+	CompareStats& stats = summary.stats;
+
+	int64_t phaseStart = getTimeStamp();
+
+	const int diffCostLimit = (options.diffCostLimit > 0) ?
+			std::max(options.diffCostLimit, cMinDiffCostLimit) : INT_MAX;
+
+	const diff_algorithm algorithm = options.patienceDiff ? diff_algorithm::PATIENCE : diff_algorithm::MYERS;
+
+	bool approximate = false;
+
+	int hashCollisions = 0;
+
+	const bool spliced = prevDiffs &&
+			spliceLineDiffs(*prevDiffs, cmpInfo, diffCostLimit, algorithm, options, hashCollisions, approximate);
+
+	if (options.isCancelled())
+		return CompareResult::COMPARE_CANCELLED;
+
+	if (!spliced)
+	{
+		const std::vector<uint64_t> hashes1 = getLineHashes(cmpInfo.doc1.lines);
+		const std::vector<uint64_t> hashes2 = getLineHashes(cmpInfo.doc2.lines);
+
+		const int linesCount = static_cast<int>(hashes1.size() + hashes2.size());
+		const int maxChunks = getMaxChunks();
+
+#ifdef DLOG
+		const bool parallel = false;
+#else
+		const bool parallel = (maxChunks > 1 && linesCount > cMinParallelDiffLines);
+#endif
+
+		if (parallel || linesCount > cMinWindowedDiffLines)
+		{
+			// Enough windows for the pool workers to balance them
+			const int windowLines = parallel ?
+					std::min(std::max(linesCount / (maxChunks * 8), cMinParallelWindowLines), cDiffWindowLines) :
+					cDiffWindowLines;
+
+			approximate = diffLinesWindowed(hashes1, hashes2, diffCostLimit, algorithm, windowLines, parallel,
+					cmpInfo.blockDiffs, options);
+
+			if (options.isCancelled())
+				return CompareResult::COMPARE_CANCELLED;
+		}
+		else
+		{
+			DiffCalc<uint64_t, blockDiffInfo> diffCalc(hashes1, hashes2, diffCostLimit);
+
+			auto diffRes = diffCalc(true, true, algorithm);
+			cmpInfo.blockDiffs = std::move(diffRes.first);
+
+			if (diffRes.second)
+				swap(cmpInfo.doc1, cmpInfo.doc2);
+
+			approximate = diffCalc.isApproximate();
+		}
+	}
+
+	LOGD_GET_TIME;
+	PRINT_DIFFS("COMPARE START - LINE DIFFS", cmpInfo.blockDiffs);
+
+	// The spliced diffs window is verified on its own - the rest has been verified by the previous compare
+	if (options.verifyMatches && !spliced)
+	{
+		hashCollisions = verifyLineMatches(cmpInfo, options);
+
+		if (hashCollisions)
+			PRINT_DIFFS("VERIFIED LINE DIFFS", cmpInfo.blockDiffs);
+	}
+
+	const int blockDiffsSize = static_cast<int>(cmpInfo.blockDiffs.size());
+
+	stats.blockDiffs = blockDiffsSize;
+	stats.addTime(ComparePhase::LINES_DIFF, phaseStart);
+
+	if (blockDiffsSize == 0 || (blockDiffsSize == 1 && cmpInfo.blockDiffs[0].type == diff_type::DIFF_MATCH))
+		return CompareResult::COMPARE_MATCH;
+
+	phaseStart = getTimeStamp();
+
+	findUniqueLines(cmpInfo);
+
+	if (options.detectMoves)
+	{
+		// The edited moves are found first - the exact ones would take their unedited parts otherwise
+		findFuzzyMoves(cmpInfo, options);
+		findMoves(cmpInfo);
+	}
 
-				if (options.ignoreEmptyLines && !options.neverMarkIgnored)
-				{
-					for (; prevLine < docLine; ++prevLine)
-						CallScintilla(doc.view, SCI_MARKERADDSET, prevLine, MARKER_MASK_MOVED_MID & MARKER_MASK_LINE);
+	stats.addTime(ComparePhase::MOVES, phaseStart);
 
-					prevLine = docLine + 1;
-				}
-			}
+	if ((progress && !progress->NextPhase()) || options.isCancelled())
+		return CompareResult::COMPARE_CANCELLED;
 
-			const int docLine = doc.lines[line].line;
-			CallScintilla(doc.view, SCI_MARKERADDSET, docLine, MARKER_MASK_MOVED_END);
+	phaseStart = getTimeStamp();
 
-			if (options.ignoreEmptyLines && !options.neverMarkIgnored)
-			{
-				for (; prevLine < docLine; ++prevLine)
-					CallScintilla(doc.view, SCI_MARKERADDSET, prevLine, MARKER_MASK_MOVED_MID & MARKER_MASK_LINE);
-			}
-		}
-	}
-}
+	std::vector<int> changedBlockIdx;
+
+	// The sub-compares work - the blocks lines products can overflow an int
+	int64_t changedProgressCount = 0;
 
-bool isNumberFromStartOfLine(const int& viewd, int linePos, int offset) {
-	std::vector<char> text = getText(viewd, linePos, linePos + offset + 1);
-	for each (char digit in text)
+	// Get changed blocks to sub-compare
+	for (int i = 1; i < blockDiffsSize; ++i)
 	{
-		if (digit != '\0' && !isdigit(digit))
-			return false;
+		if ((cmpInfo.blockDiffs[i].type == diff_type::DIFF_IN_2) &&
+				(cmpInfo.blockDiffs[i - 1].type == diff_type::DIFF_IN_1))
+		{
+			changedProgressCount +=
+					static_cast<int64_t>(cmpInfo.blockDiffs[i].len) * cmpInfo.blockDiffs[i - 1].len;
+			changedBlockIdx.emplace_back(i++);
+		}
 	}
-	return true;
-}
 
-void markLineDiffs(const CompareInfo& cmpInfo, const diffInfo& bd, int lineIdx)
-{
+	stats.changedBlocks = static_cast<int>(changedBlockIdx.size());
+
+	int deferredBlocks = 0;
 
-	int line = cmpInfo.doc1.lines[bd.off + bd.info.changedLines[lineIdx].line].line;
-	int linePos = getLineStart(cmpInfo.doc1.view, line);
-	int color = (cmpInfo.doc1.blockDiffMask == MARKER_MASK_ADDED) ?
-			Settings.colors.add_highlight : Settings.colors.rem_highlight;
+	// The sub-compares of big changed blocks are left to AsyncBlocksCompare - the blocks lines are marked as added and
+	// removed until then
+	if (options.deferBlocksCompare && changedProgressCount > cMinDeferredBlocksWork)
+	{
+		deferredBlocks = stats.changedBlocks;
 
-	for (const auto& change: bd.info.changedLines[lineIdx].changes)
-		if (!Settings.ignoreLineNumbers || !isNumberFromStartOfLine(cmpInfo.doc1.view,linePos, change.off))
-			markTextAsChanged(cmpInfo.doc1.view, linePos + change.off, change.len, color);
+		changedBlockIdx.clear();
+		changedProgressCount = 0;
+	}
 
-	CallScintilla(cmpInfo.doc1.view, SCI_MARKERADDSET, line,
-			cmpInfo.doc1.nonUniqueLines.find(line) == cmpInfo.doc1.nonUniqueLines.end() ?
-			MARKER_MASK_CHANGED : MARKER_MASK_CHANGED_LOCAL);
+	if (progress)
+	{
+		// The progress count is clamped - the bar stays full once the advanced count reaches it
+		progress->SetMaxCount(static_cast<unsigned>(std::min<int64_t>(changedProgressCount, UINT_MAX)));
 
-	line = cmpInfo.doc2.lines[bd.info.matchBlock->off + bd.info.matchBlock->info.changedLines[lineIdx].line].line;
-	linePos = getLineStart(cmpInfo.doc2.view, line);
-	color = (cmpInfo.doc2.blockDiffMask == MARKER_MASK_ADDED) ?
-			Settings.colors.add_highlight : Settings.colors.rem_highlight;
+		if (changedProgressCount > 10000)
+			progress->Show();
+	}
 
-	for (const auto& change: bd.info.matchBlock->info.changedLines[lineIdx].changes)
-		if (!Settings.ignoreLineNumbers || !isNumberFromStartOfLine(cmpInfo.doc2.view, linePos, change.off))
-		    markTextAsChanged(cmpInfo.doc2.view, linePos + change.off, change.len, color);
+	if (!compareChangedBlocks(cmpInfo, changedBlockIdx, options, hashCollisions, stats.subDiffs))
+		return CompareResult::COMPARE_CANCELLED;
 
-	CallScintilla(cmpInfo.doc2.view, SCI_MARKERADDSET, line,
-			cmpInfo.doc2.nonUniqueLines.find(line) == cmpInfo.doc2.nonUniqueLines.end() ?
-			MARKER_MASK_CHANGED : MARKER_MASK_CHANGED_LOCAL);
-}
+	stats.addTime(ComparePhase::BLOCKS_DIFF, phaseStart);
 
+	if ((progress && !progress->NextPhase()) || options.isCancelled())
+		return CompareResult::COMPARE_CANCELLED;
 
+	phaseStart = getTimeStamp();
 
-bool markAllDiffs(CompareInfo& cmpInfo, const CompareOptions& options, CompareSummary& summary)
-{
-	progress_ptr& progress = ProgressDlg::Get();
+	if (!markAllDiffs(cmpInfo, options, summary))
+		return CompareResult::COMPARE_CANCELLED;
 
-	summary.clear();
+	stats.addTime(ComparePhase::MARKING, phaseStart);
 
-	const int blockDiffSize = static_cast<int>(cmpInfo.blockDiffs.size());
+	summary.hashCollisions	= hashCollisions;
+	summary.approximate		= approximate;
+	summary.deferredBlocks	= deferredBlocks;
 
-	if (progress)
-		progress->SetMaxCount(blockDiffSize);
+	return CompareResult::COMPARE_MISMATCH;
+}
 
-	std::pair<int, int> alignLines {0, 0};
 
-	AlignmentPair alignPair;
+// Finds the unique lines of the hashed documents and collects their markers. Uses only the documents snapshots so
+// it is safe to be run in a worker thread
+CompareResult findUniqueDocs(DocCmpInfo& doc1, DocCmpInfo& doc2, const CompareOptions& options,
+		CompareSummary& summary)
+{
+	CompareProgress* progress = getProgress(options);
 
-	AlignmentViewData* pMainAlignData	= &alignPair.main;
-	AlignmentViewData* pSubAlignData	= &alignPair.sub;
+	summary.clear();
 
-	// Make sure pMainAlignData is linked to doc1
-	if (cmpInfo.doc1.view == SUB_VIEW)
-		std::swap(pMainAlignData, pSubAlignData);
+	// Both documents hashing phases are done at once
+	if ((progress && (!progress->NextPhase() || !progress->NextPhase())) || options.isCancelled())
+		return CompareResult::COMPARE_CANCELLED;
 
-	for (int i = 0; i < blockDiffSize; ++i)
+	// Lines sorted by hash are merged - equal hashes runs are matching lines, the others are unique
 	{
-		const diffInfo& bd = cmpInfo.blockDiffs[i];
+		std::vector<Line> sortBuf;
 
-		if (bd.type == diff_type::DIFF_MATCH)
-		{
-			pMainAlignData->diffMask	= 0;
-			pMainAlignData->line		= toAlignmentLine(cmpInfo.doc1, alignLines.first);
+		sortLinesByHash(doc1.lines, sortBuf);
 
-			pSubAlignData->diffMask		= 0;
-			pSubAlignData->line			= toAlignmentLine(cmpInfo.doc2, alignLines.second);
+		if ((progress && !progress->NextPhase()) || options.isCancelled())
+			return CompareResult::COMPARE_CANCELLED;
 
-			summary.alignmentInfo.emplace_back(alignPair);
+		sortLinesByHash(doc2.lines, sortBuf);
+	}
 
-			if (options.alignAllMatches)
-			{
-				// Align all pairs of matching lines
-				for (int j = bd.len - 1; j; --j)
-				{
-					++alignLines.first;
-					++alignLines.second;
+	if ((progress && !progress->NextPhase()) || options.isCancelled())
+		return CompareResult::COMPARE_CANCELLED;
 
-					pMainAlignData->line	= cmpInfo.doc1.lines[alignLines.first].line;
-					pSubAlignData->line		= cmpInfo.doc2.lines[alignLines.second].line;
+	int doc1UniqueLinesCount = 0;
+	int doc2UniqueLinesCount = 0;
 
-					summary.alignmentInfo.emplace_back(alignPair);
-				}
+	auto line1Itr = doc1.lines.cbegin();
+	auto line2Itr = doc2.lines.cbegin();
 
-				++alignLines.first;
-				++alignLines.second;
-			}
-			else
-			{
-				if (options.ignoreEmptyLines)
-				{
-					// Align pairs of matching lines after ignored lines sections
-					for (int j = bd.len - 1; j; --j)
-					{
-						++alignLines.first;
-						++alignLines.second;
+	const auto lines1End = doc1.lines.cend();
+	const auto lines2End = doc2.lines.cend();
 
-						if ((++pMainAlignData->line != cmpInfo.doc1.lines[alignLines.first].line) ||
-							(++pSubAlignData->line != cmpInfo.doc2.lines[alignLines.second].line))
-						{
-							pMainAlignData->line	= cmpInfo.doc1.lines[alignLines.first].line;
-							pSubAlignData->line		= cmpInfo.doc2.lines[alignLines.second].line;
+	while (line1Itr != lines1End || line2Itr != lines2End)
+	{
+		if (line2Itr == lines2End || (line1Itr != lines1End && line1Itr->hash < line2Itr->hash))
+		{
+			doc1.marks.addMarker(line1Itr->line, doc1.blockDiffMask);
+			++doc1UniqueLinesCount;
+			++line1Itr;
+		}
+		else if (line1Itr == lines1End || line2Itr->hash < line1Itr->hash)
+		{
+			doc2.marks.addMarker(line2Itr->line, doc2.blockDiffMask);
+			++doc2UniqueLinesCount;
+			++line2Itr;
+		}
+		else
+		{
+			const uint64_t hash = line1Itr->hash;
 
-							summary.alignmentInfo.emplace_back(alignPair);
-						}
-					}
+			while (line1Itr != lines1End && line1Itr->hash == hash)
+				++line1Itr;
 
-					++alignLines.first;
-					++alignLines.second;
-				}
-				else
-				{
-					alignLines.first	+= bd.len;
-					alignLines.second	+= bd.len;
-				}
-			}
+			while (line2Itr != lines2End && line2Itr->hash == hash)
+				++line2Itr;
 
-			summary.match += bd.len;
+			++summary.match;
 		}
-		else if (bd.type == diff_type::DIFF_IN_2)
-		{
-			cmpInfo.doc2.section.off = 0;
-			cmpInfo.doc2.section.len = bd.len;
-			markSection(cmpInfo.doc2, bd, options);
+	}
 
-			pMainAlignData->diffMask	= 0;
-			pMainAlignData->line		= toAlignmentLine(cmpInfo.doc1, alignLines.first);
+	doc1.lines.clear();
+	doc2.lines.clear();
 
-			pSubAlignData->diffMask		= cmpInfo.doc2.blockDiffMask;
-			pSubAlignData->line			= toAlignmentLine(cmpInfo.doc2, alignLines.second);
+	if (doc1UniqueLinesCount == 0 && doc2UniqueLinesCount == 0)
+		return CompareResult::COMPARE_MATCH;
 
-			summary.alignmentInfo.emplace_back(alignPair);
+	if (doc1.blockDiffMask == MARKER_MASK_ADDED)
+	{
+		summary.added	= doc1UniqueLinesCount;
+		summary.removed	= doc2UniqueLinesCount;
+	}
+	else
+	{
+		summary.added	= doc2UniqueLinesCount;
+		summary.removed	= doc1UniqueLinesCount;
+	}
 
-			const int movedLines = bd.info.movedCount();
+	AlignmentPair align;
+	align.main.line	= doc1.section.off;
+	align.sub.line	= doc2.section.off;
 
-			summary.diffLines	+= bd.len;
-			summary.moved		+= movedLines;
+	summary.alignmentInfo.push_back(align);
 
-			if (cmpInfo.doc2.blockDiffMask == MARKER_MASK_ADDED)
-				summary.added += bd.len - movedLines;
-			else
-				summary.removed += bd.len - movedLines;
+	return CompareResult::COMPARE_MISMATCH;
+}
 
-			alignLines.second += bd.len;
-		}
-		else if (bd.type == diff_type::DIFF_IN_1)
-		{
-			if (bd.info.matchBlock)
-			{
-				const int changedLinesCount = static_cast<int>(bd.info.changedLines.size());
 
-				cmpInfo.doc1.section.off = 0;
-				cmpInfo.doc2.section.off = 0;
+// Diffs both hashed documents against the hashed base lines and marks the merge regions. Uses only the documents
+// snapshots so it is safe to be run in a worker thread
+CompareResult compareDocsToBase(const DocCmpInfo& base, CompareInfo& cmpInfo, const CompareOptions& options,
+		CompareSummary& summary)
+{
+	CompareProgress* progress = getProgress(options);
 
-				for (int j = 0; j < changedLinesCount; ++j)
-				{
-					cmpInfo.doc1.section.len = bd.info.changedLines[j].line - cmpInfo.doc1.section.off;
-					cmpInfo.doc2.section.len = bd.info.matchBlock->info.changedLines[j].line - cmpInfo.doc2.section.off;
+	CompareStats& stats = summary.stats;
 
-					if (cmpInfo.doc1.section.len || cmpInfo.doc2.section.len)
-					{
-						pMainAlignData->diffMask	= cmpInfo.doc1.section.len ? cmpInfo.doc1.blockDiffMask : 0;
-						pMainAlignData->line		= toAlignmentLine(cmpInfo.doc1, alignLines.first);
+	// Both documents hashing phases are done at once
+	if ((progress && (!progress->NextPhase() || !progress->NextPhase())) || options.isCancelled())
+		return CompareResult::COMPARE_CANCELLED;
 
-						pSubAlignData->diffMask		= cmpInfo.doc2.section.len ? cmpInfo.doc2.blockDiffMask : 0;
-						pSubAlignData->line			= toAlignmentLine(cmpInfo.doc2, alignLines.second);
+	int64_t phaseStart = getTimeStamp();
 
-						summary.alignmentInfo.emplace_back(alignPair);
+	std::vector<int> matches1;
+	std::vector<int> matches2;
 
-						if (options.ignoreEmptyLines && options.neverMarkIgnored &&
-							cmpInfo.doc1.section.len && cmpInfo.doc2.section.len)
-						{
-							std::vector<int> alignLines1;
-							int maxLines = cmpInfo.doc1.section.len + alignLines.first;
+	bool approximate[2]		= { false, false };
+	int hashCollisions[2]	= { 0, 0 };
 
-							for (int l = alignLines.first + 1; l < maxLines; ++l)
-							{
-								if (cmpInfo.doc1.lines[l].line - cmpInfo.doc1.lines[l - 1].line > 1)
-									alignLines1.emplace_back(l);
-							}
+	// Both documents are diffed against the same base lines at once
+	{
+		TaskGroup tasks;
 
-							if (!alignLines1.empty())
-							{
-								std::vector<int> alignLines2;
-								maxLines = cmpInfo.doc2.section.len + alignLines.second;
+		tasks.run([&]() { hashCollisions[0] = getBaseMatches(base, cmpInfo.doc1, options, matches1, approximate[0]); });
+		tasks.run([&]() { hashCollisions[1] = getBaseMatches(base, cmpInfo.doc2, options, matches2, approximate[1]); });
 
-								for (int l = alignLines.second + 1; l < maxLines; ++l)
-								{
-									if (cmpInfo.doc2.lines[l].line - cmpInfo.doc2.lines[l - 1].line > 1)
-										alignLines2.emplace_back(l);
-								}
+		tasks.wait();
+	}
 
-								maxLines = std::min(alignLines1.size(), alignLines2.size());
+	stats.addTime(ComparePhase::LINES_DIFF, phaseStart);
 
-								for (int l = 0; l < maxLines; ++l)
-								{
-									pMainAlignData->line	= toAlignmentLine(cmpInfo.doc1, alignLines1[l]);
-									pSubAlignData->line		= toAlignmentLine(cmpInfo.doc2, alignLines2[l]);
+	if ((progress && !progress->NextPhase()) || options.isCancelled())
+		return CompareResult::COMPARE_CANCELLED;
 
-									summary.alignmentInfo.emplace_back(alignPair);
-								}
-							}
-						}
+	phaseStart = getTimeStamp();
 
-						if (cmpInfo.doc1.section.len)
-						{
-							markSection(cmpInfo.doc1, bd, options);
-							alignLines.first += cmpInfo.doc1.section.len;
-						}
+	const std::vector<MergeRegion> regions = getMergeRegions(cmpInfo.doc1, cmpInfo.doc2, matches1, matches2, options);
 
-						if (cmpInfo.doc2.section.len)
-						{
-							markSection(cmpInfo.doc2, *bd.info.matchBlock, options);
-							alignLines.second += cmpInfo.doc2.section.len;
-						}
+	LOGD("COMPARE TO BASE - " + std::to_string(regions.size()) + " merge regions\n");
 
-						summary.diffLines += std::max(cmpInfo.doc1.section.len, cmpInfo.doc2.section.len);
-					}
+	if (std::all_of(regions.begin(), regions.end(), [](const MergeRegion& region)
+			{ return (region.change == MergeChange::NONE || region.change == MergeChange::SAME); }))
+		return CompareResult::COMPARE_MATCH;
 
-					pMainAlignData->diffMask	= MARKER_MASK_CHANGED;
-					pMainAlignData->line		= toAlignmentLine(cmpInfo.doc1, alignLines.first);
+	summary.clear();
 
-					pSubAlignData->diffMask		= MARKER_MASK_CHANGED;
-					pSubAlignData->line			= toAlignmentLine(cmpInfo.doc2, alignLines.second);
+	markMergeRegions(cmpInfo, regions, options, summary);
 
-					summary.alignmentInfo.emplace_back(alignPair);
+	summary.hashCollisions	= hashCollisions[0] + hashCollisions[1];
+	summary.approximate		= approximate[0] || approximate[1];
 
-					markLineDiffs(cmpInfo, bd, j);
+	stats.blockDiffs = static_cast<int>(regions.size());
+	stats.addTime(ComparePhase::MARKING, phaseStart);
 
-					cmpInfo.doc1.section.off = bd.info.changedLines[j].line + 1;
-					cmpInfo.doc2.section.off = bd.info.matchBlock->info.changedLines[j].line + 1;
+	if ((progress && !progress->NextPhase()) || options.isCancelled())
+		return CompareResult::COMPARE_CANCELLED;
 
-					++alignLines.first;
-					++alignLines.second;
-				}
+	return CompareResult::COMPARE_MISMATCH;
+}
 
-				cmpInfo.doc1.section.len = bd.len - cmpInfo.doc1.section.off;
-				cmpInfo.doc2.section.len = bd.info.matchBlock->len - cmpInfo.doc2.section.off;
 
-				if (cmpInfo.doc1.section.len || cmpInfo.doc2.section.len)
-				{
-					pMainAlignData->diffMask	= cmpInfo.doc1.section.len ? cmpInfo.doc1.blockDiffMask : 0;
-					pMainAlignData->line		= toAlignmentLine(cmpInfo.doc1, alignLines.first);
+inline uint64_t getIgnoreRulesKey(const CompareOptions& options)
+{
+	return options.ignoreRules ? options.ignoreRules->key() : 0;
+}
 
-					pSubAlignData->diffMask		= cmpInfo.doc2.section.len ? cmpInfo.doc2.blockDiffMask : 0;
-					pSubAlignData->line			= toAlignmentLine(cmpInfo.doc2, alignLines.second);
 
-					summary.alignmentInfo.emplace_back(alignPair);
+// Compares the options that affect the block diffs - all but the marking ones
+bool isSameDiff(const CompareOptions& lhs, const CompareOptions& rhs)
+{
+	return ((lhs.newFileViewId			== rhs.newFileViewId) &&
+			(lhs.findUniqueMode			== rhs.findUniqueMode) &&
+			(lhs.charPrecision			== rhs.charPrecision) &&
+			(lhs.diffsBasedLineChanges	== rhs.diffsBasedLineChanges) &&
+			(lhs.ignoreSpaces			== rhs.ignoreSpaces) &&
+			(lhs.ignoreEmptyLines		== rhs.ignoreEmptyLines) &&
+			(lhs.ignoreCase				== rhs.ignoreCase) &&
+			(lhs.detectMoves			== rhs.detectMoves) &&
+			(lhs.ignoreLineNumbers		== rhs.ignoreLineNumbers) &&
+			(getIgnoreRulesKey(lhs)		== getIgnoreRulesKey(rhs)) &&
+			(lhs.verifyMatches			== rhs.verifyMatches) &&
+			(lhs.patienceDiff			== rhs.patienceDiff) &&
+			(lhs.wordTokenizer			== rhs.wordTokenizer) &&
+			(lhs.changedThresholdPercent	== rhs.changedThresholdPercent) &&
+			(lhs.diffCostLimit			== rhs.diffCostLimit) &&
+			(lhs.selectionCompare		== rhs.selectionCompare) &&
+			(!lhs.selectionCompare ||
+				((lhs.selections[MAIN_VIEW] == rhs.selections[MAIN_VIEW]) &&
+				(lhs.selections[SUB_VIEW] == rhs.selections[SUB_VIEW]))));
+}
 
-					if (options.ignoreEmptyLines && options.neverMarkIgnored &&
-						cmpInfo.doc1.section.len && cmpInfo.doc2.section.len)
-					{
-						std::vector<int> alignLines1;
-						int maxLines = cmpInfo.doc1.section.len + alignLines.first;
 
-						for (int l = alignLines.first + 1; l < maxLines; ++l)
-						{
-							if (cmpInfo.doc1.lines[l].line - cmpInfo.doc1.lines[l - 1].line > 1)
-								alignLines1.emplace_back(l);
-						}
+// Takes the block diffs of a completed compare. The documents text is dropped - it is taken again from the views when
+// the block diffs are re-marked
+std::shared_ptr<CompareCacheData> makeCacheData(const CompareOptions& options, CompareResult result,
+		CompareInfo& cmpInfo, const CompareSummary& summary)
+{
+	std::shared_ptr<CompareCacheData> data = std::make_shared<CompareCacheData>();
+
+	data->options				= options;
+	data->options.cancelToken	= nullptr;
+	data->options.progress		= nullptr;
 
-						if (!alignLines1.empty())
-						{
-							std::vector<int> alignLines2;
-							maxLines = cmpInfo.doc2.section.len + alignLines.second;
+	data->result			= result;
+	data->hashCollisions	= summary.hashCollisions;
+	data->approximate		= summary.approximate;
+	data->deferredBlocks	= summary.deferredBlocks;
 
-							for (int l = alignLines.second + 1; l < maxLines; ++l)
-							{
-								if (cmpInfo.doc2.lines[l].line - cmpInfo.doc2.lines[l - 1].line > 1)
-									alignLines2.emplace_back(l);
-							}
+	data->textHashes[MAIN_VIEW]	= 0;
+	data->textHashes[SUB_VIEW]	= 0;
 
-							maxLines = std::min(alignLines1.size(), alignLines2.size());
+	if (result == CompareResult::COMPARE_MISMATCH)
+	{
+		data->cmpInfo = std::move(cmpInfo);
 
-							for (int l = 0; l < maxLines; ++l)
-							{
-								pMainAlignData->line	= toAlignmentLine(cmpInfo.doc1, alignLines1[l]);
-								pSubAlignData->line		= toAlignmentLine(cmpInfo.doc2, alignLines2[l]);
+		for (DocCmpInfo* doc: {&data->cmpInfo.doc1, &data->cmpInfo.doc2})
+		{
+			doc->textCopy	= std::vector<char>();
+			doc->text		= nullptr;
+			doc->lineHashes	= nullptr;
+			doc->marks		= ViewMarks();
+		}
+	}
 
-								summary.alignmentInfo.emplace_back(alignPair);
-							}
-						}
-					}
+	return data;
+}
 
-					if (cmpInfo.doc1.section.len)
-					{
-						markSection(cmpInfo.doc1, bd, options);
-						alignLines.first += cmpInfo.doc1.section.len;
-					}
 
-					if (cmpInfo.doc2.section.len)
-					{
-						markSection(cmpInfo.doc2, *bd.info.matchBlock, options);
-						alignLines.second += cmpInfo.doc2.section.len;
-					}
+// Compares the lines text the same way it has been hashed to rule out hash collisions
+bool areLinesEqual(const DocCmpInfo& doc1, int line1, const DocCmpInfo& doc2, int line2,
+		const CompareOptions& options, std::vector<char>& buf1, std::vector<char>& buf2)
+{
+	const span_t& span1 = doc1.lineSpan(line1);
+	const span_t& span2 = doc2.lineSpan(line2);
 
-					summary.diffLines += std::max(cmpInfo.doc1.section.len, cmpInfo.doc2.section.len);
-				}
+	const intptr_t start1 = getLineTextStart(doc1, span1.off, span1.off + span1.len, options);
+	const intptr_t start2 = getLineTextStart(doc2, span2.off, span2.off + span2.len, options);
 
-				const int movedLines1 = bd.info.movedCount();
-				const int movedLines2 = bd.info.matchBlock->info.movedCount();
+	const intptr_t end1 = span1.off + span1.len;
+	const intptr_t end2 = span2.off + span2.len;
 
-				const int newLines1 = bd.len - changedLinesCount - movedLines1;
-				const int newLines2 = bd.info.matchBlock->len - changedLinesCount - movedLines2;
+	const auto spans1 = findIgnoredSpans(doc1, start1, end1);
+	const auto spans2 = findIgnoredSpans(doc2, start2, end2);
 
-				summary.diffLines	+= changedLinesCount;
-				summary.changed		+= changedLinesCount;
-				summary.moved		+= movedLines1 + movedLines2;
+	int len1;
+	int len2;
 
-				if (cmpInfo.doc1.blockDiffMask == MARKER_MASK_ADDED)
-				{
-					summary.added	+= newLines1;
-					summary.removed	+= newLines2;
-				}
-				else
-				{
-					summary.added	+= newLines2;
-					summary.removed	+= newLines1;
-				}
+	bool foldASCII1;
+	bool foldASCII2;
 
-				++i;
-			}
-			else
-			{
-				cmpInfo.doc1.section.off = 0;
-				cmpInfo.doc1.section.len = bd.len;
-				markSection(cmpInfo.doc1, bd, options);
+	const char* text1 = getUnignoredText(doc1, start1, end1, spans1.first, spans1.second, options.ignoreCase, buf1,
+			len1, foldASCII1);
+	const char* text2 = getUnignoredText(doc2, start2, end2, spans2.first, spans2.second, options.ignoreCase, buf2,
+			len2, foldASCII2);
 
-				pMainAlignData->diffMask	= cmpInfo.doc1.blockDiffMask;
-				pMainAlignData->line		= toAlignmentLine(cmpInfo.doc1, alignLines.first);
+	return isTextEqual(text1, len1, foldASCII1, text2, len2, foldASCII2, options.ignoreSpaces);
+}
 
-				pSubAlignData->diffMask		= 0;
-				pSubAlignData->line			= toAlignmentLine(cmpInfo.doc2, alignLines.second);
 
-				summary.alignmentInfo.emplace_back(alignPair);
+uint64_t getLineHashesKey(const CompareOptions& options)
+{
+	// The ignore rules key takes the bits above the flags ones
+	const uint64_t rulesKey = getIgnoreRulesKey(options) << 3;
 
-				const int movedLines = bd.info.movedCount();
+	return (1ULL << 63) | rulesKey |
+			(options.ignoreSpaces		? 1 : 0) |
+			(options.ignoreCase			? 2 : 0) |
+			(options.ignoreLineNumbers	? 4 : 0);
+}
 
-				summary.diffLines	+= bd.len;
-				summary.moved		+= movedLines;
 
-				if (cmpInfo.doc1.blockDiffMask == MARKER_MASK_ADDED)
-					summary.added += bd.len - movedLines;
-				else
-					summary.removed += bd.len - movedLines;
+namespace {
 
-				alignLines.first += bd.len;
-			}
-		}
+/**
+ *  \struct
+ *  \brief  Word tokenizer of a Notepad++ language and the files extensions Notepad++ sets that language by
+ */
+struct LangTokenizer
+{
+	int				langType;
+	WordTokenizer	tokenizer;
 
-		if (progress && !progress->Advance())
-			return false;
-	}
+	// Ends at the first nullptr
+	const TCHAR*	exts[9];
+};
 
-	summary.moved /= 2;
 
-	if (options.selectionCompare)
-	{
-		pMainAlignData->diffMask	= 0;
-		pMainAlignData->line		= options.selections[cmpInfo.doc1.view].second + 1;
+// The languages not listed are split in words as plain text. L_JS is not used by Notepad++ any more
+const LangTokenizer cLangTokenizers[] = {
+	{ L_C,				WordTokenizer::CODE,	{ TEXT("c") } },
+	{ L_CPP,			WordTokenizer::CODE,	{ TEXT("cc"), TEXT("cpp"), TEXT("cxx"), TEXT("h"), TEXT("hh"),
+													TEXT("hpp"), TEXT("hxx") } },
+	{ L_CS,				WordTokenizer::CODE,	{ TEXT("cs") } },
+	{ L_OBJC,			WordTokenizer::CODE,	{ TEXT("m"), TEXT("mm") } },
+	{ L_JAVA,			WordTokenizer::CODE,	{ TEXT("java") } },
+	{ L_RC,				WordTokenizer::CODE,	{ TEXT("rc") } },
+	{ L_D,				WordTokenizer::CODE,	{ TEXT("d") } },
+	{ L_JAVASCRIPT,		WordTokenizer::CODE,	{ TEXT("js") } },
+	{ L_JS,				WordTokenizer::CODE,	{} },
+	{ L_COFFEESCRIPT,	WordTokenizer::CODE,	{ TEXT("coffee") } },
+	{ L_FLASH,			WordTokenizer::CODE,	{ TEXT("as"), TEXT("mx") } },
+	{ L_PHP,			WordTokenizer::CODE,	{ TEXT("php") } },
+	{ L_JSP,			WordTokenizer::CODE,	{ TEXT("jsp") } },
+	{ L_PYTHON,			WordTokenizer::CODE,	{ TEXT("py") } },
+	{ L_PERL,			WordTokenizer::CODE,	{ TEXT("pl") } },
+	{ L_RUBY,			WordTokenizer::CODE,	{ TEXT("rb") } },
+	{ L_LUA,			WordTokenizer::CODE,	{ TEXT("lua") } },
+	{ L_POWERSHELL,		WordTokenizer::CODE,	{ TEXT("ps1") } },
+	{ L_SQL,			WordTokenizer::CODE,	{ TEXT("sql") } },
+	{ L_JSON,			WordTokenizer::JSON,	{ TEXT("json") } }
+};
 
-		pSubAlignData->diffMask		= 0;
-		pSubAlignData->line			= options.selections[cmpInfo.doc2.view].second + 1;
+}
 
-		if ((pMainAlignData->line < CallScintilla(cmpInfo.doc1.view, SCI_GETLINECOUNT, 0, 0)) &&
-				(pSubAlignData->line < CallScintilla(cmpInfo.doc2.view, SCI_GETLINECOUNT, 0, 0)))
-			summary.alignmentInfo.emplace_back(alignPair);
-	}
 
-	if (progress && !progress->NextPhase())
-		return false;
+WordTokenizer getLangTokenizer(int langType)
+{
+	for (const LangTokenizer& lang: cLangTokenizers)
+	{
+		if (lang.langType == langType)
+			return lang.tokenizer;
+	}
 
-	return true;
+	return WordTokenizer::TEXT;
 }
 
 
-CompareResult runCompare(const CompareOptions& options, CompareSummary& summary)
+WordTokenizer getFileTokenizer(const TCHAR* file)
 {
-	progress_ptr& progress = ProgressDlg::Get();
+	const TCHAR* ext = _tcsrchr(file, TEXT('.'));
 
-	CompareInfo cmpInfo;
+	if (!ext || _tcspbrk(ext, TEXT("\\/")))
+		return WordTokenizer::TEXT;
 
-	cmpInfo.doc1.view	= MAIN_VIEW;
-	cmpInfo.doc2.view	= SUB_VIEW;
+	++ext;
 
-	if (options.selectionCompare)
+	for (const LangTokenizer& lang: cLangTokenizers)
 	{
-		cmpInfo.doc1.section.off	= options.selections[MAIN_VIEW].first;
-		cmpInfo.doc1.section.len	= options.selections[MAIN_VIEW].second - options.selections[MAIN_VIEW].first + 1;
-
-		cmpInfo.doc2.section.off	= options.selections[SUB_VIEW].first;
-		cmpInfo.doc2.section.len	= options.selections[SUB_VIEW].second - options.selections[SUB_VIEW].first + 1;
+		for (size_t i = 0; i < _countof(lang.exts) && lang.exts[i]; ++i)
+		{
+			if (!_tcsicmp(ext, lang.exts[i]))
+				return lang.tokenizer;
+		}
 	}
 
-	cmpInfo.doc1.blockDiffMask = (options.newFileViewId == MAIN_VIEW) ? MARKER_MASK_ADDED : MARKER_MASK_REMOVED;
-	cmpInfo.doc2.blockDiffMask = (options.newFileViewId == MAIN_VIEW) ? MARKER_MASK_REMOVED : MARKER_MASK_ADDED;
-
-	getLines(cmpInfo.doc1, options);
+	return WordTokenizer::TEXT;
+}
 
-	if (progress && !progress->NextPhase())
-		return CompareResult::COMPARE_CANCELLED;
 
-	getLines(cmpInfo.doc2, options);
+CompareResult compareTexts(const CompareOptions& options, const char* text1, intptr_t textLen1, const char* text2,
+		intptr_t textLen2, CompareSummary& summary, CompareCache& cmpCache)
+{
+	cmpCache.clear();
 
-	if (progress && !progress->NextPhase())
-		return CompareResult::COMPARE_CANCELLED;
+	summary.stats.clear();
 
-	auto diffRes = DiffCalc<Line, blockDiffInfo>(cmpInfo.doc1.lines, cmpInfo.doc2.lines)(true, true);
-	cmpInfo.blockDiffs = std::move(diffRes.first);
+	const int64_t hashStart = getTimeStamp();
 
-	if (diffRes.second)
-		swap(cmpInfo.doc1, cmpInfo.doc2);
+	CompareInfo cmpInfo;
 
-	LOGD_GET_TIME;
-	PRINT_DIFFS("COMPARE START - LINE DIFFS", cmpInfo.blockDiffs);
+	setupDocs(cmpInfo.doc1, cmpInfo.doc2, options, nullptr);
 
-	const int blockDiffsSize = static_cast<int>(cmpInfo.blockDiffs.size());
+	// The texts are not in the views yet - text1 is the old one
+	cmpInfo.doc1.blockDiffMask = MARKER_MASK_REMOVED;
+	cmpInfo.doc2.blockDiffMask = MARKER_MASK_ADDED;
 
-	if (blockDiffsSize == 0 || (blockDiffsSize == 1 && cmpInfo.blockDiffs[0].type == diff_type::DIFF_MATCH))
-		return CompareResult::COMPARE_MATCH;
+	const int maxChunks = getMaxChunks();
 
-	findUniqueLines(cmpInfo);
+	std::vector<LinesChunk> chunks;
 
-	if (options.detectMoves)
-		findMoves(cmpInfo);
+	getTextSnapshot(cmpInfo.doc1, text1, textLen1, maxChunks, chunks);
+	getTextSnapshot(cmpInfo.doc2, text2, textLen2, maxChunks, chunks);
 
-	if (progress && !progress->NextPhase())
-		return CompareResult::COMPARE_CANCELLED;
+	summary.stats.linesHashed = hashChunks(chunks, options);
+	chunks.clear();
 
-	std::vector<int> changedBlockIdx;
+	summary.stats.linesCount = static_cast<int>(cmpInfo.doc1.lines.size() + cmpInfo.doc2.lines.size());
+	summary.stats.addTime(ComparePhase::HASH, hashStart);
 
-	int changedProgressCount = 0;
+	const CompareResult result = compareDocs(cmpInfo, options, summary);
 
-	// Get changed blocks to sub-compare
-	for (int i = 1; i < blockDiffsSize; ++i)
+	if (result == CompareResult::COMPARE_MISMATCH || result == CompareResult::COMPARE_MATCH)
 	{
-		if ((cmpInfo.blockDiffs[i].type == diff_type::DIFF_IN_2) &&
-				(cmpInfo.blockDiffs[i - 1].type == diff_type::DIFF_IN_1))
-		{
-			changedProgressCount += cmpInfo.blockDiffs[i].len * cmpInfo.blockDiffs[i - 1].len;
-			changedBlockIdx.emplace_back(i++);
-		}
+		std::shared_ptr<CompareCacheData> data = makeCacheData(options, result, cmpInfo, summary);
+
+		data->docs[MAIN_VIEW]		= 0;
+		data->docs[SUB_VIEW]		= 0;
+		data->versions[MAIN_VIEW]	= 0;
+		data->versions[SUB_VIEW]	= 0;
+		data->textLens[MAIN_VIEW]	= textLen1;
+		data->textLens[SUB_VIEW]	= textLen2;
+		data->textHashes[MAIN_VIEW]	= getTextHash(text1, textLen1);
+		data->textHashes[SUB_VIEW]	= getTextHash(text2, textLen2);
+
+		cmpCache.data = std::move(data);
 	}
 
-	if (progress)
-	{
-		progress->SetMaxCount(changedProgressCount);
+	return result;
+}
 
-		if (changedProgressCount > 10000)
-			progress->Show();
-	}
 
-	// Do block compares
-	for (int i: changedBlockIdx)
-	{
-		diffInfo& blockDiff1 = cmpInfo.blockDiffs[i - 1];
-		diffInfo& blockDiff2 = cmpInfo.blockDiffs[i];
+bool writeUnifiedDiff(const CompareInfo& cmpInfo, const char* oldText, const char* newText, const char* name1,
+		const char* name2, int contextLines, const DiffWriteFn& writeFn)
+{
+	// The docs might be swapped by the compare - the old one is marked as removed
+	const bool swapped = (cmpInfo.doc1.blockDiffMask != MARKER_MASK_REMOVED);
 
-		blockDiff1.info.matchBlock = &blockDiff2;
-		blockDiff2.info.matchBlock = &blockDiff1;
+	const DocCmpInfo& oldDoc = swapped ? cmpInfo.doc2 : cmpInfo.doc1;
+	const DocCmpInfo& newDoc = swapped ? cmpInfo.doc1 : cmpInfo.doc2;
 
-		if (!compareBlocks(cmpInfo.doc1, cmpInfo.doc2, blockDiff1, blockDiff2, options))
-			return CompareResult::COMPARE_CANCELLED;
-	}
+	// The empty line after the last EOL is not a line of the diff
+	auto diffLinesCount =
+		[](const DocCmpInfo& doc) -> int
+		{
+			const int count = static_cast<int>(doc.lineSpans.size());
 
-	if (progress && !progress->NextPhase())
-		return CompareResult::COMPARE_CANCELLED;
+			return (count && doc.lineSpans.back().len == 0 && doc.lineSpans.back().off == doc.textLen) ?
+					count - 1 : count;
+		};
 
-	clearWindow(MAIN_VIEW);
-	clearWindow(SUB_VIEW);
+	const int linesCount1 = diffLinesCount(oldDoc);
+	const int linesCount2 = diffLinesCount(newDoc);
 
-	if (!markAllDiffs(cmpInfo, options, summary))
-		return CompareResult::COMPARE_CANCELLED;
+	// The last lines without EOL are kept only if both of them are such
+	auto noEolLine =
+		[](const DocCmpInfo& doc, int linesCount) -> int
+		{
+			return (linesCount &&
+					doc.lineSpans[linesCount - 1].off + doc.lineSpans[linesCount - 1].len == doc.textLen) ?
+					linesCount - 1 : -1;
+		};
 
-	return CompareResult::COMPARE_MISMATCH;
-}
+	const int noEolLine1 = noEolLine(oldDoc, linesCount1);
+	const int noEolLine2 = noEolLine(newDoc, linesCount2);
 
+	// The line text end with its EOL - the section last line EOL is not in the next line span
+	auto lineEnd =
+		[](const char* text, const DocCmpInfo& doc, int line) -> intptr_t
+		{
+			const span_t& span = doc.lineSpans[line];
 
-CompareResult runFindUnique(const CompareOptions& options, CompareSummary& summary)
-{
-	progress_ptr& progress = ProgressDlg::Get();
+			if (line + 1 < static_cast<int>(doc.lineSpans.size()))
+				return doc.lineSpans[line + 1].off;
 
-	summary.alignmentInfo.clear();
+			intptr_t end = span.off + span.len;
 
-	summary.diffLines	= 0;
-	summary.added		= 0;
-	summary.removed		= 0;
-	summary.changed		= 0;
-	summary.moved		= 0;
-	summary.match		= 0;
+			if (end < doc.textLen && text[end] == '\r')
+				++end;
 
-	DocCmpInfo doc1;
-	DocCmpInfo doc2;
+			if (end < doc.textLen && text[end] == '\n')
+				++end;
 
-	doc1.view	= MAIN_VIEW;
-	doc2.view	= SUB_VIEW;
+			return end;
+		};
 
-	if (options.selectionCompare)
-	{
-		doc1.section.off	= options.selections[MAIN_VIEW].first;
-		doc1.section.len	= options.selections[MAIN_VIEW].second - options.selections[MAIN_VIEW].first + 1;
+	// Lines left out of the compare (the ignored empty ones) are not in the block diffs
+	std::vector<char> compared1(linesCount1, 0);
+	std::vector<char> compared2(linesCount2, 0);
 
-		doc2.section.off	= options.selections[SUB_VIEW].first;
-		doc2.section.len	= options.selections[SUB_VIEW].second - options.selections[SUB_VIEW].first + 1;
-	}
+	for (const Line& line: oldDoc.lines)
+		if (line.line - oldDoc.firstLine < linesCount1)
+			compared1[line.line - oldDoc.firstLine] = 1;
 
-	if (options.newFileViewId == MAIN_VIEW)
-	{
-		doc1.blockDiffMask = MARKER_MASK_ADDED;
-		doc2.blockDiffMask = MARKER_MASK_REMOVED;
-	}
-	else
+	for (const Line& line: newDoc.lines)
+		if (line.line - newDoc.firstLine < linesCount2)
+			compared2[line.line - newDoc.firstLine] = 1;
+
+	// The not compared lines are kept only if they are the same in both documents
+	auto isKept =
+		[&](int line1, int line2) -> bool
+		{
+			if (compared1[line1] || compared2[line2] || ((line1 == noEolLine1) != (line2 == noEolLine2)))
+				return false;
+
+			const intptr_t off1 = oldDoc.lineSpans[line1].off;
+			const intptr_t off2 = newDoc.lineSpans[line2].off;
+			const intptr_t len1 = lineEnd(oldText, oldDoc, line1) - off1;
+
+			return (len1 == lineEnd(newText, newDoc, line2) - off2 &&
+					!std::memcmp(oldText + off1, newText + off2, static_cast<size_t>(len1)));
+		};
+
+	// Changed ranges of old and new lines between the matched lines pairs - the lines between the changes are paired
+	// one to one
+	struct Change
 	{
-		doc1.blockDiffMask = MARKER_MASK_REMOVED;
-		doc2.blockDiffMask = MARKER_MASK_ADDED;
-	}
+		int	start1;
+		int	end1;
+		int	start2;
+		int	end2;
+	};
 
-	getLines(doc1, options);
+	std::vector<Change> changes;
 
-	if (progress && !progress->NextPhase())
-		return CompareResult::COMPARE_CANCELLED;
+	int next1 = 0;
+	int next2 = 0;
+
+	// Adds the change of the lines up to the matched pair (end1, end2) - the documents ends close the last one
+	auto addChange =
+		[&](int end1, int end2)
+		{
+			for (; next1 < end1 && next2 < end2 && isKept(next1, next2); ++next1, ++next2);
 
-	getLines(doc2, options);
+			int start1 = end1;
+			int start2 = end2;
 
-	if (progress && !progress->NextPhase())
-		return CompareResult::COMPARE_CANCELLED;
+			for (; start1 > next1 && start2 > next2 && isKept(start1 - 1, start2 - 1); --start1, --start2);
 
-	std::unordered_map<uint64_t, std::vector<int>> doc1UniqueLines;
+			if (next1 < start1 || next2 < start2)
+				changes.push_back({ next1, start1, next2, start2 });
+		};
 
-	for (const auto& line: doc1.lines)
+	for (int i = 0, pos1 = 0, pos2 = 0; i < static_cast<int>(cmpInfo.blockDiffs.size()); ++i)
 	{
-		auto insertPair = doc1UniqueLines.emplace(line.hash, std::vector<int>{line.line});
-		if (!insertPair.second)
-			insertPair.first->second.emplace_back(line.line);
-	}
+		const diffInfo& bd = cmpInfo.blockDiffs[i];
 
-	doc1.lines.clear();
+		if (bd.type == diff_type::DIFF_IN_1)
+		{
+			pos1 += bd.len;
+			continue;
+		}
 
-	if (progress && !progress->NextPhase())
-		return CompareResult::COMPARE_CANCELLED;
+		if (bd.type == diff_type::DIFF_IN_2)
+		{
+			pos2 += bd.len;
+			continue;
+		}
 
-	std::unordered_map<uint64_t, std::vector<int>> doc2UniqueLines;
+		for (int k = 0; k < bd.len; ++k)
+		{
+			const int line1 = cmpInfo.doc1.lines[pos1 + k].line - cmpInfo.doc1.firstLine;
+			const int line2 = cmpInfo.doc2.lines[pos2 + k].line - cmpInfo.doc2.firstLine;
 
-	for (const auto& line: doc2.lines)
-	{
-		auto insertPair = doc2UniqueLines.emplace(line.hash, std::vector<int>{line.line});
-		if (!insertPair.second)
-			insertPair.first->second.emplace_back(line.line);
+			const int oldLine = swapped ? line2 : line1;
+			const int newLine = swapped ? line1 : line2;
+
+			// The pairs with a single no EOL line are changed
+			if (oldLine >= linesCount1 || newLine >= linesCount2 ||
+					((oldLine == noEolLine1) != (newLine == noEolLine2)))
+				continue;
+
+			addChange(oldLine, newLine);
+
+			next1 = oldLine + 1;
+			next2 = newLine + 1;
+		}
+
+		pos1 += bd.len;
+		pos2 += bd.len;
 	}
 
-	doc2.lines.clear();
+	addChange(linesCount1, linesCount2);
 
-	if (progress && !progress->NextPhase())
-		return CompareResult::COMPARE_CANCELLED;
+	if (changes.empty())
+		return true;
 
-	clearWindow(MAIN_VIEW);
-	clearWindow(SUB_VIEW);
+	// The diff is collected and passed to writeFn in blocks of that size at least
+	static const size_t cWriteBlockSize = 1024 * 1024;
 
-	int doc1UniqueLinesCount = 0;
+	std::string buf;
+	buf.reserve(cWriteBlockSize + 4096);
 
-	for (const auto& uniqueLine: doc1UniqueLines)
-	{
-		auto doc2it = doc2UniqueLines.find(uniqueLine.first);
+	bool writeFailed = false;
 
-		if (doc2it != doc2UniqueLines.end())
+	auto flush =
+		[&]()
 		{
-			doc2UniqueLines.erase(doc2it);
-			++summary.match;
-		}
-		else
+			if (!writeFailed && !buf.empty())
+				writeFailed = !writeFn(buf.data(), static_cast<intptr_t>(buf.size()));
+
+			buf.clear();
+		};
+
+	auto append =
+		[&](const char* text, intptr_t len)
 		{
-			for (const auto& line: uniqueLine.second)
+			if (buf.size() + static_cast<size_t>(len) > cWriteBlockSize)
 			{
-				CallScintilla(doc1.view, SCI_MARKERADDSET, line, doc1.blockDiffMask);
-				++doc1UniqueLinesCount;
+				flush();
+
+				// Long lines are written as they are
+				if (len > static_cast<intptr_t>(cWriteBlockSize))
+				{
+					if (!writeFailed)
+						writeFailed = !writeFn(text, len);
+
+					return;
+				}
 			}
-		}
-	}
 
-	if (doc1UniqueLinesCount == 0 && doc2UniqueLines.empty())
-		return CompareResult::COMPARE_MATCH;
+			buf.append(text, len);
+		};
 
-	if (doc1.blockDiffMask == MARKER_MASK_ADDED)
-		summary.added = doc1UniqueLinesCount;
-	else
-		summary.removed = doc1UniqueLinesCount;
+	auto addLine =
+		[&](char mark, const char* text, const DocCmpInfo& doc, int line, int lastLine)
+		{
+			const intptr_t off = doc.lineSpans[line].off;
 
-	for (const auto& uniqueLine: doc2UniqueLines)
-	{
-		for (const auto& line: uniqueLine.second)
-			CallScintilla(doc2.view, SCI_MARKERADDSET, line, doc2.blockDiffMask);
+			buf += mark;
+			append(text + off, lineEnd(text, doc, line) - off);
 
-		if (doc2.blockDiffMask == MARKER_MASK_ADDED)
-			summary.added += uniqueLine.second.size();
-		else
-			summary.removed += uniqueLine.second.size();
-	}
+			if (line == lastLine)
+				buf += "\n\\ No newline at end of file\n";
+		};
 
-	AlignmentPair align;
-	align.main.line	= doc1.section.off;
-	align.sub.line	= doc2.section.off;
+	buf += "--- ";
+	buf += name1;
+	buf += "\n+++ ";
+	buf += name2;
+	buf += '\n';
 
-	summary.alignmentInfo.push_back(align);
+	const int changesCount = static_cast<int>(changes.size());
 
-	return CompareResult::COMPARE_MISMATCH;
-}
+	for (int first = 0; first < changesCount && !writeFailed;)
+	{
+		// The changes closer than twice the context lines are in the same hunk
+		int last = first;
 
-}
+		while (last + 1 < changesCount && changes[last + 1].start1 - changes[last].end1 <= 2 * contextLines)
+			++last;
 
+		const int leading	= std::min(contextLines, changes[first].start1);
+		const int trailing	= std::min(contextLines, (last + 1 < changesCount) ?
+				changes[last + 1].start1 - changes[last].end1 : linesCount1 - changes[last].end1);
 
-CompareResult compareViews(const CompareOptions& options, const TCHAR* progressInfo, CompareSummary& summary)
-{
-	CompareResult result = CompareResult::COMPARE_ERROR;
+		const int start1	= changes[first].start1 - leading;
+		const int start2	= changes[first].start2 - leading;
+		const int len1		= changes[last].end1 + trailing - start1;
+		const int len2		= changes[last].end2 + trailing - start2;
 
-	if (progressInfo)
-		ProgressDlg::Open(progressInfo);
+		// The compared sections might not start at the documents start
+		const int firstLine1 = oldDoc.firstLine + start1;
+		const int firstLine2 = newDoc.firstLine + start2;
 
-	try
-	{
-		if (options.findUniqueMode)
-			result = runFindUnique(options, summary);
-		else
-			result = runCompare(options, summary);
+		char header[64];
+
+		_snprintf_s(header, _countof(header), _TRUNCATE, "@@ -%d,%d +%d,%d @@\n",
+				len1 ? firstLine1 + 1 : firstLine1, len1, len2 ? firstLine2 + 1 : firstLine2, len2);
+		buf += header;
 
-		ProgressDlg::Close();
+		int line1 = start1;
 
-		if (result != CompareResult::COMPARE_MISMATCH)
+		for (int c = first; c <= last; ++c)
 		{
-			clearWindow(MAIN_VIEW);
-			clearWindow(SUB_VIEW);
+			for (; line1 < changes[c].start1; ++line1)
+				addLine(' ', oldText, oldDoc, line1, noEolLine1);
+
+			for (; line1 < changes[c].end1; ++line1)
+				addLine('-', oldText, oldDoc, line1, noEolLine1);
+
+			for (int line2 = changes[c].start2; line2 < changes[c].end2; ++line2)
+				addLine('+', newText, newDoc, line2, noEolLine2);
 		}
-	}
-	catch (std::exception& e)
-	{
-		ProgressDlg::Close();
 
-		clearWindow(MAIN_VIEW);
-		clearWindow(SUB_VIEW);
+		for (; line1 < start1 + len1; ++line1)
+			addLine(' ', oldText, oldDoc, line1, noEolLine1);
 
-		char msg[128];
-		_snprintf_s(msg, _countof(msg), _TRUNCATE, "Exception occurred: %s", e.what());
-		::MessageBoxA(nppData._nppHandle, msg, "ComparePlus", MB_OK | MB_ICONWARNING);
+		first = last + 1;
 	}
-	catch (...)
-	{
-		ProgressDlg::Close();
 
-		::MessageBoxA(nppData._nppHandle, "Unknown exception occurred.", "ComparePlus", MB_OK | MB_ICONWARNING);
-	}
+	flush();
 
-	return result;
+	return !writeFailed;
+}
+
+
+bool writeUnifiedDiff(const CompareCache& cmpCache, const char* text1, const char* text2, const char* name1,
+		const char* name2, int contextLines, const DiffWriteFn& writeFn)
+{
+	if (!cmpCache.data || !cmpCache.data->textHashes[MAIN_VIEW])
+		return false;
+
+	const CompareCacheData& data = *cmpCache.data;
+
+	if (data.result != CompareResult::COMPARE_MISMATCH)
+		return true;
+
+	// text1 is the old one
+	return writeUnifiedDiff(data.cmpInfo, text1, text2, name1, name2, contextLines, writeFn);
+}
+
+
+bool getUnifiedDiff(const CompareCache& cmpCache, const char* text1, const char* text2, const char* name1,
+		const char* name2, int contextLines, std::string& diff)
+{
+	diff.clear();
+
+	return writeUnifiedDiff(cmpCache, text1, text2, name1, name2, contextLines,
+			[&diff](const char* data, intptr_t len) { diff.append(data, len); return true; });
 }
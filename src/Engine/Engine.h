@@ -20,11 +20,21 @@
 #pragma once
 
 #include <windows.h>
+#include <cstdint>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
 #include <vector>
 #include <utility>
 
 #include "Compare.h"
 #include "NppHelpers.h"
+#include "CompareStats.h"
+#include "CompareProgress.h"
+
+
+class IgnoreRules;
 
 
 enum class CompareResult
@@ -36,6 +46,7 @@ enum class CompareResult
 };
 
 
+// Lines and diff elements section - they are indexed by int
 struct section_t
 {
 	section_t() : off(0), len(0) {}
@@ -46,6 +57,36 @@ struct section_t
 };
 
 
+// Text section in a line - the positions are 64 bit in the x64 build so the documents compared can be as big as the
+// ones Notepad++ opens. The compared lines are shorter than 2GB
+struct span_t
+{
+	span_t() : off(0), len(0) {}
+	span_t(intptr_t o, int l) : off(o), len(l) {}
+
+	intptr_t off;
+	int len;
+};
+
+
+// Splits the changed lines in words for the word diffs - selected by the compared documents language
+enum class WordTokenizer
+{
+	TEXT,	// Runs of spaces, alphanumeric and other chars
+	CODE,	// Identifiers, numbers, string literals (single or double quoted) and C-like operators
+	JSON	// Identifiers, numbers, double quoted strings and single char punctuation
+};
+
+
+// Returns the word tokenizer of a Notepad++ language (LangType)
+WordTokenizer getLangTokenizer(int langType);
+
+
+// Returns the word tokenizer of the language Notepad++ sets by the file extension so the folder compare results are
+// reused when the files are opened
+WordTokenizer getFileTokenizer(const TCHAR* file);
+
+
 struct CompareOptions
 {
 	CompareOptions()
@@ -67,12 +108,37 @@ struct CompareOptions
 	bool	ignoreCase;
 	bool	detectMoves;
 	bool	ignoreLineNumbers;
+	bool	verifyMatches;
+	bool	patienceDiff;
+
+	WordTokenizer	wordTokenizer {WordTokenizer::TEXT};
 
 	int		changedThresholdPercent;
+	int		diffCostLimit;
+
+	int		addHighlightColor;
+	int		remHighlightColor;
 
 	bool	selectionCompare;
 
+	// Set by the views compares - the sub-compares of big changed blocks are left to AsyncBlocksCompare
+	bool	deferBlocksCompare {false};
+
 	std::pair<int, int>	selections[2];
+
+	// Optional compiled user ignore patterns - their matches are left out of the compared text
+	std::shared_ptr<const IgnoreRules>	ignoreRules;
+
+	// Set by the background compares - the progress dialog is used otherwise
+	const std::atomic<bool>*	cancelToken {nullptr};
+
+	// Set by the views compares to the progress dialog - the engine core doesn't show any UI itself
+	CompareProgress*			progress {nullptr};
+
+	inline bool isCancelled() const
+	{
+		return (cancelToken && cancelToken->load());
+	}
 };
 
 
@@ -95,6 +161,7 @@ using AlignmentInfo_t = std::vector<AlignmentPair>;
 
 struct CompareSummary
 {
+	// The stats are not cleared - they are collected by the whole compare that clears the rest on marking
 	inline void clear()
 	{
 		diffLines	= 0;
@@ -103,8 +170,16 @@ struct CompareSummary
 		changed		= 0;
 		moved		= 0;
 		match		= 0;
+		conflicts	= 0;
+
+		hashCollisions	= 0;
+		approximate		= false;
+		deferredBlocks	= 0;
 
 		alignmentInfo.clear();
+
+		diffRanges[MAIN_VIEW].invalidate();
+		diffRanges[SUB_VIEW].invalidate();
 	}
 
 	int				diffLines;
@@ -114,8 +189,300 @@ struct CompareSummary
 	int				moved;
 	int				match;
 
+	// Lines changed differently in both documents - set only by the compares to a base
+	int				conflicts;
+
+	int				hashCollisions;
+	bool			approximate;
+
+	// Changed blocks pairs marked as added and removed lines until they are sub-compared by AsyncBlocksCompare
+	int				deferredBlocks;
+
 	AlignmentInfo_t	alignmentInfo;
+
+	// Indexed by view id, filled when the compare marks are applied
+	DiffLinesIndex	diffRanges[2];
+
+	// Reset by each compare run
+	CompareStats	stats;
 };
 
 
-CompareResult compareViews(const CompareOptions& options, const TCHAR* progressInfo, CompareSummary& summary);
+/**
+ *  \struct
+ *  \brief  Document line hashes kept between the re-compares of a compared pair. Text changes mark only the touched
+ *          lines dirty so only they are re-hashed on the next re-compare. The hashes depend on the compare options
+ *          so the cache must be invalidated if they change.
+ */
+struct LineHashCache
+{
+	inline void invalidate()
+	{
+		hashes.clear();
+		dirty.clear();
+
+		isStored = false;
+	}
+
+	inline bool isValid() const
+	{
+		return !hashes.empty();
+	}
+
+	// Call after text is inserted or deleted starting on startLine
+	inline void onTextChanged(int startLine, int linesAdded)
+	{
+		++version;
+
+		isStored = false;
+
+		if (!isValid())
+			return;
+
+		const int linesCount = static_cast<int>(hashes.size());
+
+		if (startLine < 0 || startLine >= linesCount || startLine + 1 - linesAdded > linesCount)
+		{
+			invalidate();
+			return;
+		}
+
+		if (linesAdded > 0)
+		{
+			hashes.insert(hashes.begin() + startLine + 1, linesAdded, 0);
+			dirty.insert(dirty.begin() + startLine + 1, linesAdded, 1);
+		}
+		else if (linesAdded < 0)
+		{
+			hashes.erase(hashes.begin() + startLine + 1, hashes.begin() + startLine + 1 - linesAdded);
+			dirty.erase(dirty.begin() + startLine + 1, dirty.begin() + startLine + 1 - linesAdded);
+		}
+
+		dirty[startLine] = 1;
+	}
+
+	std::vector<uint64_t>	hashes;
+	std::vector<char>		dirty;
+
+	// Incremented on each text change - used to detect that the document changed during background compare
+	unsigned				version {0};
+
+	// Compare options the hashes are calculated with - see getLineHashesKey()
+	uint64_t				optionsKey {0};
+
+	// Set when the hashes are the same as the ones stored on disk for the document file
+	bool					isStored {false};
+};
+
+
+// Identifies the compare options that affect the line hashes - the hashes cache is reused only while it is the same.
+// Never 0 so a new cache doesn't match any options
+uint64_t getLineHashesKey(const CompareOptions& options);
+
+
+struct CompareCacheData;
+
+
+/**
+ *  \struct
+ *  \brief  Block diffs of the last compare kept so a re-compare of the same unchanged documents with the same diff
+ *          options only marks them again. The marking options (align all matches and never mark ignored) might differ.
+ *          The documents content changes are tracked through the line hashes caches versions
+ */
+struct CompareCache
+{
+	inline void clear()
+	{
+		data.reset();
+	}
+
+	// Compare engine internal data shared by the copies of the cache - it is replaced on each compare
+	std::shared_ptr<CompareCacheData>	data;
+};
+
+
+// lineHashes is an optional array of two caches indexed by view id. The compare cache is used only with lineHashes
+CompareResult compareViews(const CompareOptions& options, const TCHAR* progressInfo, CompareSummary& summary,
+		LineHashCache* lineHashes = nullptr, CompareCache* cmpCache = nullptr);
+
+
+// Compares two texts that are not loaded in the views (e.g. files mapped in memory) - text1 is the old one. The texts
+// must stay valid during the call. Only the texts are accessed so it is safe to be run in a worker thread; use the
+// options cancel token to stop it. Exceptions are passed to the caller.
+// The results are kept in cmpCache to be marked once the texts are opened - see bindCompareCache()
+CompareResult compareTexts(const CompareOptions& options, const char* text1, intptr_t textLen1, const char* text2,
+		intptr_t textLen2, CompareSummary& summary, CompareCache& cmpCache);
+
+
+// Binds compareTexts() results to the documents in the views so compareViews() just marks them. The texts can be in
+// either view. Returns false and clears cmpCache if the views don't hold the compared texts
+bool bindCompareCache(CompareCache& cmpCache, const LineHashCache* lineHashes);
+
+
+// Takes the unified diffs text in blocks of about 1 MB - returns false to stop the writing (e.g. on a write error)
+using DiffWriteFn = std::function<bool(const char* data, intptr_t len)>;
+
+
+// Streams compareTexts() results kept in cmpCache as a unified diff with contextLines of context around the changes.
+// The texts must be the compared ones. The differences of the matched lines ignored by the compare options are not in
+// the diff - the context lines are taken from text1. The ignored empty lines that differ are in the diff so it always
+// applies to text1. Returns false if cmpCache doesn't hold compareTexts() results or writeFn fails
+bool writeUnifiedDiff(const CompareCache& cmpCache, const char* text1, const char* text2, const char* name1,
+		const char* name2, int contextLines, const DiffWriteFn& writeFn);
+
+
+// Collects the writeUnifiedDiff() output in diff
+bool getUnifiedDiff(const CompareCache& cmpCache, const char* text1, const char* text2, const char* name1,
+		const char* name2, int contextLines, std::string& diff);
+
+
+// Checks if cmpCache holds the compare results of the views documents and they are not changed since then
+bool isCompareCacheCurrent(const CompareCache& cmpCache, const LineHashCache* lineHashes);
+
+
+// Streams compareViews() results kept in cmpCache as writeUnifiedDiff() does - name1 is the old document one. The
+// views documents texts are taken so they must not be changed since the compare (lineHashes are the compare ones).
+// Returns false if cmpCache doesn't hold the current views compare results or writeFn fails
+bool writeViewsUnifiedDiff(const CompareCache& cmpCache, const LineHashCache* lineHashes, const char* name1,
+		const char* name2, int contextLines, const DiffWriteFn& writeFn);
+
+
+// Three-way compare of the views documents to their common base text (not loaded in Scintilla, e.g. a file mapped in
+// memory). The base is hashed once and both documents are diffed against its lines in parallel. The lines changed
+// only in one document are marked added there and removed in the other one, the lines changed differently in both
+// are marked changed and counted as conflicts. Lines changed the same way in both are not marked.
+// Selections, find unique, moves detection and the compare cache are not used
+CompareResult compareViewsToBase(const CompareOptions& options, const TCHAR* progressInfo, const char* baseText,
+		intptr_t baseTextLen, CompareSummary& summary, LineHashCache* lineHashes = nullptr);
+
+
+/**
+ *  \struct
+ *  \brief  Line hashes of a document kept to check it later against that state without keeping its text (e.g. the
+ *          last saved one or a VCS base version). The hashes are valid only with the compare options they are taken
+ *          with
+ */
+struct DocSnapshot
+{
+	// A hash for each line - the empty lines are not left out even if they are ignored
+	std::vector<uint64_t>	lineHashes;
+
+	uint64_t				textHash {0};
+	intptr_t				textLen {0};
+
+	// Compare options the hashes are calculated with - see getLineHashesKey()
+	uint64_t				optionsKey {0};
+};
+
+
+// Checks if the view document lines match the text lines with the options that affect the lines hashes. The text is
+// not loaded in Scintilla (it can be a file mapped in memory) and it must stay valid during the call.
+// The view is not marked so a mismatch should be shown by a full compare - on a mismatch textSnapshot (if given) is
+// filled with the text hashes so the full compare doesn't hash the text again (see setLineHashesFromSnapshot()).
+// COMPARE_ERROR is returned on failure to let the full compare handle it
+CompareResult compareViewToText(const CompareOptions& options, int view, const char* text, intptr_t textLen,
+		DocSnapshot* textSnapshot = nullptr);
+
+
+// Takes the view document snapshot. Returns false on failure
+bool takeViewSnapshot(const CompareOptions& options, int view, DocSnapshot& snapshot);
+
+
+// Takes the snapshot of a text that is not loaded in Scintilla. Only the text is accessed so it is safe to be run in a
+// worker thread - the options cancel token stops it. Returns false on failure or if cancelled
+bool takeTextSnapshot(const CompareOptions& options, const char* text, intptr_t textLen, DocSnapshot& snapshot);
+
+
+// Checks the view document against its snapshot as compareViewToText() checks it against a text but the matched lines
+// can't be verified as the text is not kept. COMPARE_ERROR is returned on failure or if the snapshot is taken with
+// other options
+CompareResult compareViewToSnapshot(const CompareOptions& options, int view, const DocSnapshot& snapshot);
+
+
+// Fills the view document line hashes cache from the snapshot of the same text so its compare doesn't hash the lines
+// again. Returns false and leaves the cache untouched if the view text or the options are not the snapshot ones
+bool setLineHashesFromSnapshot(const CompareOptions& options, int view, const DocSnapshot& snapshot,
+		LineHashCache& cache);
+
+
+/**
+ *  \class
+ *  \brief  Compare run in a worker thread over a private copy of the views text so the UI is not blocked.
+ *          The views are accessed only from the main thread - when the text snapshot is taken on construction and
+ *          when the results are applied. Only one background compare can run at a time and no other compare should run
+ *          in parallel.
+ */
+class AsyncCompare
+{
+public:
+	// lineHashes is an array of two caches indexed by view id - they are copied and not accessed until apply(). The
+	// line diffs of the previous compare of the documents are copied from the optional cmpCache to be re-used for
+	// the unchanged lines
+	AsyncCompare(const CompareOptions& options, const LineHashCache* lineHashes,
+			const CompareCache* cmpCache = nullptr);
+	~AsyncCompare();
+
+	AsyncCompare(const AsyncCompare&) = delete;
+	AsyncCompare& operator=(const AsyncCompare&) = delete;
+
+	void cancel();
+	bool isDone() const;
+
+	// Checks if the compared documents are changed since the compare start
+	bool isStale(const LineHashCache* lineHashes) const;
+
+	// Marks the views and updates lineHashes and the optional cmpCache with the compare results. Must be called from
+	// the main thread once isDone() - stale results are discarded and COMPARE_CANCELLED is returned
+	CompareResult apply(CompareSummary& summary, LineHashCache* lineHashes, CompareCache* cmpCache = nullptr);
+
+private:
+	struct Job;
+
+	std::unique_ptr<Job> _job;
+};
+
+
+/**
+ *  \class
+ *  \brief  Sub-compares the changed blocks left by a views compare with deferred blocks compare in a worker thread
+ *          over private copies of the compare cache data and the views text. The blocks shown in the views are
+ *          compared first - a run compares them or all the rest if none of them is shown. The views are accessed
+ *          only from the main thread on construction and when the results are applied. Same rules as for
+ *          AsyncCompare apply
+ */
+class AsyncBlocksCompare
+{
+public:
+	// lineHashes is an array of two caches indexed by view id. Nothing is compared if cmpCache doesn't hold the views
+	// documents compare
+	AsyncBlocksCompare(const CompareCache& cmpCache, const LineHashCache* lineHashes);
+	~AsyncBlocksCompare();
+
+	AsyncBlocksCompare(const AsyncBlocksCompare&) = delete;
+	AsyncBlocksCompare& operator=(const AsyncBlocksCompare&) = delete;
+
+	void cancel();
+	bool isDone() const;
+
+	// Updates cmpCache with the compared blocks - re-compare the views to mark them. Must be called from the main
+	// thread once isDone(). Returns false if the results are stale or the cache is replaced meanwhile
+	bool apply(CompareCache& cmpCache, const LineHashCache* lineHashes);
+
+private:
+	struct Job;
+
+	std::unique_ptr<Job> _job;
+};
+
+
+#ifdef DLOG
+
+// Takes the engine debug log messages - the log time base is reset instead if resetTime is true
+using EngineLogFn = std::function<void(const std::string& msg, bool resetTime)>;
+
+
+// Sets the engine debug log hook so the engine does not depend on the plugin debug log. Nothing is logged while it is
+// not set (e.g. in the bench apps)
+void setEngineLog(EngineLogFn logFn);
+
+#endif
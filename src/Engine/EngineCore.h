@@ -0,0 +1,503 @@
+/*
+ * This file is part of ComparePlus plugin for Notepad++
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+#include "Engine.h"
+#include "diff.h"
+#include "TextScan.h"
+
+
+/**
+ *  \class
+ *  \brief  Document the compare engine takes its text snapshot from. The text is contiguous and stays valid until the
+ *          document is modified. Implemented over the Scintilla views by the views layer
+ */
+class DocSource
+{
+public:
+	virtual ~DocSource() {}
+
+	virtual const char* text() const = 0;
+	virtual intptr_t textLength() const = 0;
+	virtual intptr_t linesCount() const = 0;
+	virtual intptr_t lineStart(int line) const = 0;
+};
+
+
+struct Line
+{
+	int line;
+
+	uint64_t hash;
+
+	inline bool operator==(const Line& rhs) const
+	{
+		return (hash == rhs.hash);
+	}
+
+	inline bool operator!=(const Line& rhs) const
+	{
+		return (hash != rhs.hash);
+	}
+
+	inline bool operator==(uint64_t rhs) const
+	{
+		return (hash == rhs);
+	}
+
+	inline bool operator!=(uint64_t rhs) const
+	{
+		return (hash != rhs);
+	}
+};
+
+
+inline uint64_t diffHash(const Line& line)
+{
+	return line.hash;
+}
+
+
+// Word span in its line - the word hashes are kept in a parallel array diffed on their own
+struct Word
+{
+	int pos;
+	int len;
+};
+
+
+/**
+ *  \struct
+ *  \brief  Chars of a section compared char by char. The chars positions in the section are kept only if some chars
+ *          are skipped (ignored spaces) - the char index is its position otherwise
+ */
+struct SectionChars
+{
+	std::vector<char>	chars;
+	std::vector<int>	positions;
+
+	inline int size() const
+	{
+		return static_cast<int>(chars.size());
+	}
+
+	inline bool empty() const
+	{
+		return chars.empty();
+	}
+
+	inline int pos(int i) const
+	{
+		return positions.empty() ? i : positions[i];
+	}
+};
+
+
+/**
+ *  \struct
+ *  \brief  Line markers and changed text highlights collected while marking the diffs of one view. They are applied
+ *          to the view in a single batch by the views layer
+ */
+struct ViewMarks
+{
+	// Pairs of document line and marker mask
+	std::vector<std::pair<int, int>>	markers;
+	std::vector<TextHighlight>			highlights;
+
+	inline void addMarker(int line, int mask)
+	{
+		markers.emplace_back(line, mask);
+	}
+
+	inline void addHighlight(intptr_t start, intptr_t length, int color)
+	{
+		if (length <= 0)
+			return;
+
+		if (!highlights.empty())
+		{
+			TextHighlight& last = highlights.back();
+
+			if (last.color == color && last.start + last.length == start)
+			{
+				last.length += length;
+				return;
+			}
+		}
+
+		highlights.push_back({start, length, color});
+	}
+};
+
+
+/**
+ *  \struct
+ *  \brief  Dense bit flags indexed by the line offset from the compared section start
+ */
+struct LinesBitset
+{
+	inline void reset(int linesCount)
+	{
+		bits.assign((linesCount + 63) / 64, 0);
+	}
+
+	inline void set(int line)
+	{
+		bits[line >> 6] |= (1ULL << (line & 63));
+	}
+
+	inline bool test(int line) const
+	{
+		return ((bits[line >> 6] >> (line & 63)) & 1) != 0;
+	}
+
+	inline bool empty() const
+	{
+		return bits.empty();
+	}
+
+	std::vector<uint64_t>	bits;
+};
+
+
+struct DocCmpInfo
+{
+	int			view;
+	section_t	section;
+
+	int			blockDiffMask;
+
+	// Document text snapshot - valid as long as the document is not modified
+	const char*				text {nullptr};
+	intptr_t				textLen {0};
+	int						linesCount {0};
+	int						firstLine {0};
+	std::vector<span_t>		lineSpans;
+
+	// Absolute positions of the text matched by the ignore rules, sorted
+	std::vector<span_t>		ignoredSpans;
+
+	// Private text copy used by the background compares
+	std::vector<char>		textCopy;
+
+	// Optional line hashes kept from the previous compare
+	LineHashCache*			lineHashes {nullptr};
+
+	std::vector<Line>		lines;
+	LinesBitset				nonUniqueLines;
+
+	ViewMarks				marks;
+
+	inline const span_t& lineSpan(int docLine) const
+	{
+		return lineSpans[docLine - firstLine];
+	}
+
+	// Lines found in the other document too - set only by the compares that mark them
+	inline bool isNonUnique(int docLine) const
+	{
+		return (!nonUniqueLines.empty() && nonUniqueLines.test(docLine - firstLine));
+	}
+};
+
+
+struct diffLine
+{
+	diffLine(int lineNum) : line(lineNum) {}
+
+	int line;
+	std::vector<section_t> changes;
+};
+
+
+struct blockDiffInfo
+{
+	const diff_info<blockDiffInfo>*	matchBlock {nullptr};
+
+	std::vector<diffLine>	changedLines;
+
+	// Non-overlapping moved sections sorted by offset
+	std::vector<section_t>	moves;
+
+	// Edited lines of the fuzzy moves sorted by line - they are part of the moves but are marked as changed
+	std::vector<diffLine>	movedChanges;
+
+	inline void addMove(int off, int len)
+	{
+		auto it = std::upper_bound(moves.begin(), moves.end(), off,
+				[](int o, const section_t& move) { return o < move.off; });
+
+		moves.emplace(it, off, len);
+		_movedCount += len;
+	}
+
+	// The fuzzy moves lines are added in order per move but the moves are not
+	inline void addMovedChange(diffLine&& changed)
+	{
+		auto it = std::upper_bound(movedChanges.begin(), movedChanges.end(), changed.line,
+				[](int l, const diffLine& dl) { return l < dl.line; });
+
+		movedChanges.emplace(it, std::move(changed));
+	}
+
+	inline int movedCount() const
+	{
+		return _movedCount;
+	}
+
+	// Returns the first moved section that ends after line
+	inline std::vector<section_t>::const_iterator nextMove(int line) const
+	{
+		return std::upper_bound(moves.begin(), moves.end(), line,
+				[](int l, const section_t& move) { return l < move.off + move.len; });
+	}
+
+	inline int movedSection(int line) const
+	{
+		const section_t* move = findMove(line);
+
+		return move ? move->len : 0;
+	}
+
+	inline bool getNextUnmoved(int& line) const
+	{
+		const section_t* move = findMove(line);
+
+		if (move)
+		{
+			line = move->off + move->len;
+			return true;
+		}
+
+		return false;
+	}
+
+private:
+	inline const section_t* findMove(int line) const
+	{
+		auto it = nextMove(line);
+
+		return (it != moves.end() && line >= it->off) ? &(*it) : nullptr;
+	}
+
+	int _movedCount {0};
+};
+
+
+using diffInfo = diff_info<blockDiffInfo>;
+
+
+struct CompareInfo
+{
+	// Input data
+	DocCmpInfo				doc1;
+	DocCmpInfo				doc2;
+
+	// Output data - filled by the compare engine
+	std::vector<diffInfo>	blockDiffs;
+};
+
+
+struct CompareCacheData
+{
+	CompareOptions	options;
+
+	// Documents in the views and their content when compared
+	LRESULT			docs[2];
+	unsigned		versions[2];
+	intptr_t		textLens[2];
+
+	// Compared texts hashes - set by compareTexts() to check the views text when the cache is bound to them
+	uint64_t		textHashes[2];
+
+	CompareResult	result;
+	CompareInfo		cmpInfo;
+
+	int				hashCollisions;
+	bool			approximate;
+
+	// Changed blocks pairs not sub-compared yet - see AsyncBlocksCompare
+	int				deferredBlocks;
+};
+
+
+/**
+ *  \struct
+ *  \brief  Line diffs of the previous compare of the same documents with the same diff options. A re-compare after an
+ *          edit diffs only the lines between the unchanged matches around the edit and splices them in these ones.
+ *          The line hashes are the compared lines ones in doc1 and doc2 order - the views are the compare docs ones
+ */
+struct PrevLineDiffs
+{
+	int								views[2];
+	std::vector<uint64_t>			hashes1;
+	std::vector<uint64_t>			hashes2;
+	std::vector<diff_info<void>>	diffs;
+
+	bool							approximate {false};
+};
+
+
+struct LinesChunk
+{
+	LinesChunk(DocCmpInfo& d, int first, int count, intptr_t pos) :
+			doc(d), firstLine(first), linesCount(count), startPos(pos)
+	{}
+
+	DocCmpInfo&	doc;
+
+	int			firstLine;
+	int			linesCount;
+	intptr_t	startPos;
+
+	// Lines not reused from the document line hashes cache
+	int			linesHashed {0};
+
+	std::vector<span_t>		lineSpans;
+	std::vector<span_t>		ignoredSpans;
+	std::vector<Line>		lines;
+};
+
+
+// Finds the longest chain of lines convergences with both line1 and line2 increasing - at most one of each line1
+// convergences can be in it. The convergences are grouped per line1 by lines sections in line1 order and sorted by
+// line2 in them. Of the longest chains the one that ends first at the smallest line2 is taken. The mapping differs
+// from the one of the greedy grouping the blocks compare used before - that one could settle on a shorter chain and
+// it picked other pairs of the equally long ones. DiffBench compares the two. Returns the chain pairs in order
+template <typename LinesConvT>
+std::vector<std::pair<int, int>> getBestLineMappings(const std::vector<LinesConvT>& convs,
+		const std::vector<section_t>& lines)
+{
+	// tails[len - 1] is the convs index of the last line pair of the chain of length len that ends at the smallest
+	// line2 so far
+	std::vector<int> tails;
+	std::vector<int> prevs(convs.size(), -1);
+
+	int bestTail = -1;
+	int bestTailLine1 = -1;
+
+	for (const auto& lineConvs: lines)
+	{
+		// Walked from the biggest line2 so line1 convergences don't extend each other's chains
+		for (int i = lineConvs.off + lineConvs.len - 1; i >= lineConvs.off; --i)
+		{
+			auto tailItr = std::lower_bound(tails.begin(), tails.end(), convs[i].line2,
+					[&convs](int tail, int line2) { return (convs[tail].line2 < line2); });
+
+			if (tailItr != tails.begin())
+				prevs[i] = *(tailItr - 1);
+
+			if (tailItr == tails.end())
+			{
+				tails.emplace_back(i);
+
+				bestTail = i;
+				bestTailLine1 = convs[i].line1;
+			}
+			else
+			{
+				if ((tailItr + 1 == tails.end()) && (convs[i].line1 == bestTailLine1))
+					bestTail = i;
+
+				*tailItr = i;
+			}
+		}
+	}
+
+	std::vector<std::pair<int, int>> lineMappings(tails.size());
+
+	for (int i = bestTail, mapIdx = static_cast<int>(tails.size()) - 1; i != -1; i = prevs[i], --mapIdx)
+		lineMappings[mapIdx] = std::make_pair(convs[i].line1, convs[i].line2);
+
+	return lineMappings;
+}
+
+
+// Work of the parallel phases is split in up to that many chunks
+int getMaxChunks();
+
+// Takes the document text snapshot and splits its section in up to maxChunks line chunks. The text is copied if
+// the snapshot should stay valid while the document is changed. Throws std::length_error if the document has more
+// lines than the engine can index
+void getSnapshot(DocCmpInfo& doc, const DocSource& source, int maxChunks, std::vector<LinesChunk>& chunks,
+		bool copyText);
+
+// Takes a snapshot of text that is not in a view and splits it in up to maxChunks line chunks. The text is not copied.
+// Throws std::length_error as getSnapshot()
+void getTextSnapshot(DocCmpInfo& doc, const char* text, intptr_t textLen, int maxChunks,
+		std::vector<LinesChunk>& chunks);
+
+// Hashes the snapshots chunks in parallel and collects their lines in the documents. Returns the count of the lines
+// hashed (not reused from the line hashes caches)
+int hashChunks(std::vector<LinesChunk>& chunks, const CompareOptions& options);
+
+void setupDocs(DocCmpInfo& doc1, DocCmpInfo& doc2, const CompareOptions& options, LineHashCache* lineHashes);
+
+// Compares the hashed documents and collects their markers. The line diffs are spliced in prevDiffs if they are given
+// and the edited lines are few enough
+CompareResult compareDocs(CompareInfo& cmpInfo, const CompareOptions& options, CompareSummary& summary,
+		const PrevLineDiffs* prevDiffs = nullptr);
+
+// Sub-compares the changed blocks pairs given by the indexes of their DIFF_IN_2 blocks. Returns false if cancelled
+bool compareChangedBlocks(CompareInfo& cmpInfo, const std::vector<int>& changedBlockIdx, const CompareOptions& options,
+		int& hashCollisions, int& subDiffs);
+
+// Indexes of the DIFF_IN_2 blocks of the changed blocks pairs left by a compare with deferred blocks compare
+std::vector<int> getDeferredBlocks(const CompareInfo& cmpInfo);
+
+// Finds the unique lines of the hashed documents and collects their markers
+CompareResult findUniqueDocs(DocCmpInfo& doc1, DocCmpInfo& doc2, const CompareOptions& options,
+		CompareSummary& summary);
+
+// Three-way compare of the hashed documents to their hashed common base - see compareViewsToBase()
+CompareResult compareDocsToBase(const DocCmpInfo& base, CompareInfo& cmpInfo, const CompareOptions& options,
+		CompareSummary& summary);
+
+// Collects the markers and the alignment of the compared block diffs
+bool markAllDiffs(CompareInfo& cmpInfo, const CompareOptions& options, CompareSummary& summary);
+
+bool areLinesEqual(const DocCmpInfo& doc1, int line1, const DocCmpInfo& doc2, int line2,
+		const CompareOptions& options, std::vector<char>& buf1, std::vector<char>& buf2);
+
+// Compares the options that affect the block diffs - all but the marking ones
+bool isSameDiff(const CompareOptions& lhs, const CompareOptions& rhs);
+
+// Streams the block diffs of the compared documents as a unified diff - the texts are the old (marked as removed) and
+// the new document ones
+bool writeUnifiedDiff(const CompareInfo& cmpInfo, const char* oldText, const char* newText, const char* name1,
+		const char* name2, int contextLines, const DiffWriteFn& writeFn);
+
+// Takes the block diffs of a completed compare. The documents text is dropped
+std::shared_ptr<CompareCacheData> makeCacheData(const CompareOptions& options, CompareResult result,
+		CompareInfo& cmpInfo, const CompareSummary& summary);
+
+
+inline uint64_t getTextHash(const char* text, intptr_t textLen)
+{
+	TextHash hash;
+
+	hash.add(text, textLen);
+
+	return hash.get();
+}
@@ -0,0 +1,1147 @@
+/*
+ * This file is part of ComparePlus plugin for Notepad++
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define NOMINMAX
+
+#include <cstdint>
+#include <exception>
+#include <utility>
+#include <vector>
+#include <algorithm>
+
+#include <windows.h>
+
+#include "EngineCore.h"
+#include "ProgressDlg.h"
+
+#ifdef MULTITHREAD
+
+#if defined(__MINGW32__) && !defined(_GLIBCXX_HAS_GTHREADS)
+#include "../mingw-std-threads/mingw.thread.h"
+#else
+#include <thread>
+#endif // __MINGW32__ ...
+
+#endif // MULTITHREAD
+
+
+namespace {
+
+/**
+ *  \class
+ *  \brief  Scintilla view document source - must be used from the main thread only
+ */
+class ViewSource : public DocSource
+{
+public:
+	explicit ViewSource(int view) : _view(view) {}
+
+	const char* text() const override
+	{
+		return reinterpret_cast<const char*>(CallScintilla(_view, SCI_GETCHARACTERPOINTER, 0, 0));
+	}
+
+	intptr_t textLength() const override
+	{
+		return CallScintilla(_view, SCI_GETLENGTH, 0, 0);
+	}
+
+	intptr_t linesCount() const override
+	{
+		return CallScintilla(_view, SCI_GETLINECOUNT, 0, 0);
+	}
+
+	intptr_t lineStart(int line) const override
+	{
+		return getLineStart(_view, line);
+	}
+
+private:
+	const int _view;
+};
+
+
+// The doc lines must be hashed with all lines taken (empty lines included)
+void setSnapshot(const CompareOptions& options, const DocCmpInfo& doc, DocSnapshot& snapshot)
+{
+	snapshot.lineHashes.resize(doc.lines.size());
+
+	for (size_t i = 0; i < doc.lines.size(); ++i)
+		snapshot.lineHashes[i] = doc.lines[i].hash;
+
+	snapshot.textLen	= doc.textLen;
+	snapshot.textHash	= doc.textLen ? getTextHash(doc.text, doc.textLen) : 0;
+	snapshot.optionsKey	= getLineHashesKey(options);
+}
+
+
+// The snapshots keep a hash for each line so they can fill the line hashes caches. Hashes of all lines are taken
+bool fillSnapshot(const CompareOptions& options, DocCmpInfo& doc, std::vector<LinesChunk>& chunks,
+		DocSnapshot& snapshot)
+{
+	CompareOptions allLines = options;
+
+	allLines.ignoreEmptyLines = false;
+
+	hashChunks(chunks, allLines);
+
+	if (options.isCancelled() || static_cast<int>(doc.lines.size()) != (doc.textLen ? doc.linesCount : 0))
+	{
+		snapshot = DocSnapshot();
+		return false;
+	}
+
+	setSnapshot(options, doc, snapshot);
+
+	return true;
+}
+
+
+// The empty lines hash to the seed - they are skipped if they are ignored
+bool areLineHashesEqual(const std::vector<uint64_t>& hashes1, const std::vector<uint64_t>& hashes2,
+		bool ignoreEmptyLines)
+{
+	if (!ignoreEmptyLines)
+		return (hashes1 == hashes2);
+
+	size_t i1 = 0;
+	size_t i2 = 0;
+
+	for (;;)
+	{
+		for (; i1 < hashes1.size() && hashes1[i1] == cHashSeed; ++i1);
+		for (; i2 < hashes2.size() && hashes2[i2] == cHashSeed; ++i2);
+
+		if (i1 == hashes1.size() || i2 == hashes2.size())
+			return (i1 == hashes1.size() && i2 == hashes2.size());
+
+		if (hashes1[i1++] != hashes2[i2++])
+			return false;
+	}
+}
+
+
+// Applies the collected line markers and text highlights to the view at once
+void applyViewMarks(ViewMarks& marks, int view, DiffLinesIndex& diffLines)
+{
+	ScopedViewRedrawBlocker redrawBlock(view);
+
+	diffLines.clear();
+
+	std::sort(marks.markers.begin(), marks.markers.end(),
+			[](const std::pair<int, int>& lhs, const std::pair<int, int>& rhs) { return lhs.first < rhs.first; });
+
+	const int markersCount = static_cast<int>(marks.markers.size());
+
+	for (int i = 0; i < markersCount;)
+	{
+		const int line = marks.markers[i].first;
+		int mask = 0;
+
+		for (; i < markersCount && marks.markers[i].first == line; ++i)
+			mask |= marks.markers[i].second;
+
+		CallScintilla(view, SCI_MARKERADDSET, line, mask);
+
+		if (mask & MARKER_MASK_LINE)
+			diffLines.addLine(line);
+	}
+
+	markTextAsChanged(view, marks.highlights);
+
+	marks.markers.clear();
+	marks.highlights.clear();
+}
+
+
+// Takes both documents snapshots split in chunks to be hashed in parallel. Must be called from the main thread
+void getSnapshots(DocCmpInfo& doc1, DocCmpInfo& doc2, std::vector<LinesChunk>& chunks, bool copyText)
+{
+	const int maxChunks = getMaxChunks();
+
+	getSnapshot(doc1, ViewSource(doc1.view), maxChunks, chunks, copyText);
+	getSnapshot(doc2, ViewSource(doc2.view), maxChunks, chunks, copyText);
+}
+
+
+// Gets both documents lines hashes at once - documents are split in chunks that are hashed in parallel
+void getLines(DocCmpInfo& doc1, DocCmpInfo& doc2, const CompareOptions& options, CompareStats& stats)
+{
+	const int64_t hashStart = getTimeStamp();
+
+	std::vector<LinesChunk> chunks;
+
+	getSnapshots(doc1, doc2, chunks, false);
+
+	stats.linesHashed	= hashChunks(chunks, options);
+	stats.linesCount	= static_cast<int>(doc1.lines.size() + doc2.lines.size());
+
+	stats.addTime(ComparePhase::HASH, hashStart);
+}
+
+
+// Clears the views and marks the compare results
+void applyMarks(DocCmpInfo& doc1, DocCmpInfo& doc2, CompareSummary& summary)
+{
+	const int64_t applyStart = getTimeStamp();
+
+	clearWindow(MAIN_VIEW);
+	clearWindow(SUB_VIEW);
+
+	applyViewMarks(doc1.marks, doc1.view, summary.diffRanges[doc1.view]);
+	applyViewMarks(doc2.marks, doc2.view, summary.diffRanges[doc2.view]);
+
+	summary.stats.addTime(ComparePhase::APPLY, applyStart);
+}
+
+
+// Checks if the cached compare is of the documents in the views and they are not changed since then
+bool isCacheCurrent(const CompareCache* cmpCache, const LineHashCache* lineHashes)
+{
+	if (!cmpCache || !cmpCache->data || !lineHashes)
+		return false;
+
+	const CompareCacheData& data = *cmpCache->data;
+
+	for (int view: {MAIN_VIEW, SUB_VIEW})
+	{
+		if ((data.versions[view] != lineHashes[view].version) ||
+			(data.docs[view] != CallScintilla(view, SCI_GETDOCPOINTER, 0, 0)) ||
+			(data.textLens[view] != CallScintilla(view, SCI_GETLENGTH, 0, 0)))
+			return false;
+	}
+
+	return true;
+}
+
+
+bool isCacheValid(const CompareCache* cmpCache, const CompareOptions& options, const LineHashCache* lineHashes)
+{
+	return (isCacheCurrent(cmpCache, lineHashes) && isSameDiff(cmpCache->data->options, options));
+}
+
+
+// Takes the line diffs of the cached compare of the views documents to splice the re-compare ones in. The cache
+// might be stale - only the documents and the diff options must be the same
+bool getPrevLineDiffs(const CompareCache* cmpCache, const CompareOptions& options, PrevLineDiffs& prevDiffs)
+{
+	if (!cmpCache || !cmpCache->data || options.findUniqueMode || options.selectionCompare)
+		return false;
+
+	const CompareCacheData& data = *cmpCache->data;
+
+	if (data.result != CompareResult::COMPARE_MISMATCH || !isSameDiff(data.options, options))
+		return false;
+
+	for (int view: {MAIN_VIEW, SUB_VIEW})
+	{
+		if (data.docs[view] != CallScintilla(view, SCI_GETDOCPOINTER, 0, 0))
+			return false;
+	}
+
+	const CompareInfo& cmpInfo = data.cmpInfo;
+
+	prevDiffs.views[0]		= cmpInfo.doc1.view;
+	prevDiffs.views[1]		= cmpInfo.doc2.view;
+	prevDiffs.approximate	= data.approximate;
+
+	prevDiffs.hashes1.resize(cmpInfo.doc1.lines.size());
+	prevDiffs.hashes2.resize(cmpInfo.doc2.lines.size());
+
+	for (size_t i = 0; i < cmpInfo.doc1.lines.size(); ++i)
+		prevDiffs.hashes1[i] = cmpInfo.doc1.lines[i].hash;
+
+	for (size_t i = 0; i < cmpInfo.doc2.lines.size(); ++i)
+		prevDiffs.hashes2[i] = cmpInfo.doc2.lines[i].hash;
+
+	prevDiffs.diffs.resize(cmpInfo.blockDiffs.size());
+
+	for (size_t i = 0; i < cmpInfo.blockDiffs.size(); ++i)
+	{
+		prevDiffs.diffs[i].type	= cmpInfo.blockDiffs[i].type;
+		prevDiffs.diffs[i].off	= cmpInfo.blockDiffs[i].off;
+		prevDiffs.diffs[i].len	= cmpInfo.blockDiffs[i].len;
+	}
+
+	return true;
+}
+
+
+// Keeps the block diffs of a completed compare - the views must hold the compared text.
+// Find unique results are not stored
+void storeCompare(CompareCache* cmpCache, const CompareOptions& options, const LineHashCache* lineHashes,
+		CompareResult result, CompareInfo& cmpInfo, const CompareSummary& summary)
+{
+	if (!cmpCache)
+		return;
+
+	cmpCache->clear();
+
+	if (!lineHashes || options.findUniqueMode ||
+			(result != CompareResult::COMPARE_MISMATCH && result != CompareResult::COMPARE_MATCH))
+		return;
+
+	std::shared_ptr<CompareCacheData> data = makeCacheData(options, result, cmpInfo, summary);
+
+	for (int view: {MAIN_VIEW, SUB_VIEW})
+	{
+		data->docs[view]		= CallScintilla(view, SCI_GETDOCPOINTER, 0, 0);
+		data->versions[view]	= lineHashes[view].version;
+		data->textLens[view]	= CallScintilla(view, SCI_GETLENGTH, 0, 0);
+	}
+
+	cmpCache->data = std::move(data);
+}
+
+
+// Marks the stored block diffs with the current marking options and colors
+CompareResult remarkCompare(CompareCacheData& data, const CompareOptions& options, CompareSummary& summary)
+{
+	if (data.result != CompareResult::COMPARE_MISMATCH)
+		return data.result;
+
+	CompareInfo& cmpInfo = data.cmpInfo;
+
+	summary.stats.reused		= true;
+	summary.stats.linesCount	= static_cast<int>(cmpInfo.doc1.lines.size() + cmpInfo.doc2.lines.size());
+	summary.stats.blockDiffs	= static_cast<int>(cmpInfo.blockDiffs.size());
+
+	for (DocCmpInfo* doc: {&cmpInfo.doc1, &cmpInfo.doc2})
+	{
+		doc->text		= reinterpret_cast<const char*>(CallScintilla(doc->view, SCI_GETCHARACTERPOINTER, 0, 0));
+		doc->textLen	= CallScintilla(doc->view, SCI_GETLENGTH, 0, 0);
+	}
+
+	const int64_t markStart = getTimeStamp();
+
+	if (!markAllDiffs(cmpInfo, options, summary))
+		return CompareResult::COMPARE_CANCELLED;
+
+	summary.stats.addTime(ComparePhase::MARKING, markStart);
+
+	summary.hashCollisions	= data.hashCollisions;
+	summary.approximate		= data.approximate;
+	summary.deferredBlocks	= data.deferredBlocks;
+
+	applyMarks(cmpInfo.doc1, cmpInfo.doc2, summary);
+
+	LOGD("COMPARE RESULTS REUSED\n");
+
+	return CompareResult::COMPARE_MISMATCH;
+}
+
+
+CompareResult runCompare(const CompareOptions& options, CompareSummary& summary, LineHashCache* lineHashes,
+		CompareCache* cmpCache)
+{
+	summary.stats.clear();
+
+	if (isCacheValid(cmpCache, options, lineHashes))
+		return remarkCompare(*cmpCache->data, options, summary);
+
+	CompareInfo cmpInfo;
+
+	setupDocs(cmpInfo.doc1, cmpInfo.doc2, options, lineHashes);
+
+	getLines(cmpInfo.doc1, cmpInfo.doc2, options, summary.stats);
+
+	PrevLineDiffs prevDiffs;
+
+	const CompareResult result = compareDocs(cmpInfo, options, summary,
+			getPrevLineDiffs(cmpCache, options, prevDiffs) ? &prevDiffs : nullptr);
+
+	if (result == CompareResult::COMPARE_MISMATCH)
+		applyMarks(cmpInfo.doc1, cmpInfo.doc2, summary);
+
+	storeCompare(cmpCache, options, lineHashes, result, cmpInfo, summary);
+
+	return result;
+}
+
+
+CompareResult runFindUnique(const CompareOptions& options, CompareSummary& summary, LineHashCache* lineHashes)
+{
+	summary.stats.clear();
+
+	DocCmpInfo doc1;
+	DocCmpInfo doc2;
+
+	setupDocs(doc1, doc2, options, lineHashes);
+
+	getLines(doc1, doc2, options, summary.stats);
+
+	const int64_t diffStart = getTimeStamp();
+
+	const CompareResult result = findUniqueDocs(doc1, doc2, options, summary);
+
+	summary.stats.addTime(ComparePhase::LINES_DIFF, diffStart);
+
+	if (result == CompareResult::COMPARE_MISMATCH)
+		applyMarks(doc1, doc2, summary);
+
+	return result;
+}
+
+
+CompareResult runCompareToBase(const CompareOptions& options, const char* baseText, intptr_t baseTextLen,
+		CompareSummary& summary, LineHashCache* lineHashes)
+{
+	CompareStats& stats = summary.stats;
+
+	stats.clear();
+
+	const int64_t hashStart = getTimeStamp();
+
+	CompareInfo cmpInfo;
+	DocCmpInfo base;
+
+	setupDocs(cmpInfo.doc1, cmpInfo.doc2, options, lineHashes);
+
+	base.view = -1;
+
+	const int maxChunks = getMaxChunks();
+
+	std::vector<LinesChunk> chunks;
+
+	// The base is hashed once along with both documents
+	getTextSnapshot(base, baseText, baseTextLen, maxChunks, chunks);
+	getSnapshot(cmpInfo.doc1, ViewSource(cmpInfo.doc1.view), maxChunks, chunks, false);
+	getSnapshot(cmpInfo.doc2, ViewSource(cmpInfo.doc2.view), maxChunks, chunks, false);
+
+	stats.linesHashed = hashChunks(chunks, options);
+	chunks.clear();
+
+	stats.linesCount = static_cast<int>(base.lines.size() + cmpInfo.doc1.lines.size() + cmpInfo.doc2.lines.size());
+	stats.addTime(ComparePhase::HASH, hashStart);
+
+	const CompareResult result = compareDocsToBase(base, cmpInfo, options, summary);
+
+	if (result == CompareResult::COMPARE_MISMATCH)
+		applyMarks(cmpInfo.doc1, cmpInfo.doc2, summary);
+
+	return result;
+}
+
+
+// Closes the progress dialog and reports the compare exception
+void reportCompareError(const std::exception_ptr& error)
+{
+	ProgressDlg::Close();
+
+	try
+	{
+		std::rethrow_exception(error);
+	}
+	catch (std::exception& e)
+	{
+		clearWindow(MAIN_VIEW);
+		clearWindow(SUB_VIEW);
+
+		char msg[128];
+		_snprintf_s(msg, _countof(msg), _TRUNCATE, "Exception occurred: %s", e.what());
+		::MessageBoxA(nppData._nppHandle, msg, "ComparePlus", MB_OK | MB_ICONWARNING);
+	}
+	catch (...)
+	{
+		::MessageBoxA(nppData._nppHandle, "Unknown exception occurred.", "ComparePlus", MB_OK | MB_ICONWARNING);
+	}
+}
+
+}
+
+
+CompareResult compareViewToText(const CompareOptions& options, int view, const char* text, intptr_t textLen,
+		DocSnapshot* textSnapshot)
+{
+	try
+	{
+		DocCmpInfo viewDoc;
+		DocCmpInfo textDoc;
+
+		viewDoc.view = view;
+		textDoc.view = -1;
+
+		const int maxChunks = getMaxChunks();
+
+		std::vector<LinesChunk> chunks;
+
+		getSnapshot(viewDoc, ViewSource(view), maxChunks, chunks, false);
+		getTextSnapshot(textDoc, text, textLen, maxChunks, chunks);
+
+		// All lines are hashed so the text hashes can fill its snapshot - the ignored empty lines are skipped below
+		CompareOptions allLines = options;
+
+		allLines.ignoreEmptyLines = false;
+
+		hashChunks(chunks, allLines);
+
+		const int linesCount1 = static_cast<int>(viewDoc.lines.size());
+		const int linesCount2 = static_cast<int>(textDoc.lines.size());
+
+		std::vector<char> buf1;
+		std::vector<char> buf2;
+
+		int i1 = 0;
+		int i2 = 0;
+
+		for (;; ++i1, ++i2)
+		{
+			if (options.ignoreEmptyLines)
+			{
+				for (; i1 < linesCount1 && viewDoc.lines[i1].hash == cHashSeed; ++i1);
+				for (; i2 < linesCount2 && textDoc.lines[i2].hash == cHashSeed; ++i2);
+			}
+
+			if (i1 == linesCount1 || i2 == linesCount2)
+				break;
+
+			if (viewDoc.lines[i1].hash != textDoc.lines[i2].hash)
+				break;
+
+			if (options.verifyMatches &&
+				!areLinesEqual(viewDoc, viewDoc.lines[i1].line, textDoc, textDoc.lines[i2].line, options, buf1, buf2))
+				break;
+		}
+
+		if (i1 == linesCount1 && i2 == linesCount2)
+			return CompareResult::COMPARE_MATCH;
+
+		if (textSnapshot && linesCount2 == (textDoc.textLen ? textDoc.linesCount : 0))
+			setSnapshot(options, textDoc, *textSnapshot);
+
+		return CompareResult::COMPARE_MISMATCH;
+	}
+	catch (...)
+	{
+		// Errors are reported by the full compare that should follow
+	}
+
+	return CompareResult::COMPARE_ERROR;
+}
+
+
+bool takeViewSnapshot(const CompareOptions& options, int view, DocSnapshot& snapshot)
+{
+	try
+	{
+		DocCmpInfo doc;
+
+		doc.view = view;
+
+		std::vector<LinesChunk> chunks;
+
+		getSnapshot(doc, ViewSource(view), getMaxChunks(), chunks, false);
+
+		return fillSnapshot(options, doc, chunks, snapshot);
+	}
+	catch (...)
+	{
+		snapshot = DocSnapshot();
+	}
+
+	return false;
+}
+
+
+bool takeTextSnapshot(const CompareOptions& options, const char* text, intptr_t textLen, DocSnapshot& snapshot)
+{
+	try
+	{
+		DocCmpInfo doc;
+
+		doc.view = -1;
+
+		std::vector<LinesChunk> chunks;
+
+		getTextSnapshot(doc, text, textLen, getMaxChunks(), chunks);
+
+		return fillSnapshot(options, doc, chunks, snapshot);
+	}
+	catch (...)
+	{
+		snapshot = DocSnapshot();
+	}
+
+	return false;
+}
+
+
+CompareResult compareViewToSnapshot(const CompareOptions& options, int view, const DocSnapshot& snapshot)
+{
+	if (snapshot.optionsKey != getLineHashesKey(options))
+		return CompareResult::COMPARE_ERROR;
+
+	const intptr_t textLen = CallScintilla(view, SCI_GETLENGTH, 0, 0);
+
+	// The unchanged text is not hashed line by line
+	if (textLen == snapshot.textLen && (textLen == 0 || snapshot.textHash ==
+			getTextHash(reinterpret_cast<const char*>(CallScintilla(view, SCI_GETCHARACTERPOINTER, 0, 0)), textLen)))
+		return CompareResult::COMPARE_MATCH;
+
+	DocSnapshot viewSnapshot;
+
+	if (!takeViewSnapshot(options, view, viewSnapshot))
+		return CompareResult::COMPARE_ERROR;
+
+	return areLineHashesEqual(viewSnapshot.lineHashes, snapshot.lineHashes, options.ignoreEmptyLines) ?
+			CompareResult::COMPARE_MATCH : CompareResult::COMPARE_MISMATCH;
+}
+
+
+bool setLineHashesFromSnapshot(const CompareOptions& options, int view, const DocSnapshot& snapshot,
+		LineHashCache& cache)
+{
+	if (snapshot.optionsKey != getLineHashesKey(options) ||
+			snapshot.lineHashes.size() != static_cast<size_t>(CallScintilla(view, SCI_GETLINECOUNT, 0, 0)))
+		return false;
+
+	const intptr_t textLen = CallScintilla(view, SCI_GETLENGTH, 0, 0);
+
+	if (textLen != snapshot.textLen || (textLen && snapshot.textHash !=
+			getTextHash(reinterpret_cast<const char*>(CallScintilla(view, SCI_GETCHARACTERPOINTER, 0, 0)), textLen)))
+		return false;
+
+	cache.hashes		= snapshot.lineHashes;
+	cache.optionsKey	= snapshot.optionsKey;
+	cache.isStored		= false;
+
+	cache.dirty.assign(cache.hashes.size(), 0);
+
+	return true;
+}
+
+
+bool bindCompareCache(CompareCache& cmpCache, const LineHashCache* lineHashes)
+{
+	if (!cmpCache.data || !lineHashes || !cmpCache.data->textHashes[MAIN_VIEW])
+	{
+		cmpCache.clear();
+		return false;
+	}
+
+	CompareCacheData& data = *cmpCache.data;
+
+	uint64_t viewHashes[2];
+
+	for (int view: {MAIN_VIEW, SUB_VIEW})
+	{
+		const intptr_t textLen = CallScintilla(view, SCI_GETLENGTH, 0, 0);
+
+		viewHashes[view] = getTextHash(
+				reinterpret_cast<const char*>(CallScintilla(view, SCI_GETCHARACTERPOINTER, 0, 0)), textLen);
+	}
+
+	bool swapViews = false;
+
+	if (viewHashes[MAIN_VIEW] != data.textHashes[MAIN_VIEW] || viewHashes[SUB_VIEW] != data.textHashes[SUB_VIEW])
+	{
+		if (viewHashes[MAIN_VIEW] != data.textHashes[SUB_VIEW] || viewHashes[SUB_VIEW] != data.textHashes[MAIN_VIEW])
+		{
+			cmpCache.clear();
+			return false;
+		}
+
+		swapViews = true;
+	}
+
+	if (swapViews)
+	{
+		std::swap(data.textLens[MAIN_VIEW], data.textLens[SUB_VIEW]);
+		std::swap(data.textHashes[MAIN_VIEW], data.textHashes[SUB_VIEW]);
+
+		for (DocCmpInfo* doc: {&data.cmpInfo.doc1, &data.cmpInfo.doc2})
+			doc->view = (doc->view == MAIN_VIEW) ? SUB_VIEW : MAIN_VIEW;
+	}
+
+	for (DocCmpInfo* doc: {&data.cmpInfo.doc1, &data.cmpInfo.doc2})
+		doc->blockDiffMask = (data.options.newFileViewId == doc->view) ? MARKER_MASK_ADDED : MARKER_MASK_REMOVED;
+
+	for (int view: {MAIN_VIEW, SUB_VIEW})
+	{
+		data.docs[view]		= CallScintilla(view, SCI_GETDOCPOINTER, 0, 0);
+		data.versions[view]	= lineHashes[view].version;
+	}
+
+	return true;
+}
+
+
+bool isCompareCacheCurrent(const CompareCache& cmpCache, const LineHashCache* lineHashes)
+{
+	return isCacheCurrent(&cmpCache, lineHashes);
+}
+
+
+bool writeViewsUnifiedDiff(const CompareCache& cmpCache, const LineHashCache* lineHashes, const char* name1,
+		const char* name2, int contextLines, const DiffWriteFn& writeFn)
+{
+	if (!isCacheCurrent(&cmpCache, lineHashes))
+		return false;
+
+	const CompareCacheData& data = *cmpCache.data;
+
+	if (data.result != CompareResult::COMPARE_MISMATCH)
+		return true;
+
+	const DocCmpInfo& doc1 = data.cmpInfo.doc1;
+	const DocCmpInfo& doc2 = data.cmpInfo.doc2;
+
+	const int oldView = (doc1.blockDiffMask == MARKER_MASK_REMOVED) ? doc1.view : doc2.view;
+	const int newView = (oldView == doc1.view) ? doc2.view : doc1.view;
+
+	const char* oldText = reinterpret_cast<const char*>(CallScintilla(oldView, SCI_GETCHARACTERPOINTER, 0, 0));
+	const char* newText = reinterpret_cast<const char*>(CallScintilla(newView, SCI_GETCHARACTERPOINTER, 0, 0));
+
+	return writeUnifiedDiff(data.cmpInfo, oldText, newText, name1, name2, contextLines, writeFn);
+}
+
+
+CompareResult compareViews(const CompareOptions& options, const TCHAR* progressInfo, CompareSummary& summary,
+		LineHashCache* lineHashes, CompareCache* cmpCache)
+{
+	CompareResult result = CompareResult::COMPARE_ERROR;
+
+	CompareOptions viewsOptions = options;
+
+	if (progressInfo)
+		viewsOptions.progress = ProgressDlg::Open(progressInfo).get();
+
+	try
+	{
+		if (viewsOptions.findUniqueMode)
+		{
+			if (cmpCache)
+				cmpCache->clear();
+
+			result = runFindUnique(viewsOptions, summary, lineHashes);
+		}
+		else
+		{
+			result = runCompare(viewsOptions, summary, lineHashes, cmpCache);
+		}
+
+		ProgressDlg::Close();
+
+		if (result != CompareResult::COMPARE_MISMATCH)
+		{
+			clearWindow(MAIN_VIEW);
+			clearWindow(SUB_VIEW);
+		}
+	}
+	catch (...)
+	{
+		reportCompareError(std::current_exception());
+	}
+
+	return result;
+}
+
+
+CompareResult compareViewsToBase(const CompareOptions& options, const TCHAR* progressInfo, const char* baseText,
+		intptr_t baseTextLen, CompareSummary& summary, LineHashCache* lineHashes)
+{
+	CompareResult result = CompareResult::COMPARE_ERROR;
+
+	// The documents are compared as a whole
+	CompareOptions mergeOptions = options;
+
+	mergeOptions.findUniqueMode		= false;
+	mergeOptions.selectionCompare	= false;
+
+	if (progressInfo)
+		mergeOptions.progress = ProgressDlg::Open(progressInfo).get();
+
+	try
+	{
+		result = runCompareToBase(mergeOptions, baseText, baseTextLen, summary, lineHashes);
+
+		ProgressDlg::Close();
+
+		if (result != CompareResult::COMPARE_MISMATCH)
+		{
+			clearWindow(MAIN_VIEW);
+			clearWindow(SUB_VIEW);
+		}
+	}
+	catch (...)
+	{
+		reportCompareError(std::current_exception());
+	}
+
+	return result;
+}
+
+
+struct AsyncCompare::Job
+{
+	void run();
+
+	CompareOptions			options;
+	CompareInfo				cmpInfo;
+	std::vector<LinesChunk>	chunks;
+
+	// Private copies of the caches given on construction and their versions at the compare start
+	LineHashCache			lineHashes[2];
+	unsigned				versions[2];
+
+	// Copied from the compare cache given on construction - it is changed by the main thread meanwhile
+	PrevLineDiffs			prevDiffs;
+	bool					hasPrevDiffs {false};
+
+	CompareSummary			summary;
+	CompareResult			result {CompareResult::COMPARE_ERROR};
+	std::exception_ptr		error;
+
+	std::atomic<bool>		cancelled {false};
+	std::atomic<bool>		done {false};
+
+#ifdef MULTITHREAD
+	std::thread				worker;
+#endif
+};
+
+
+void AsyncCompare::Job::run()
+{
+	try
+	{
+		CompareStats& stats = summary.stats;
+
+		int64_t phaseStart = getTimeStamp();
+
+		stats.linesHashed = hashChunks(chunks, options);
+		chunks.clear();
+
+		stats.linesCount = static_cast<int>(cmpInfo.doc1.lines.size() + cmpInfo.doc2.lines.size());
+		stats.addTime(ComparePhase::HASH, phaseStart);
+
+		if (options.findUniqueMode)
+		{
+			phaseStart = getTimeStamp();
+
+			result = findUniqueDocs(cmpInfo.doc1, cmpInfo.doc2, options, summary);
+
+			stats.addTime(ComparePhase::LINES_DIFF, phaseStart);
+		}
+		else
+		{
+			result = compareDocs(cmpInfo, options, summary, hasPrevDiffs ? &prevDiffs : nullptr);
+		}
+	}
+	catch (...)
+	{
+		error = std::current_exception();
+	}
+
+	done = true;
+}
+
+
+AsyncCompare::AsyncCompare(const CompareOptions& options, const LineHashCache* lineHashes,
+		const CompareCache* cmpCache) : _job(new Job)
+{
+	Job& job = *_job;
+
+	job.options				= options;
+	job.options.cancelToken	= &job.cancelled;
+	job.hasPrevDiffs		= getPrevLineDiffs(cmpCache, job.options, job.prevDiffs);
+
+	for (int view: {MAIN_VIEW, SUB_VIEW})
+	{
+		job.lineHashes[view]	= lineHashes[view];
+		job.versions[view]		= lineHashes[view].version;
+	}
+
+	// The text copy is timed along with the hashing in the worker
+	const int64_t snapshotStart = getTimeStamp();
+
+	setupDocs(job.cmpInfo.doc1, job.cmpInfo.doc2, job.options, job.lineHashes);
+	getSnapshots(job.cmpInfo.doc1, job.cmpInfo.doc2, job.chunks, true);
+
+	job.summary.stats.addTime(ComparePhase::HASH, snapshotStart);
+
+#ifdef MULTITHREAD
+	try
+	{
+		job.worker = std::thread(&Job::run, &job);
+
+		return;
+	}
+	catch (...)
+	{
+	}
+#endif
+
+	// No worker thread - compare synchronously
+	job.run();
+}
+
+
+AsyncCompare::~AsyncCompare()
+{
+	cancel();
+
+#ifdef MULTITHREAD
+	if (_job->worker.joinable())
+		_job->worker.join();
+#endif
+}
+
+
+void AsyncCompare::cancel()
+{
+	_job->cancelled = true;
+}
+
+
+bool AsyncCompare::isDone() const
+{
+	return _job->done;
+}
+
+
+bool AsyncCompare::isStale(const LineHashCache* lineHashes) const
+{
+	return (lineHashes[MAIN_VIEW].version != _job->versions[MAIN_VIEW] ||
+			lineHashes[SUB_VIEW].version != _job->versions[SUB_VIEW]);
+}
+
+
+CompareResult AsyncCompare::apply(CompareSummary& summary, LineHashCache* lineHashes, CompareCache* cmpCache)
+{
+	Job& job = *_job;
+
+#ifdef MULTITHREAD
+	if (job.worker.joinable())
+		job.worker.join();
+#endif
+
+	if (job.error)
+	{
+		reportCompareError(job.error);
+		return CompareResult::COMPARE_ERROR;
+	}
+
+	if (job.cancelled || isStale(lineHashes))
+		return CompareResult::COMPARE_CANCELLED;
+
+	if (job.result == CompareResult::COMPARE_MISMATCH)
+	{
+		applyMarks(job.cmpInfo.doc1, job.cmpInfo.doc2, job.summary);
+	}
+	else
+	{
+		clearWindow(MAIN_VIEW);
+		clearWindow(SUB_VIEW);
+	}
+
+	lineHashes[MAIN_VIEW]	= std::move(job.lineHashes[MAIN_VIEW]);
+	lineHashes[SUB_VIEW]	= std::move(job.lineHashes[SUB_VIEW]);
+
+	storeCompare(cmpCache, job.options, lineHashes, job.result, job.cmpInfo, job.summary);
+
+	summary = std::move(job.summary);
+
+	return job.result;
+}
+
+
+struct AsyncBlocksCompare::Job
+{
+	void run();
+
+	CompareOptions			options;
+	CompareInfo				cmpInfo;
+
+	// First and last shown document lines indexed by view id
+	std::pair<int, int>		shownLines[2];
+
+	// The cache data the blocks are copied from - the results are applied only if it is not replaced meanwhile
+	std::weak_ptr<CompareCacheData>	source;
+
+	int						hashCollisions {0};
+
+	// Blocks left for the next run
+	int						deferredBlocks {0};
+	std::exception_ptr		error;
+
+	std::atomic<bool>		cancelled {false};
+	std::atomic<bool>		done {false};
+
+#ifdef MULTITHREAD
+	std::thread				worker;
+#endif
+};
+
+
+void AsyncBlocksCompare::Job::run()
+{
+	try
+	{
+		std::vector<int> blockIdx = getDeferredBlocks(cmpInfo);
+
+		auto isShown =
+			[this](const DocCmpInfo& doc, const diffInfo& bd)
+			{
+				const std::pair<int, int>& shown = shownLines[doc.view];
+
+				return (doc.lines[bd.off].line <= shown.second && doc.lines[bd.off + bd.len - 1].line >= shown.first);
+			};
+
+		std::vector<int> shownBlockIdx;
+
+		for (int i: blockIdx)
+		{
+			if (isShown(cmpInfo.doc1, cmpInfo.blockDiffs[i - 1]) || isShown(cmpInfo.doc2, cmpInfo.blockDiffs[i]))
+				shownBlockIdx.emplace_back(i);
+		}
+
+		const int blocksCount = static_cast<int>(blockIdx.size());
+
+		if (!shownBlockIdx.empty())
+			blockIdx.swap(shownBlockIdx);
+
+		deferredBlocks = blocksCount - static_cast<int>(blockIdx.size());
+
+		int subDiffs = 0;
+
+		if (!compareChangedBlocks(cmpInfo, blockIdx, options, hashCollisions, subDiffs))
+			cancelled = true;
+	}
+	catch (...)
+	{
+		error = std::current_exception();
+	}
+
+	done = true;
+}
+
+
+AsyncBlocksCompare::AsyncBlocksCompare(const CompareCache& cmpCache, const LineHashCache* lineHashes) :
+	_job(new Job)
+{
+	Job& job = *_job;
+
+	// The blocks line spans are valid only for the compared text
+	if (!cmpCache.data || !isCacheValid(&cmpCache, cmpCache.data->options, lineHashes))
+	{
+		job.cancelled	= true;
+		job.done		= true;
+
+		return;
+	}
+
+	const CompareCacheData& data = *cmpCache.data;
+
+	job.options				= data.options;
+	job.options.cancelToken	= &job.cancelled;
+	job.source				= cmpCache.data;
+
+	// The copied blocks are linked to their copied pairs
+	job.cmpInfo = data.cmpInfo;
+
+	for (diffInfo& bd: job.cmpInfo.blockDiffs)
+	{
+		if (bd.info.matchBlock)
+			bd.info.matchBlock = &job.cmpInfo.blockDiffs[bd.info.matchBlock - data.cmpInfo.blockDiffs.data()];
+	}
+
+	for (DocCmpInfo* doc: {&job.cmpInfo.doc1, &job.cmpInfo.doc2})
+	{
+		const char* text = reinterpret_cast<const char*>(CallScintilla(doc->view, SCI_GETCHARACTERPOINTER, 0, 0));
+
+		doc->textLen = CallScintilla(doc->view, SCI_GETLENGTH, 0, 0);
+		doc->textCopy.assign(text, text + doc->textLen + 1);
+		doc->text = doc->textCopy.data();
+
+		job.shownLines[doc->view] = std::make_pair(getFirstLine(doc->view), getLastLine(doc->view));
+	}
+
+#ifdef MULTITHREAD
+	try
+	{
+		job.worker = std::thread(&Job::run, &job);
+
+		return;
+	}
+	catch (...)
+	{
+	}
+#endif
+
+	// No worker thread - compare synchronously
+	job.run();
+}
+
+
+AsyncBlocksCompare::~AsyncBlocksCompare()
+{
+	cancel();
+
+#ifdef MULTITHREAD
+	if (_job->worker.joinable())
+		_job->worker.join();
+#endif
+}
+
+
+void AsyncBlocksCompare::cancel()
+{
+	_job->cancelled = true;
+}
+
+
+bool AsyncBlocksCompare::isDone() const
+{
+	return _job->done;
+}
+
+
+bool AsyncBlocksCompare::apply(CompareCache& cmpCache, const LineHashCache* lineHashes)
+{
+	Job& job = *_job;
+
+#ifdef MULTITHREAD
+	if (job.worker.joinable())
+		job.worker.join();
+#endif
+
+	if (job.error)
+	{
+		reportCompareError(job.error);
+		return false;
+	}
+
+	if (job.cancelled || job.source.lock() != cmpCache.data || !isCacheValid(&cmpCache, job.options, lineHashes))
+		return false;
+
+	CompareCacheData& data = *cmpCache.data;
+
+	// The moved blocks keep their addresses so the blocks links stay valid
+	data.cmpInfo = std::move(job.cmpInfo);
+
+	for (DocCmpInfo* doc: {&data.cmpInfo.doc1, &data.cmpInfo.doc2})
+	{
+		doc->textCopy	= std::vector<char>();
+		doc->text		= nullptr;
+	}
+
+	data.hashCollisions	+= job.hashCollisions;
+	data.deferredBlocks	= job.deferredBlocks;
+
+	return true;
+}
@@ -0,0 +1,375 @@
+/*
+ * This file is part of ComparePlus plugin for Notepad++
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define NOMINMAX
+
+#include <cstring>
+#include <exception>
+#include <system_error>
+#include <algorithm>
+
+#include "FolderCompare.h"
+#include "ThreadPool.h"
+#include "Tools.h"
+
+#ifdef MULTITHREAD
+
+#if defined(__MINGW32__) && !defined(_GLIBCXX_HAS_GTHREADS)
+#include "../mingw-std-threads/mingw.thread.h"
+#else
+#include <thread>
+#endif // __MINGW32__ ...
+
+#endif // MULTITHREAD
+
+
+namespace {
+
+using Path_t = std::basic_string<TCHAR>;
+
+
+// The compare caches take about the memory of the compared texts - the different files over that total are not
+// cached and are compared again when opened
+const intptr_t cMaxCachedTextLen = 256 * 1024 * 1024;
+
+
+// Lists the files in folder and its sub-folders with paths relative to root. Linked folders are not followed so
+// the tree can't loop
+void listFiles(const Path_t& root, const Path_t& relPath, std::vector<Path_t>& files,
+		const std::atomic<bool>& cancelled)
+{
+	WIN32_FIND_DATA findData;
+
+	HANDLE hFind = ::FindFirstFile((root + relPath + TEXT("*")).c_str(), &findData);
+
+	if (hFind == INVALID_HANDLE_VALUE)
+		return;
+
+	do
+	{
+		if (cancelled)
+			break;
+
+		if (!_tcscmp(findData.cFileName, TEXT(".")) || !_tcscmp(findData.cFileName, TEXT("..")))
+			continue;
+
+		const Path_t filePath = relPath + findData.cFileName;
+
+		if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+		{
+			if (!(findData.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+				listFiles(root, filePath + TEXT("\\"), files, cancelled);
+		}
+		else
+		{
+			files.emplace_back(filePath);
+		}
+	}
+	while (::FindNextFile(hFind, &findData));
+
+	::FindClose(hFind);
+}
+
+
+inline bool isPathLess(const Path_t& lhs, const Path_t& rhs)
+{
+	return (_tcsicmp(lhs.c_str(), rhs.c_str()) < 0);
+}
+
+}
+
+
+struct FolderCompare::Job
+{
+	void run();
+	void compareFiles(FolderCompareEntry& entry);
+
+	CompareOptions		options;
+
+	// Both end with a path separator
+	Path_t				oldFolder;
+	Path_t				newFolder;
+
+	std::vector<FolderCompareEntry>	entries;
+
+	std::atomic<int>	filesCount {0};
+	std::atomic<int>	filesDone {0};
+
+	// Compared texts length of the entries that keep their compare cache
+	std::atomic<intptr_t>	cachedTextLen {0};
+
+	std::atomic<bool>	cancelled {false};
+	std::atomic<bool>	failed {false};
+	std::atomic<bool>	done {false};
+
+#ifdef MULTITHREAD
+	std::thread			worker;
+#endif
+};
+
+
+void FolderCompare::Job::compareFiles(FolderCompareEntry& entry)
+{
+	if (cancelled)
+		return;
+
+	try
+	{
+		MappedFile oldFile((oldFolder + entry.relPath).c_str());
+		MappedFile newFile((newFolder + entry.relPath).c_str());
+
+		if (!oldFile.isOpen() || !newFile.isOpen())
+		{
+			entry.state = FileCompareState::FAILED;
+		}
+		// Identical files are the common case in big trees - they are told by a single pass over their content
+		else if (oldFile.size() == newFile.size() &&
+				(oldFile.size() == 0 || !std::memcmp(oldFile.data(), newFile.data(), oldFile.size())))
+		{
+			entry.state = FileCompareState::IDENTICAL;
+		}
+		else
+		{
+			const char* oldText = getLoadedText(oldFile);
+			const char* newText = getLoadedText(newFile);
+
+			if (!oldText || !newText)
+			{
+				entry.state = FileCompareState::DIFFERENT_BINARY;
+			}
+			else
+			{
+				CompareSummary summary;
+				summary.clear();
+
+				CompareOptions fileOptions = options;
+
+				fileOptions.wordTokenizer = getFileTokenizer(entry.relPath.c_str());
+
+				const CompareResult result = compareTexts(fileOptions,
+						oldText, oldFile.size() - (oldText - oldFile.data()),
+						newText, newFile.size() - (newText - newFile.data()),
+						summary, entry.cmpCache);
+
+				if (result == CompareResult::COMPARE_MATCH)
+				{
+					entry.state = FileCompareState::MATCH;
+				}
+				else if (result == CompareResult::COMPARE_MISMATCH)
+				{
+					entry.state		= FileCompareState::DIFFERENT;
+					entry.added		= summary.added;
+					entry.removed	= summary.removed;
+					entry.changed	= summary.changed;
+					entry.moved		= summary.moved;
+
+					const intptr_t textLen = oldFile.size() + newFile.size();
+
+					if (cachedTextLen.fetch_add(textLen) + textLen > cMaxCachedTextLen)
+					{
+						cachedTextLen -= textLen;
+						entry.cmpCache.clear();
+					}
+				}
+			}
+		}
+	}
+	catch (...)
+	{
+		entry.cmpCache.clear();
+		entry.state = FileCompareState::FAILED;
+	}
+
+	++filesDone;
+}
+
+
+void FolderCompare::Job::run()
+{
+	std::vector<Path_t> oldFiles;
+	std::vector<Path_t> newFiles;
+
+	try
+	{
+		listFiles(oldFolder, Path_t(), oldFiles, cancelled);
+		listFiles(newFolder, Path_t(), newFiles, cancelled);
+
+		std::sort(oldFiles.begin(), oldFiles.end(), isPathLess);
+		std::sort(newFiles.begin(), newFiles.end(), isPathLess);
+
+		entries.reserve(std::max(oldFiles.size(), newFiles.size()));
+
+		// Merge the sorted lists - the files in both folders are compared
+		auto oldItr = oldFiles.begin();
+		auto newItr = newFiles.begin();
+
+		while (oldItr != oldFiles.end() || newItr != newFiles.end())
+		{
+			if (newItr == newFiles.end() || (oldItr != oldFiles.end() && isPathLess(*oldItr, *newItr)))
+			{
+				entries.emplace_back(*oldItr++);
+				entries.back().state = FileCompareState::ONLY_IN_OLD;
+			}
+			else if (oldItr == oldFiles.end() || isPathLess(*newItr, *oldItr))
+			{
+				entries.emplace_back(*newItr++);
+				entries.back().state = FileCompareState::ONLY_IN_NEW;
+			}
+			else
+			{
+				entries.emplace_back(*oldItr++);
+				++newItr;
+			}
+		}
+
+		filesCount = static_cast<int>(std::count_if(entries.begin(), entries.end(),
+				[](const FolderCompareEntry& entry) { return (entry.state == FileCompareState::NOT_COMPARED); }));
+
+		// Each pair is compared on its own - a task per pair, the files compare itself runs nested tasks
+		TaskGroup tasks;
+
+		for (auto& entry: entries)
+		{
+			if (entry.state != FileCompareState::NOT_COMPARED)
+				continue;
+
+#ifdef DLOG
+			// Debug log is not thread safe - files are compared one by one
+			compareFiles(entry);
+#else
+			tasks.run([this, &entry]() { compareFiles(entry); });
+#endif
+		}
+
+		tasks.wait();
+	}
+	catch (...)
+	{
+		// The entries compared so far are kept
+		failed = true;
+	}
+
+	done = true;
+}
+
+
+FolderCompare::FolderCompare(const CompareOptions& options, const TCHAR* oldFolder, const TCHAR* newFolder) :
+	_job(new Job)
+{
+	Job& job = *_job;
+
+	job.options				= options;
+	job.options.cancelToken	= &job.cancelled;
+
+	// Files are compared as a whole and the results are marked when they are opened
+	job.options.selectionCompare	= false;
+	job.options.findUniqueMode		= false;
+
+	job.oldFolder = oldFolder;
+	job.newFolder = newFolder;
+
+	for (Path_t* folder: {&job.oldFolder, &job.newFolder})
+	{
+		if (!folder->empty() && folder->back() != TEXT('\\') && folder->back() != TEXT('/'))
+			folder->push_back(TEXT('\\'));
+	}
+
+#ifdef MULTITHREAD
+	try
+	{
+		job.worker = std::thread(&Job::run, &job);
+
+		return;
+	}
+	catch (const std::system_error&)
+	{
+	}
+#endif
+
+	// No worker thread - compare synchronously
+	job.run();
+}
+
+
+FolderCompare::~FolderCompare()
+{
+	cancel();
+
+#ifdef MULTITHREAD
+	if (_job->worker.joinable())
+		_job->worker.join();
+#endif
+}
+
+
+void FolderCompare::cancel()
+{
+	_job->cancelled = true;
+}
+
+
+bool FolderCompare::isDone() const
+{
+	return _job->done;
+}
+
+
+bool FolderCompare::isCancelled() const
+{
+	return _job->cancelled;
+}
+
+
+bool FolderCompare::isFailed() const
+{
+	return _job->failed;
+}
+
+
+int FolderCompare::filesCount() const
+{
+	return _job->filesCount;
+}
+
+
+int FolderCompare::filesDone() const
+{
+	return _job->filesDone;
+}
+
+
+const std::basic_string<TCHAR>& FolderCompare::oldFolder() const
+{
+	return _job->oldFolder;
+}
+
+
+const std::basic_string<TCHAR>& FolderCompare::newFolder() const
+{
+	return _job->newFolder;
+}
+
+
+std::vector<FolderCompareEntry>& FolderCompare::entries()
+{
+#ifdef MULTITHREAD
+	if (_job->worker.joinable())
+		_job->worker.join();
+#endif
+
+	return _job->entries;
+}
@@ -0,0 +1,104 @@
+/*
+ * This file is part of ComparePlus plugin for Notepad++
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <windows.h>
+#include <tchar.h>
+
+#include "Engine.h"
+
+
+enum class FileCompareState
+{
+	NOT_COMPARED,
+	IDENTICAL,		// Same file content
+	MATCH,			// Same lines with the compare options
+	DIFFERENT,
+	DIFFERENT_BINARY,	// Different but not compared line by line - binary or UTF-16/32 content
+	ONLY_IN_OLD,
+	ONLY_IN_NEW,
+	FAILED			// Not possible to read and compare
+};
+
+
+/**
+ *  \struct
+ *  \brief  Compare result of a file found in any of the compared folders. The block diffs of the compared text files
+ *          are kept in cmpCache so opening the files only marks them - up to a total compared texts size, the rest are
+ *          compared again when opened
+ */
+struct FolderCompareEntry
+{
+	explicit FolderCompareEntry(const std::basic_string<TCHAR>& path) : relPath(path) {}
+
+	// Path relative to the compared folders
+	std::basic_string<TCHAR>	relPath;
+
+	FileCompareState			state {FileCompareState::NOT_COMPARED};
+
+	int							added {0};
+	int							removed {0};
+	int							changed {0};
+	int							moved {0};
+
+	CompareCache				cmpCache;
+};
+
+
+/**
+ *  \class
+ *  \brief  Compares the files of two folder trees in a worker thread. The files are read mapped in memory - files of
+ *          the same size are checked byte by byte first and the rest are compared in parallel on the thread pool.
+ *          The entries are accessed only from the main thread once isDone(). No Scintilla view is used
+ */
+class FolderCompare
+{
+public:
+	FolderCompare(const CompareOptions& options, const TCHAR* oldFolder, const TCHAR* newFolder);
+	~FolderCompare();
+
+	FolderCompare(const FolderCompare&) = delete;
+	FolderCompare& operator=(const FolderCompare&) = delete;
+
+	void cancel();
+	bool isDone() const;
+	bool isCancelled() const;
+
+	// The folders could not be listed or the compare ran out of memory - the entries done so far are kept
+	bool isFailed() const;
+
+	// Progress of the running compare - the files count is 0 until the folders are listed
+	int filesCount() const;
+	int filesDone() const;
+
+	const std::basic_string<TCHAR>& oldFolder() const;
+	const std::basic_string<TCHAR>& newFolder() const;
+
+	// Sorted by path - valid only once isDone()
+	std::vector<FolderCompareEntry>& entries();
+
+private:
+	struct Job;
+
+	std::unique_ptr<Job> _job;
+};
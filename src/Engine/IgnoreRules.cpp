@@ -0,0 +1,348 @@
+/*
+ * This file is part of ComparePlus plugin for Notepad++
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+#include <climits>
+#include <cstdlib>
+#include <algorithm>
+
+#include "IgnoreRules.h"
+#include "TextScan.h"
+
+
+namespace {
+
+// Bigger counts are taken as unbounded
+const int cMaxItemCount = 0xFFFF;
+
+
+inline bool isDigit(char ch)
+{
+	return (ch >= '0' && ch <= '9');
+}
+
+
+// Parses the {n} and {n,m} counts - pos is after the opening brace and is left after the closing one
+bool parseCounts(const std::string& pattern, size_t& pos, int& minCount, int& maxCount)
+{
+	auto parseNumber =
+		[&](int& number) -> bool
+		{
+			if (pos >= pattern.size() || !isDigit(pattern[pos]))
+				return false;
+
+			number = 0;
+
+			for (; pos < pattern.size() && isDigit(pattern[pos]); ++pos)
+				number = std::min(number * 10 + (pattern[pos] - '0'), cMaxItemCount);
+
+			return true;
+		};
+
+	if (!parseNumber(minCount))
+		return false;
+
+	maxCount = minCount;
+
+	if (pos < pattern.size() && pattern[pos] == ',')
+	{
+		++pos;
+
+		if (pos < pattern.size() && pattern[pos] == '}')
+			maxCount = INT_MAX;
+		else if (!parseNumber(maxCount) || maxCount < minCount)
+			return false;
+	}
+
+	if (pos >= pattern.size() || pattern[pos] != '}')
+		return false;
+
+	++pos;
+
+	return true;
+}
+
+}
+
+
+IgnoreRules::IgnoreRules(const std::string& patterns)
+{
+	std::memset(&_firstChars, 0, sizeof(_firstChars));
+
+	TextHash hash;
+
+	size_t pos = 0;
+
+	while (pos < patterns.size())
+	{
+		if (patterns[pos] == ' ' || patterns[pos] == '\t')
+		{
+			++pos;
+			continue;
+		}
+
+		size_t end = patterns.find_first_of(" \t", pos);
+
+		if (end == std::string::npos)
+			end = patterns.size();
+
+		const std::string pattern = patterns.substr(pos, end - pos);
+
+		Rule rule;
+
+		if (compile(pattern, rule, _firstChars))
+		{
+			_rules.emplace_back(std::move(rule));
+
+			hash.add(pattern.data(), static_cast<int>(pattern.size()));
+			hash.add(' ');
+		}
+		else
+		{
+			if (!_invalid.empty())
+				_invalid += ' ';
+
+			_invalid += pattern;
+		}
+
+		pos = end;
+	}
+
+	_key = _rules.empty() ? 0 : (hash.get() | 1);
+}
+
+
+bool IgnoreRules::compile(const std::string& pattern, Rule& rule, ByteClass& firstChars)
+{
+	size_t pos = 0;
+
+	rule.anchored = (!pattern.empty() && pattern[0] == '^');
+
+	if (rule.anchored)
+		++pos;
+
+	while (pos < pattern.size())
+	{
+		Item item;
+
+		std::memset(&item.chars, 0, sizeof(item.chars));
+
+		item.minCount = 1;
+		item.maxCount = 1;
+
+		const char ch = pattern[pos++];
+
+		if (ch == '\\')
+		{
+			if (pos >= pattern.size())
+				return false;
+
+			const char esc = pattern[pos++];
+
+			for (int b = 0; b < 256; ++b)
+			{
+				const char c = static_cast<char>(b);
+
+				const bool isLetter = ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'));
+
+				bool inClass;
+
+				switch (esc)
+				{
+					case 'd':	inClass = isDigit(c);															break;
+					case 'x':	inClass = isDigit(c) || ((c | 0x20) >= 'a' && (c | 0x20) <= 'f');			break;
+					case 'a':	inClass = isLetter;																break;
+					case 'w':	inClass = isLetter || isDigit(c) || c == '_';									break;
+					case 's':	inClass = (c == ' ' || c == '\t');												break;
+					default:	inClass = (c == esc);
+				}
+
+				if (inClass)
+					item.chars.set(static_cast<unsigned char>(b));
+			}
+		}
+		else if (ch == '[')
+		{
+			const bool negated = (pos < pattern.size() && pattern[pos] == '^');
+
+			if (negated)
+				++pos;
+
+			ByteClass set;
+
+			std::memset(&set, 0, sizeof(set));
+
+			bool closed = false;
+
+			while (pos < pattern.size())
+			{
+				char first = pattern[pos++];
+
+				if (first == ']')
+				{
+					closed = true;
+					break;
+				}
+
+				if (first == '\\')
+				{
+					if (pos >= pattern.size())
+						return false;
+
+					first = pattern[pos++];
+				}
+
+				char last = first;
+
+				if (pos + 1 < pattern.size() && pattern[pos] == '-' && pattern[pos + 1] != ']')
+				{
+					last = pattern[pos + 1];
+					pos += 2;
+
+					if (static_cast<unsigned char>(last) < static_cast<unsigned char>(first))
+						return false;
+				}
+
+				for (int b = static_cast<unsigned char>(first); b <= static_cast<unsigned char>(last); ++b)
+					set.set(static_cast<unsigned char>(b));
+			}
+
+			if (!closed)
+				return false;
+
+			for (int w = 0; w < 4; ++w)
+				item.chars.bits[w] = negated ? ~set.bits[w] : set.bits[w];
+		}
+		else if (ch == '.')
+		{
+			std::memset(&item.chars, 0xFF, sizeof(item.chars));
+		}
+		else if (ch == '?' || ch == '*' || ch == '+' || ch == '{' || ch == '^')
+		{
+			// Quantifier without an item
+			return false;
+		}
+		else
+		{
+			item.chars.set(static_cast<unsigned char>(ch));
+		}
+
+		if (pos < pattern.size())
+		{
+			switch (pattern[pos])
+			{
+				case '?':	item.minCount = 0;	item.maxCount = 1;			++pos;	break;
+				case '*':	item.minCount = 0;	item.maxCount = INT_MAX;	++pos;	break;
+				case '+':	item.minCount = 1;	item.maxCount = INT_MAX;	++pos;	break;
+				case '{':
+					++pos;
+
+					if (!parseCounts(pattern, pos, item.minCount, item.maxCount) || item.maxCount == 0)
+						return false;
+				break;
+			}
+		}
+
+		rule.items.emplace_back(item);
+	}
+
+	// The patterns that match empty text are rejected - the chars they start with are the ones of their leading
+	// optional items and of the first required one
+	ByteClass ruleFirstChars;
+
+	std::memset(&ruleFirstChars, 0, sizeof(ruleFirstChars));
+
+	bool required = false;
+
+	for (const Item& item: rule.items)
+	{
+		for (int w = 0; w < 4; ++w)
+			ruleFirstChars.bits[w] |= item.chars.bits[w];
+
+		if (item.minCount > 0)
+		{
+			required = true;
+			break;
+		}
+	}
+
+	if (!required)
+		return false;
+
+	for (int w = 0; w < 4; ++w)
+		firstChars.bits[w] |= ruleFirstChars.bits[w];
+
+	return true;
+}
+
+
+int IgnoreRules::match(const Rule& rule, const char* text, int len)
+{
+	int pos = 0;
+
+	for (const Item& item: rule.items)
+	{
+		int count = 0;
+
+		while (count < item.maxCount && pos < len && item.chars.test(text[pos]))
+		{
+			++count;
+			++pos;
+		}
+
+		if (count < item.minCount)
+			return 0;
+	}
+
+	return pos;
+}
+
+
+void IgnoreRules::scan(const char* line, int len, intptr_t offset, std::vector<span_t>& spans) const
+{
+	for (int i = 0; i < len;)
+	{
+		if (!_firstChars.test(line[i]))
+		{
+			++i;
+			continue;
+		}
+
+		int matchLen = 0;
+
+		for (const Rule& rule: _rules)
+		{
+			if (rule.anchored && i)
+				continue;
+
+			matchLen = std::max(matchLen, match(rule, line + i, len - i));
+		}
+
+		if (matchLen == 0)
+		{
+			++i;
+			continue;
+		}
+
+		if (!spans.empty() && spans.back().off + spans.back().len == offset + i)
+			spans.back().len += matchLen;
+		else
+			spans.emplace_back(offset + i, matchLen);
+
+		i += matchLen;
+	}
+}
@@ -0,0 +1,107 @@
+/*
+ * This file is part of ComparePlus plugin for Notepad++
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Engine.h"
+
+
+/**
+ *  \class
+ *  \brief  Text patterns ignored by the compare (e.g. timestamps, GUIDs and build IDs in logs). The patterns are
+ *          compiled once to runs of byte classes and each line is scanned in a single pass - only the bytes that can
+ *          start a pattern are tried. Patterns are separated by spaces and made of:
+ *              \d digit, \x hex digit, \a letter, \w letter, digit or '_', \s space or tab, . any char,
+ *              [...] and [^...] char sets (ranges allowed), \c or any other char - itself
+ *          Each item can be followed by ?, *, + or {n} / {n,m} and ^ at the pattern start anchors it at the line start.
+ *          The items are matched greedily without backtracking so "\d+5" never matches. The rules are read only once
+ *          compiled so they can be shared by the compare threads
+ */
+class IgnoreRules
+{
+public:
+	explicit IgnoreRules(const std::string& patterns);
+
+	inline bool empty() const
+	{
+		return _rules.empty();
+	}
+
+	// The patterns that failed to compile separated by spaces
+	inline const std::string& invalidPatterns() const
+	{
+		return _invalid;
+	}
+
+	// Identifies the compiled patterns - never 0
+	inline uint64_t key() const
+	{
+		return _key;
+	}
+
+	// Appends the ignored spans of the line text to spans with offset added to their positions. Adjacent spans are
+	// joined and the longest match is taken where several patterns match
+	void scan(const char* line, int len, intptr_t offset, std::vector<span_t>& spans) const;
+
+private:
+	struct ByteClass
+	{
+		uint64_t bits[4];
+
+		inline bool test(char ch) const
+		{
+			const unsigned char b = static_cast<unsigned char>(ch);
+
+			return ((bits[b >> 6] >> (b & 63)) & 1) != 0;
+		}
+
+		inline void set(unsigned char b)
+		{
+			bits[b >> 6] |= (1ULL << (b & 63));
+		}
+	};
+
+	struct Item
+	{
+		ByteClass	chars;
+		int			minCount;
+		int			maxCount;
+	};
+
+	struct Rule
+	{
+		std::vector<Item>	items;
+		bool				anchored;
+	};
+
+	static bool compile(const std::string& pattern, Rule& rule, ByteClass& firstChars);
+
+	// Returns the match length at the text start, 0 if there is no match
+	static int match(const Rule& rule, const char* text, int len);
+
+	std::vector<Rule>	_rules;
+
+	// The chars any pattern can start with
+	ByteClass			_firstChars;
+
+	std::string			_invalid;
+	uint64_t			_key;
+};
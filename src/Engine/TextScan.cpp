@@ -0,0 +1,131 @@
+/*
+ * This file is part of ComparePlus plugin for Notepad++
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <vector>
+
+#include <windows.h>
+
+#include "TextScan.h"
+
+
+namespace // anonymous namespace
+{
+
+inline int utf8Length(unsigned codePoint)
+{
+	return (codePoint < 0x80) ? 1 : (codePoint < 0x800) ? 2 : 3;
+}
+
+
+// Lower case of each BMP code point as given by CharLowerBuffW(). Mappings that change the UTF-8 length of the code
+// point are dropped so case folded text keeps its byte positions. The table is built once on first use
+const wchar_t* getLowerCaseTable()
+{
+	static const std::vector<wchar_t> table = []()
+	{
+		std::vector<wchar_t> lower(0x10000);
+
+		for (unsigned cp = 0; cp < 0x10000; ++cp)
+			lower[cp] = static_cast<wchar_t>(cp);
+
+		::CharLowerBuffW(lower.data(), static_cast<DWORD>(lower.size()));
+
+		for (unsigned cp = 0; cp < 0x10000; ++cp)
+		{
+			const unsigned lowerCp = static_cast<unsigned>(lower[cp]);
+
+			if ((cp >= 0xD800 && cp <= 0xDFFF) || (lowerCp >= 0xD800 && lowerCp <= 0xDFFF) ||
+					utf8Length(lowerCp) != utf8Length(cp))
+				lower[cp] = static_cast<wchar_t>(cp);
+		}
+
+		return lower;
+	}();
+
+	return table.data();
+}
+
+
+inline bool isUTF8Trail(char ch)
+{
+	return ((static_cast<unsigned char>(ch) & 0xC0) == 0x80);
+}
+
+} // anonymous namespace
+
+
+void toLowerCase(std::vector<char>& text)
+{
+	const int len = static_cast<int>(text.size());
+
+	if (len == 0)
+		return;
+
+	const wchar_t* lowerTable = getLowerCaseTable();
+
+	char* str = text.data();
+
+	for (int i = 0; i < len;)
+	{
+		const unsigned char lead = static_cast<unsigned char>(str[i]);
+
+		if (lead < 0x80)
+		{
+			if (lead >= 'A' && lead <= 'Z')
+				str[i] = static_cast<char>(lead + ('a' - 'A'));
+
+			++i;
+		}
+		else if (lead >= 0xC2 && lead <= 0xDF && i + 1 < len && isUTF8Trail(str[i + 1]))
+		{
+			const unsigned cp = ((lead & 0x1F) << 6) | (static_cast<unsigned char>(str[i + 1]) & 0x3F);
+			const unsigned lowerCp = static_cast<unsigned>(lowerTable[cp]);
+
+			if (lowerCp != cp)
+			{
+				str[i]		= static_cast<char>(0xC0 | (lowerCp >> 6));
+				str[i + 1]	= static_cast<char>(0x80 | (lowerCp & 0x3F));
+			}
+
+			i += 2;
+		}
+		else if (lead >= 0xE0 && lead <= 0xEF && i + 2 < len && isUTF8Trail(str[i + 1]) && isUTF8Trail(str[i + 2]))
+		{
+			const unsigned cp = ((lead & 0x0F) << 12) | ((static_cast<unsigned char>(str[i + 1]) & 0x3F) << 6) |
+					(static_cast<unsigned char>(str[i + 2]) & 0x3F);
+
+			// Overlong sequences are skipped, the table keeps surrogates unchanged
+			if (cp >= 0x800)
+			{
+				const unsigned lowerCp = static_cast<unsigned>(lowerTable[cp]);
+
+				if (lowerCp != cp)
+				{
+					str[i]		= static_cast<char>(0xE0 | (lowerCp >> 12));
+					str[i + 1]	= static_cast<char>(0x80 | ((lowerCp >> 6) & 0x3F));
+					str[i + 2]	= static_cast<char>(0x80 | (lowerCp & 0x3F));
+				}
+			}
+
+			i += 3;
+		}
+		else
+		{
+			++i;
+		}
+	}
+}
@@ -0,0 +1,300 @@
+/*
+ * This file is part of ComparePlus plugin for Notepad++
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define TEXTSCAN_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+
+const uint64_t cHashSeed = 0x84222325;
+
+
+/**
+ *  \class
+ *  \brief  Streaming 64-bit hash. Input bytes are packed in 64-bit words that are mixed in with MurmurHash3 like
+ *          multiply-rotate rounds and the result is avalanched when taken. Empty input hashes to cHashSeed.
+ *          Byte by byte and bulk input produce the same hash.
+ */
+class TextHash
+{
+public:
+	inline void add(char letter)
+	{
+		_word |= static_cast<uint64_t>(static_cast<unsigned char>(letter)) << _shift;
+		_shift += 8;
+		++_len;
+
+		if (_shift == 64)
+		{
+			_hash = mix(_hash, _word);
+			_word = 0;
+			_shift = 0;
+		}
+	}
+
+	inline void add(const char* text, intptr_t len)
+	{
+		intptr_t i = 0;
+
+		if (_shift == 0)
+		{
+			for (; i + 8 <= len; i += 8)
+			{
+				uint64_t word;
+				std::memcpy(&word, text + i, sizeof(word));
+
+				_hash = mix(_hash, word);
+				_len += 8;
+			}
+		}
+
+		for (; i < len; ++i)
+			add(text[i]);
+	}
+
+	inline uint64_t get() const
+	{
+		if (_len == 0)
+			return cHashSeed;
+
+		uint64_t h = _shift ? mix(_hash, _word) : _hash;
+
+		h ^= _len;
+
+		h ^= h >> 33;
+		h *= 0xFF51AFD7ED558CCDULL;
+		h ^= h >> 33;
+		h *= 0xC4CEB9FE1A85EC53ULL;
+		h ^= h >> 33;
+
+		return h;
+	}
+
+private:
+	static inline uint64_t rotl(uint64_t x, int r)
+	{
+		return (x << r) | (x >> (64 - r));
+	}
+
+	static inline uint64_t mix(uint64_t h, uint64_t k)
+	{
+		k *= 0x87C37B91114253D5ULL;
+		k = rotl(k, 31);
+		k *= 0x4CF5AD432745937FULL;
+
+		h ^= k;
+		h = rotl(h, 27);
+
+		return (h * 5 + 0x52DCE729);
+	}
+
+	uint64_t	_hash {cHashSeed};
+	uint64_t	_word {0};
+	unsigned	_shift {0};
+	uint64_t	_len {0};
+};
+
+
+inline int firstSetBit(unsigned mask)
+{
+#ifdef _MSC_VER
+	unsigned long idx;
+	_BitScanForward(&idx, mask);
+
+	return static_cast<int>(idx);
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+
+inline char toLowerASCII(char letter)
+{
+	return (letter >= 'A' && letter <= 'Z') ? letter + ('a' - 'A') : letter;
+}
+
+
+// Returns the position of the first '\n' or '\r' in the [pos, end) range or end if there is none
+inline intptr_t findLineEnd(const char* text, intptr_t pos, intptr_t end)
+{
+#ifdef TEXTSCAN_SSE2
+	const __m128i lf = _mm_set1_epi8('\n');
+	const __m128i cr = _mm_set1_epi8('\r');
+
+	for (; pos + 16 <= end; pos += 16)
+	{
+		const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + pos));
+		const int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, lf), _mm_cmpeq_epi8(block, cr)));
+
+		if (mask)
+			return pos + firstSetBit(mask);
+	}
+#endif
+
+	while (pos < end && text[pos] != '\n' && text[pos] != '\r')
+		++pos;
+
+	return pos;
+}
+
+
+// Returns the number of line ends in the [pos, end) range - CRLF is a single line end
+inline intptr_t countLineEnds(const char* text, intptr_t pos, intptr_t end)
+{
+	intptr_t count = 0;
+
+	while ((pos = findLineEnd(text, pos, end)) < end)
+	{
+		++count;
+		pos += (text[pos] == '\r' && pos + 1 < end && text[pos + 1] == '\n') ? 2 : 1;
+	}
+
+	return count;
+}
+
+
+inline bool isASCII(const char* text, intptr_t len)
+{
+	intptr_t i = 0;
+
+#ifdef TEXTSCAN_SSE2
+	__m128i acc = _mm_setzero_si128();
+
+	for (; i + 16 <= len; i += 16)
+		acc = _mm_or_si128(acc, _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i)));
+
+	if (_mm_movemask_epi8(acc))
+		return false;
+#endif
+
+	for (; i < len; ++i)
+	{
+		if (text[i] & 0x80)
+			return false;
+	}
+
+	return true;
+}
+
+
+// Lower-cases UTF-8 text in place through the BMP lower case table - no UTF-16 conversion is needed and the text keeps
+// its length. Invalid sequences and code points above the BMP are left as they are
+void toLowerCase(std::vector<char>& text);
+
+
+// Adds text to the hash skipping spaces and tabs and folding ASCII letters case if requested.
+// Blocks without spaces are case folded and hashed 16 bytes at a time
+inline void hashText(TextHash& hash, const char* text, int len, bool ignoreSpaces, bool foldCase)
+{
+	int i = 0;
+
+#ifdef TEXTSCAN_SSE2
+	const __m128i space		= _mm_set1_epi8(' ');
+	const __m128i tab		= _mm_set1_epi8('\t');
+	const __m128i beforeA	= _mm_set1_epi8('A' - 1);
+	const __m128i afterZ	= _mm_set1_epi8('Z' + 1);
+	const __m128i caseBit	= _mm_set1_epi8('a' - 'A');
+
+	char block[16];
+
+	for (; i + 16 <= len; i += 16)
+	{
+		__m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i));
+
+		if (ignoreSpaces &&
+			_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chars, space), _mm_cmpeq_epi8(chars, tab))))
+		{
+			for (int j = i; j < i + 16; ++j)
+			{
+				if (text[j] != ' ' && text[j] != '\t')
+					hash.add(foldCase ? toLowerASCII(text[j]) : text[j]);
+			}
+
+			continue;
+		}
+
+		// Non-ASCII bytes are negative as signed chars so they are never folded
+		if (foldCase)
+		{
+			const __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(chars, beforeA), _mm_cmplt_epi8(chars, afterZ));
+			chars = _mm_or_si128(chars, _mm_and_si128(upper, caseBit));
+		}
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(block), chars);
+		hash.add(block, 16);
+	}
+#endif
+
+	for (; i < len; ++i)
+	{
+		if (ignoreSpaces && (text[i] == ' ' || text[i] == '\t'))
+			continue;
+
+		hash.add(foldCase ? toLowerASCII(text[i]) : text[i]);
+	}
+}
+
+
+// Compares two texts the way hashText() hashes them - spaces and tabs are skipped if requested and ASCII letters case
+// is folded for the sides that need it. Identical texts are resolved with a single memcmp
+inline bool isTextEqual(const char* text1, int len1, bool foldCase1, const char* text2, int len2, bool foldCase2,
+		bool ignoreSpaces)
+{
+	if (len1 == len2 && (len1 == 0 || std::memcmp(text1, text2, len1) == 0))
+		return true;
+
+	if (!ignoreSpaces && (len1 != len2 || (!foldCase1 && !foldCase2)))
+		return false;
+
+	int i = 0;
+	int j = 0;
+
+	for (;;)
+	{
+		if (ignoreSpaces)
+		{
+			while (i < len1 && (text1[i] == ' ' || text1[i] == '\t'))
+				++i;
+
+			while (j < len2 && (text2[j] == ' ' || text2[j] == '\t'))
+				++j;
+		}
+
+		if (i == len1 || j == len2)
+			return (i == len1 && j == len2);
+
+		const char ch1 = foldCase1 ? toLowerASCII(text1[i]) : text1[i];
+		const char ch2 = foldCase2 ? toLowerASCII(text2[j]) : text2[j];
+
+		if (ch1 != ch2)
+			return false;
+
+		++i;
+		++j;
+	}
+}
@@ -0,0 +1,349 @@
+/*
+ * This file is part of ComparePlus plugin for Notepad++
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <utility>
+
+#include "ThreadPool.h"
+
+
+#ifdef MULTITHREAD
+
+std::mutex					ThreadPool::InstMtx;
+std::unique_ptr<ThreadPool>	ThreadPool::Inst;
+
+
+ThreadPool* ThreadPool::get()
+{
+	std::lock_guard<std::mutex> lock(InstMtx);
+
+	if (!Inst)
+	{
+		// The thread waiting for a tasks group also runs its tasks. One more core is left for the UI threads
+		const int workersCount = static_cast<int>(std::thread::hardware_concurrency()) - 2;
+
+		Inst.reset(new ThreadPool(workersCount > 0 ? workersCount : 0));
+	}
+
+	return Inst.get();
+}
+
+
+void ThreadPool::release()
+{
+	std::unique_ptr<ThreadPool> pool;
+
+	{
+		std::lock_guard<std::mutex> lock(InstMtx);
+		pool = std::move(Inst);
+	}
+}
+
+
+ThreadPool::ThreadPool(int workersCount) :
+	_queues(new TasksQueue[workersCount + 1]), _queuesCount(workersCount + 1), _queuedCount(0), _stop(false)
+{
+	for (int i = 0; i < workersCount; ++i)
+	{
+		// Deques of workers that could not be started just stay empty
+		try
+		{
+			_workers.emplace_back(&ThreadPool::workerFn, this, i);
+		}
+		catch (...)
+		{
+			break;
+		}
+	}
+}
+
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(_sleepMtx);
+		_stop = true;
+	}
+
+	_wakeUp.notify_all();
+
+	for (auto& worker : _workers)
+		worker.join();
+}
+
+
+int ThreadPool::ownQueue() const
+{
+	const std::thread::id threadId = std::this_thread::get_id();
+
+	for (int i = 0; i < static_cast<int>(_workers.size()); ++i)
+	{
+		if (_workers[i].get_id() == threadId)
+			return i;
+	}
+
+	return _queuesCount - 1;
+}
+
+
+void ThreadPool::submit(Task&& task)
+{
+	TasksQueue& queue = _queues[task.group->_queueIdx];
+
+	{
+		std::lock_guard<std::mutex> lock(queue.mtx);
+		queue.tasks.emplace_back(std::move(task));
+	}
+
+	++_queuedCount;
+
+	// Taking the lock makes sure a worker going to sleep sees the new task or gets the notification
+	{
+		std::lock_guard<std::mutex> lock(_sleepMtx);
+	}
+
+	_wakeUp.notify_one();
+}
+
+
+// Runs the most recently queued task of the group that is still in the deque. Only the group own tasks are run while
+// waiting for it so nested groups waits don't pile up on the stack
+bool ThreadPool::runGroupTask(int queueIdx, const TaskGroup* group)
+{
+	TasksQueue& queue = _queues[queueIdx];
+
+	Task task;
+
+	{
+		std::lock_guard<std::mutex> lock(queue.mtx);
+
+		auto taskItr = queue.tasks.rbegin();
+
+		for (; taskItr != queue.tasks.rend(); ++taskItr)
+		{
+			if (taskItr->group == group)
+				break;
+		}
+
+		if (taskItr == queue.tasks.rend())
+			return false;
+
+		task = std::move(*taskItr);
+		queue.tasks.erase(std::next(taskItr).base());
+	}
+
+	--_queuedCount;
+
+	run(task);
+
+	return true;
+}
+
+
+// Takes a task from the back of the own deque or steals the oldest one from the other deques
+bool ThreadPool::stealTask(int queueIdx, Task& task)
+{
+	{
+		TasksQueue& queue = _queues[queueIdx];
+		std::lock_guard<std::mutex> lock(queue.mtx);
+
+		if (!queue.tasks.empty())
+		{
+			task = std::move(queue.tasks.back());
+			queue.tasks.pop_back();
+
+			--_queuedCount;
+
+			return true;
+		}
+	}
+
+	for (int i = 1; i < _queuesCount; ++i)
+	{
+		TasksQueue& queue = _queues[(queueIdx + i) % _queuesCount];
+		std::lock_guard<std::mutex> lock(queue.mtx);
+
+		if (!queue.tasks.empty())
+		{
+			task = std::move(queue.tasks.front());
+			queue.tasks.pop_front();
+
+			--_queuedCount;
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+void ThreadPool::run(Task& task)
+{
+	TaskGroup* group = task.group;
+
+	try
+	{
+		task.fn();
+	}
+	catch (...)
+	{
+		group->setError(std::current_exception());
+	}
+
+	task.fn = nullptr;
+
+	// The group might be gone as soon as its last task is marked done - the waiting thread can't see it before the
+	// lock is released
+	std::lock_guard<std::mutex> lock(group->_doneMtx);
+
+	if (--group->_pendingCount == 0)
+		group->_done.notify_all();
+}
+
+
+void ThreadPool::workerFn(int queueIdx)
+{
+	Task task;
+
+	for (;;)
+	{
+		if (stealTask(queueIdx, task))
+		{
+			run(task);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(_sleepMtx);
+
+		_wakeUp.wait(lock, [this]() { return (_stop || _queuedCount > 0); });
+
+		if (_stop)
+			return;
+	}
+}
+
+
+TaskGroup::TaskGroup() : _pool(ThreadPool::get()), _pendingCount(0)
+{
+	_queueIdx = _pool->ownQueue();
+}
+
+
+TaskGroup::~TaskGroup()
+{
+	join();
+}
+
+
+void TaskGroup::run(std::function<void()> fn)
+{
+	if (_pool->workersCount() == 0)
+	{
+		try
+		{
+			fn();
+		}
+		catch (...)
+		{
+			setError(std::current_exception());
+		}
+
+		return;
+	}
+
+	++_pendingCount;
+
+	try
+	{
+		_pool->submit(ThreadPool::Task { std::move(fn), this });
+	}
+	catch (...)
+	{
+		--_pendingCount;
+		throw;
+	}
+}
+
+
+void TaskGroup::setError(std::exception_ptr&& error)
+{
+	std::lock_guard<std::mutex> lock(_errorMtx);
+
+	if (!_error)
+		_error = std::move(error);
+}
+
+
+void TaskGroup::join()
+{
+	while (_pool->runGroupTask(_queueIdx, this));
+
+	// The group tasks left are run by the workers. The lock is taken even if they are done so the last one has
+	// released it before the group is gone
+	std::unique_lock<std::mutex> lock(_doneMtx);
+
+	_done.wait(lock, [this]() { return (_pendingCount == 0); });
+}
+
+#else
+
+TaskGroup::TaskGroup()
+{}
+
+
+TaskGroup::~TaskGroup()
+{}
+
+
+void TaskGroup::run(std::function<void()> fn)
+{
+	try
+	{
+		fn();
+	}
+	catch (...)
+	{
+		setError(std::current_exception());
+	}
+}
+
+
+void TaskGroup::setError(std::exception_ptr&& error)
+{
+	if (!_error)
+		_error = std::move(error);
+}
+
+
+void TaskGroup::join()
+{}
+
+#endif // MULTITHREAD
+
+
+void TaskGroup::wait()
+{
+	join();
+
+	if (_error)
+	{
+		std::exception_ptr error;
+		std::swap(error, _error);
+
+		std::rethrow_exception(error);
+	}
+}
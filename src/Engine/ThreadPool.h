@@ -0,0 +1,154 @@
+/*
+ * This file is part of ComparePlus plugin for Notepad++
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <exception>
+#include <functional>
+
+#ifdef MULTITHREAD
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#if defined(__MINGW32__) && !defined(_GLIBCXX_HAS_GTHREADS)
+#include "../mingw-std-threads/mingw.thread.h"
+#include "../mingw-std-threads/mingw.mutex.h"
+#include "../mingw-std-threads/mingw.condition_variable.h"
+#else
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#endif // __MINGW32__ ...
+
+#endif // MULTITHREAD
+
+
+class TaskGroup;
+
+
+#ifdef MULTITHREAD
+
+/**
+ *  \class
+ *  \brief  Pool of worker threads created on first use and kept until release() is called. Each worker owns a tasks
+ *          deque - it pushes and pops its tasks at the back and when it runs out of work it steals from the front of
+ *          the other deques. Tasks submitted from non-worker threads go to a shared deque that is served the same way
+ */
+class ThreadPool
+{
+public:
+	static ThreadPool* get();
+
+	// Stops and joins the workers - nothing should be run in the pool anymore. Must be called from the main thread
+	static void release();
+
+	~ThreadPool();
+
+	inline int workersCount() const
+	{
+		return static_cast<int>(_workers.size());
+	}
+
+private:
+	friend class TaskGroup;
+
+	struct Task
+	{
+		std::function<void()>	fn;
+		TaskGroup*				group;
+	};
+
+	struct TasksQueue
+	{
+		std::mutex			mtx;
+		std::deque<Task>	tasks;
+	};
+
+	static std::mutex					InstMtx;
+	static std::unique_ptr<ThreadPool>	Inst;
+
+	explicit ThreadPool(int workersCount);
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	int ownQueue() const;
+
+	void submit(Task&& task);
+	bool runGroupTask(int queueIdx, const TaskGroup* group);
+	bool stealTask(int queueIdx, Task& task);
+	void run(Task& task);
+
+	void workerFn(int queueIdx);
+
+	std::vector<std::thread>		_workers;
+
+	// One deque per worker and the last one is for the tasks of non-worker threads
+	std::unique_ptr<TasksQueue[]>	_queues;
+	const int						_queuesCount;
+
+	std::atomic<int>				_queuedCount;
+
+	std::mutex						_sleepMtx;
+	std::condition_variable			_wakeUp;
+	bool							_stop;
+};
+
+#endif // MULTITHREAD
+
+
+/**
+ *  \class
+ *  \brief  Set of tasks run in the thread pool. wait() returns when all of them are done and while waiting it runs
+ *          the group tasks that are not taken by the pool workers yet. The first task exception is rethrown by wait().
+ *          Tasks are run directly in the calling thread if the pool has no workers or MULTITHREAD is not defined
+ */
+class TaskGroup
+{
+public:
+	TaskGroup();
+	~TaskGroup();
+
+	void run(std::function<void()> fn);
+	void wait();
+
+private:
+	TaskGroup(const TaskGroup&) = delete;
+	TaskGroup& operator=(const TaskGroup&) = delete;
+
+	void setError(std::exception_ptr&& error);
+	void join();
+
+	std::exception_ptr	_error;
+
+#ifdef MULTITHREAD
+	friend class ThreadPool;
+
+	ThreadPool*			_pool;
+	int					_queueIdx;
+
+	std::atomic<int>	_pendingCount;
+	std::mutex			_errorMtx;
+
+	// Signaled by the last done task
+	std::mutex				_doneMtx;
+	std::condition_variable	_done;
+#endif // MULTITHREAD
+};
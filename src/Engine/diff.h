@@ -37,16 +37,49 @@
  * Copyright (C) 2017-2019  Pavel Nedev <pg.nedev@gmail.com>
  */
 
+/* The patience algorithm anchors the compare on elements that are unique in both sequences,
+ * takes the longest increasing sequence of those as matches and recurses in the gaps between them.
+ * Gaps with no unique elements are compared with the Myers algorithm above.
+ */
+
+/* If max (the cost limit) is given, the middle snake search that goes past it is cut short like GNU diff's
+ * heuristic does - the furthest reaching forward or backward path is taken as the split point and each part is
+ * compared separately. The result is then not guaranteed to be minimal but compare time stays about linear.
+ */
+
 
 #pragma once
 
 #include <cstdlib>
+#include <cstdint>
 #include <climits>
 #include <utility>
+#include <algorithm>
+#include <vector>
+#include <unordered_map>
+
+#ifdef DIFF_TIMING
+#include <chrono>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define DIFF_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 #include "varray.h"
 
 
+// VS2013 has no thread_local support - DiffCalc objects use their own workspaces then
+#if defined(_MSC_VER) && (_MSC_VER < 1900)
+#define DIFF_NO_THREAD_LOCAL
+#endif
+
+
 enum class diff_type
 {
 	DIFF_MATCH,
@@ -55,6 +88,13 @@ enum class diff_type
 };
 
 
+enum class diff_algorithm
+{
+	MYERS,
+	PATIENCE
+};
+
+
 template <typename UserDataT>
 struct diff_info
 {
@@ -75,9 +115,176 @@ struct diff_info<void>
 };
 
 
+// Bare hashes and chars compared as they are - the elements metadata is kept aside in parallel arrays
+inline uint64_t diffHash(uint64_t hash)
+{
+	return hash;
+}
+
+
+inline uint64_t diffHash(char chr)
+{
+	return static_cast<unsigned char>(chr);
+}
+
+
+// Matching elements run length from the start of a and b, n elements at most
+template <typename Elem>
+inline int diff_match_fwd(const Elem* a, const Elem* b, int n)
+{
+	int i = 0;
+
+	while (i < n && a[i] == b[i])
+		++i;
+
+	return i;
+}
+
+
+// Matching elements run length back from the ends of a and b (pointing past the last elements), n elements at most
+template <typename Elem>
+inline int diff_match_bwd(const Elem* a, const Elem* b, int n)
+{
+	int i = 0;
+
+	while (i < n && a[-i - 1] == b[-i - 1])
+		++i;
+
+	return i;
+}
+
+
+#ifdef DIFF_SSE2
+
+inline int diff_first_set_bit(unsigned mask)
+{
+#ifdef _MSC_VER
+	unsigned long idx;
+	_BitScanForward(&idx, mask);
+
+	return static_cast<int>(idx);
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+
+inline int diff_last_set_bit(unsigned mask)
+{
+#ifdef _MSC_VER
+	unsigned long idx;
+	_BitScanReverse(&idx, mask);
+
+	return static_cast<int>(idx);
+#else
+	return 31 - __builtin_clz(mask);
+#endif
+}
+
+
+// The bytes equality mask of 4 hashes - a hash is equal if all its 8 mask bits are set
+inline unsigned diff_eq_mask4(const uint64_t* a, const uint64_t* b)
+{
+	const __m128i eq1 = _mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a)),
+			_mm_loadu_si128(reinterpret_cast<const __m128i*>(b)));
+	const __m128i eq2 = _mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + 2)),
+			_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + 2)));
+
+	return static_cast<unsigned>(_mm_movemask_epi8(eq1)) | (static_cast<unsigned>(_mm_movemask_epi8(eq2)) << 16);
+}
+
+
+inline unsigned diff_eq_mask16(const char* a, const char* b)
+{
+	return static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(
+			_mm_loadu_si128(reinterpret_cast<const __m128i*>(a)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(b)))));
+}
+
+
+// 4 hashes are compared at once
+inline int diff_match_fwd(const uint64_t* a, const uint64_t* b, int n)
+{
+	int i = 0;
+
+	for (; i + 4 <= n; i += 4)
+	{
+		const unsigned mask = diff_eq_mask4(a + i, b + i);
+
+		if (mask != 0xFFFFFFFF)
+			return i + diff_first_set_bit(~mask) / 8;
+	}
+
+	while (i < n && a[i] == b[i])
+		++i;
+
+	return i;
+}
+
+
+inline int diff_match_bwd(const uint64_t* a, const uint64_t* b, int n)
+{
+	int i = 0;
+
+	for (; i + 4 <= n; i += 4)
+	{
+		const unsigned mask = diff_eq_mask4(a - i - 4, b - i - 4);
+
+		if (mask != 0xFFFFFFFF)
+			return i + (31 - diff_last_set_bit(~mask)) / 8;
+	}
+
+	while (i < n && a[-i - 1] == b[-i - 1])
+		++i;
+
+	return i;
+}
+
+
+// 16 chars are compared at once
+inline int diff_match_fwd(const char* a, const char* b, int n)
+{
+	int i = 0;
+
+	for (; i + 16 <= n; i += 16)
+	{
+		const unsigned mask = diff_eq_mask16(a + i, b + i);
+
+		if (mask != 0xFFFF)
+			return i + diff_first_set_bit(~mask & 0xFFFF);
+	}
+
+	while (i < n && a[i] == b[i])
+		++i;
+
+	return i;
+}
+
+
+inline int diff_match_bwd(const char* a, const char* b, int n)
+{
+	int i = 0;
+
+	for (; i + 16 <= n; i += 16)
+	{
+		const unsigned mask = diff_eq_mask16(a - i - 16, b - i - 16);
+
+		if (mask != 0xFFFF)
+			return i + 15 - diff_last_set_bit(~mask & 0xFFFF);
+	}
+
+	while (i < n && a[-i - 1] == b[-i - 1])
+		++i;
+
+	return i;
+}
+
+#endif // DIFF_SSE2
+
+
 /**
  *  \class  DiffCalc
- *  \brief  Compares and makes a differences list between two vectors (elements are template, must have operator==)
+ *  \brief  Compares and makes a differences list between two vectors (elements are template, must have operator==
+ *          and there must be a diffHash(const Elem&) function returning uint64_t used by the patience algorithm)
  */
 template <typename Elem, typename UserDataT = void>
 class DiffCalc
@@ -90,7 +297,31 @@ public:
 	// compared sequences have been swapped for better results (if true, _a and _b have been swapped,
 	// meaning that DIFF_IN_1 in the differences is regarding _b instead of _a)
 	std::pair<std::vector<diff_info<UserDataT>>, bool> operator()(bool doDiffsCombine = false,
-			bool doBoundaryShift = false);
+			bool doBoundaryShift = false, diff_algorithm algorithm = diff_algorithm::MYERS);
+
+	// Same as above but the differences are stored in diffs reusing its memory. Returns the swap flag
+	bool operator()(std::vector<diff_info<UserDataT>>& diffs, bool doDiffsCombine = false,
+			bool doBoundaryShift = false, diff_algorithm algorithm = diff_algorithm::MYERS);
+
+	// True if the cost limit has been hit and the last result might not be the minimal one
+	inline bool isApproximate() const
+	{
+		return _approximate;
+	}
+
+#ifdef DIFF_TIMING
+	// Last compare phases times - built in the micro-benchmarks only
+	struct timing {
+		int64_t search_ns;
+		int64_t combine_ns;
+		int64_t shift_ns;
+	};
+
+	inline const timing& lastTiming() const
+	{
+		return _timing;
+	}
+#endif
 
 	DiffCalc(const DiffCalc&) = delete;
 	const DiffCalc& operator=(const DiffCalc&) = delete;
@@ -100,13 +331,38 @@ private:
 		int x, y, u, v;
 	};
 
+	// Reusable compare memory - shared by all same type DiffCalc objects in a thread
+	struct workspace {
+		varray<int>							v;
+		std::vector<diff_info<UserDataT>>	stored_diff;
+	};
+
+	// Workspace memory above that (in elements) is freed after the compare
+	static const unsigned _max_kept_workspace = 1 << 20;
+
+	static inline workspace& _workspace();
+
 	inline int& _v(int k, int r);
 	void _edit(diff_type type, int off, int len);
 	int _find_middle_snake(int aoff, int aend, int boff, int bend, middle_snake& ms);
+	bool _find_approximate_split(int aoff, int boff, int d, int aend, int bend, middle_snake& ms);
 	int _ses(int aoff, int aend, int boff, int bend);
+	void _find_anchors(int aoff, int aend, int boff, int bend, std::vector<std::pair<int, int>>& anchors);
+	int _patience(int aoff, int aend, int boff, int bend);
+	inline int _run(diff_algorithm algorithm, int aoff, int aend, int boff, int bend);
 	void _combine_diffs();
 	void _shift_boundaries();
+	void _normalize_diffs();
 	inline int _count_replaces();
+	bool _compare(bool doDiffsCombine, bool doBoundaryShift, diff_algorithm algorithm);
+	void _release_workspace();
+
+#ifdef DIFF_TIMING
+	static inline int64_t _elapsed_ns(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	}
+#endif
 
 	const Elem*	_a;
 	int _a_size;
@@ -116,10 +372,23 @@ private:
 	std::vector<diff_info<UserDataT>>	_diff;
 
 	const int	_dmax;
-	varray<int>	_buf;
+
+#ifdef DIFF_NO_THREAD_LOCAL
+	workspace	_ws;
+#else
+	workspace&	_ws;
+#endif
+
+	bool		_approximate {false};
+
+#ifdef DIFF_TIMING
+	timing		_timing;
+#endif
 };
 
 
+#ifdef DIFF_NO_THREAD_LOCAL
+
 template <typename Elem, typename UserDataT>
 DiffCalc<Elem, UserDataT>::DiffCalc(const std::vector<Elem>& v1, const std::vector<Elem>& v2, int max) :
 	_a(v1.data()), _a_size(v1.size()), _b(v2.data()), _b_size(v2.size()), _dmax(max)
@@ -133,6 +402,32 @@ DiffCalc<Elem, UserDataT>::DiffCalc(const Elem v1[], int v1_size, const Elem v2[
 {
 }
 
+#else
+
+template <typename Elem, typename UserDataT>
+DiffCalc<Elem, UserDataT>::DiffCalc(const std::vector<Elem>& v1, const std::vector<Elem>& v2, int max) :
+	_a(v1.data()), _a_size(v1.size()), _b(v2.data()), _b_size(v2.size()), _dmax(max), _ws(_workspace())
+{
+}
+
+
+template <typename Elem, typename UserDataT>
+DiffCalc<Elem, UserDataT>::DiffCalc(const Elem v1[], int v1_size, const Elem v2[], int v2_size, int max) :
+	_a(v1), _a_size(v1_size), _b(v2), _b_size(v2_size), _dmax(max), _ws(_workspace())
+{
+}
+
+
+template <typename Elem, typename UserDataT>
+inline typename DiffCalc<Elem, UserDataT>::workspace& DiffCalc<Elem, UserDataT>::_workspace()
+{
+	thread_local workspace ws;
+
+	return ws;
+}
+
+#endif // DIFF_NO_THREAD_LOCAL
+
 
 template <typename Elem, typename UserDataT>
 inline int& DiffCalc<Elem, UserDataT>::_v(int k, int r)
@@ -140,7 +435,7 @@ inline int& DiffCalc<Elem, UserDataT>::_v(int k, int r)
 	/* Pack -N to N into 0 to N * 2 */
 	const int j = (k <= 0) ? (-k * 4 + r) : (k * 4 + (r - 2));
 
-	return _buf.get(j);
+	return _ws.v.get(j);
 }
 
 
@@ -186,8 +481,12 @@ int DiffCalc<Elem, UserDataT>::_find_middle_snake(int aoff, int aend, int boff,
 	{
 		int k, x, y;
 
-		if ((2 * d - 1) >= _dmax)
-			return _dmax;
+		// Too expensive - split at the furthest reaching path found so far
+		if ((2 * d - 1) >= _dmax && d > 1 && _find_approximate_split(aoff, boff, d - 1, aend, bend, ms))
+		{
+			_approximate = true;
+			return 2 * d - 1;
+		}
 
 		for (k = d; k >= -d; k -= 2)
 		{
@@ -201,10 +500,12 @@ int DiffCalc<Elem, UserDataT>::_find_middle_snake(int aoff, int aend, int boff,
 			ms.x = x;
 			ms.y = y;
 
-			while (x < aend && y < bend &&  _a[aoff + x] == _b[boff + y])
+			if (x < aend && y < bend)
 			{
-				++x;
-				++y;
+				const int match = diff_match_fwd(_a + aoff + x, _b + boff + y, std::min(aend - x, bend - y));
+
+				x += match;
+				y += match;
 			}
 
 			_v(k, 0) = x;
@@ -238,10 +539,12 @@ int DiffCalc<Elem, UserDataT>::_find_middle_snake(int aoff, int aend, int boff,
 			ms.u = x;
 			ms.v = y;
 
-			while (x > 0 && y > 0 &&  _a[aoff + x - 1] == _b[boff + y - 1])
+			if (x > 0 && y > 0)
 			{
-				--x;
-				--y;
+				const int match = diff_match_bwd(_a + aoff + x, _b + boff + y, std::min(x, y));
+
+				x -= match;
+				y -= match;
 			}
 
 			_v(kr, 1) = x;
@@ -263,6 +566,84 @@ int DiffCalc<Elem, UserDataT>::_find_middle_snake(int aoff, int aend, int boff,
 }
 
 
+// Picks the forward or backward path of cost d that got furthest from its start and makes the matching elements run
+// around its end the middle snake - _ses() relies on the sub-problems beginning with a diff.
+// Returns false if no path can split the problem in smaller parts
+template <typename Elem, typename UserDataT>
+bool DiffCalc<Elem, UserDataT>::_find_approximate_split(int aoff, int boff, int d, int aend, int bend,
+		middle_snake& ms)
+{
+	const int delta = aend - bend;
+
+	int best_fwd = -1;
+	int fwd_x = 0;
+	int fwd_y = 0;
+
+	for (int k = d; k >= -d; k -= 2)
+	{
+		const int x = _v(k, 0);
+		const int y = x - k;
+
+		if (x <= aend && y >= 0 && y <= bend && x + y > best_fwd)
+		{
+			best_fwd = x + y;
+			fwd_x = x;
+			fwd_y = y;
+		}
+	}
+
+	int best_bwd = -1;
+	int bwd_x = 0;
+	int bwd_y = 0;
+
+	for (int k = d; k >= -d; k -= 2)
+	{
+		const int kr = delta + k;
+		const int x = _v(kr, 1);
+		const int y = x - kr;
+
+		if (x >= 0 && x <= aend && y >= 0 && y <= bend && (aend - x) + (bend - y) > best_bwd)
+		{
+			best_bwd = (aend - x) + (bend - y);
+			bwd_x = x;
+			bwd_y = y;
+		}
+	}
+
+	if (best_fwd >= best_bwd)
+	{
+		ms.x = ms.u = fwd_x;
+		ms.y = ms.v = fwd_y;
+	}
+	else
+	{
+		ms.x = ms.u = bwd_x;
+		ms.y = ms.v = bwd_y;
+	}
+
+	if (ms.x + ms.y == 0 || ms.x + ms.y == aend + bend)
+		return false;
+
+	if (ms.x > 0 && ms.y > 0)
+	{
+		const int match = diff_match_bwd(_a + aoff + ms.x, _b + boff + ms.y, std::min(ms.x, ms.y));
+
+		ms.x -= match;
+		ms.y -= match;
+	}
+
+	if (ms.u < aend && ms.v < bend)
+	{
+		const int match = diff_match_fwd(_a + aoff + ms.u, _b + boff + ms.v, std::min(aend - ms.u, bend - ms.v));
+
+		ms.u += match;
+		ms.v += match;
+	}
+
+	return true;
+}
+
+
 template <typename Elem, typename UserDataT>
 int DiffCalc<Elem, UserDataT>::_ses(int aoff, int aend, int boff, int bend)
 {
@@ -288,9 +669,6 @@ int DiffCalc<Elem, UserDataT>::_ses(int aoff, int aend, int boff, int bend)
 		if (d == -1)
 			return -1;
 
-		if (d >= _dmax)
-			return _dmax;
-
 		if (d > 1)
 		{
 			if (_ses(aoff, ms.x, boff, ms.y) == -1)
@@ -358,6 +736,161 @@ int DiffCalc<Elem, UserDataT>::_ses(int aoff, int aend, int boff, int bend)
 }
 
 
+// Finds the longest sequence of elements that are unique in both compared ranges and are in the same order in both.
+// Anchors are returned as pairs of offsets into _a and _b
+template <typename Elem, typename UserDataT>
+void DiffCalc<Elem, UserDataT>::_find_anchors(int aoff, int aend, int boff, int bend,
+		std::vector<std::pair<int, int>>& anchors)
+{
+	struct occurrence {
+		int a_count, b_count;
+		int a_pos, b_pos;
+	};
+
+	std::unordered_map<uint64_t, occurrence> occurrences;
+	occurrences.reserve(aend);
+
+	for (int i = aoff; i < aoff + aend; ++i)
+	{
+		occurrence& occ = occurrences.emplace(diffHash(_a[i]), occurrence{ 0, 0, 0, 0 }).first->second;
+
+		if (occ.a_count++ == 0)
+			occ.a_pos = i;
+	}
+
+	for (int i = boff; i < boff + bend; ++i)
+	{
+		auto it = occurrences.find(diffHash(_b[i]));
+
+		if (it != occurrences.end() && it->second.b_count++ == 0)
+			it->second.b_pos = i;
+	}
+
+	// Unique elements in _a order
+	std::vector<std::pair<int, int>> unique;
+
+	for (int i = aoff; i < aoff + aend; ++i)
+	{
+		const occurrence& occ = occurrences[diffHash(_a[i])];
+
+		if (occ.a_count == 1 && occ.b_count == 1 && _a[i] == _b[occ.b_pos])
+			unique.emplace_back(i, occ.b_pos);
+	}
+
+	if (unique.empty())
+		return;
+
+	// Patience sorting - tails[n] is the index in unique of the smallest _b offset ending an increasing run of n + 1
+	std::vector<int> tails;
+	std::vector<int> prev(unique.size(), -1);
+
+	for (int i = 0; i < static_cast<int>(unique.size()); ++i)
+	{
+		int lo = 0;
+		int hi = static_cast<int>(tails.size());
+
+		while (lo < hi)
+		{
+			const int mid = (lo + hi) / 2;
+
+			if (unique[tails[mid]].second < unique[i].second)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		if (lo > 0)
+			prev[i] = tails[lo - 1];
+
+		if (lo == static_cast<int>(tails.size()))
+			tails.push_back(i);
+		else
+			tails[lo] = i;
+	}
+
+	anchors.resize(tails.size());
+
+	for (int i = tails.back(), j = static_cast<int>(tails.size()) - 1; i >= 0; i = prev[i], --j)
+		anchors[j] = unique[i];
+}
+
+
+template <typename Elem, typename UserDataT>
+int DiffCalc<Elem, UserDataT>::_patience(int aoff, int aend, int boff, int bend)
+{
+	const int pre = diff_match_fwd(_a + aoff, _b + boff, std::min(aend, bend));
+
+	_edit(diff_type::DIFF_MATCH, aoff, pre);
+
+	aoff += pre;
+	boff += pre;
+	aend -= pre;
+	bend -= pre;
+
+	const int suf = diff_match_bwd(_a + aoff + aend, _b + boff + bend, std::min(aend, bend));
+
+	aend -= suf;
+	bend -= suf;
+
+	const int suf_off = aoff + aend;
+
+	std::vector<std::pair<int, int>> anchors;
+
+	if (aend && bend)
+		_find_anchors(aoff, aend, boff, bend, anchors);
+
+	int d = 0;
+
+	if (anchors.empty())
+	{
+		d = _ses(aoff, aend, boff, bend);
+
+		if (d == -1)
+			return -1;
+	}
+	else
+	{
+		for (const auto& anchor: anchors)
+		{
+			const int r = _patience(aoff, anchor.first - aoff, boff, anchor.second - boff);
+
+			if (r == -1)
+				return -1;
+
+			d += r;
+
+			_edit(diff_type::DIFF_MATCH, anchor.first, 1);
+
+			aend -= anchor.first + 1 - aoff;
+			bend -= anchor.second + 1 - boff;
+			aoff = anchor.first + 1;
+			boff = anchor.second + 1;
+		}
+
+		const int r = _patience(aoff, aend, boff, bend);
+
+		if (r == -1)
+			return -1;
+
+		d += r;
+	}
+
+	_edit(diff_type::DIFF_MATCH, suf_off, suf);
+
+	return d;
+}
+
+
+template <typename Elem, typename UserDataT>
+inline int DiffCalc<Elem, UserDataT>::_run(diff_algorithm algorithm, int aoff, int aend, int boff, int bend)
+{
+	if (algorithm == diff_algorithm::PATIENCE)
+		return _patience(aoff, aend, boff, bend);
+
+	return _ses(aoff, aend, boff, bend);
+}
+
+
 // If a whole matching block is contained at the end of the next diff block shift match down:
 // If [] surrounds the marked differences, basically [abc]d[efgd]hi is the same as [abcdefg]dhi
 // We combine diffs to make results more compact and clean
@@ -415,26 +948,32 @@ void DiffCalc<Elem, UserDataT>::_combine_diffs()
 			// The whole match is contained at the end of the next diff -
 			// move the match down linking the surrounding diffs and matches
 
+			match_len = match.len;
+
+			next_diff->off -= match_len;
+
 			// Link match to the next matching block
 			if (i + 2 < static_cast<int>(_diff.size()))
 			{
-				_diff[i + 2].off -= match.len;
-				_diff[i + 2].len += match.len;
+				_diff[i + 2].off -= match_len;
+				_diff[i + 2].len += match_len;
 			}
-			// Create new match block at the end
+			// Create new match block at the end (match and next_diff references are invalid after that)
 			else
 			{
 				diff_info<UserDataT> end_match;
 
 				end_match.type = diff_type::DIFF_MATCH;
-				end_match.off = match.off + next_diff->len;
-				end_match.len = match.len;
+				end_match.off = match.off;
+				end_match.len = match_len;
+
+				// Match offset is into 1 - moves down only past DIFF_IN_1
+				if (next_diff->type == diff_type::DIFF_IN_1)
+					end_match.off += next_diff->len;
 
 				_diff.emplace_back(end_match);
 			}
 
-			next_diff->off -= match.len;
-
 			_diff.erase(_diff.begin() + i);
 
 			next_diff = &_diff[i];
@@ -498,7 +1037,9 @@ void DiffCalc<Elem, UserDataT>::_shift_boundaries()
 			el	= _a;
 		}
 
-		if (i + 1 < static_cast<int>(_diff.size()))
+		// Only diffs surrounded by matches can be shifted
+		if ((i + 1 < static_cast<int>(_diff.size())) && (_diff[i + 1].type == diff_type::DIFF_MATCH) &&
+				(i == 0 || _diff[i - 1].type == diff_type::DIFF_MATCH))
 		{
 			diff_info<UserDataT>& diff = _diff[i];
 			diff_info<UserDataT>* next_match_diff = &_diff[i + 1];
@@ -555,6 +1096,21 @@ void DiffCalc<Elem, UserDataT>::_shift_boundaries()
 						// Diff blocks merged - recheck same diff
 						--i;
 					}
+					// Diff blocks are now a replacement - keep them in DIFF_IN_1, DIFF_IN_2 order
+					else if (j < static_cast<int>(_diff.size()) && _diff[j].type != diff_type::DIFF_MATCH &&
+							_diff[i].type == diff_type::DIFF_IN_2)
+					{
+						std::swap(_diff[i], _diff[j]);
+
+						// The swapped DIFF_IN_2 can be followed by another one - merge them and recheck same diff
+						if (j + 1 < static_cast<int>(_diff.size()) && _diff[j + 1].type == _diff[j].type)
+						{
+							_diff[j].len += _diff[j + 1].len;
+							_diff.erase(_diff.begin() + j + 1);
+
+							--i;
+						}
+					}
 				}
 			}
 		}
@@ -562,6 +1118,69 @@ void DiffCalc<Elem, UserDataT>::_shift_boundaries()
 }
 
 
+// The cost limited search and the diffs combining / shifting can leave the diff blocks between two matches
+// interleaved (e.g. DIFF_IN_2, DIFF_IN_1, DIFF_IN_2). They are merged in a single replacement - DIFF_IN_1 followed by
+// DIFF_IN_2 as the diffs users pair them. The blocks of a type between two matches are contiguous
+template <typename Elem, typename UserDataT>
+void DiffCalc<Elem, UserDataT>::_normalize_diffs()
+{
+	const int size = static_cast<int>(_diff.size());
+
+	int i = 1;
+
+	for (; i < size; ++i)
+	{
+		if (_diff[i].type == _diff[i - 1].type ||
+				(_diff[i].type == diff_type::DIFF_IN_1 && _diff[i - 1].type == diff_type::DIFF_IN_2))
+			break;
+	}
+
+	if (i >= size)
+		return;
+
+	int out = 0;
+
+	for (i = 0; i < size;)
+	{
+		if (_diff[i].type == diff_type::DIFF_MATCH)
+		{
+			if (out && _diff[out - 1].type == diff_type::DIFF_MATCH)
+				_diff[out - 1].len += _diff[i].len;
+			else
+				_diff[out++] = std::move(_diff[i]);
+
+			++i;
+			continue;
+		}
+
+		diff_info<UserDataT> in1;
+		diff_info<UserDataT> in2;
+
+		in1.len = 0;
+		in2.len = 0;
+
+		for (; i < size && _diff[i].type != diff_type::DIFF_MATCH; ++i)
+		{
+			diff_info<UserDataT>& in = (_diff[i].type == diff_type::DIFF_IN_1) ? in1 : in2;
+
+			if (in.len)
+				in.len += _diff[i].len;
+			else
+				in = std::move(_diff[i]);
+		}
+
+		// At most as many blocks are written as have been read
+		if (in1.len)
+			_diff[out++] = std::move(in1);
+
+		if (in2.len)
+			_diff[out++] = std::move(in2);
+	}
+
+	_diff.erase(_diff.begin() + out, _diff.end());
+}
+
+
 template <typename Elem, typename UserDataT>
 inline int DiffCalc<Elem, UserDataT>::_count_replaces()
 {
@@ -582,9 +1201,14 @@ inline int DiffCalc<Elem, UserDataT>::_count_replaces()
 
 
 template <typename Elem, typename UserDataT>
-std::pair<std::vector<diff_info<UserDataT>>, bool> DiffCalc<Elem, UserDataT>::operator()(bool doDiffsCombine,
-		bool doBoundaryShift)
+bool DiffCalc<Elem, UserDataT>::_compare(bool doDiffsCombine, bool doBoundaryShift, diff_algorithm algorithm)
 {
+#ifdef DIFF_TIMING
+	_timing = timing {0, 0, 0};
+
+	auto phaseStart = std::chrono::steady_clock::now();
+#endif
+
 	bool swapped = (_a_size > _b_size);
 
 	if (swapped)
@@ -596,30 +1220,39 @@ std::pair<std::vector<diff_info<UserDataT>>, bool> DiffCalc<Elem, UserDataT>::op
 	/* The _ses function assumes we begin with a diff. The following ensures this is true by skipping any matches
 	 * in the beginning. This also helps to quickly process sequences that match entirely.
 	 */
-	int off = 0;
-
 	int asize = _a_size;
 	int bsize = _b_size;
 
-	while (off < asize && off < bsize && _a[off] == _b[off])
-		++off;
+	const int off = diff_match_fwd(_a, _b, std::min(asize, bsize));
 
 	_edit(diff_type::DIFF_MATCH, 0, off);
 
 	if (asize == bsize && off == asize)
-		return std::make_pair(_diff, swapped);
+		return swapped;
 
 	asize -= off;
 	bsize -= off;
 
-	if (_ses(off, asize, off, bsize) == -1)
+	// The matching tail is skipped as well so nearly identical sequences are searched only around their differences
+	const int suffix = diff_match_bwd(_a + _a_size, _b + _b_size, std::min(asize, bsize));
+
+	asize -= suffix;
+	bsize -= suffix;
+
+	// Workspace large enough for the usual compares - bigger ones grow it on demand
+	const unsigned usual_size = 4u * (asize + bsize) + 8u;
+
+	_ws.v.reserve((usual_size < _max_kept_workspace) ? usual_size : _max_kept_workspace);
+
+	if (_run(algorithm, off, asize, off, bsize) == -1)
 	{
 		_diff.clear();
-		return std::make_pair(_diff, swapped);
+		_release_workspace();
+
+		return swapped;
 	}
 
-	// Wipe temporal buffer to free memory
-	_buf.get().clear();
+	_normalize_diffs();
 
 	// Swap compared sequences and re-compare to see if result is more optimal
 	if (_a_size == _b_size)
@@ -627,7 +1260,11 @@ std::pair<std::vector<diff_info<UserDataT>>, bool> DiffCalc<Elem, UserDataT>::op
 		const int replacesCount = _count_replaces();
 
 		// Store current compare result
-		std::vector<diff_info<UserDataT>> storedDiff = std::move(_diff);
+		std::vector<diff_info<UserDataT>>& storedDiff = _ws.stored_diff;
+
+		storedDiff.swap(_diff);
+		_diff.clear();
+
 		std::swap(_a, _b);
 		swapped = !swapped;
 
@@ -635,28 +1272,95 @@ std::pair<std::vector<diff_info<UserDataT>>, bool> DiffCalc<Elem, UserDataT>::op
 		if (storedDiff[0].type == diff_type::DIFF_MATCH)
 			_diff.push_back(storedDiff[0]);
 
-		int newReplacesCount = _ses(off, asize, off, bsize);
-
-		// Wipe temporal buffer to free memory
-		_buf.get().clear();
+		int newReplacesCount = _run(algorithm, off, asize, off, bsize);
 
 		if (newReplacesCount != -1)
+		{
+			_normalize_diffs();
 			newReplacesCount = _count_replaces();
+		}
 
 		// If re-compare result is not more optimal - restore the previous state
 		if (newReplacesCount < replacesCount)
 		{
-			_diff = std::move(storedDiff);
+			_diff.swap(storedDiff);
 			std::swap(_a, _b);
 			swapped = !swapped;
 		}
+
+		storedDiff.clear();
 	}
 
+	_edit(diff_type::DIFF_MATCH, _a_size - suffix, suffix);
+
+	_release_workspace();
+
+#ifdef DIFF_TIMING
+	_timing.search_ns = _elapsed_ns(phaseStart);
+#endif
+
 	if (doDiffsCombine)
+	{
+#ifdef DIFF_TIMING
+		phaseStart = std::chrono::steady_clock::now();
+#endif
 		_combine_diffs();
+#ifdef DIFF_TIMING
+		_timing.combine_ns = _elapsed_ns(phaseStart);
+#endif
+	}
 
 	if (doBoundaryShift)
+	{
+#ifdef DIFF_TIMING
+		phaseStart = std::chrono::steady_clock::now();
+#endif
 		_shift_boundaries();
+#ifdef DIFF_TIMING
+		_timing.shift_ns = _elapsed_ns(phaseStart);
+#endif
+	}
+
+	if (doDiffsCombine || doBoundaryShift)
+		_normalize_diffs();
+
+	return swapped;
+}
+
+
+// Frees the workspace memory if it grew too much so big compares do not keep it for the thread life time
+template <typename Elem, typename UserDataT>
+void DiffCalc<Elem, UserDataT>::_release_workspace()
+{
+	if (_ws.v.size() > _max_kept_workspace)
+		_ws.v.release();
+
+	if (_ws.stored_diff.capacity() > _max_kept_workspace)
+		std::vector<diff_info<UserDataT>>().swap(_ws.stored_diff);
+}
+
+
+template <typename Elem, typename UserDataT>
+std::pair<std::vector<diff_info<UserDataT>>, bool> DiffCalc<Elem, UserDataT>::operator()(bool doDiffsCombine,
+		bool doBoundaryShift, diff_algorithm algorithm)
+{
+	const bool swapped = _compare(doDiffsCombine, doBoundaryShift, algorithm);
+
+	return std::make_pair(std::move(_diff), swapped);
+}
+
+
+template <typename Elem, typename UserDataT>
+bool DiffCalc<Elem, UserDataT>::operator()(std::vector<diff_info<UserDataT>>& diffs, bool doDiffsCombine,
+		bool doBoundaryShift, diff_algorithm algorithm)
+{
+	// Reuse diffs memory
+	_diff.swap(diffs);
+	_diff.clear();
+
+	const bool swapped = _compare(doDiffsCombine, doBoundaryShift, algorithm);
+
+	_diff.swap(diffs);
 
-	return std::make_pair(_diff, swapped);
+	return swapped;
 }
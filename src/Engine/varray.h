@@ -27,6 +27,24 @@ public:
 		return _buf;
 	}
 
+	// Makes elements up to size accessible without reallocation
+	inline void reserve(unsigned int size)
+	{
+		if (_buf.size() < size)
+			_buf.resize(size, { 0 });
+	}
+
+	inline unsigned int size() const
+	{
+		return static_cast<unsigned int>(_buf.size());
+	}
+
+	// Frees the allocated memory
+	inline void release()
+	{
+		std::vector<Elem>().swap(_buf);
+	}
+
 private:
 	std::vector<Elem> _buf;
 };
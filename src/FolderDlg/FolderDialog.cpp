@@ -0,0 +1,359 @@
+/*
+ * This file is part of ComparePlus plugin for Notepad++
+ * Copyright (C)2017-2019 Pavel Nedev (pg.nedev@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#define NOMINMAX
+
+#include "Compare.h"
+#include "FolderDialog.h"
+#include "resource.h"
+
+#include <windowsx.h>
+#include <commctrl.h>
+#include <tchar.h>
+
+
+const UINT_PTR	FolderDialog::cPollTimerId		= 1;
+const UINT		FolderDialog::cPollPeriod_ms	= 100;
+
+
+namespace
+{
+
+enum ListColumn_t
+{
+	COLUMN_FILE = 0,
+	COLUMN_RESULT
+};
+
+
+void getResultText(const FolderCompareEntry& entry, TCHAR* text, int textSize)
+{
+	switch (entry.state)
+	{
+		case FileCompareState::IDENTICAL:
+			_tcscpy_s(text, textSize, TEXT("Identical"));
+		break;
+
+		case FileCompareState::MATCH:
+			_tcscpy_s(text, textSize, TEXT("Match"));
+		break;
+
+		case FileCompareState::DIFFERENT:
+			_sntprintf_s(text, textSize, _TRUNCATE, TEXT("%d added, %d removed, %d changed, %d moved"),
+					entry.added, entry.removed, entry.changed, entry.moved);
+		break;
+
+		case FileCompareState::DIFFERENT_BINARY:
+			_tcscpy_s(text, textSize, TEXT("Different (not text)"));
+		break;
+
+		case FileCompareState::ONLY_IN_OLD:
+			_tcscpy_s(text, textSize, TEXT("Only in old folder"));
+		break;
+
+		case FileCompareState::ONLY_IN_NEW:
+			_tcscpy_s(text, textSize, TEXT("Only in new folder"));
+		break;
+
+		case FileCompareState::FAILED:
+			_tcscpy_s(text, textSize, TEXT("Cannot be read"));
+		break;
+
+		default:
+			_tcscpy_s(text, textSize, TEXT("Not compared"));
+	}
+}
+
+}
+
+
+FolderDialog::FolderDialog() : DockingDlgInterface(IDD_FOLDER_DIALOG), m_hList(NULL)
+{
+	_data.hIconTab = NULL;
+
+	m_info[0] = 0;
+}
+
+
+FolderDialog::~FolderDialog()
+{
+	destroy();
+
+	if (_data.hIconTab)
+		::DestroyIcon(_data.hIconTab);
+}
+
+
+void FolderDialog::init(HINSTANCE hInst)
+{
+	m_hInst = hInst;
+
+	DockingDlgInterface::init(hInst, nppData._nppHandle);
+}
+
+
+void FolderDialog::destroy()
+{
+	if (isCreated())
+		::KillTimer(_hSelf, cPollTimerId);
+
+	m_compare = nullptr;
+}
+
+
+void FolderDialog::doDialog()
+{
+	if (!isCreated())
+	{
+		create(&_data);
+
+		// define the default docking behaviour
+		_data.uMask			= DWS_DF_CONT_BOTTOM | DWS_ICONTAB | DWS_ADDINFO;
+		_data.pszName       = TEXT("ComparePlus Folders");
+		_data.pszModuleName	= getPluginFileName();
+		_data.pszAddInfo	= m_info;
+		_data.dlgID			= CMD_COMPARE_FOLDERS;
+		_data.hIconTab		= (HICON)::LoadImage(GetModuleHandle(TEXT("ComparePlus.dll")),
+				MAKEINTRESOURCE(IDB_ICON), IMAGE_ICON, 0, 0, LR_DEFAULTSIZE);
+
+		::SendMessage(_hParent, NPPM_DMMREGASDCKDLG, 0, (LPARAM)&_data);
+	}
+}
+
+
+void FolderDialog::Compare(const CompareOptions& options, const TCHAR* oldFolder, const TCHAR* newFolder)
+{
+	doDialog();
+
+	::KillTimer(_hSelf, cPollTimerId);
+
+	// Stop the previous compare before the new one is started
+	m_compare = nullptr;
+
+	ListView_DeleteAllItems(m_hList);
+
+	m_compare = std::make_unique<FolderCompare>(options, oldFolder, newFolder);
+
+	setInfo(TEXT("Listing files..."));
+
+	display(true);
+
+	::SetTimer(_hSelf, cPollTimerId, cPollPeriod_ms, NULL);
+}
+
+
+void FolderDialog::Hide()
+{
+	if (isCreated())
+		::KillTimer(_hSelf, cPollTimerId);
+
+	// Results are not needed anymore
+	m_compare = nullptr;
+
+	display(false);
+}
+
+
+void FolderDialog::resizeList()
+{
+	RECT r;
+	::GetClientRect(_hSelf, &r);
+
+	::MoveWindow(m_hList, 0, 0, r.right, r.bottom, TRUE);
+
+	const int width = r.right - ::GetSystemMetrics(SM_CXVSCROLL);
+
+	ListView_SetColumnWidth(m_hList, COLUMN_FILE, width * 3 / 5);
+	ListView_SetColumnWidth(m_hList, COLUMN_RESULT, width - width * 3 / 5);
+}
+
+
+void FolderDialog::setInfo(const TCHAR* info)
+{
+	_tcscpy_s(m_info, _countof(m_info), info);
+
+	updateDockingDlg();
+}
+
+
+void FolderDialog::onPoll()
+{
+	if (!m_compare)
+	{
+		::KillTimer(_hSelf, cPollTimerId);
+		return;
+	}
+
+	if (!m_compare->isDone())
+	{
+		const int filesCount = m_compare->filesCount();
+
+		if (filesCount)
+		{
+			TCHAR info[128];
+
+			_sntprintf_s(info, _countof(info), _TRUNCATE, TEXT("Comparing files %d of %d..."),
+					m_compare->filesDone(), filesCount);
+
+			setInfo(info);
+		}
+
+		return;
+	}
+
+	::KillTimer(_hSelf, cPollTimerId);
+
+	fillList();
+}
+
+
+void FolderDialog::fillList()
+{
+	std::vector<FolderCompareEntry>& entries = m_compare->entries();
+
+	const int entriesCount = static_cast<int>(entries.size());
+
+	int diffsCount = 0;
+
+	::SendMessage(m_hList, WM_SETREDRAW, FALSE, 0);
+
+	ListView_DeleteAllItems(m_hList);
+
+	// Items are in the entries order so the item index is the entry index
+	for (int i = 0; i < entriesCount; ++i)
+	{
+		const FolderCompareEntry& entry = entries[i];
+
+		if (entry.state != FileCompareState::IDENTICAL && entry.state != FileCompareState::MATCH)
+			++diffsCount;
+
+		LVITEM item = { 0 };
+
+		item.mask		= LVIF_TEXT;
+		item.iItem		= i;
+		item.pszText	= const_cast<TCHAR*>(entry.relPath.c_str());
+
+		ListView_InsertItem(m_hList, &item);
+
+		TCHAR result[128];
+
+		getResultText(entry, result, _countof(result));
+
+		ListView_SetItemText(m_hList, i, COLUMN_RESULT, result);
+	}
+
+	::SendMessage(m_hList, WM_SETREDRAW, TRUE, 0);
+	::InvalidateRect(m_hList, NULL, TRUE);
+
+	TCHAR info[128];
+
+	if (m_compare->isFailed())
+		_tcscpy_s(info, _countof(info), TEXT("Compare failed - the list is incomplete"));
+	else if (m_compare->isCancelled())
+		_tcscpy_s(info, _countof(info), TEXT("Compare cancelled"));
+	else
+		_sntprintf_s(info, _countof(info), _TRUNCATE, TEXT("%d of %d files differ"), diffsCount, entriesCount);
+
+	setInfo(info);
+}
+
+
+void FolderDialog::openEntry(int item)
+{
+	if (!m_compare || !m_compare->isDone())
+		return;
+
+	std::vector<FolderCompareEntry>& entries = m_compare->entries();
+
+	if (item < 0 || item >= static_cast<int>(entries.size()))
+		return;
+
+	FolderCompareEntry& entry = entries[item];
+
+	const std::basic_string<TCHAR> oldFile = m_compare->oldFolder() + entry.relPath;
+	const std::basic_string<TCHAR> newFile = m_compare->newFolder() + entry.relPath;
+
+	if (entry.state == FileCompareState::ONLY_IN_OLD)
+		::SendMessage(nppData._nppHandle, NPPM_DOOPEN, 0, (LPARAM)oldFile.c_str());
+	else if (entry.state == FileCompareState::ONLY_IN_NEW)
+		::SendMessage(nppData._nppHandle, NPPM_DOOPEN, 0, (LPARAM)newFile.c_str());
+	else
+		CompareFiles(oldFile.c_str(), newFile.c_str(), &entry.cmpCache);
+}
+
+
+INT_PTR CALLBACK FolderDialog::run_dlgProc(UINT Message, WPARAM wParam, LPARAM lParam)
+{
+	switch (Message)
+	{
+		case WM_INITDIALOG:
+		{
+			m_hList = ::CreateWindowEx(0, WC_LISTVIEW, NULL,
+					WS_CHILD | WS_VISIBLE | LVS_REPORT | LVS_SINGLESEL | LVS_SHOWSELALWAYS | LVS_NOSORTHEADER,
+					0, 0, 0, 0, _hSelf, NULL, m_hInst, NULL);
+
+			ListView_SetExtendedListViewStyle(m_hList, LVS_EX_FULLROWSELECT | LVS_EX_DOUBLEBUFFER);
+
+			LVCOLUMN column = { 0 };
+
+			column.mask		= LVCF_TEXT | LVCF_WIDTH;
+			column.cx		= 100;
+
+			column.pszText	= const_cast<TCHAR*>(TEXT("File"));
+			ListView_InsertColumn(m_hList, COLUMN_FILE, &column);
+
+			column.pszText	= const_cast<TCHAR*>(TEXT("Result"));
+			ListView_InsertColumn(m_hList, COLUMN_RESULT, &column);
+		}
+		break;
+
+		case WM_SIZE:
+			resizeList();
+		break;
+
+		case WM_TIMER:
+			if (wParam == cPollTimerId)
+				onPoll();
+		break;
+
+		case WM_NOTIFY:
+		{
+			LPNMHDR	pnmh = (LPNMHDR)lParam;
+
+			if (pnmh->hwndFrom == _hParent && LOWORD(pnmh->code) == DMN_CLOSE)
+			{
+				Hide();
+			}
+			else if (pnmh->hwndFrom == m_hList && pnmh->code == LVN_ITEMACTIVATE)
+			{
+				openEntry(((LPNMITEMACTIVATE)lParam)->iItem);
+			}
+			else
+			{
+				return DockingDlgInterface::run_dlgProc(Message, wParam, lParam);
+			}
+		}
+		break;
+
+		default:
+			return DockingDlgInterface::run_dlgProc(Message, wParam, lParam);
+	}
+
+	return FALSE;
+}
@@ -0,0 +1,78 @@
+/*
+ * This file is part of ComparePlus plugin for Notepad++
+ * Copyright (C)2017-2019 Pavel Nedev (pg.nedev@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#pragma once
+
+#include "Compare.h"
+#include "Window.h"
+#include "DockingDlgInterface.h"
+#include "FolderCompare.h"
+
+#include <memory>
+
+
+/**
+ *  \class
+ *  \brief  Docked panel listing the files of two compared folders and their compare results. Activating an entry
+ *          opens its files and marks the precomputed diffs
+ */
+class FolderDialog : public DockingDlgInterface
+{
+public:
+	FolderDialog();
+	~FolderDialog();
+
+	FolderDialog(const FolderDialog&) = delete;
+	FolderDialog& operator=(const FolderDialog&) = delete;
+
+	void init(HINSTANCE hInst);
+
+	// Stops the running folders compare - must be called before the engine thread pool is released
+	void destroy();
+
+	// Starts comparing the folders in the background and shows the panel filled when the compare is done
+	void Compare(const CompareOptions& options, const TCHAR* oldFolder, const TCHAR* newFolder);
+
+	void Hide();
+
+protected:
+	virtual INT_PTR CALLBACK run_dlgProc(UINT message, WPARAM wParam, LPARAM lParam);
+
+private:
+	static const UINT_PTR	cPollTimerId;
+	static const UINT		cPollPeriod_ms;
+
+	void doDialog();
+
+	void resizeList();
+	void setInfo(const TCHAR* info);
+
+	void onPoll();
+	void fillList();
+	void openEntry(int item);
+
+	tTbData		_data;
+
+	HINSTANCE	m_hInst;
+	HWND		m_hList;
+
+	TCHAR		m_info[128];
+
+	std::unique_ptr<FolderCompare>	m_compare;
+};
@@ -62,6 +62,9 @@ std::unique_ptr<LibGit>& LibGit::load()
 	Inst->repository_index = (PGITREPOSITORYINDEX)::GetProcAddress(libGit2, "git_repository_index");
 	if (!Inst->repository_index)
 		Inst->_isInit = false;
+	Inst->index_read = (PGITINDEXREAD)::GetProcAddress(libGit2, "git_index_read");
+	if (!Inst->index_read)
+		Inst->_isInit = false;
 	Inst->index_get_bypath = (PGITINDEXGETBYPATH)::GetProcAddress(libGit2, "git_index_get_bypath");
 	if (!Inst->index_get_bypath)
 		Inst->_isInit = false;
@@ -82,6 +82,7 @@ private:
 			unsigned int flags, const char *ceiling_dirs);
 	typedef const char* (*PGITREPOSITORYWORKDIR) (git_repository *repo);
 	typedef int (*PGITREPOSITORYINDEX) (git_index **out, git_repository *repo);
+	typedef int (*PGITINDEXREAD) (git_index *index, int force);
 	typedef const git_index_entry* (*PGITINDEXGETBYPATH) (git_index *index, const char *path, int stage);
 	typedef int (*PGITBLOBLOOKUP) (git_blob **blob, git_repository *repo, const git_oid *id);
 	typedef int (*PGITBLOBFILTERCONTENT) (git_buf *out, git_blob *blob, const char *as_path, int check_for_bin_data);
@@ -108,6 +109,7 @@ public:
 	PGITREPOSITORYOPENEXT	repository_open_ext;
 	PGITREPOSITORYWORKDIR	repository_workdir;
 	PGITREPOSITORYINDEX		repository_index;
+	PGITINDEXREAD			index_read;
 	PGITINDEXGETBYPATH		index_get_bypath;
 	PGITBLOBLOOKUP			blob_lookup;
 	PGITBLOBFILTERCONTENT	blob_filtered_content;
@@ -20,6 +20,20 @@
 #include <stdlib.h>
 #include <shlwapi.h>
 #include <cstring>
+#include <utility>
+#include <algorithm>
+#include <string>
+#include <map>
+
+#ifdef MULTITHREAD
+
+#if defined(__MINGW32__) && !defined(_GLIBCXX_HAS_GTHREADS)
+#include "mingw-std-threads/mingw.mutex.h"
+#else
+#include <mutex>
+#endif // __MINGW32__ ...
+
+#endif // MULTITHREAD
 
 #include "Compare.h"
 #include "LibHelpers.h"
@@ -125,10 +139,170 @@ bool LocateDirUp(const TCHAR* dirName, const TCHAR* currentDir, TCHAR* fullDirPa
 	return false;
 }
 
-} // anonymous namespace
+
+/**
+ *  \struct
+ *  \brief  Opened Git repository and its index kept for the next diffs of files in the same working copy
+ */
+struct GitRepo
+{
+	git_repository*	repo;
+	git_index*		index;
+};
+
+
+/**
+ *  \struct
+ *  \brief  Opened SVN working copy database and its prepared checksum query
+ */
+struct SvnWorkingCopy
+{
+	sqlite3*		db;
+	sqlite3_stmt*	checksumQuery;
+};
+
+
+// Working copies are keyed by their root folder. The roots of the files folders are cached too so the repository
+// discovery is done once per folder
+std::map<std::string, GitRepo>								gitRepos;
+std::map<std::basic_string<TCHAR>, std::string>				gitRoots;
+
+std::map<std::basic_string<TCHAR>, SvnWorkingCopy>			svnWorkingCopies;
+std::map<std::basic_string<TCHAR>, std::basic_string<TCHAR>>	svnRoots;
+
+
+#ifdef MULTITHREAD
+std::mutex	vcsMtx;
+#endif
+
+
+/**
+ *  \struct
+ *  \brief  Held while the kept repositories and databases are used - the diffs and the background prefetch take turns.
+ *          Message boxes are not shown while it is held so nothing run by their message loop waits for it
+ */
+struct VcsLock
+{
+#ifdef MULTITHREAD
+	VcsLock() : lock(vcsMtx) {}
+
+	std::lock_guard<std::mutex>	lock;
+#else
+	VcsLock() {}
+#endif
+};
+
+
+void freeGitRepo(LibGit& gitLib, GitRepo& gitRepo)
+{
+	gitLib.index_free(gitRepo.index);
+	gitLib.repository_free(gitRepo.repo);
+}
 
 
-bool GetSvnFile(const TCHAR* fullFilePath, TCHAR* svnFile, unsigned svnFileSize)
+void freeSvnWorkingCopy(SvnWorkingCopy& svnWc)
+{
+	if (svnWc.checksumQuery)
+		sqlite3_finalize(svnWc.checksumQuery);
+
+	if (svnWc.db)
+		sqlite3_close(svnWc.db);
+}
+
+
+// Returns the cached repository of the folder or opens and caches it on first use. The index is re-read only if it
+// has changed on disk since the last diff
+std::map<std::string, GitRepo>::iterator getGitRepo(LibGit& gitLib, const TCHAR* dir)
+{
+	auto rootItr = gitRoots.find(dir);
+
+	if (rootItr != gitRoots.end())
+	{
+		auto repoItr = gitRepos.find(rootItr->second);
+
+		if (repoItr != gitRepos.end())
+		{
+			if (!gitLib.index_read(repoItr->second.index, 0))
+				return repoItr;
+
+			// The repository is gone or broken - forget it and look for the folder repository again
+			freeGitRepo(gitLib, repoItr->second);
+			gitRepos.erase(repoItr);
+		}
+
+		gitRoots.erase(rootItr);
+	}
+
+	char ansiPath[MAX_PATH];
+
+	TCharToChar(dir, ansiPath, sizeof(ansiPath));
+
+	git_repository* repo = NULL;
+
+	if (gitLib.repository_open_ext(&repo, ansiPath, 0, NULL))
+		return gitRepos.end();
+
+	const char* ansiGitDir = gitLib.repository_workdir(repo);
+
+	// Bare repositories have no working copy files to diff
+	if (!ansiGitDir)
+	{
+		gitLib.repository_free(repo);
+		return gitRepos.end();
+	}
+
+	auto repoItr = gitRepos.find(ansiGitDir);
+
+	// Folder in an already opened working copy
+	if (repoItr != gitRepos.end())
+	{
+		gitLib.repository_free(repo);
+
+		if (gitLib.index_read(repoItr->second.index, 0))
+			return gitRepos.end();
+	}
+	else
+	{
+		git_index* index;
+
+		if (gitLib.repository_index(&index, repo))
+		{
+			gitLib.repository_free(repo);
+			return gitRepos.end();
+		}
+
+		repoItr = gitRepos.emplace(ansiGitDir, GitRepo { repo, index }).first;
+	}
+
+	gitRoots.emplace(dir, repoItr->first);
+
+	return repoItr;
+}
+
+
+// Returns the cached SVN 1.7+ working copy database or opens and caches it on first use
+SvnWorkingCopy* getSvnWorkingCopy(const TCHAR* svnTop, const TCHAR* wcDb)
+{
+	auto wcItr = svnWorkingCopies.find(svnTop);
+
+	if (wcItr != svnWorkingCopies.end())
+		return &wcItr->second;
+
+	SvnWorkingCopy svnWc { NULL, NULL };
+
+	if ((sqlite3_open16(wcDb, &svnWc.db) != SQLITE_OK) ||
+		(sqlite3_prepare16_v2(svnWc.db, TEXT("SELECT checksum FROM nodes_current WHERE local_relpath=?1;"), -1,
+			&svnWc.checksumQuery, NULL) != SQLITE_OK))
+	{
+		freeSvnWorkingCopy(svnWc);
+		return NULL;
+	}
+
+	return &svnWorkingCopies.emplace(svnTop, svnWc).first->second;
+}
+
+
+bool findSvnFile(const TCHAR* fullFilePath, TCHAR* svnFile, unsigned svnFileSize, const TCHAR*& error)
 {
 	TCHAR svnTop[MAX_PATH];
 	TCHAR svnBase[MAX_PATH];
@@ -136,7 +310,22 @@ bool GetSvnFile(const TCHAR* fullFilePath, TCHAR* svnFile, unsigned svnFileSize)
 	_tcscpy_s(svnBase, _countof(svnBase), fullFilePath);
 	::PathRemoveFileSpec(svnBase);
 
-	bool ret = LocateDirUp(TEXT(".svn"), svnBase, svnTop, _countof(svnTop));
+	const std::basic_string<TCHAR> fileDir(svnBase);
+
+	bool ret = false;
+
+	auto rootItr = svnRoots.find(fileDir);
+
+	if (rootItr != svnRoots.end())
+	{
+		_tcscpy_s(svnTop, _countof(svnTop), rootItr->second.c_str());
+		ret = true;
+	}
+	else if (LocateDirUp(TEXT(".svn"), svnBase, svnTop, _countof(svnTop)))
+	{
+		svnRoots.emplace(fileDir, svnTop);
+		ret = true;
+	}
 
 	if (ret)
 	{
@@ -152,30 +341,25 @@ bool GetSvnFile(const TCHAR* fullFilePath, TCHAR* svnFile, unsigned svnFileSize)
 		{
 			if (!InitSQLite())
 			{
-				::MessageBox(nppData._nppHandle, TEXT("Failed to initialize SQLite - operation aborted."),
-						PLUGIN_NAME, MB_OK);
+				error = TEXT("Failed to initialize SQLite - operation aborted.");
 				return false;
 			}
 
-			sqlite3* ppDb;
+			SvnWorkingCopy* svnWc = getSvnWorkingCopy(svnTop, svnBase);
 
-			if (sqlite3_open16(svnBase, &ppDb) == SQLITE_OK)
+			if (svnWc)
 			{
-				RelativePath(fullFilePath, svnTop, svnBase, _countof(svnBase));
-
-				TCHAR sqlQuery[MAX_PATH + 64];
-				_sntprintf_s(sqlQuery, _countof(sqlQuery), _TRUNCATE,
-						TEXT("SELECT checksum FROM nodes_current WHERE local_relpath='%s';"), svnBase);
+				sqlite3_stmt* pStmt = svnWc->checksumQuery;
 
-				sqlite3_stmt* pStmt;
+				RelativePath(fullFilePath, svnTop, svnBase, _countof(svnBase));
 
-				if (sqlite3_prepare16_v2(ppDb, sqlQuery, -1, &pStmt, NULL) == SQLITE_OK)
+				if (sqlite3_bind_text16(pStmt, 1, svnBase, -1, SQLITE_TRANSIENT) == SQLITE_OK)
 				{
 					if (sqlite3_step(pStmt) == SQLITE_ROW)
 					{
 						const TCHAR* checksum = (const TCHAR*)sqlite3_column_text16(pStmt, 0);
 
-						if (checksum[0] != 0)
+						if (checksum && checksum[0] != 0)
 						{
 							TCHAR idx[128];
 
@@ -196,11 +380,10 @@ bool GetSvnFile(const TCHAR* fullFilePath, TCHAR* svnFile, unsigned svnFileSize)
 							}
 						}
 					}
-
-					sqlite3_finalize(pStmt);
 				}
 
-				sqlite3_close(ppDb);
+				// Resetting the query releases the database read lock so SVN can update it
+				sqlite3_reset(pStmt);
 			}
 		}
 		else
@@ -222,81 +405,247 @@ bool GetSvnFile(const TCHAR* fullFilePath, TCHAR* svnFile, unsigned svnFileSize)
 	}
 
 	if (!ret)
-		::MessageBox(nppData._nppHandle, TEXT("No SVN data found."), PLUGIN_NAME, MB_OK);
+	{
+		// The working copy might have been moved or removed - look for it again next time
+		auto rootItr = svnRoots.find(fileDir);
+
+		if (rootItr != svnRoots.end())
+		{
+			auto wcItr = svnWorkingCopies.find(rootItr->second);
+
+			if (wcItr != svnWorkingCopies.end())
+			{
+				freeSvnWorkingCopy(wcItr->second);
+				svnWorkingCopies.erase(wcItr);
+			}
+
+			svnRoots.erase(rootItr);
+		}
+
+		error = TEXT("No SVN data found.");
+	}
 
 	return ret;
 }
 
 
-std::vector<char> GetGitFileContent(const TCHAR* fullFilePath)
+// Returns the file entry in the Git index, NULL if the file is not in a Git working copy. The repository path of the
+// file is set to gitFilePath
+const git_index_entry* findGitIndexEntry(LibGit& gitLib, const TCHAR* fullFilePath, git_repository*& repo,
+		char* gitFilePath, unsigned gitFilePathSize)
 {
-	std::vector<char> gitFileContent;
+	TCHAR fileDir[MAX_PATH];
 
-	std::unique_ptr<LibGit>& gitLib = LibGit::load();
-	if (!gitLib)
+	_tcscpy_s(fileDir, _countof(fileDir), fullFilePath);
+	::PathRemoveFileSpec(fileDir);
+
+	auto repoItr = getGitRepo(gitLib, fileDir);
+
+	if (repoItr == gitRepos.end())
+		return NULL;
+
+	repo = repoItr->second.repo;
+
+	char ansiPath[MAX_PATH];
+
+	TCharToChar(fullFilePath, ansiPath, sizeof(ansiPath));
+	RelativePath(ansiPath, repoItr->first.c_str(), gitFilePath, gitFilePathSize);
+
+	return gitLib.index_get_bypath(repoItr->second.index, gitFilePath, 0);
+}
+
+
+// The filtered content has the working copy line endings. The buffer ownership is taken over. If no filter applies
+// LibGit2 points the buffer to the blob data (asize is 0) - it is copied to blobCopy then as the blob is freed here
+bool readGitBlob(LibGit& gitLib, git_repository* repo, const git_oid& id, const char* gitFilePath, git_buf& gitBuf,
+		std::vector<char>& blobCopy)
+{
+	git_blob* blob;
+
+	if (gitLib.blob_lookup(&blob, repo, &id))
+		return false;
+
+	const bool ok = !gitLib.blob_filtered_content(&gitBuf, blob, gitFilePath, 1);
+
+	if (ok && gitBuf.asize == 0)
 	{
-		::MessageBox(nppData._nppHandle, TEXT("Failed to initialize LibGit2 - operation aborted."),
-				PLUGIN_NAME, MB_OK);
-		return gitFileContent;
+		if (gitBuf.ptr && gitBuf.size)
+			blobCopy.assign(gitBuf.ptr, gitBuf.ptr + gitBuf.size);
+
+		gitBuf.ptr = NULL;
 	}
 
-	git_repository* repo = NULL;
+	gitLib.blob_free(blob);
 
-	char ansiGitFilePath[MAX_PATH];
+	return ok;
+}
+
+} // anonymous namespace
+
+
+void ClearVcsCache()
+{
+	VcsLock lock;
 
+	if (!gitRepos.empty())
 	{
-		char ansiPath[MAX_PATH];
+		std::unique_ptr<LibGit>& gitLib = LibGit::load();
 
-		TCharToChar(fullFilePath, ansiPath, sizeof(ansiPath));
-		::PathRemoveFileSpecA(ansiPath);
+		for (auto& gitRepo : gitRepos)
+			freeGitRepo(*gitLib, gitRepo.second);
 
-		if (!gitLib->repository_open_ext(&repo, ansiPath, 0, NULL))
-		{
-			const char* ansiGitDir = gitLib->repository_workdir(repo);
+		gitRepos.clear();
+	}
 
-			//reinit with fullFilePath after modification by PathRemoveFileSpecA(), needed to get the relative path
-			TCharToChar(fullFilePath, ansiPath, sizeof(ansiPath));
+	gitRoots.clear();
 
-			RelativePath(ansiPath, ansiGitDir, ansiGitFilePath, sizeof(ansiGitFilePath));
-		}
+	for (auto& svnWc : svnWorkingCopies)
+		freeSvnWorkingCopy(svnWc.second);
+
+	svnWorkingCopies.clear();
+	svnRoots.clear();
+}
+
+
+bool GetSvnFile(const TCHAR* fullFilePath, TCHAR* svnFile, unsigned svnFileSize, bool showErrors)
+{
+	const TCHAR* error = NULL;
+
+	bool ret;
+
+	{
+		VcsLock lock;
+
+		ret = findSvnFile(fullFilePath, svnFile, svnFileSize, error);
 	}
 
-	if (repo)
+	if (!ret && error && showErrors)
+		::MessageBox(nppData._nppHandle, error, PLUGIN_NAME, MB_OK);
+
+	return ret;
+}
+
+
+GitFileContent::GitFileContent(GitFileContent&& other) : _ptr(other._ptr), _asize(other._asize), _size(other._size),
+		_blobCopy(std::move(other._blobCopy))
+{
+	std::memcpy(_id, other._id, sizeof(_id));
+
+	other._ptr		= NULL;
+	other._asize	= 0;
+	other._size		= 0;
+}
+
+
+GitFileContent::~GitFileContent()
+{
+	release();
+}
+
+
+GitFileContent& GitFileContent::operator=(GitFileContent&& other)
+{
+	if (this != &other)
 	{
-		git_index* index;
+		release();
+
+		std::swap(_ptr, other._ptr);
+		std::swap(_asize, other._asize);
+		std::swap(_size, other._size);
+		std::swap_ranges(_id, _id + sizeof(_id), other._id);
+
+		_blobCopy.swap(other._blobCopy);
+	}
+
+	return *this;
+}
+
+
+void GitFileContent::release()
+{
+	if (_ptr)
+	{
+		git_buf gitBuf = { _ptr, _asize, _size };
+
+		// LibGit2 is loaded when the content is created and is never unloaded
+		if (_asize)
+			LibGit::load()->buf_free(&gitBuf);
 
-		if (!gitLib->repository_index(&index, repo))
+		_ptr	= NULL;
+		_asize	= 0;
+		_size	= 0;
+
+		std::vector<char>().swap(_blobCopy);
+	}
+}
+
+
+GitFileContent GetGitFileContent(const TCHAR* fullFilePath, bool showErrors)
+{
+	GitFileContent gitFileContent;
+
+	const TCHAR* error = NULL;
+
+	{
+		VcsLock lock;
+
+		std::unique_ptr<LibGit>& gitLib = LibGit::load();
+
+		if (gitLib)
 		{
-			const git_index_entry* e = gitLib->index_get_bypath(index, ansiGitFilePath, 0);
+			git_repository* repo;
+			char ansiGitFilePath[MAX_PATH];
 
-			if (e)
-			{
-				git_blob* blob;
+			const git_index_entry* e =
+					findGitIndexEntry(*gitLib, fullFilePath, repo, ansiGitFilePath, sizeof(ansiGitFilePath));
 
-				if (!gitLib->blob_lookup(&blob, repo, &e->id))
-				{
-					git_buf gitBuf = { 0 };
+			git_buf gitBuf = { 0 };
 
-					if (!gitLib->blob_filtered_content(&gitBuf, blob, ansiGitFilePath, 1))
-					{
-						gitFileContent.resize(gitBuf.size + 1, 0);
-						std::memcpy(gitFileContent.data(), gitBuf.ptr, gitBuf.size);
+			if (e && readGitBlob(*gitLib, repo, e->id, ansiGitFilePath, gitBuf, gitFileContent._blobCopy))
+			{
+				static char emptyContent[1] = { 0 };
 
-						gitLib->buf_free(&gitBuf);
-					}
+				gitFileContent._ptr		= gitBuf.ptr ? gitBuf.ptr :
+						!gitFileContent._blobCopy.empty() ? gitFileContent._blobCopy.data() : emptyContent;
+				gitFileContent._asize	= gitBuf.asize;
+				gitFileContent._size	= gitBuf.size;
 
-					gitLib->blob_free(blob);
-				}
+				std::memcpy(gitFileContent._id, e->id.id, sizeof(gitFileContent._id));
+			}
+			else
+			{
+				error = TEXT("No Git data found.");
 			}
-
-			gitLib->index_free(index);
 		}
-
-		gitLib->repository_free(repo);
+		else
+		{
+			error = TEXT("Failed to initialize LibGit2 - operation aborted.");
+		}
 	}
 
-	if (gitFileContent.empty())
-		::MessageBox(nppData._nppHandle, TEXT("No Git data found."), PLUGIN_NAME, MB_OK);
+	if (error && showErrors)
+		::MessageBox(nppData._nppHandle, error, PLUGIN_NAME, MB_OK);
 
 	return gitFileContent;
 }
+
+
+bool IsGitFileContentCurrent(const TCHAR* fullFilePath, const GitFileContent& content)
+{
+	if (!content.isValid())
+		return false;
+
+	VcsLock lock;
+
+	std::unique_ptr<LibGit>& gitLib = LibGit::load();
+	if (!gitLib)
+		return false;
+
+	git_repository* repo;
+	char ansiGitFilePath[MAX_PATH];
+
+	const git_index_entry* e =
+			findGitIndexEntry(*gitLib, fullFilePath, repo, ansiGitFilePath, sizeof(ansiGitFilePath));
+
+	return (e && !std::memcmp(e->id.id, content._id, sizeof(content._id)));
+}
@@ -19,9 +19,69 @@
 
 #pragma once
 
+#include <cstdint>
+#include <vector>
 #include <windows.h>
 #include <tchar.h>
-#include <vector>
 
-bool GetSvnFile(const TCHAR* fullFilePath, TCHAR* svnFile, unsigned svnFileSize);
-std::vector<char> GetGitFileContent(const TCHAR* fullFilePath);
+/**
+ *  \class
+ *  \brief  File content from the Git index. The filtered buffer is allocated by LibGit2 and is used without copying.
+ *          Unfiltered content is the blob data itself so it is copied before the blob is freed
+ */
+class GitFileContent
+{
+public:
+	GitFileContent() {}
+	GitFileContent(GitFileContent&& other);
+	~GitFileContent();
+
+	GitFileContent& operator=(GitFileContent&& other);
+
+	// Empty files are valid, they have zero size
+	inline bool isValid() const
+	{
+		return (_ptr != NULL);
+	}
+
+	inline const char* data() const
+	{
+		return _ptr;
+	}
+
+	inline intptr_t size() const
+	{
+		return static_cast<intptr_t>(_size);
+	}
+
+	void release();
+
+private:
+	friend GitFileContent GetGitFileContent(const TCHAR* fullFilePath, bool showErrors);
+	friend bool IsGitFileContentCurrent(const TCHAR* fullFilePath, const GitFileContent& content);
+
+	GitFileContent(const GitFileContent&) = delete;
+	GitFileContent& operator=(const GitFileContent&) = delete;
+
+	char*			_ptr {NULL};
+	size_t			_asize {0};
+	size_t			_size {0};
+
+	// Holds the content if it is not allocated by LibGit2 (_asize is 0)
+	std::vector<char>	_blobCopy;
+
+	// The index blob id the content is read from
+	unsigned char	_id[20];
+};
+
+
+// Closes the Git repositories and SVN databases kept open between diffs
+void ClearVcsCache();
+
+// The VCS functions can be called from any thread - they take turns on the repositories and databases kept open.
+// Errors are shown in message boxes only if showErrors is set so the background callers should clear it
+bool GetSvnFile(const TCHAR* fullFilePath, TCHAR* svnFile, unsigned svnFileSize, bool showErrors = true);
+GitFileContent GetGitFileContent(const TCHAR* fullFilePath, bool showErrors = true);
+
+// Checks if the content read by GetGitFileContent() is still the one in the Git index of the file
+bool IsGitFileContentCurrent(const TCHAR* fullFilePath, const GitFileContent& content);
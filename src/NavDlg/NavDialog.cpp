@@ -35,32 +35,55 @@
 
 const int NavDialog::cSpace = 2;
 const int NavDialog::cScrollerWidth = 15;
+const size_t NavDialog::cMaxKeptStates = 32;
 
 
-void NavDialog::NavView::init(HDC hDC)
+namespace
 {
-	// Create bitmaps used to store graphical representation
+
+constexpr int cDiffMarkersMask = MARKER_MASK_CHANGED | MARKER_MASK_ADDED | MARKER_MASK_REMOVED | MARKER_MASK_MOVED;
+
+}
+
+
+void NavDialog::NavView::init(HDC hDC, std::vector<DiffLevel_t>* keptLevels)
+{
+	// Create bitmaps used to store graphical representation - the view bitmap is created on render
 	m_hViewDC	= ::CreateCompatibleDC(hDC);
 	m_hSelDC	= ::CreateCompatibleDC(hDC);
 
+	m_hSelBMP	= ::CreateCompatibleBitmap(hDC, 1, 1);
+
+	// Attach bitmap to the DC
+	::SelectObject(m_hSelDC, m_hSelBMP);
+
+	m_doc	= getDocId(m_view);
 	m_lines	= CallScintilla(m_view, SCI_GETLINECOUNT, 0, 0);
 
-	m_hViewBMP	= ::CreateCompatibleBitmap(hDC, 1, m_lines);
-	m_hSelBMP	= ::CreateCompatibleBitmap(hDC, 1, 1);
+	if (keptLevels)
+	{
+		m_diffLevels.swap(*keptLevels);
+		return;
+	}
 
-	BITMAP bmpInfo;
-	::GetObject(m_hViewBMP, sizeof(bmpInfo), &bmpInfo);
-	::GetObject(m_hSelBMP, sizeof(bmpInfo), &bmpInfo);
+	m_diffLevels.assign(1, DiffLevel_t(m_lines, DIFF_NONE));
 
-	// Attach bitmaps to the DC
-	::SelectObject(m_hViewDC, m_hViewBMP);
-	::SelectObject(m_hSelDC, m_hSelBMP);
+	readMarkers(0, m_lines - 1);
+	buildLevels(0);
 }
 
 
 void NavDialog::NavView::reset()
 {
-	m_lineMap.clear();
+	m_diffLevels.clear();
+
+	m_doc			= 0;
+	m_lines			= 0;
+	m_bmpLines		= 0;
+	m_bmpHeight		= 0;
+	m_reduction		= 1;
+	m_dirtyFirst	= -1;
+	m_dirtyLast		= -1;
 
 	if (m_hViewDC)
 	{
@@ -88,6 +111,195 @@ void NavDialog::NavView::reset()
 }
 
 
+// Only the diff markers lines are visited - the rest of the lines range is just cleared
+void NavDialog::NavView::readMarkers(int firstLine, int lastLine)
+{
+	DiffLevel_t& lines = m_diffLevels[0];
+
+	std::fill(lines.begin() + firstLine, lines.begin() + lastLine + 1, DIFF_NONE);
+
+	for (int line = CallScintilla(m_view, SCI_MARKERNEXT, firstLine, cDiffMarkersMask); line >= 0 && line <= lastLine;
+			line = CallScintilla(m_view, SCI_MARKERNEXT, line + 1, cDiffMarkersMask))
+	{
+		const int marker = CallScintilla(m_view, SCI_MARKERGET, line, 0);
+
+		if (marker & MARKER_MASK_CHANGED)		lines[line] = DIFF_CHANGED;
+		else if (marker & MARKER_MASK_ADDED)	lines[line] = DIFF_ADDED;
+		else if (marker & MARKER_MASK_REMOVED)	lines[line] = DIFF_REMOVED;
+		else if (marker & MARKER_MASK_MOVED)	lines[line] = DIFF_MOVED;
+	}
+}
+
+
+// Rebuilds the pyramid levels above level 0 from the entries covering firstLine onwards
+void NavDialog::NavView::buildLevels(int firstLine)
+{
+	size_t level = 1;
+
+	for (int first = firstLine >> 1; m_diffLevels[level - 1].size() > 1; ++level, first >>= 1)
+	{
+		if (m_diffLevels.size() == level)
+			m_diffLevels.emplace_back();
+
+		const DiffLevel_t& lower = m_diffLevels[level - 1];
+		DiffLevel_t& upper = m_diffLevels[level];
+
+		const int lowerSize = static_cast<int>(lower.size());
+
+		upper.resize((lowerSize + 1) / 2);
+
+		for (int i = first; i < static_cast<int>(upper.size()); ++i)
+		{
+			const int j = 2 * i;
+
+			upper[i] = (j + 1 < lowerSize) ? std::max(lower[j], lower[j + 1]) : lower[j];
+		}
+	}
+
+	m_diffLevels.resize(level);
+}
+
+
+// Returns the highest diff in the [firstLine, endLine) range climbing up the pyramid levels
+int NavDialog::NavView::maxDiff(int firstLine, int endLine) const
+{
+	int diff = DIFF_NONE;
+
+	for (size_t level = 0; (firstLine < endLine) && (diff != DIFF_CHANGED); ++level)
+	{
+		const DiffLevel_t& lines = m_diffLevels[level];
+
+		if (firstLine & 1)
+			diff = std::max<int>(diff, lines[firstLine++]);
+
+		if (endLine & 1)
+			diff = std::max<int>(diff, lines[--endLine]);
+
+		firstLine	>>= 1;
+		endLine		>>= 1;
+	}
+
+	return diff;
+}
+
+
+void NavDialog::NavView::drawRows(int firstRow, const ColorSettings& clr)
+{
+	RECT bmpRect = { 0 };
+
+	bmpRect.top		= firstRow;
+	bmpRect.right	= 1;
+	bmpRect.bottom	= m_bmpHeight;
+
+	HBRUSH hBrush = ::CreateSolidBrush(clr._default);
+
+	::FillRect(m_hViewDC, &bmpRect, hBrush);
+
+	::DeleteObject(hBrush);
+
+	for (int row = firstRow; row < m_bmpLines; ++row)
+	{
+		const int diff = maxDiff(row * m_reduction, std::min((row + 1) * m_reduction, m_lines));
+
+		if (diff == DIFF_NONE)
+			continue;
+
+		int color;
+
+		if (diff == DIFF_CHANGED)		color = clr.changed;
+		else if (diff == DIFF_ADDED)	color = clr.added;
+		else if (diff == DIFF_REMOVED)	color = clr.removed;
+		else							color = clr.moved;
+
+		::SetPixel(m_hViewDC, 0, row, color);
+	}
+}
+
+
+// Redraws only the rows from the first changed line onwards if the bitmap and reduction ratio are unchanged
+void NavDialog::NavView::render(HDC hDC, int bmpHeight, int reduction, const ColorSettings& clr)
+{
+	if (!m_hViewDC)
+		return;
+
+	int firstRow = 0;
+
+	if (!m_hViewBMP || m_bmpHeight != bmpHeight)
+	{
+		HBITMAP hViewBMP = ::CreateCompatibleBitmap(hDC, 1, bmpHeight);
+
+		::SelectObject(m_hViewDC, hViewBMP);
+
+		if (m_hViewBMP)
+			::DeleteObject(m_hViewBMP);
+
+		m_hViewBMP	= hViewBMP;
+		m_bmpHeight	= bmpHeight;
+	}
+	else if (m_reduction == reduction)
+	{
+		if (m_dirtyFirst < 0)
+			return;
+
+		firstRow = docToBmpLine(m_dirtyFirst);
+	}
+
+	if (m_dirtyFirst >= 0)
+	{
+		readMarkers(m_dirtyFirst, m_dirtyLast);
+		buildLevels(m_dirtyFirst);
+
+		m_dirtyFirst	= -1;
+		m_dirtyLast		= -1;
+	}
+
+	m_reduction	= reduction;
+	m_bmpLines	= (m_lines + reduction - 1) / reduction;
+
+	drawRows(firstRow, clr);
+}
+
+
+void NavDialog::NavView::linesChanged(int line, int linesAdded)
+{
+	if (m_diffLevels.empty())
+		return;
+
+	DiffLevel_t& lines = m_diffLevels[0];
+
+	// Lines change we can't follow - the line counts mismatch makes Update() recreate the whole bitmap
+	if (line < 0 || line >= m_lines || line - linesAdded >= m_lines)
+	{
+		m_lines = -1;
+		return;
+	}
+
+	if (linesAdded > 0)
+		lines.insert(lines.begin() + line + 1, linesAdded, DIFF_NONE);
+	else
+		lines.erase(lines.begin() + line + 1, lines.begin() + line + 1 - linesAdded);
+
+	m_lines = static_cast<int>(lines.size());
+
+	// The changed line gets its markers re-read together with the ones inserted after it
+	const int lastChanged = line + std::max(linesAdded, 0);
+
+	if (m_dirtyFirst < 0)
+	{
+		m_dirtyFirst	= line;
+		m_dirtyLast		= lastChanged;
+	}
+	else
+	{
+		if (m_dirtyLast > line)
+			m_dirtyLast = std::max(line, m_dirtyLast + linesAdded);
+
+		m_dirtyFirst	= std::min(m_dirtyFirst, line);
+		m_dirtyLast		= std::min(std::max(m_dirtyLast, lastChanged), m_lines - 1);
+	}
+}
+
+
 void NavDialog::NavView::paint(HDC hDC, int xPos, int yPos, int width, int height, int hScale, int hOffset)
 {
 	const int usefulHeight = (maxBmpLines() - hOffset) * hScale;
@@ -164,23 +376,6 @@ void NavDialog::NavView::paint(HDC hDC, int xPos, int yPos, int width, int heigh
 }
 
 
-int NavDialog::NavView::docToBmpLine(int docLine) const
-{
-	if (m_lineMap.empty())
-		return docLine;
-
-	const int max = static_cast<int>(m_lineMap.size());
-
-	for (int i = 0; i < max; ++i)
-	{
-		if (docLine <= m_lineMap[i])
-			return i + 1;
-	}
-
-	return max;
-}
-
-
 NavDialog::NavDialog() : DockingDlgInterface(IDD_NAV_DIALOG),
 	m_hScroll(NULL), m_mouseOver(false)
 {
@@ -235,12 +430,20 @@ void NavDialog::Update()
 	if (!isVisible())
 		return;
 
+	if (areShownDocsChanged())
+	{
+		Restore();
+	}
 	// Bitmap needs to be recreated
-	if ((m_view[0].m_lines != CallScintilla(m_view[0].m_view, SCI_GETLINECOUNT, 0, 0)) ||
+	else if ((m_view[0].m_lines != CallScintilla(m_view[0].m_view, SCI_GETLINECOUNT, 0, 0)) ||
 		(m_view[1].m_lines != CallScintilla(m_view[1].m_view, SCI_GETLINECOUNT, 0, 0)))
 	{
 		Show();
 	}
+	else if ((m_view[0].m_dirtyFirst >= 0) || (m_view[1].m_dirtyFirst >= 0))
+	{
+		createBitmap();
+	}
 	else
 	{
 		m_view[0].updateFirstVisible();
@@ -253,12 +456,33 @@ void NavDialog::Update()
 }
 
 
+void NavDialog::LinesChanged(int view, int line, int linesAdded)
+{
+	if (!isVisible())
+		return;
+
+	if (m_view[0].m_view == view)
+		m_view[0].linesChanged(line, linesAdded);
+	else
+		m_view[1].linesChanged(line, linesAdded);
+}
+
+
 void NavDialog::Show()
 {
 	HWND hwnd = ::GetFocus();
 
 	doDialog();
 
+	// The state of the shown documents is rebuilt - the kept one might be stale
+	if (areShownDocsChanged())
+		keepState();
+
+	auto state = findKeptState(getDocId(m_view[0].m_view), getDocId(m_view[1].m_view));
+
+	if (state != m_keptStates.end())
+		m_keptStates.erase(state);
+
 	// Free resources if needed
 	m_view[0].reset();
 	m_view[1].reset();
@@ -279,12 +503,53 @@ void NavDialog::Show()
 }
 
 
+void NavDialog::Restore()
+{
+	if (areShownDocsChanged())
+		keepState();
+
+	auto state = findKeptState(getDocId(m_view[0].m_view), getDocId(m_view[1].m_view));
+
+	if ((state == m_keptStates.end()) ||
+		(state->lines[0] != CallScintilla(m_view[0].m_view, SCI_GETLINECOUNT, 0, 0)) ||
+		(state->lines[1] != CallScintilla(m_view[1].m_view, SCI_GETLINECOUNT, 0, 0)))
+	{
+		Show();
+		return;
+	}
+
+	HWND hwnd = ::GetFocus();
+
+	doDialog();
+
+	m_view[0].reset();
+	m_view[1].reset();
+
+	HDC hDC = ::GetDC(_hSelf);
+
+	m_view[0].init(hDC, &state->diffLevels[0]);
+	m_view[1].init(hDC, &state->diffLevels[1]);
+
+	::ReleaseDC(_hSelf, hDC);
+
+	m_keptStates.erase(state);
+
+	createBitmap();
+
+	display(true);
+
+	::SetFocus(hwnd);
+}
+
+
 void NavDialog::Hide()
 {
 	HWND hwnd = ::GetFocus();
 
 	display(false);
 
+	keepState();
+
 	m_view[0].reset();
 	m_view[1].reset();
 
@@ -292,6 +557,49 @@ void NavDialog::Hide()
 }
 
 
+bool NavDialog::areShownDocsChanged() const
+{
+	return ((m_view[0].m_doc != getDocId(m_view[0].m_view)) || (m_view[1].m_doc != getDocId(m_view[1].m_view)));
+}
+
+
+// The state is not kept if it has lines changes not read yet - the views might show other documents already
+void NavDialog::keepState()
+{
+	for (const NavView& view: m_view)
+	{
+		if (!view.m_doc || view.m_lines < 0 || view.m_dirtyFirst >= 0 || view.m_diffLevels.empty())
+			return;
+	}
+
+	auto state = findKeptState(m_view[0].m_doc, m_view[1].m_doc);
+
+	if (state != m_keptStates.end())
+		m_keptStates.erase(state);
+	else if (m_keptStates.size() == cMaxKeptStates)
+		m_keptStates.erase(m_keptStates.begin());
+
+	m_keptStates.emplace_back();
+
+	KeptState& kept = m_keptStates.back();
+
+	for (int i = 0; i < 2; ++i)
+	{
+		kept.docs[i]	= m_view[i].m_doc;
+		kept.lines[i]	= m_view[i].m_lines;
+
+		kept.diffLevels[i].swap(m_view[i].m_diffLevels);
+	}
+}
+
+
+std::vector<NavDialog::KeptState>::iterator NavDialog::findKeptState(int doc0, int doc1)
+{
+	return std::find_if(m_keptStates.begin(), m_keptStates.end(),
+			[doc0, doc1](const KeptState& state) { return (state.docs[0] == doc0 && state.docs[1] == doc1); });
+}
+
+
 void NavDialog::createBitmap()
 {
 	RECT r;
@@ -300,10 +608,11 @@ void NavDialog::createBitmap()
 	const int maxLines	= std::max(m_view[0].m_lines, m_view[1].m_lines);
 	const int maxHeight	= (r.bottom - r.top) - 2 * cSpace - 2;
 
-	int reductionRatio = maxLines / maxHeight;
+	if (maxHeight <= 0)
+		return;
 
-	if (reductionRatio && (maxLines % maxHeight))
-		++reductionRatio;
+	// Each bitmap line covers reductionRatio document lines so the bitmaps always fit in the dialog height
+	const int reductionRatio = std::max((maxLines + maxHeight - 1) / maxHeight, 1);
 
 	{
 		RECT bmpRect = { 0 };
@@ -317,98 +626,14 @@ void NavDialog::createBitmap()
 		::FillRect(m_view[1].m_hSelDC, &bmpRect, hBrush);
 
 		::DeleteObject(hBrush);
+	}
 
-		hBrush = ::CreateSolidBrush(m_clr._default);
-
-		bmpRect.bottom = m_view[0].m_lines;
-		::FillRect(m_view[0].m_hViewDC, &bmpRect, hBrush);
-
-		bmpRect.bottom = m_view[1].m_lines;
-		::FillRect(m_view[1].m_hViewDC, &bmpRect, hBrush);
-
-		::DeleteObject(hBrush);
-
-		m_view[0].m_lineMap.clear();
-		m_view[1].m_lineMap.clear();
-
-		int skipLine = reductionRatio;
-		int prevMarker = m_clr._default;
-		int bmpLine = 0;
-
-		for (int i = 0; i < m_view[0].m_lines; ++i)
-		{
-			int marker = CallScintilla(m_view[0].m_view, SCI_MARKERGET, i, 0);
-			if (!marker && !reductionRatio)
-				continue;
-
-			if (marker & MARKER_MASK_CHANGED)		marker = m_clr.changed;
-			else if (marker & MARKER_MASK_ADDED)	marker = m_clr.added;
-			else if (marker & MARKER_MASK_REMOVED)	marker = m_clr.removed;
-			else if (marker & MARKER_MASK_MOVED)	marker = m_clr.moved;
-			else if (reductionRatio)				marker = m_clr._default;
-			else
-				continue;
-
-			if (reductionRatio)
-			{
-				if (prevMarker == marker)
-					--skipLine;
-
-				if (prevMarker != marker || !skipLine)
-				{
-					skipLine = reductionRatio;
-					prevMarker = marker;
-
-					m_view[0].m_lineMap.push_back(i);
-
-					::SetPixel(m_view[0].m_hViewDC, 0, bmpLine++, marker);
-				}
-			}
-			else
-			{
-				::SetPixel(m_view[0].m_hViewDC, 0, i, marker);
-			}
-		}
-
-		skipLine = reductionRatio;
-		prevMarker = m_clr._default;
-		bmpLine = 0;
-
-		for (int i = 0; i < m_view[1].m_lines; ++i)
-		{
-			int marker = CallScintilla(m_view[1].m_view, SCI_MARKERGET, i, 0);
-			if (!marker && !reductionRatio)
-				continue;
-
-			if (marker & MARKER_MASK_CHANGED)		marker = m_clr.changed;
-			else if (marker & MARKER_MASK_ADDED)	marker = m_clr.added;
-			else if (marker & MARKER_MASK_REMOVED)	marker = m_clr.removed;
-			else if (marker & MARKER_MASK_MOVED)	marker = m_clr.moved;
-			else if (reductionRatio)				marker = m_clr._default;
-			else
-				continue;
-
-			if (reductionRatio)
-			{
-				if (prevMarker == marker)
-					--skipLine;
-
-				if (prevMarker != marker || !skipLine)
-				{
-					skipLine = reductionRatio;
-					prevMarker = marker;
+	HDC hDC = ::GetDC(_hSelf);
 
-					m_view[1].m_lineMap.push_back(i);
+	m_view[0].render(hDC, maxHeight, reductionRatio, m_clr);
+	m_view[1].render(hDC, maxHeight, reductionRatio, m_clr);
 
-					::SetPixel(m_view[1].m_hViewDC, 0, bmpLine++, marker);
-				}
-			}
-			else
-			{
-				::SetPixel(m_view[1].m_hViewDC, 0, i, marker);
-			}
-		}
-	}
+	::ReleaseDC(_hSelf, hDC);
 
 	setScalingFactor();
 }
@@ -451,15 +676,16 @@ void NavDialog::setScalingFactor()
 	if (r.bottom - r.top == 0)
 		return;
 
-	m_view[0].m_lines = CallScintilla(m_view[0].m_view, SCI_GETLINECOUNT, 0, 0);
-	m_view[1].m_lines = CallScintilla(m_view[1].m_view, SCI_GETLINECOUNT, 0, 0);
-
 	m_view[0].updateFirstVisible();
 	m_view[1].updateFirstVisible();
 
 	m_maxBmpLines = std::max(m_view[0].maxBmpLines(), m_view[1].maxBmpLines());
 	m_syncView = (m_maxBmpLines == m_view[0].maxBmpLines()) ? &m_view[0] : &m_view[1];
 
+	// Bitmaps are not rendered yet
+	if (m_maxBmpLines == 0)
+		return;
+
 	m_navViewWidth = ((r.right - r.left) - 3 * cSpace - 4) / 2;
 	m_navHeight = (r.bottom - r.top) - 2 * cSpace - 2;
 
@@ -714,7 +940,7 @@ INT_PTR CALLBACK NavDialog::run_dlgProc(UINT Message, WPARAM wParam, LPARAM lPar
 		case WM_SIZE:
 		case WM_MOVE:
 			if (isVisible())
-				setScalingFactor();
+				createBitmap();
 		break;
 
 		case WM_NOTIFY:
@@ -23,6 +23,7 @@
 #include "Window.h"
 #include "DockingDlgInterface.h"
 
+#include <cstdint>
 #include <vector>
 
 
@@ -56,6 +57,13 @@ public:
 
 	void Update();
 
+	// Shows the navigation state kept for the shown documents if their lines counts are unchanged since it was
+	// kept - the markers are not read then. Same as Show() otherwise
+	void Restore();
+
+	// Shifts the view diffs by the lines change made at line - changed lines are re-read on the next Update()
+	void LinesChanged(int view, int line, int linesAdded);
+
 protected:
 	virtual INT_PTR CALLBACK run_dlgProc(UINT message, WPARAM wParam, LPARAM lParam);
 
@@ -63,23 +71,45 @@ private:
 	static const int cSpace;
 	static const int cScrollerWidth;
 
+	// Navigation states kept for the documents pairs shown before
+	static const size_t cMaxKeptStates;
+
+	// Line diffs in increasing priority - a bitmap pixel covering several lines shows the highest one
+	enum LineDiff_t : uint8_t
+	{
+		DIFF_NONE = 0,
+		DIFF_MOVED,
+		DIFF_REMOVED,
+		DIFF_ADDED,
+		DIFF_CHANGED
+	};
+
+	using DiffLevel_t = std::vector<uint8_t>;
+
 	/**
 	 *  \struct
-	 *  \brief
+	 *  \brief  Navigation view of a document. The line diffs are kept in a pyramid - level 0 holds the diff of each
+	 *          document line and each next level holds the highest diff of two adjacent entries of the level below.
+	 *          The bitmap pixels cover reduction ratio lines each and are rendered with range queries on the pyramid
 	 */
 	struct NavView
 	{
-		NavView() : m_view(0), m_hViewDC(NULL), m_hSelDC(NULL), m_hViewBMP(NULL), m_hSelBMP(NULL) {}
+		NavView() : m_view(0), m_doc(0), m_hViewDC(NULL), m_hSelDC(NULL), m_hViewBMP(NULL), m_hSelBMP(NULL),
+				m_lines(0), m_bmpLines(0), m_bmpHeight(0), m_reduction(1), m_dirtyFirst(-1), m_dirtyLast(-1) {}
 
 		~NavView()
 		{
 			reset();
 		}
 
-		void init(HDC hDC);
+		// The diff levels are taken from keptLevels if given - the document markers are read otherwise
+		void init(HDC hDC, std::vector<DiffLevel_t>* keptLevels = nullptr);
 		void reset();
+		void render(HDC hDC, int bmpHeight, int reduction, const ColorSettings& clr);
 		void paint(HDC hDC, int xPos, int yPos, int width, int height, int hScale, int hOffset);
 
+		void linesChanged(int line, int linesAdded);
+
 		void updateFirstVisible()
 		{
 			m_firstVisible = CallScintilla(m_view, SCI_GETFIRSTVISIBLELINE, 0, 0);
@@ -87,25 +117,34 @@ private:
 
 		int maxBmpLines() const
 		{
-			return (m_lineMap.empty() ? m_lines : static_cast<int>(m_lineMap.size()));
+			return m_bmpLines;
 		}
 
 		int bmpToDocLine(int bmpLine) const
 		{
-			if (bmpLine < 0)
+			if (bmpLine <= 0)
 				return 0;
-			else if (m_lineMap.empty())
-				return bmpLine;
-			else if (bmpLine < static_cast<int>(m_lineMap.size()))
-				return m_lineMap[bmpLine];
+			else if (bmpLine >= m_bmpLines)
+				bmpLine = m_bmpLines - 1;
+
+			return bmpLine * m_reduction;
+		}
 
-			return m_lineMap.back();
+		int docToBmpLine(int docLine) const
+		{
+			return docLine / m_reduction;
 		}
 
-		int docToBmpLine(int docLine) const;
+		void readMarkers(int firstLine, int lastLine);
+		void buildLevels(int firstLine);
+		int maxDiff(int firstLine, int endLine) const;
+		void drawRows(int firstRow, const ColorSettings& clr);
 
 		int		m_view;
 
+		// The Scintilla document the diff levels are of
+		int		m_doc;
+
 		HDC		m_hViewDC;
 		HDC		m_hSelDC;
 
@@ -115,11 +154,35 @@ private:
 		int		m_firstVisible;
 		int		m_lines;
 
-		std::vector<int>	m_lineMap;
+		int		m_bmpLines;
+		int		m_bmpHeight;
+		int		m_reduction;
+
+		// Lines range changed since the last render that needs its markers re-read
+		int		m_dirtyFirst;
+		int		m_dirtyLast;
+
+		std::vector<DiffLevel_t>	m_diffLevels;
+	};
+
+	/**
+	 *  \struct
+	 *  \brief  Diff levels of a documents pair kept while other documents are shown
+	 */
+	struct KeptState
+	{
+		int							docs[2];
+		int							lines[2];
+		std::vector<DiffLevel_t>	diffLevels[2];
 	};
 
 	void doDialog();
 
+	bool areShownDocsChanged() const;
+
+	void keepState();
+	std::vector<KeptState>::iterator findKeptState(int doc0, int doc1);
+
 	void createBitmap();
 	void showScroller(RECT& r);
 
@@ -149,4 +212,7 @@ private:
 
 	NavView		m_view[2];
 	NavView*	m_syncView;
+
+	// Oldest first
+	std::vector<KeptState>	m_keptStates;
 };
@@ -196,11 +196,25 @@ namespace // anonymous namespace
 const int cBlinkCount		= 3;
 const int cBlinkInterval_ms	= 100;
 
+// All compare markers except the arrow symbol
+const int cClearMarkersMask	= MARKER_MASK_ALL | MARKER_MASK_BLANK;
+
 bool compareMode[2]		= { false, false };
 int blankStyle[2]		= { 0, 0 };
 bool endAtLastLine[2]	= { true, true };
 
 
+// Deletes the given markers of the line one by one - Scintilla has no markers set delete
+void deleteMarks(int view, int line, int marker)
+{
+	for (int markerId = 0; marker; ++markerId, marker >>= 1)
+	{
+		if (marker & 1)
+			CallScintilla(view, SCI_MARKERDELETE, line, markerId);
+	}
+}
+
+
 void defineColor(int type, int color)
 {
 	CallScintilla(MAIN_VIEW,	SCI_MARKERDEFINE,	type, SC_MARK_BACKGROUND);
@@ -280,8 +294,8 @@ std::pair<int, int> getSelectionLines(int view)
 	if (isSelectionVertical(view))
 		return std::make_pair(-1, -1);
 
-	const int selectionStart = CallScintilla(view, SCI_GETSELECTIONSTART, 0, 0);
-	const int selectionEnd = CallScintilla(view, SCI_GETSELECTIONEND, 0, 0);
+	const Sci_Position selectionStart = CallScintilla(view, SCI_GETSELECTIONSTART, 0, 0);
+	const Sci_Position selectionEnd = CallScintilla(view, SCI_GETSELECTIONEND, 0, 0);
 
 	if (selectionEnd - selectionStart == 0)
 		return std::make_pair(-1, -1);
@@ -338,10 +352,10 @@ void blinkLine(int view, int line)
 }
 
 
-void blinkRange(int view, int startPos, int endPos)
+void blinkRange(int view, Sci_Position startPos, Sci_Position endPos)
 {
 	ViewLocation loc(view);
-	const std::pair<int, int> sel = getSelection(view);
+	const std::pair<Sci_Position, Sci_Position> sel = getSelection(view);
 
 	for (int i = cBlinkCount; ;)
 	{
@@ -455,7 +469,7 @@ void setStyles(UserSettings& settings)
 }
 
 
-void markTextAsChanged(int view, int start, int length, int color)
+void markTextAsChanged(int view, Sci_Position start, Sci_Position length, int color)
 {
 	if (length > 0)
 	{
@@ -468,7 +482,35 @@ void markTextAsChanged(int view, int start, int length, int color)
 }
 
 
-void clearChangedIndicator(int view, int start, int length)
+void markTextAsChanged(int view, const std::vector<TextHighlight>& highlights)
+{
+	if (highlights.empty())
+		return;
+
+	const int curIndic = CallScintilla(view, SCI_GETINDICATORCURRENT, 0, 0);
+	CallScintilla(view, SCI_SETINDICATORCURRENT, INDIC_HIGHLIGHT, 0);
+
+	int color = -1;
+
+	for (const auto& highlight: highlights)
+	{
+		if (highlight.length <= 0)
+			continue;
+
+		if (highlight.color != color)
+		{
+			color = highlight.color;
+			CallScintilla(view, SCI_SETINDICATORVALUE, color | SC_INDICVALUEBIT, 0);
+		}
+
+		CallScintilla(view, SCI_INDICATORFILLRANGE, highlight.start, highlight.length);
+	}
+
+	CallScintilla(view, SCI_SETINDICATORCURRENT, curIndic, 0);
+}
+
+
+void clearChangedIndicator(int view, Sci_Position start, Sci_Position length)
 {
 	if (length > 0)
 	{
@@ -480,42 +522,32 @@ void clearChangedIndicator(int view, int start, int length)
 }
 
 
-std::vector<char> getText(int view, int startPos, int endPos)
+std::vector<char> getText(int view, Sci_Position startPos, Sci_Position endPos)
 {
-	const int len = endPos - startPos;
+	const Sci_Position len = endPos - startPos;
 
 	if (len <= 0)
 		return std::vector<char>(1, 0);
 
 	std::vector<char> text(len + 1, 0);
 
-	Sci_TextRange tr;
+	Sci_TextRangeFull tr;
 	tr.chrg.cpMin = startPos;
 	tr.chrg.cpMax = endPos;
 	tr.lpstrText = text.data();
 
-	CallScintilla(view, SCI_GETTEXTRANGE, 0, (LPARAM)&tr);
-
-	return text;
-}
-
-
-void toLowerCase(std::vector<char>& text)
-{
-	const int len = static_cast<int>(text.size());
-
-	if (len == 0)
-		return;
-
-	std::vector<wchar_t> wText(len);
-
-	::MultiByteToWideChar(CP_UTF8, 0, text.data(), -1, wText.data(), len * sizeof(wchar_t));
+	// Scintilla before 5.3 doesn't know SCI_GETTEXTRANGEFULL and returns 0 - its documents are below 2GB anyway
+	if (CallScintilla(view, SCI_GETTEXTRANGEFULL, 0, (LPARAM)&tr) == 0)
+	{
+		Sci_TextRange tr32;
+		tr32.chrg.cpMin = static_cast<long>(startPos);
+		tr32.chrg.cpMax = static_cast<long>(endPos);
+		tr32.lpstrText = text.data();
 
-	wText.push_back(L'\0');
-	::CharLowerW((LPWSTR)wText.data());
-	wText.pop_back();
+		CallScintilla(view, SCI_GETTEXTRANGE, 0, (LPARAM)&tr32);
+	}
 
-	::WideCharToMultiByte(CP_UTF8, 0, wText.data(), -1, text.data(), len * sizeof(char), NULL, NULL);
+	return text;
 }
 
 
@@ -546,23 +578,10 @@ void clearWindow(int view)
 }
 
 
+// Deletes only the markers set on the line instead of each possible marker
 void clearMarks(int view, int line)
 {
-	CallScintilla(view, SCI_MARKERDELETE, line, MARKER_CHANGED_LINE);
-	CallScintilla(view, SCI_MARKERDELETE, line, MARKER_ADDED_LINE);
-	CallScintilla(view, SCI_MARKERDELETE, line, MARKER_REMOVED_LINE);
-	CallScintilla(view, SCI_MARKERDELETE, line, MARKER_MOVED_LINE);
-	CallScintilla(view, SCI_MARKERDELETE, line, MARKER_BLANK);
-	CallScintilla(view, SCI_MARKERDELETE, line, MARKER_CHANGED_SYMBOL);
-	CallScintilla(view, SCI_MARKERDELETE, line, MARKER_CHANGED_LOCAL_SYMBOL);
-	CallScintilla(view, SCI_MARKERDELETE, line, MARKER_ADDED_SYMBOL);
-	CallScintilla(view, SCI_MARKERDELETE, line, MARKER_ADDED_LOCAL_SYMBOL);
-	CallScintilla(view, SCI_MARKERDELETE, line, MARKER_REMOVED_SYMBOL);
-	CallScintilla(view, SCI_MARKERDELETE, line, MARKER_REMOVED_LOCAL_SYMBOL);
-	CallScintilla(view, SCI_MARKERDELETE, line, MARKER_MOVED_LINE_SYMBOL);
-	CallScintilla(view, SCI_MARKERDELETE, line, MARKER_MOVED_BLOCK_BEGIN_SYMBOL);
-	CallScintilla(view, SCI_MARKERDELETE, line, MARKER_MOVED_BLOCK_MID_SYMBOL);
-	CallScintilla(view, SCI_MARKERDELETE, line, MARKER_MOVED_BLOCK_END_SYMBOL);
+	deleteMarks(view, line, CallScintilla(view, SCI_MARKERGET, line, 0) & cClearMarkersMask);
 }
 
 
@@ -573,12 +592,13 @@ void clearMarks(int view, int startLine, int length)
 	if (startLine + length < endLine)
 		endLine = startLine + length;
 
-	const int startPos = getLineStart(view, startLine);
+	const Sci_Position startPos = getLineStart(view, startLine);
 
 	clearChangedIndicator(view, startPos, getLineEnd(view, endLine - 1) - startPos);
 
-	for (; startLine < endLine; ++startLine)
-		clearMarks(view, startLine);
+	for (int line = CallScintilla(view, SCI_MARKERNEXT, startLine, cClearMarkersMask); line >= 0 && line < endLine;
+			line = CallScintilla(view, SCI_MARKERNEXT, line + 1, cClearMarkersMask))
+		clearMarks(view, line);
 }
 
 
@@ -603,7 +623,113 @@ int getNextUnmarkedLine(int view, int startLine, int markMask)
 }
 
 
-std::pair<int, int> getMarkedSection(int view, int startLine, int endLine, int markMask, bool excludeNewLine)
+void DiffLinesIndex::clear()
+{
+	_ranges.clear();
+	_isValid = true;
+}
+
+
+void DiffLinesIndex::addLine(int line)
+{
+	if (!_ranges.empty() && _ranges.back().second + 1 >= line)
+		_ranges.back().second = line;
+	else
+		_ranges.emplace_back(line, line);
+}
+
+
+void DiffLinesIndex::build(int view)
+{
+	clear();
+
+	const int linesCount = CallScintilla(view, SCI_GETLINECOUNT, 0, 0);
+
+	for (int line = CallScintilla(view, SCI_MARKERNEXT, 0, MARKER_MASK_LINE); line >= 0;
+			line = CallScintilla(view, SCI_MARKERNEXT, line, MARKER_MASK_LINE))
+	{
+		const int first = line;
+
+		for (++line; line < linesCount && ::isLineMarked(view, line, MARKER_MASK_LINE); ++line);
+
+		_ranges.emplace_back(first, line - 1);
+
+		if (line >= linesCount)
+			break;
+	}
+}
+
+
+std::vector<std::pair<int, int>>::const_iterator DiffLinesIndex::findRange(int line) const
+{
+	return std::lower_bound(_ranges.begin(), _ranges.end(), line,
+			[](const std::pair<int, int>& range, int l) { return range.second < l; });
+}
+
+
+bool DiffLinesIndex::isLineMarked(int line) const
+{
+	auto rangeItr = findRange(line);
+
+	return (rangeItr != _ranges.end() && rangeItr->first <= line);
+}
+
+
+int DiffLinesIndex::getNextMarkedLine(int line) const
+{
+	if (line < 0)
+		line = 0;
+
+	auto rangeItr = findRange(line);
+
+	if (rangeItr == _ranges.end())
+		return -1;
+
+	return (rangeItr->first <= line) ? line : rangeItr->first;
+}
+
+
+int DiffLinesIndex::getPrevMarkedLine(int line) const
+{
+	if (line < 0)
+		return -1;
+
+	auto rangeItr = findRange(line);
+
+	if (rangeItr != _ranges.end() && rangeItr->first <= line)
+		return line;
+
+	if (rangeItr == _ranges.begin())
+		return -1;
+
+	return (--rangeItr)->second;
+}
+
+
+int DiffLinesIndex::getNextUnmarkedLine(int line, int linesCount) const
+{
+	auto rangeItr = findRange(line);
+
+	if (rangeItr != _ranges.end() && rangeItr->first <= line)
+		line = rangeItr->second + 1;
+
+	return (line < linesCount) ? line : -1;
+}
+
+
+int DiffLinesIndex::getPrevUnmarkedLine(int line) const
+{
+	auto rangeItr = findRange(line);
+
+	if (rangeItr != _ranges.end() && rangeItr->first <= line)
+		line = rangeItr->first - 1;
+
+	return line;
+}
+
+
+std::pair<Sci_Position, Sci_Position> getMarkedSection(int view, int startLine, int endLine, int markMask,
+		bool excludeNewLine)
 {
 	const int lastLine = CallScintilla(view, SCI_GETLINECOUNT, 0, 0) - 1;
 
@@ -619,16 +745,16 @@ std::pair<int, int> getMarkedSection(int view, int startLine, int endLine, int m
 	if (excludeNewLine)
 		--line2;
 
-	const int endPos = (line2 < 0) ? getLineEnd(view, lastLine) :
+	const Sci_Position endPos = (line2 < 0) ? getLineEnd(view, lastLine) :
 			(excludeNewLine ? getLineEnd(view, line2) : getLineStart(view, line2));
 
 	return std::make_pair(getLineStart(view, line1), endPos);
 }
 
 
-std::vector<int> getMarkers(int view, int startLine, int length, int markMask, bool clearMarkers)
+MarkerRuns getMarkers(int view, int startLine, int length, int markMask, bool clearMarkers)
 {
-	std::vector<int> markers;
+	MarkerRuns markers;
 
 	if (length <= 0 || startLine < 0)
 		return markers;
@@ -638,43 +764,60 @@ std::vector<int> getMarkers(int view, int startLine, int length, int markMask, b
 	if (startLine + length > linesCount)
 		length = linesCount - startLine;
 
+	if (length <= 0)
+		return markers;
+
 	if (clearMarkers)
 	{
-		const int startPos = getLineStart(view, startLine);
+		const Sci_Position startPos = getLineStart(view, startLine);
 		clearChangedIndicator(view, startPos, getLineEnd(view, startLine + length - 1) - startPos);
 	}
 
-	markers.resize(length, 0);
+	markers._linesCount = length;
+
+	// The runs are collected from the range end backwards as the marked lines are walked
+	std::vector<MarkerRuns::Run>& runs = markers._runs;
 
 	for (int line = CallScintilla(view, SCI_MARKERPREVIOUS, startLine + length - 1, markMask); line >= startLine;
 		line = CallScintilla(view, SCI_MARKERPREVIOUS, line - 1, markMask))
 	{
-		markers[line - startLine] = CallScintilla(view, SCI_MARKERGET, line, 0) & markMask;
+		const int lineMarkers = CallScintilla(view, SCI_MARKERGET, line, 0);
 
 		if (clearMarkers)
-			clearMarks(view, line);
+			deleteMarks(view, line, lineMarkers & cClearMarkersMask);
+
+		const int relLine = line - startLine;
+
+		if (!runs.empty() && runs.back().line == relLine + 1 && runs.back().markers == (lineMarkers & markMask))
+		{
+			runs.back().line = relLine;
+			++runs.back().length;
+		}
+		else
+		{
+			runs.push_back(MarkerRuns::Run{relLine, 1, lineMarkers & markMask});
+		}
 	}
 
+	std::reverse(runs.begin(), runs.end());
+
 	return markers;
 }
 
 
-void setMarkers(int view, int startLine, const std::vector<int> &markers)
+void setMarkers(int view, int startLine, const MarkerRuns& markers)
 {
-	const int linesCount = static_cast<int>(markers.size());
-
-	if (startLine < 0 || linesCount == 0)
+	if (startLine < 0 || markers.empty())
 		return;
 
-	const int startPos = getLineStart(view, startLine);
-	clearChangedIndicator(view, startPos, getLineEnd(view, startLine + linesCount - 1) - startPos);
+	clearMarks(view, startLine, markers.size());
 
-	for (int i = 0; i < linesCount; ++i)
+	for (const MarkerRuns::Run& run: markers._runs)
 	{
-		clearMarks(view, startLine + i);
+		const int endLine = startLine + run.line + run.length;
 
-		if (markers[i])
-			CallScintilla(view, SCI_MARKERADDSET, startLine + i, markers[i]);
+		for (int line = startLine + run.line; line < endLine; ++line)
+			CallScintilla(view, SCI_MARKERADDSET, line, run.markers);
 	}
 }
 
@@ -709,25 +852,28 @@ void hideOutsideRange(int view, int startLine, int endLine)
 }
 
 
-void hideUnmarked(int view, int markMask)
+// Each unmarked lines run between the diffs ranges is hidden with a single call
+void hideUnmarked(int view, const DiffLinesIndex& diffLines)
 {
 	const int linesCount = CallScintilla(view, SCI_GETLINECOUNT, 0, 0);
 
 	// First line (0) cannot be hidden so start from line 1
-	for (int nextMarkedLine, nextUnmarkedLine = 1; nextUnmarkedLine < linesCount; nextUnmarkedLine = nextMarkedLine)
-	{
-		for (; (nextUnmarkedLine < linesCount) && isLineMarked(view, nextUnmarkedLine, markMask); ++nextUnmarkedLine);
+	int nextUnmarkedLine = 1;
 
-		if (nextUnmarkedLine == linesCount)
+	for (const auto& range : diffLines.getRanges())
+	{
+		if (range.first >= linesCount)
 			break;
 
-		nextMarkedLine = CallScintilla(view, SCI_MARKERNEXT, nextUnmarkedLine, markMask);
-
-		if (nextMarkedLine < 0)
-			nextMarkedLine = linesCount;
+		if (range.first > nextUnmarkedLine)
+			CallScintilla(view, SCI_HIDELINES, nextUnmarkedLine, range.first - 1);
 
-		CallScintilla(view, SCI_HIDELINES, nextUnmarkedLine, nextMarkedLine - 1);
+		if (range.second + 1 > nextUnmarkedLine)
+			nextUnmarkedLine = range.second + 1;
 	}
+
+	if (nextUnmarkedLine < linesCount)
+		CallScintilla(view, SCI_HIDELINES, nextUnmarkedLine, linesCount - 1);
 }
 
 
@@ -210,6 +210,37 @@ private:
 };
 
 
+/**
+ *  \struct
+ *  \brief  Suspends view repainting and markers and indicators change notifications. The view is repainted once
+ *          on scope exit
+ */
+struct ScopedViewRedrawBlocker
+{
+	ScopedViewRedrawBlocker(int view) : _view(view),
+		_hView((view == MAIN_VIEW) ? nppData._scintillaMainHandle : nppData._scintillaSecondHandle)
+	{
+		_modEventMask = CallScintilla(_view, SCI_GETMODEVENTMASK, 0, 0);
+		CallScintilla(_view, SCI_SETMODEVENTMASK, _modEventMask & ~(SC_MOD_CHANGEMARKER | SC_MOD_CHANGEINDICATOR), 0);
+
+		::SendMessage(_hView, WM_SETREDRAW, FALSE, 0);
+	}
+
+	~ScopedViewRedrawBlocker()
+	{
+		::SendMessage(_hView, WM_SETREDRAW, TRUE, 0);
+		::InvalidateRect(_hView, NULL, TRUE);
+
+		CallScintilla(_view, SCI_SETMODEVENTMASK, _modEventMask, 0);
+	}
+
+private:
+	int		_view;
+	HWND	_hView;
+	int		_modEventMask;
+};
+
+
 /**
  *  \struct
  *  \brief
@@ -405,13 +436,13 @@ inline int getDocId(int view)
 }
 
 
-inline int getLineStart(int view, int line)
+inline Sci_Position getLineStart(int view, int line)
 {
 	return CallScintilla(view, SCI_POSITIONFROMLINE, line, 0);
 }
 
 
-inline int getLineEnd(int view, int line)
+inline Sci_Position getLineEnd(int view, int line)
 {
 	return CallScintilla(view, SCI_GETLINEENDPOSITION, line, 0);
 }
@@ -539,7 +570,7 @@ inline int isSelectionVertical(int view)
 }
 
 
-inline std::pair<int, int> getSelection(int view)
+inline std::pair<Sci_Position, Sci_Position> getSelection(int view)
 {
 	return std::make_pair(CallScintilla(view, SCI_GETSELECTIONSTART, 0, 0),
 			CallScintilla(view, SCI_GETSELECTIONEND, 0, 0));
@@ -548,12 +579,12 @@ inline std::pair<int, int> getSelection(int view)
 
 inline void clearSelection(int view)
 {
-	const int currentPos = CallScintilla(view, SCI_GETCURRENTPOS, 0, 0);
+	const Sci_Position currentPos = CallScintilla(view, SCI_GETCURRENTPOS, 0, 0);
 	CallScintilla(view, SCI_SETEMPTYSELECTION, currentPos, 0);
 }
 
 
-inline void setSelection(int view, int start, int end, bool scrollView = false)
+inline void setSelection(int view, Sci_Position start, Sci_Position end, bool scrollView = false)
 {
 	if (scrollView)
 	{
@@ -574,12 +605,21 @@ std::pair<int, int> getSelectionLines(int view);
 int showArrowSymbol(int view, int line, bool down);
 
 void blinkLine(int view, int line);
-void blinkRange(int view, int startPos, int endPos);
+void blinkRange(int view, Sci_Position startPos, Sci_Position endPos);
 
 void centerAt(int view, int line);
 
-void markTextAsChanged(int view, int start, int length, int color);
-void clearChangedIndicator(int view, int start, int length);
+struct TextHighlight
+{
+	Sci_Position	start;
+	Sci_Position	length;
+	int				color;
+};
+
+
+void markTextAsChanged(int view, Sci_Position start, Sci_Position length, int color);
+void markTextAsChanged(int view, const std::vector<TextHighlight>& highlights);
+void clearChangedIndicator(int view, Sci_Position start, Sci_Position length);
 
 void setNormalView(int view);
 void setCompareView(int view, int blankColor);
@@ -592,13 +632,109 @@ void clearMarks(int view, int startLine, int length);
 int getPrevUnmarkedLine(int view, int startLine, int markMask);
 int getNextUnmarkedLine(int view, int startLine, int markMask);
 
-std::pair<int, int> getMarkedSection(int view, int startLine, int endLine, int markMask, bool excludeNewLine = false);
-std::vector<int> getMarkers(int view, int startLine, int length, int markMask, bool clearMarkers = true);
-void setMarkers(int view, int startLine, const std::vector<int> &markers);
+
+/**
+ *  \class
+ *  \brief  Sorted ranges of the view lines marked as diffs (MARKER_MASK_LINE). The diffs navigation binary searches
+ *          them instead of querying the Scintilla markers line by line. It is filled when the compare marks are set
+ *          and is rebuilt from the view markers on first use after it has been invalidated by a change
+ */
+class DiffLinesIndex
+{
+public:
+	inline bool isValid() const
+	{
+		return _isValid;
+	}
+
+	inline void invalidate()
+	{
+		_ranges.clear();
+		_isValid = false;
+	}
+
+	void clear();
+
+	// Lines must be added in ascending order
+	void addLine(int line);
+
+	void build(int view);
+
+	bool isLineMarked(int line) const;
+
+	// Same results as SCI_MARKERNEXT and SCI_MARKERPREVIOUS - the closest marked line or -1
+	int getNextMarkedLine(int line) const;
+	int getPrevMarkedLine(int line) const;
+
+	// Same results as getNextUnmarkedLine() and getPrevUnmarkedLine()
+	int getNextUnmarkedLine(int line, int linesCount) const;
+	int getPrevUnmarkedLine(int line) const;
+
+	// First and last line of each marked lines range in ascending order
+	inline const std::vector<std::pair<int, int>>& getRanges() const
+	{
+		return _ranges;
+	}
+
+private:
+	// The range of the line or the first range after it
+	std::vector<std::pair<int, int>>::const_iterator findRange(int line) const;
+
+	// First and last line of each marked lines range
+	std::vector<std::pair<int, int>>	_ranges;
+	bool								_isValid {false};
+};
+
+
+/**
+ *  \class
+ *  \brief  Markers of a lines range kept as runs of consecutive lines with the same markers. The unmarked lines are
+ *          not stored so the snapshot of a huge range of few diff blocks is a few runs instead of an int per line
+ */
+class MarkerRuns
+{
+public:
+	inline bool empty() const
+	{
+		return (_linesCount == 0);
+	}
+
+	// The lines count of the range the markers are taken from - marked or not
+	inline int size() const
+	{
+		return _linesCount;
+	}
+
+	inline void clear()
+	{
+		_runs.clear();
+		_linesCount = 0;
+	}
+
+private:
+	friend MarkerRuns getMarkers(int view, int startLine, int length, int markMask, bool clearMarkers);
+	friend void setMarkers(int view, int startLine, const MarkerRuns& markers);
+
+	struct Run
+	{
+		int	line;		// Relative to the range start
+		int	length;
+		int	markers;
+	};
+
+	std::vector<Run>	_runs;
+	int					_linesCount {0};
+};
+
+
+std::pair<Sci_Position, Sci_Position> getMarkedSection(int view, int startLine, int endLine, int markMask,
+		bool excludeNewLine = false);
+MarkerRuns getMarkers(int view, int startLine, int length, int markMask, bool clearMarkers = true);
+void setMarkers(int view, int startLine, const MarkerRuns& markers);
 
 void showRange(int view, int line, int length);
 void hideOutsideRange(int view, int startLine, int endLine);
-void hideUnmarked(int view, int markMask);
+void hideUnmarked(int view, const DiffLinesIndex& diffLines);
 
 bool isAdjacentAnnotation(int view, int line, bool down);
 bool isVisibleAdjacentAnnotation(int view, int line, bool down);
@@ -612,7 +748,6 @@ inline void clearAnnotation(int view, int line)
 
 void clearAnnotations(int view, int startLine, int length);
 
-std::vector<char> getText(int view, int startPos, int endPos);
-void toLowerCase(std::vector<char>& text);
+std::vector<char> getText(int view, Sci_Position startPos, Sci_Position endPos);
 
 void addBlankSection(int view, int line, int length, int selectionMarkPosition = 0, const char *text = nullptr);
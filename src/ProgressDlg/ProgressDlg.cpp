@@ -86,7 +86,7 @@ void ProgressDlg::Show() const
 			::UpdateWindow(_hwnd);
 		}
 
-		::KillTimer(_hwnd, 1);
+		::KillTimer(_hwnd, cShowTimer);
 	}
 }
 
@@ -96,17 +96,17 @@ unsigned ProgressDlg::NextPhase()
 	if (IsCancelled())
 		return 0;
 
-	if (_phase + 1 < _countof(cPhases))
+	const unsigned phase = _phase;
+
+	if (phase + 1 < _countof(cPhases))
 	{
-		_phasePosOffset = cPhases[_phase++];
-		_phaseRange = cPhases[_phase] - _phasePosOffset;
-		_max = _phaseRange;
+		_max = cPhases[phase + 1] - cPhases[phase];
 		_count = 0;
-		setPos(_phasePosOffset);
+		_phase = phase + 1;
 	}
 	else
 	{
-		setPos(cPhases[_countof(cPhases) - 1]);
+		_count = _max.load();
 	}
 
 	return _phase + 1;
@@ -133,10 +133,11 @@ bool ProgressDlg::SetCount(unsigned cnt, unsigned phase)
 	if (IsCancelled())
 		return false;
 
-	if ((phase == 0 || phase - 1 == _phase) && _count < cnt && cnt <= _max)
+	if ((phase == 0 || phase - 1 == _phase) && cnt <= _max)
 	{
-		_count = cnt;
-		update();
+		unsigned count = _count;
+
+		while (count < cnt && !_count.compare_exchange_weak(count, cnt));
 	}
 
 	return true;
@@ -149,17 +150,14 @@ bool ProgressDlg::Advance(unsigned cnt, unsigned phase)
 		return false;
 
 	if (phase == 0 || phase - 1 == _phase)
-	{
-		_count += cnt;
-		update();
-	}
+		_count.fetch_add(cnt, std::memory_order_relaxed);
 
 	return true;
 }
 
 
 ProgressDlg::ProgressDlg() : _hwnd(NULL),  _hKeyHook(NULL),
-		_phase(0), _phaseRange(cPhases[0]), _phasePosOffset(0), _max(cPhases[0]), _count(0), _pos(0)
+		_phase(0), _max(cPhases[0]), _count(0), _cancelled(false), _pos(0)
 {
 	::GetModuleHandleEx(
 		GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS |
@@ -236,7 +234,8 @@ HWND ProgressDlg::create()
 
 void ProgressDlg::cancel()
 {
-	::ResetEvent(_hActiveState);
+	_cancelled = true;
+
 	::EnableWindow(_hBtn, FALSE);
 
 	SetInfo(TEXT("Cancelling compare, please wait..."));
@@ -247,7 +246,8 @@ void ProgressDlg::destroy()
 {
 	if (_hwnd)
 	{
-		::KillTimer(_hwnd, 1);
+		::KillTimer(_hwnd, cShowTimer);
+		::KillTimer(_hwnd, cUpdateTimer);
 		::PostMessage(_hwnd, WM_CLOSE, 0, 0);
 		_hwnd = NULL;
 
@@ -258,14 +258,28 @@ void ProgressDlg::destroy()
 }
 
 
+// Run on the progress window thread timer
 void ProgressDlg::update()
 {
-	const unsigned newPos = ((_count * _phaseRange) / _max) + _phasePosOffset;
+	const unsigned phase	= _phase;
+	const unsigned max		= _max;
+
+	if (max == 0)
+		return;
+
+	unsigned count = _count;
+
+	if (count > max)
+		count = max;
+
+	const unsigned posOffset = phase ? cPhases[phase - 1] : 0;
+	const unsigned newPos = posOffset +
+			static_cast<unsigned>((static_cast<unsigned long long>(count) * (cPhases[phase] - posOffset)) / max);
 
 	if (newPos > _pos)
 	{
 		_pos = newPos;
-		setPos(newPos);
+		::SendMessage(_hPBar, PBM_SETPOS, (WPARAM)newPos, 0);
 	}
 }
 
@@ -338,7 +352,8 @@ BOOL ProgressDlg::createProgressWindow()
 
 	::ShowWindow(_hwnd, SW_HIDE);
 
-	::SetTimer(_hwnd, 1, cInitialShowDelay_ms, NULL);
+	::SetTimer(_hwnd, cShowTimer, cInitialShowDelay_ms, NULL);
+	::SetTimer(_hwnd, cUpdateTimer, cUpdatePeriod_ms, NULL);
 
 	return TRUE;
 }
@@ -452,7 +467,10 @@ LRESULT APIENTRY ProgressDlg::wndProc(HWND hwnd, UINT umsg, WPARAM wparam, LPARA
 			break;
 
 		case WM_TIMER:
-			Inst->Show();
+			if (wparam == cUpdateTimer)
+				Inst->update();
+			else
+				Inst->Show();
 			return 0;
 
 		case WM_DESTROY:
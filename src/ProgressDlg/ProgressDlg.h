@@ -23,13 +23,16 @@
 #include <commctrl.h>
 
 #include <memory>
+#include <atomic>
+
+#include "CompareProgress.h"
 
 
 class ProgressDlg;
 using progress_ptr = std::unique_ptr<ProgressDlg>;
 
 
-class ProgressDlg
+class ProgressDlg : public CompareProgress
 {
 public:
 	static progress_ptr& Open(const TCHAR* info = NULL);
@@ -44,7 +47,7 @@ public:
 		Inst.reset();
 	}
 
-    ~ProgressDlg();
+    virtual ~ProgressDlg();
 
 	inline void SetInfo(const TCHAR *info) const
 	{
@@ -52,19 +55,17 @@ public:
 			::SendMessage(_hPText, WM_SETTEXT, 0, (LPARAM)info);
 	}
 
-	void Show() const;
+	void Show() const override;
 
-	inline bool IsCancelled() const
+	inline bool IsCancelled() const override
 	{
-		if (_hwnd)
-			return (::WaitForSingleObject(_hActiveState, 0) != WAIT_OBJECT_0);
-		return false;
+		return _cancelled.load(std::memory_order_relaxed);
 	}
 
-	unsigned NextPhase();
-	bool SetMaxCount(unsigned max, unsigned phase = 0);
+	unsigned NextPhase() override;
+	bool SetMaxCount(unsigned max, unsigned phase = 0) override;
 	bool SetCount(unsigned cnt, unsigned phase = 0);
-	bool Advance(unsigned cnt = 1, unsigned phase = 0);
+	bool Advance(unsigned cnt = 1, unsigned phase = 0) override;
 
 private:
     static const TCHAR cClassName[];
@@ -76,6 +77,12 @@ private:
 
 	static const int cInitialShowDelay_ms = 500;
 
+	// The progress bar samples the counters that often - the compare threads never wait on the window
+	static const int cUpdatePeriod_ms = 50;
+
+	static const UINT_PTR cShowTimer	= 1;
+	static const UINT_PTR cUpdateTimer	= 2;
+
 	static const int cPhases[];
 
 	static progress_ptr Inst;
@@ -94,12 +101,6 @@ private:
     void cancel();
     void destroy();
 
-    inline void setPos(unsigned pos) const
-	{
-		if (_hwnd)
-			::PostMessage(_hPBar, PBM_SETPOS, (WPARAM)pos, 0);
-	}
-
     void update();
 
     BOOL thread();
@@ -115,11 +116,13 @@ private:
     HWND			_hBtn;
     HHOOK			_hKeyHook;
 
-	unsigned	_phase;
-	unsigned	_phaseRange;
-	unsigned	_phasePosOffset;
-	unsigned	_max;
-	unsigned	_count;
+	// Set by the compare threads and sampled by the progress window thread
+	std::atomic<unsigned>	_phase;
+	std::atomic<unsigned>	_max;
+	std::atomic<unsigned>	_count;
+
+	std::atomic<bool>		_cancelled;
 
+	// Progress bar position - used by the progress window thread only
 	unsigned	_pos;
 };
@@ -25,7 +25,9 @@
 
 PSQLOPEN16			sqlite3_open16;
 PSQLPREPARE16V2		sqlite3_prepare16_v2;
+PSQLBINDTEXT16		sqlite3_bind_text16;
 PSQLSTEP			sqlite3_step;
+PSQLRESET			sqlite3_reset;
 PSQLCOLUMNTEXT16	sqlite3_column_text16;
 PSQLFINALZE			sqlite3_finalize;
 PSQLCLOSE			sqlite3_close;
@@ -56,9 +58,15 @@ bool InitSQLite()
 		sqlite3_prepare16_v2 = (PSQLPREPARE16V2)::GetProcAddress(ligSQLite, "sqlite3_prepare16_v2");
 		if (!sqlite3_prepare16_v2)
 			return false;
+		sqlite3_bind_text16 = (PSQLBINDTEXT16)::GetProcAddress(ligSQLite, "sqlite3_bind_text16");
+		if (!sqlite3_bind_text16)
+			return false;
 		sqlite3_step = (PSQLSTEP)::GetProcAddress(ligSQLite, "sqlite3_step");
 		if (!sqlite3_step)
 			return false;
+		sqlite3_reset = (PSQLRESET)::GetProcAddress(ligSQLite, "sqlite3_reset");
+		if (!sqlite3_reset)
+			return false;
 		sqlite3_column_text16 = (PSQLCOLUMNTEXT16)::GetProcAddress(ligSQLite, "sqlite3_column_text16");
 		if (!sqlite3_column_text16)
 			return false;
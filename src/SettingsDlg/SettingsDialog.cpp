@@ -114,6 +114,9 @@ INT_PTR CALLBACK SettingsDialog::run_dlgProc(UINT Message, WPARAM wParam, LPARAM
 					settings.WrapAround				= (bool) DEFAULT_WRAP_AROUND;
 					settings.GotoFirstDiff			= (bool) DEFAULT_GOTO_FIRST_DIFF;
 					settings.PromptToCloseOnMatch	= (bool) DEFAULT_PROMPT_CLOSE_ON_MATCH;
+					settings.VerifyMatches			= (bool) DEFAULT_VERIFY_MATCHES;
+					settings.PatienceDiff			= (bool) DEFAULT_PATIENCE_DIFF;
+					settings.PrefetchVcsBase		= (bool) DEFAULT_PREFETCH_VCS_BASE;
 
 					settings.colors.added			= DEFAULT_ADDED_COLOR;
 					settings.colors.removed			= DEFAULT_REMOVED_COLOR;
@@ -189,6 +192,12 @@ void SettingsDialog::SetParams(UserSettings* settings)
 			settings->NeverMarkIgnored ? BST_CHECKED : BST_UNCHECKED);
 	Button_SetCheck(::GetDlgItem(_hSelf, IDC_PROMPT_CLOSE_ON_MATCH),
 			settings->PromptToCloseOnMatch ? BST_CHECKED : BST_UNCHECKED);
+	Button_SetCheck(::GetDlgItem(_hSelf, IDC_VERIFY_MATCHES),
+			settings->VerifyMatches ? BST_CHECKED : BST_UNCHECKED);
+	Button_SetCheck(::GetDlgItem(_hSelf, IDC_PATIENCE_DIFF),
+			settings->PatienceDiff ? BST_CHECKED : BST_UNCHECKED);
+	Button_SetCheck(::GetDlgItem(_hSelf, IDC_PREFETCH_VCS_BASE),
+			settings->PrefetchVcsBase ? BST_CHECKED : BST_UNCHECKED);
 	Button_SetCheck(::GetDlgItem(_hSelf, IDC_WRAP_AROUND),
 			settings->WrapAround ? BST_CHECKED : BST_UNCHECKED);
 	Button_SetCheck(::GetDlgItem(_hSelf, IDC_GOTO_FIRST_DIFF),
@@ -232,6 +241,9 @@ void SettingsDialog::GetParams()
 	_Settings->AlignAllMatches		= (Button_GetCheck(::GetDlgItem(_hSelf, IDC_ALIGN_ALL_MATCHES)) == BST_CHECKED);
 	_Settings->NeverMarkIgnored		= (Button_GetCheck(::GetDlgItem(_hSelf, IDC_NEVER_MARK_IGNORED)) == BST_CHECKED);
 	_Settings->PromptToCloseOnMatch	= (Button_GetCheck(::GetDlgItem(_hSelf, IDC_PROMPT_CLOSE_ON_MATCH)) == BST_CHECKED);
+	_Settings->VerifyMatches		= (Button_GetCheck(::GetDlgItem(_hSelf, IDC_VERIFY_MATCHES)) == BST_CHECKED);
+	_Settings->PatienceDiff			= (Button_GetCheck(::GetDlgItem(_hSelf, IDC_PATIENCE_DIFF)) == BST_CHECKED);
+	_Settings->PrefetchVcsBase		= (Button_GetCheck(::GetDlgItem(_hSelf, IDC_PREFETCH_VCS_BASE)) == BST_CHECKED);
 	_Settings->WrapAround			= (Button_GetCheck(::GetDlgItem(_hSelf, IDC_WRAP_AROUND)) == BST_CHECKED);
 	_Settings->GotoFirstDiff		= (Button_GetCheck(::GetDlgItem(_hSelf, IDC_GOTO_FIRST_DIFF)) == BST_CHECKED);
 	_Settings->FollowingCaret		= (Button_GetCheck(::GetDlgItem(_hSelf, IDC_FOLLOWING_CARET)) == BST_CHECKED);
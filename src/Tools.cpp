@@ -17,6 +17,9 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+#include <cstdint>
+#include <cstring>
+
 #include "Tools.h"
 
 
@@ -71,3 +74,131 @@ VOID CALLBACK DelayedWork::timerCB(HWND, UINT, UINT_PTR idEvent, DWORD)
 	work->_timerId = 0;
 	(*work)();
 }
+
+
+MappedFile::MappedFile(const TCHAR* file) : _hMapping(NULL), _data(NULL), _size(0)
+{
+	_hFile = ::CreateFile(file, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+			OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+	if (_hFile == INVALID_HANDLE_VALUE)
+		return;
+
+	LARGE_INTEGER fileSize;
+
+	if (!::GetFileSizeEx(_hFile, &fileSize) || fileSize.QuadPart > INTPTR_MAX)
+		return;
+
+	// Empty files can't be mapped
+	if (fileSize.QuadPart == 0)
+	{
+		_data = "";
+		return;
+	}
+
+	_hMapping = ::CreateFileMapping(_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+
+	if (_hMapping == NULL)
+		return;
+
+	_data = static_cast<const char*>(::MapViewOfFile(_hMapping, FILE_MAP_READ, 0, 0, 0));
+
+	if (_data)
+		_size = static_cast<intptr_t>(fileSize.QuadPart);
+}
+
+
+MappedFile::~MappedFile()
+{
+	if (_data && _size)
+		::UnmapViewOfFile(_data);
+
+	if (_hMapping)
+		::CloseHandle(_hMapping);
+
+	if (_hFile != INVALID_HANDLE_VALUE)
+		::CloseHandle(_hFile);
+}
+
+
+OutputFile::OutputFile(const TCHAR* file) : _file(file), _failed(false)
+{
+	_hFile = ::CreateFile(file, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+}
+
+
+OutputFile::~OutputFile()
+{
+	if (_hFile == INVALID_HANDLE_VALUE)
+		return;
+
+	::CloseHandle(_hFile);
+	::DeleteFile(_file.c_str());
+}
+
+
+bool OutputFile::write(const char* data, intptr_t len)
+{
+	if (_hFile == INVALID_HANDLE_VALUE || _failed)
+		return false;
+
+	// WriteFile() takes up to 4 GB at once
+	static const intptr_t cMaxWriteLen = 1 << 30;
+
+	while (len > 0)
+	{
+		const DWORD toWrite = static_cast<DWORD>((len < cMaxWriteLen) ? len : cMaxWriteLen);
+
+		DWORD written = 0;
+
+		if (!::WriteFile(_hFile, data, toWrite, &written, NULL) || written != toWrite)
+		{
+			_failed = true;
+			return false;
+		}
+
+		data	+= written;
+		len		-= written;
+	}
+
+	return true;
+}
+
+
+bool OutputFile::close()
+{
+	if (_hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	const bool closed = (::CloseHandle(_hFile) != FALSE);
+
+	_hFile = INVALID_HANDLE_VALUE;
+
+	if (!_failed && closed)
+		return true;
+
+	::DeleteFile(_file.c_str());
+
+	return false;
+}
+
+
+const char* getLoadedText(const MappedFile& file)
+{
+	// The bytes checked for NULs to tell binary files - that's what most text tools do
+	static const int cBinaryCheckLen = 8000;
+
+	const char* text	= file.data();
+	const intptr_t len	= file.size();
+
+	if (len >= 2 && (!std::memcmp(text, "\xFF\xFE", 2) || !std::memcmp(text, "\xFE\xFF", 2)))
+		return nullptr;
+
+	if (std::memchr(text, 0, (len < cBinaryCheckLen) ? len : cBinaryCheckLen))
+		return nullptr;
+
+	if (len >= 3 && !std::memcmp(text, "\xEF\xBB\xBF", 3))
+		return text + 3;
+
+	return text;
+}
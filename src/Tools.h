@@ -19,7 +19,9 @@
 
 #pragma once
 
+#include <cstdint>
 #include <map>
+#include <string>
 #include <windows.h>
 
 
@@ -92,6 +94,80 @@ private:
 };
 
 
+/**
+ *  \class
+ *  \brief  Read-only view of a whole file mapped in memory. Files that don't fit in the address space are not opened
+ */
+class MappedFile
+{
+public:
+	explicit MappedFile(const TCHAR* file);
+	~MappedFile();
+
+	inline bool isOpen() const
+	{
+		return (_data != NULL);
+	}
+
+	inline const char* data() const
+	{
+		return _data;
+	}
+
+	inline intptr_t size() const
+	{
+		return _size;
+	}
+
+private:
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	HANDLE		_hFile;
+	HANDLE		_hMapping;
+	const char*	_data;
+	intptr_t	_size;
+};
+
+
+/**
+ *  \class
+ *  \brief  File created (or truncated) and written sequentially. It is deleted unless it is closed after all writes
+ *          succeeded so no partly written file is left
+ */
+class OutputFile
+{
+public:
+	explicit OutputFile(const TCHAR* file);
+	~OutputFile();
+
+	inline bool isOpen() const
+	{
+		return (_hFile != INVALID_HANDLE_VALUE);
+	}
+
+	// Returns false if this or any previous write failed
+	bool write(const char* data, intptr_t len);
+
+	// Returns false and deletes the file if any write failed
+	bool close();
+
+private:
+	OutputFile(const OutputFile&) = delete;
+	OutputFile& operator=(const OutputFile&) = delete;
+
+	std::basic_string<TCHAR>	_file;
+
+	HANDLE		_hFile;
+	bool		_failed;
+};
+
+
+// Returns the text start after the UTF-8 BOM that is not loaded in Scintilla or nullptr if the file content is loaded
+// converted (UTF-16/32) or it is binary - such files are not compared line by line
+const char* getLoadedText(const MappedFile& file);
+
+
 inline void flushMsgQueue()
 {
 	MSG msg;
@@ -33,6 +33,9 @@ const TCHAR UserSettings::encodingsCheckSetting[]		= TEXT("Check_Encodings");
 const TCHAR UserSettings::alignAllMatchesSetting[]		= TEXT("Align_All_Matches");
 const TCHAR UserSettings::markIgnoredLinesSetting[]		= TEXT("Never_Colorize_Ignored_Lines");
 const TCHAR UserSettings::promptCloseOnMatchSetting[]	= TEXT("Prompt_to_Close_on_Match");
+const TCHAR UserSettings::verifyMatchesSetting[]		= TEXT("Verify_Matches");
+const TCHAR UserSettings::patienceDiffSetting[]		= TEXT("Patience_Diff");
+const TCHAR UserSettings::prefetchVcsBaseSetting[]	= TEXT("Prefetch_VCS_Base");
 const TCHAR UserSettings::wrapAroundSetting[]			= TEXT("Wrap_Around");
 const TCHAR UserSettings::gotoFirstDiffSetting[]		= TEXT("Go_to_First_on_ReCompare");
 const TCHAR UserSettings::followingCaretSetting[]		= TEXT("Following_Caret");
@@ -41,6 +44,7 @@ const TCHAR UserSettings::charPrecisionSetting[]		= TEXT("Character_Level_Highli
 const TCHAR UserSettings::diffsBasedChangesSetting[]	= TEXT("Diffs_Based_Line_Changes");
 const TCHAR UserSettings::ignoreSpacesSetting[]			= TEXT("Ignore_Spaces");
 const TCHAR UserSettings::ignoreLineNumbers[]			= TEXT("Ignore_Line_Numbers");
+const TCHAR UserSettings::ignorePatternsSetting[]		= TEXT("Ignore_Patterns");
 const TCHAR UserSettings::ignoreEmptyLinesSetting[]		= TEXT("Ignore_Empty_Lines");
 const TCHAR UserSettings::ignoreCaseSetting[]			= TEXT("Ignore_Case");
 const TCHAR UserSettings::detectMovesSetting[]			= TEXT("Detect_Moves");
@@ -51,6 +55,7 @@ const TCHAR UserSettings::navBarSetting[]				= TEXT("Navigation_Bar");
 const TCHAR UserSettings::reCompareOnChangeSetting[]	= TEXT("ReCompare_on_Change");
 
 const TCHAR UserSettings::statusTypeSetting[]			= TEXT("Status_Type");
+const TCHAR UserSettings::diffCostLimitSetting[]		= TEXT("Diff_Cost_Limit");
 
 const TCHAR UserSettings::colorsSection[]				= TEXT("Color_Settings");
 
@@ -92,6 +97,12 @@ void UserSettings::load()
 			DEFAULT_GOTO_FIRST_DIFF, iniFile) != 0;
 	PromptToCloseOnMatch	= ::GetPrivateProfileInt(mainSection, promptCloseOnMatchSetting,
 			DEFAULT_PROMPT_CLOSE_ON_MATCH, iniFile) != 0;
+	VerifyMatches			= ::GetPrivateProfileInt(mainSection, verifyMatchesSetting,
+			DEFAULT_VERIFY_MATCHES, iniFile) != 0;
+	PatienceDiff			= ::GetPrivateProfileInt(mainSection, patienceDiffSetting,
+			DEFAULT_PATIENCE_DIFF, iniFile) != 0;
+	PrefetchVcsBase			= ::GetPrivateProfileInt(mainSection, prefetchVcsBaseSetting,
+			DEFAULT_PREFETCH_VCS_BASE, iniFile) != 0;
 
 	CharPrecision			= ::GetPrivateProfileInt(mainSection, charPrecisionSetting,		0, iniFile) != 0;
 	DiffsBasedLineChanges	= ::GetPrivateProfileInt(mainSection, diffsBasedChangesSetting,	0, iniFile) != 0;
@@ -105,11 +116,18 @@ void UserSettings::load()
 	RecompareOnChange		= ::GetPrivateProfileInt(mainSection, reCompareOnChangeSetting,	1, iniFile) != 0;
 	IgnoreLineNumbers		= ::GetPrivateProfileInt(mainSection, ignoreLineNumbers,		0, iniFile) != 0;
 
+	TCHAR patterns[1024];
+
+	::GetPrivateProfileString(mainSection, ignorePatternsSetting, TEXT(""), patterns, _countof(patterns), iniFile);
+	IgnorePatterns = patterns;
+
 	SavedStatusType	= static_cast<StatusType>(::GetPrivateProfileInt(mainSection, statusTypeSetting,
 			DEFAULT_STATUS_TYPE, iniFile));
 
 	statusType = (SavedStatusType < STATUS_TYPE_END) ? SavedStatusType : static_cast<StatusType>(DEFAULT_STATUS_TYPE);
 
+	DiffCostLimit	= ::GetPrivateProfileInt(mainSection, diffCostLimitSetting, DEFAULT_DIFF_COST_LIMIT, iniFile);
+
 	colors.added			= ::GetPrivateProfileInt(colorsSection, addedColorSetting,
 			DEFAULT_ADDED_COLOR, iniFile);
 	colors.removed			= ::GetPrivateProfileInt(colorsSection, removedColorSetting,
@@ -187,6 +205,12 @@ void UserSettings::save()
 			GotoFirstDiff ? TEXT("1") : TEXT("0"), iniFile);
 	::WritePrivateProfileString(mainSection, promptCloseOnMatchSetting,
 			PromptToCloseOnMatch ? TEXT("1") : TEXT("0"), iniFile);
+	::WritePrivateProfileString(mainSection, verifyMatchesSetting,
+			VerifyMatches ? TEXT("1") : TEXT("0"), iniFile);
+	::WritePrivateProfileString(mainSection, patienceDiffSetting,
+			PatienceDiff ? TEXT("1") : TEXT("0"), iniFile);
+	::WritePrivateProfileString(mainSection, prefetchVcsBaseSetting,
+			PrefetchVcsBase ? TEXT("1") : TEXT("0"), iniFile);
 
 	::WritePrivateProfileString(mainSection, charPrecisionSetting,
 			CharPrecision ? TEXT("1") : TEXT("0"), iniFile);
@@ -210,6 +234,7 @@ void UserSettings::save()
 			RecompareOnChange ? TEXT("1") : TEXT("0"), iniFile);
 	::WritePrivateProfileString(mainSection, ignoreLineNumbers,
 		IgnoreLineNumbers ? TEXT("1") : TEXT("0"), iniFile);
+	::WritePrivateProfileString(mainSection, ignorePatternsSetting, IgnorePatterns.c_str(), iniFile);
 
 	TCHAR buffer[64];
 
@@ -218,6 +243,9 @@ void UserSettings::save()
 	_itot_s(static_cast<int>(SavedStatusType), buffer, 64, 10);
 	::WritePrivateProfileString(mainSection, statusTypeSetting, buffer, iniFile);
 
+	_itot_s(DiffCostLimit, buffer, 64, 10);
+	::WritePrivateProfileString(mainSection, diffCostLimitSetting, buffer, iniFile);
+
 	_itot_s(colors.added, buffer, 64, 10);
 	::WritePrivateProfileString(colorsSection, addedColorSetting, buffer, iniFile);
 
@@ -21,6 +21,7 @@
 
 #include <windows.h>
 #include <tchar.h>
+#include <string>
 
 
 // Those are interpreted as bool values
@@ -35,6 +36,9 @@
 #define DEFAULT_WRAP_AROUND				0
 #define DEFAULT_GOTO_FIRST_DIFF			1
 #define DEFAULT_PROMPT_CLOSE_ON_MATCH	0
+#define DEFAULT_VERIFY_MATCHES			0
+#define DEFAULT_PATIENCE_DIFF			0
+#define DEFAULT_PREFETCH_VCS_BASE		0
 
 #define DEFAULT_STATUS_TYPE				0
 
@@ -46,6 +50,9 @@
 #define DEFAULT_HIGHLIGHT_TRANSP		0
 #define DEFAULT_CHANGED_THRESHOLD		30
 
+// Line diff cost past which the compare result gets approximate (0 means no limit)
+#define DEFAULT_DIFF_COST_LIMIT			4096
+
 
 enum StatusType
 {
@@ -101,6 +108,9 @@ public:
 	static const TCHAR wrapAroundSetting[];
 	static const TCHAR gotoFirstDiffSetting[];
 	static const TCHAR promptCloseOnMatchSetting[];
+	static const TCHAR verifyMatchesSetting[];
+	static const TCHAR patienceDiffSetting[];
+	static const TCHAR prefetchVcsBaseSetting[];
 
 	static const TCHAR charPrecisionSetting[];
 	static const TCHAR diffsBasedChangesSetting[];
@@ -109,6 +119,7 @@ public:
 	static const TCHAR ignoreCaseSetting[];
 	static const TCHAR detectMovesSetting[];
 	static const TCHAR ignoreLineNumbers[];
+	static const TCHAR ignorePatternsSetting[];
 
 	static const TCHAR showOnlySelSetting[];
 	static const TCHAR showOnlyDiffSetting[];
@@ -117,6 +128,7 @@ public:
 	static const TCHAR reCompareOnChangeSetting[];
 
 	static const TCHAR statusTypeSetting[];
+	static const TCHAR diffCostLimitSetting[];
 
 	static const TCHAR colorsSection[];
 
@@ -140,6 +152,9 @@ public:
 	bool           	WrapAround;
 	bool           	GotoFirstDiff;
 	bool           	PromptToCloseOnMatch;
+	bool           	VerifyMatches;
+	bool           	PatienceDiff;
+	bool           	PrefetchVcsBase;
 
 	bool           	CharPrecision;
 	bool           	DiffsBasedLineChanges;
@@ -149,6 +164,9 @@ public:
 	bool           	DetectMoves;
 	bool           	IgnoreLineNumbers;
 
+	// Space separated ignore patterns (see IgnoreRules) - set in the ini file only
+	std::basic_string<TCHAR>	IgnorePatterns;
+
 	bool           	ShowOnlyDiffs;
 	bool           	ShowOnlySelections;
 	bool           	UseNavBar;
@@ -161,6 +179,7 @@ public:
 	ColorSettings	colors;
 
 	int				ChangedThresholdPercent;
+	int				DiffCostLimit;
 
 private:
 	bool dirty {false};
@@ -0,0 +1,272 @@
+/*
+ * This file is part of ComparePlus plugin for Notepad++
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+#include <algorithm>
+
+#include "VcsPrefetch.h"
+#include "Tools.h"
+
+
+namespace {
+
+// The snapshot is taken of the text loaded in Scintilla - the UTF-8 BOM is left out
+void takeBaseSnapshot(const CompareOptions& options, const char* text, intptr_t textLen, DocSnapshot& snapshot,
+		int& bomLen)
+{
+	bomLen = (textLen >= 3 && !std::memcmp(text, "\xEF\xBB\xBF", 3)) ? 3 : 0;
+
+	takeTextSnapshot(options, text + bomLen, textLen - bomLen, snapshot);
+}
+
+}
+
+
+VcsPrefetch::VcsPrefetch()
+#ifdef MULTITHREAD
+	: _stop(false)
+#endif
+{
+}
+
+
+VcsPrefetch::~VcsPrefetch()
+{
+#ifdef MULTITHREAD
+	{
+		std::lock_guard<std::mutex> lock(_mtx);
+
+		_stop = true;
+	}
+
+	_wakeUp.notify_one();
+
+	if (_worker.joinable())
+		_worker.join();
+#endif
+}
+
+
+void VcsPrefetch::request(const TCHAR* file, const CompareOptions& options)
+{
+// The snapshots hashing logs to the debug log that is not thread safe
+#if defined(MULTITHREAD) && !defined(DLOG)
+	std::lock_guard<std::mutex> lock(_mtx);
+
+	auto reqItr = std::find_if(_requests.begin(), _requests.end(),
+			[file](const Request& req) { return (req.file == file); });
+
+	if (reqItr != _requests.end())
+		_requests.erase(reqItr);
+
+	_requests.push_back(Request { file, options });
+
+	// The fetch is followed by its cancel token only
+	_requests.back().options.cancelToken	= &_stop;
+	_requests.back().options.progress		= nullptr;
+
+	// Files opened all at once (e.g. a session) - only the last ones would be kept
+	if (_requests.size() > cMaxBasesCount)
+		_requests.pop_front();
+
+	if (!_worker.joinable())
+	{
+		try
+		{
+			_worker = std::thread(&VcsPrefetch::workerFn, this);
+		}
+		catch (...)
+		{
+			_requests.clear();
+			return;
+		}
+	}
+
+	_wakeUp.notify_one();
+#else
+	(void)file;
+	(void)options;
+#endif // MULTITHREAD && !DLOG
+}
+
+
+void VcsPrefetch::forget(const TCHAR* file)
+{
+#ifdef MULTITHREAD
+	std::lock_guard<std::mutex> lock(_mtx);
+
+	_requests.erase(std::remove_if(_requests.begin(), _requests.end(),
+			[file](const Request& req) { return (req.file == file); }), _requests.end());
+
+	_fetched.erase(std::remove(_fetched.begin(), _fetched.end(), file), _fetched.end());
+
+	_bases.erase(file);
+
+	// The running fetch result is dropped
+	if (_fetching == file)
+		_fetching.clear();
+#else
+	(void)file;
+#endif
+}
+
+
+std::shared_ptr<const VcsBase> VcsPrefetch::find(const TCHAR* file) const
+{
+#ifdef MULTITHREAD
+	std::lock_guard<std::mutex> lock(_mtx);
+
+	auto baseItr = _bases.find(file);
+
+	if (baseItr != _bases.end())
+		return baseItr->second;
+#else
+	(void)file;
+#endif
+
+	return nullptr;
+}
+
+
+#ifdef MULTITHREAD
+
+void VcsPrefetch::workerFn()
+{
+	std::unique_lock<std::mutex> lock(_mtx);
+
+	for (;;)
+	{
+		_wakeUp.wait(lock, [this]() { return (_stop || !_requests.empty()); });
+
+		if (_stop)
+			return;
+
+		const Request req = std::move(_requests.front());
+		_requests.pop_front();
+
+		auto keptItr = _bases.find(req.file);
+
+		const std::shared_ptr<const VcsBase> kept = (keptItr != _bases.end()) ? keptItr->second : nullptr;
+
+		_fetching = req.file;
+
+		lock.unlock();
+
+		std::shared_ptr<const VcsBase> base;
+
+		try
+		{
+			base = fetch(req, kept);
+		}
+		catch (...)
+		{
+		}
+
+		lock.lock();
+
+		if (_stop)
+			return;
+
+		// Forgotten meanwhile
+		if (_fetching.empty())
+			continue;
+
+		_fetching.clear();
+
+		_fetched.erase(std::remove(_fetched.begin(), _fetched.end(), req.file), _fetched.end());
+
+		if (!base)
+		{
+			_bases.erase(req.file);
+			continue;
+		}
+
+		_bases[req.file] = base;
+		_fetched.push_back(req.file);
+
+		if (_fetched.size() > cMaxBasesCount)
+		{
+			_bases.erase(_fetched.front());
+			_fetched.pop_front();
+		}
+	}
+}
+
+#endif // MULTITHREAD
+
+
+std::shared_ptr<const VcsBase> VcsPrefetch::fetch(const Request& req, const std::shared_ptr<const VcsBase>& kept)
+{
+	const TCHAR* file = req.file.c_str();
+
+	const uint64_t optionsKey = getLineHashesKey(req.options);
+
+	TCHAR svnFile[MAX_PATH];
+
+	if (!GetSvnFile(file, svnFile, _countof(svnFile), false))
+		svnFile[0] = 0;
+
+	// The SVN pristine copies are named by their content checksum so the kept one is current while it has that name
+	const bool svnCurrent = kept && (kept->svnFile == svnFile) &&
+			(kept->svnFile.empty() || kept->svnSnapshot.optionsKey == optionsKey);
+
+	const bool gitCurrent = kept && kept->gitContent && (kept->gitSnapshot.optionsKey == optionsKey) &&
+			IsGitFileContentCurrent(file, *kept->gitContent);
+
+	if (svnCurrent && gitCurrent)
+		return kept;
+
+	std::shared_ptr<VcsBase> base = std::make_shared<VcsBase>();
+
+	if (svnCurrent)
+	{
+		base->svnFile		= kept->svnFile;
+		base->svnSnapshot	= kept->svnSnapshot;
+		base->svnBomLen		= kept->svnBomLen;
+	}
+	else if (svnFile[0])
+	{
+		base->svnFile = svnFile;
+
+		MappedFile pristine(svnFile);
+
+		if (pristine.isOpen())
+			takeBaseSnapshot(req.options, pristine.data(), pristine.size(), base->svnSnapshot, base->svnBomLen);
+	}
+
+	if (gitCurrent)
+	{
+		base->gitContent	= kept->gitContent;
+		base->gitSnapshot	= kept->gitSnapshot;
+		base->gitBomLen		= kept->gitBomLen;
+	}
+	else
+	{
+		std::shared_ptr<GitFileContent> content = std::make_shared<GitFileContent>(GetGitFileContent(file, false));
+
+		if (content->isValid())
+		{
+			takeBaseSnapshot(req.options, content->data(), content->size(), base->gitSnapshot, base->gitBomLen);
+			base->gitContent = std::move(content);
+		}
+	}
+
+	if (base->svnFile.empty() && !base->gitContent)
+		return nullptr;
+
+	return base;
+}
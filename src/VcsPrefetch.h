@@ -0,0 +1,127 @@
+/*
+ * This file is part of ComparePlus plugin for Notepad++
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <memory>
+#include <map>
+#include <deque>
+
+#include <windows.h>
+#include <tchar.h>
+
+#ifdef MULTITHREAD
+
+#include <atomic>
+
+#if defined(__MINGW32__) && !defined(_GLIBCXX_HAS_GTHREADS)
+#include "mingw-std-threads/mingw.thread.h"
+#include "mingw-std-threads/mingw.mutex.h"
+#include "mingw-std-threads/mingw.condition_variable.h"
+#else
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#endif // __MINGW32__ ...
+
+#endif // MULTITHREAD
+
+#include "LibHelpers.h"
+#include "Engine.h"
+
+
+/**
+ *  \struct
+ *  \brief  Base versions of a file with the snapshots of their texts. The snapshots are taken without the UTF-8 BOM
+ *          that is not loaded in Scintilla - the BOM lengths tell if it was there
+ */
+struct VcsBase
+{
+	// SVN pristine copy - empty if the file is not in an SVN working copy
+	std::basic_string<TCHAR>	svnFile;
+	DocSnapshot					svnSnapshot;
+	int							svnBomLen {0};
+
+	// Git index content - nullptr if the file is not in a Git working copy. Shared with the next fetched bases of the
+	// file while it is current
+	std::shared_ptr<const GitFileContent>	gitContent;
+	DocSnapshot					gitSnapshot;
+	int							gitBomLen {0};
+};
+
+
+/**
+ *  \class
+ *  \brief  Fetches the SVN and Git base versions of the files and takes their snapshots in a worker thread so the VCS
+ *          diffs start from them instead of reading the repositories. The last fetched files bases are kept and
+ *          shared with the diffs - they must check them against the repositories (see IsGitFileContentCurrent()) as
+ *          the repositories can change meanwhile. Nothing is fetched if MULTITHREAD is not defined or if DLOG is
+ *          defined as the debug log is not thread safe
+ */
+class VcsPrefetch
+{
+public:
+	VcsPrefetch();
+	~VcsPrefetch();
+
+	VcsPrefetch(const VcsPrefetch&) = delete;
+	VcsPrefetch& operator=(const VcsPrefetch&) = delete;
+
+	// Queues the fetch of the file bases - the snapshots are taken with options. The kept bases of the file are
+	// checked and fetched again only if they are not current
+	void request(const TCHAR* file, const CompareOptions& options);
+
+	// Drops the file bases and its queued fetch
+	void forget(const TCHAR* file);
+
+	// Returns the fetched bases of the file, nullptr if they are not fetched yet
+	std::shared_ptr<const VcsBase> find(const TCHAR* file) const;
+
+private:
+	struct Request
+	{
+		std::basic_string<TCHAR>	file;
+		CompareOptions				options;
+	};
+
+	// So many files bases are kept - the oldest fetched ones are dropped
+	static const size_t cMaxBasesCount = 16;
+
+	// Returns kept if it is still current and nullptr if the file is not in a working copy
+	std::shared_ptr<const VcsBase> fetch(const Request& req, const std::shared_ptr<const VcsBase>& kept);
+
+	std::map<std::basic_string<TCHAR>, std::shared_ptr<const VcsBase>>	_bases;
+
+	// Fetch order of the kept bases files
+	std::deque<std::basic_string<TCHAR>>	_fetched;
+
+	std::deque<Request>						_requests;
+
+#ifdef MULTITHREAD
+	void workerFn();
+
+	// The file of the running fetch - cleared if the file is forgotten meanwhile
+	std::basic_string<TCHAR>				_fetching;
+
+	mutable std::mutex						_mtx;
+	std::condition_variable					_wakeUp;
+	std::atomic<bool>						_stop;
+
+	std::thread								_worker;
+#endif
+};
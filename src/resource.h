@@ -24,6 +24,7 @@
 #define IDD_COLOR_POPUP					102
 #define IDD_SETTINGS_DIALOG				103
 #define IDD_NAV_DIALOG					104
+#define IDD_FOLDER_DIALOG				105
 
 #define IDB_SETFIRST					120
 #define IDB_SETFIRST_RTL				121
@@ -69,6 +70,9 @@
 #define IDC_COMBO_REM_HIGHLIGHT_COLOR	1034
 #define IDC_HIGHLIGHT_SPIN_BOX			1035
 #define IDC_HIGHLIGHT_SPIN_CTL			1036
+#define IDC_VERIFY_MATCHES				1037
+#define IDC_PATIENCE_DIFF				1038
+#define IDC_PREFETCH_VCS_BASE			1039
 #define IDC_STATIC						-1
 
 #define COLOR_POPUP_OK		10000